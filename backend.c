@@ -0,0 +1,136 @@
+#include "backend.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mgz.h"
+
+#ifdef MGZ_LIBDEFLATE
+#include <libdeflate.h>
+
+/* Per-thread libdeflate state. A compressor is tied to one level, so it
+ * is only reallocated when the level changes. */
+typedef struct {
+    struct libdeflate_compressor *compressor;
+    struct libdeflate_decompressor *decompressor;
+    int level;
+} engine_t;
+
+static pthread_key_t engineKey;
+static pthread_once_t engineKeyOnce = PTHREAD_ONCE_INIT;
+
+static void engine_destroy(void *p) {
+    engine_t *e = (engine_t *)p;
+    libdeflate_free_compressor(e->compressor);
+    libdeflate_free_decompressor(e->decompressor);
+    free(e);
+}
+
+static void engine_key_create(void) {
+    (void)pthread_key_create(&engineKey, engine_destroy);
+}
+
+static engine_t *get_engine(void) {
+    (void)pthread_once(&engineKeyOnce, engine_key_create);
+    engine_t *e = (engine_t *)pthread_getspecific(engineKey);
+    if (e) return e;
+    e = (engine_t *)calloc(1, sizeof(engine_t));
+    if (!e) return NULL;
+    if (pthread_setspecific(engineKey, e) != 0) {
+        free(e);
+        return NULL;
+    }
+    return e;
+}
+
+/* Returns the calling thread's compressor for LEVEL, where -1 means
+ * zlib's default of 6, or NULL if an error occurred. */
+static struct libdeflate_compressor *get_compressor(int level) {
+    engine_t *e = get_engine();
+    if (!e) return NULL;
+    if (level < 0) level = 6;
+    if (e->compressor && e->level == level) return e->compressor;
+    libdeflate_free_compressor(e->compressor);
+    e->compressor = libdeflate_alloc_compressor(level);
+    e->level = level;
+    return e->compressor;
+}
+
+static struct libdeflate_decompressor *get_decompressor(void) {
+    engine_t *e = get_engine();
+    if (!e) return NULL;
+    if (!e->decompressor) e->decompressor = libdeflate_alloc_decompressor();
+    return e->decompressor;
+}
+#endif
+
+static bool active = false;
+static pthread_once_t selectOnce = PTHREAD_ONCE_INIT;
+
+static void backend_select(void) {
+#ifdef MGZ_LIBDEFLATE
+    const char *want = getenv("MGZ_BACKEND");
+    active = !want || strcmp(want, "zlib") != 0;
+#endif
+}
+
+const char *backend_name(void) {
+    return backend_active() ? "libdeflate" : "zlib";
+}
+
+const char *mgz_backend(void) { return backend_name(); }
+
+bool backend_active(void) {
+    (void)pthread_once(&selectOnce, backend_select);
+    return active;
+}
+
+uint64_t backend_deflate_bound(int level, uint64_t inSize) {
+#ifdef MGZ_LIBDEFLATE
+    struct libdeflate_compressor *c = get_compressor(level);
+    return c ? libdeflate_deflate_compress_bound(c, inSize) : 0;
+#else
+    (void)level;
+    (void)inSize;
+    return 0;
+#endif
+}
+
+uint64_t backend_deflate(void *dst, uint64_t dstCapacity, const void *in,
+                         uint64_t inSize, int level) {
+#ifdef MGZ_LIBDEFLATE
+    struct libdeflate_compressor *c = get_compressor(level);
+    return c ? libdeflate_deflate_compress(c, in, inSize, dst, dstCapacity)
+             : 0;
+#else
+    (void)dst;
+    (void)dstCapacity;
+    (void)in;
+    (void)inSize;
+    (void)level;
+    return 0;
+#endif
+}
+
+int64_t backend_inflate(void *dst, uint64_t dstCapacity, const void *in,
+                        uint64_t inSize, uint64_t *consumed) {
+#ifdef MGZ_LIBDEFLATE
+    struct libdeflate_decompressor *d = get_decompressor();
+    if (!d) return -1;
+    size_t inUsed, outSize;
+    enum libdeflate_result res = libdeflate_gzip_decompress_ex(
+        d, in, inSize, dst, dstCapacity, &inUsed, &outSize);
+    if (res == LIBDEFLATE_INSUFFICIENT_SPACE) return -2;
+    if (res != LIBDEFLATE_SUCCESS) return -1;
+    *consumed = inUsed;
+    return (int64_t)outSize;
+#else
+    (void)dst;
+    (void)dstCapacity;
+    (void)in;
+    (void)inSize;
+    (void)consumed;
+    return -1;
+#endif
+}
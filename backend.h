@@ -0,0 +1,38 @@
+#ifndef BACKEND_H
+#define BACKEND_H
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Whole-buffer deflate engines for blocks that are compressed or inflated
+ * in one piece. zlib stays the engine for everything that has to stream:
+ * sync points, partial reads and probing for members. An alternate engine
+ * is built in with a Makefile option (make BACKEND=libdeflate) and is
+ * then used by default; setting MGZ_BACKEND=zlib in the environment
+ * selects zlib for everything instead. Either way the output is standard
+ * gzip members, only the deflate data inside them may differ. */
+
+/* Returns the name of the engine in use: "zlib" or "libdeflate". */
+const char *backend_name(void);
+
+/* Returns true if an alternate engine is in use, so that the functions
+ * below may be called. */
+bool backend_active(void);
+
+/* Returns the maximum size of the raw deflate data that backend_deflate
+ * produces for INSIZE bytes at level LEVEL, or 0 if an error occurred. */
+uint64_t backend_deflate_bound(int level, uint64_t inSize);
+
+/* Compresses INSIZE bytes at IN at level LEVEL as raw deflate data into
+ * the DSTCAPACITY bytes at DST. Returns the compressed size, or 0 if an
+ * error occurred or the output did not fit. */
+uint64_t backend_deflate(void *dst, uint64_t dstCapacity, const void *in,
+                         uint64_t inSize, int level);
+
+/* Inflates the gzip member at the start of the INSIZE bytes at IN into
+ * the DSTCAPACITY bytes at DST, checking its trailer, and sets *CONSUMED
+ * to its compressed size. Returns the raw size, -1 if the member is
+ * corrupt, or -2 if its raw data does not fit in DSTCAPACITY. */
+int64_t backend_inflate(void *dst, uint64_t dstCapacity, const void *in,
+                        uint64_t inSize, uint64_t *consumed);
+
+#endif  // BACKEND_H
@@ -0,0 +1,14 @@
+#include "bench_all.h"
+
+#include "benchtools.h"
+
+int main() {
+    json_begin();
+    bench_deflate();
+    bench_crc();
+    bench_read();
+    bench_pool();
+    bench_huge();
+    json_end();
+    return 0;
+}
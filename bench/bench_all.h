@@ -0,0 +1,7 @@
+#ifndef BENCH_ALL_H
+#define BENCH_ALL_H
+#include "bench_deflate.h"
+#include "bench_pool.h"
+#include "bench_read.h"
+
+#endif  // BENCH_ALL_H
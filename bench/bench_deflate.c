@@ -0,0 +1,180 @@
+#include "bench_deflate.h"
+
+#include <fcntl.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "../backend.h"
+#include "../crc.h"
+#include "../mgz.h"
+#include "benchtools.h"
+
+#define DEFLATE_BENCH_SIZE (16ULL << 20)  // 16 MiB
+#define HUGE_BENCH_SIZE ((4ULL << 30) + (1ULL << 20))  // Past 2^32.
+#define HUGE_BENCH_BUDGET (3ULL << 30)
+#define HUGE_BENCH_STRIDE (16ULL << 20)  // Distance between random pages.
+#define HUGE_BENCH_PAGE 4096
+#define HUGE_BENCH_READ_SIZE 4096
+
+/* Compresses and decompresses DATA in memory once with the given
+ * parameters and reports throughput and ratio. */
+static void bench_deflate_case(const uint8_t *data, int corpus, int level,
+                               uint64_t blockSize, int nThreads) {
+    omp_set_num_threads(nThreads);
+    uint64_t t0 = now_ns();
+    mgz_res_t res = mgz_parallel_deflate(data, DEFLATE_BENCH_SIZE, level,
+                                         blockSize, true);
+    uint64_t deflateNs = now_ns() - t0;
+    if (!res.out) return;
+
+    t0 = now_ns();
+    void *out = NULL;
+    mgz_parallel_inflate(&out, res.out, res.size, res.lookup, res.nBlocks,
+                         blockSize);
+    uint64_t inflateNs = now_ns() - t0;
+
+    json_record_begin("deflate");
+    json_str("backend", backend_name());
+    json_str("corpus", corpusNames[corpus]);
+    json_u64("level", level);
+    json_u64("block_size", blockSize);
+    json_u64("threads", nThreads);
+    json_u64("raw_bytes", DEFLATE_BENCH_SIZE);
+    json_u64("compressed_bytes", res.size);
+    json_double("ratio", (double)DEFLATE_BENCH_SIZE / res.size);
+    json_double("deflate_mbps", mb_per_s(DEFLATE_BENCH_SIZE, deflateNs));
+    json_double("inflate_mbps", mb_per_s(DEFLATE_BENCH_SIZE, inflateNs));
+    json_record_end();
+    free(out);
+    free(res.out);
+    free(res.lookup);
+}
+
+/* Thread counts double from 1 up to the number of available threads,
+ * which is always included, giving one scaling curve per configuration. */
+void bench_deflate(void) {
+    int maxThreads = omp_get_max_threads();
+    uint64_t blockSizes[3] = {65536, 262144, 1048576};
+    int levels[3] = {1, 6, 9};
+    for (int c = 0; c < N_CORPORA; ++c) {
+        uint8_t *data = bench_create_corpus(c, DEFLATE_BENCH_SIZE);
+        if (!data) continue;
+        for (int l = 0; l < 3; ++l) {
+            for (int b = 0; b < 3; ++b) {
+                for (int t = 1;; t = t * 2 < maxThreads ? t * 2 : maxThreads) {
+                    bench_deflate_case(data, c, levels[l], blockSizes[b], t);
+                    if (t == maxThreads) break;
+                }
+            }
+        }
+        free(data);
+    }
+    omp_set_num_threads(maxThreads);
+}
+
+/* Single-threaded CRC-32 throughput of zlib and of crc32_fast over the
+ * same data, the work every block does once on deflate. */
+void bench_crc(void) {
+    uint8_t *data = bench_create_random(DEFLATE_BENCH_SIZE, 15);
+    if (!data) return;
+    uint64_t t0 = now_ns();
+    uint32_t want = (uint32_t)crc32(0L, data, DEFLATE_BENCH_SIZE);
+    uint64_t zlibNs = now_ns() - t0;
+    t0 = now_ns();
+    uint32_t got = crc32_fast(0, data, DEFLATE_BENCH_SIZE);
+    uint64_t fastNs = now_ns() - t0;
+
+    json_record_begin("crc");
+    json_str("impl", crc32_impl());
+    json_u64("raw_bytes", DEFLATE_BENCH_SIZE);
+    json_u64("match", got == want);
+    json_double("zlib_mbps", mb_per_s(DEFLATE_BENCH_SIZE, zlibNs));
+    json_double("fast_mbps", mb_per_s(DEFLATE_BENCH_SIZE, fastNs));
+    json_record_end();
+    free(data);
+}
+
+/* Compresses DATA, HUGE_BENCH_SIZE bytes, into a file in blocks of
+ * BLOCKSIZE within HUGE_BENCH_BUDGET of memory, and reports the
+ * throughput of that and of mgz_verify, and the latency of a read at the
+ * very end of the data, which inflates most of the last block. */
+static void bench_huge_case(const uint8_t *data, uint64_t blockSize) {
+    FILE *outfile = fopen("bench_huge.gz", "wb");
+    FILE *lookup = fopen("bench_huge.lookup", "wb");
+    if (!outfile || !lookup) {
+        if (outfile) fclose(outfile);
+        if (lookup) fclose(lookup);
+        return;
+    }
+    uint64_t t0 = now_ns();
+    uint64_t outSize =
+        mgz_parallel_create_bounded(data, HUGE_BENCH_SIZE, 1, blockSize,
+                                    HUGE_BENCH_BUDGET, outfile, lookup);
+    fclose(outfile);
+    fclose(lookup);
+    uint64_t createNs = now_ns() - t0;
+    int fd = open("bench_huge.gz", O_RDONLY);
+    if (outSize == 0 || fd < 0) {
+        if (fd >= 0) close(fd);
+        return;
+    }
+
+    t0 = now_ns();
+    bool ok = mgz_verify(fd, "bench_huge.lookup", NULL);
+    uint64_t verifyNs = now_ns() - t0;
+
+    uint8_t buf[HUGE_BENCH_READ_SIZE];
+    mgz_reader_t *r = mgz_reader_open(fd, "bench_huge.lookup");
+    t0 = now_ns();
+    uint64_t got = r ? mgz_reader_read(r, buf, sizeof(buf),
+                                       HUGE_BENCH_SIZE - sizeof(buf))
+                     : 0;
+    uint64_t readNs = now_ns() - t0;
+    if (r) mgz_reader_close(r);
+    close(fd);
+
+    json_record_begin("huge");
+    json_str("backend", backend_name());
+    json_u64("block_size", blockSize);
+    json_u64("threads", omp_get_max_threads());
+    json_u64("raw_bytes", HUGE_BENCH_SIZE);
+    json_u64("compressed_bytes", outSize);
+    json_u64("match", ok && got == sizeof(buf) &&
+                          memcmp(buf, data + HUGE_BENCH_SIZE - sizeof(buf),
+                                 sizeof(buf)) == 0);
+    json_double("create_mbps", mb_per_s(HUGE_BENCH_SIZE, createNs));
+    json_double("verify_mbps", mb_per_s(HUGE_BENCH_SIZE, verifyNs));
+    json_double("tail_read_ms", readNs / 1e6);
+    json_record_end();
+}
+
+/* Archives past 4 GiB, with blocks small enough to spread over every
+ * thread and with blocks past 2 GiB. The input is zero pages that are
+ * never touched, with a random page every HUGE_BENCH_STRIDE bytes, so it
+ * needs next to no memory. */
+void bench_huge(void) {
+    uint8_t *data = (uint8_t *)mmap(
+        NULL, HUGE_BENCH_SIZE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    uint8_t *page = bench_create_random(HUGE_BENCH_PAGE, 16);
+    if (data == MAP_FAILED || !page) {
+        if (data != MAP_FAILED) munmap(data, HUGE_BENCH_SIZE);
+        free(page);
+        return;
+    }
+    for (uint64_t i = 0; i + HUGE_BENCH_PAGE <= HUGE_BENCH_SIZE;
+         i += HUGE_BENCH_STRIDE) {
+        memcpy(data + i, page, HUGE_BENCH_PAGE);
+    }
+    uint64_t blockSizes[2] = {64ULL << 20, (2ULL << 30) + (1ULL << 20)};
+    for (int b = 0; b < 2; ++b) bench_huge_case(data, blockSizes[b]);
+    unlink("bench_huge.gz");
+    unlink("bench_huge.lookup");
+    munmap(data, HUGE_BENCH_SIZE);
+    free(page);
+}
@@ -0,0 +1,8 @@
+#ifndef BENCH_DEFLATE_H
+#define BENCH_DEFLATE_H
+
+void bench_deflate(void);
+void bench_crc(void);
+void bench_huge(void);
+
+#endif  // BENCH_DEFLATE_H
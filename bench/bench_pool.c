@@ -0,0 +1,120 @@
+#include "bench_pool.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <zlib.h>
+
+#include "../mgz.h"
+#include "benchtools.h"
+
+#define POOL_BENCH_SIZE (16ULL << 20)  // 16 MiB
+
+/* What every block cost before the stream pools: its own deflateInit2()
+ * and deflateEnd(), with zlib's default allocator. */
+static uint64_t deflate_fresh(void *dst, uint64_t dstSize, const void *in,
+                              uint64_t inSize, int level) {
+    z_stream strm = {0};
+    if (deflateInit2(&strm, level, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        return 0;
+    }
+    strm.next_in = (Bytef *)in;
+    strm.avail_in = (uInt)inSize;
+    strm.next_out = (Bytef *)dst;
+    strm.avail_out = (uInt)dstSize;
+    int zRet = deflate(&strm, Z_FINISH);
+    uint64_t outSize = dstSize - strm.avail_out;
+    (void)deflateEnd(&strm);
+    return zRet == Z_STREAM_END ? outSize : 0;
+}
+
+static uint64_t inflate_fresh(void *dst, uint64_t dstSize, const void *in,
+                              uint64_t inSize) {
+    z_stream strm = {0};
+    if (inflateInit2(&strm, 15 + 16) != Z_OK) return 0;
+    strm.next_in = (Bytef *)in;
+    strm.avail_in = (uInt)inSize;
+    strm.next_out = (Bytef *)dst;
+    strm.avail_out = (uInt)dstSize;
+    int zRet = inflate(&strm, Z_FINISH);
+    uint64_t outSize = dstSize - strm.avail_out;
+    (void)inflateEnd(&strm);
+    return zRet == Z_STREAM_END ? outSize : 0;
+}
+
+/* Compresses and decompresses the same data with blocks of BLOCKSIZE,
+ * once with a fresh z_stream per block and once through mgz's per-thread
+ * stream pools. */
+static void bench_pool_case(const uint8_t *data, uint64_t blockSize,
+                            int level) {
+    uint64_t nBlocks = (POOL_BENCH_SIZE + blockSize - 1) / blockSize;
+    uint64_t bound = compressBound(blockSize) + 18;
+    uint8_t *slab = (uint8_t *)malloc(bound * nBlocks);
+    uint8_t *raw = (uint8_t *)malloc(POOL_BENCH_SIZE);
+    uint64_t *sizes = (uint64_t *)malloc(nBlocks * sizeof(uint64_t));
+    if (!slab || !raw || !sizes) {
+        free(slab);
+        free(raw);
+        free(sizes);
+        return;
+    }
+
+    uint64_t t0 = now_ns();
+#pragma omp parallel for
+    for (uint64_t i = 0; i < nBlocks; ++i) {
+        sizes[i] = deflate_fresh(slab + i * bound, bound,
+                                 data + i * blockSize, blockSize, level);
+    }
+    uint64_t freshDeflate = now_ns() - t0;
+
+    t0 = now_ns();
+#pragma omp parallel for
+    for (uint64_t i = 0; i < nBlocks; ++i) {
+        inflate_fresh(raw + i * blockSize, blockSize, slab + i * bound,
+                      sizes[i]);
+    }
+    uint64_t freshInflate = now_ns() - t0;
+
+    t0 = now_ns();
+    mgz_res_t res =
+        mgz_parallel_deflate(data, POOL_BENCH_SIZE, level, blockSize, true);
+    uint64_t pooledDeflate = now_ns() - t0;
+
+    t0 = now_ns();
+    void *out = NULL;
+    mgz_parallel_inflate(&out, res.out, res.size, res.lookup, res.nBlocks,
+                         blockSize);
+    uint64_t pooledInflate = now_ns() - t0;
+
+    json_record_begin("pool");
+    json_u64("level", level);
+    json_u64("block_size", blockSize);
+    json_double("fresh_deflate_mbps",
+                mb_per_s(POOL_BENCH_SIZE, freshDeflate));
+    json_double("pooled_deflate_mbps",
+                mb_per_s(POOL_BENCH_SIZE, pooledDeflate));
+    json_double("fresh_inflate_mbps",
+                mb_per_s(POOL_BENCH_SIZE, freshInflate));
+    json_double("pooled_inflate_mbps",
+                mb_per_s(POOL_BENCH_SIZE, pooledInflate));
+    json_record_end();
+    free(out);
+    free(res.out);
+    free(res.lookup);
+    free(slab);
+    free(raw);
+    free(sizes);
+}
+
+void bench_pool(void) {
+    uint8_t *data = bench_create_text(POOL_BENCH_SIZE, 0);
+    if (!data) return;
+    uint64_t blockSizes[4] = {16384, 65536, 262144, 1048576};
+    int levels[2] = {1, 9};
+    for (int l = 0; l < 2; ++l) {
+        for (int b = 0; b < 4; ++b) {
+            bench_pool_case(data, blockSizes[b], levels[l]);
+        }
+    }
+    free(data);
+}
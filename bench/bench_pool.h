@@ -0,0 +1,6 @@
+#ifndef BENCH_POOL_H
+#define BENCH_POOL_H
+
+void bench_pool(void);
+
+#endif  // BENCH_POOL_H
@@ -0,0 +1,209 @@
+#include "bench_read.h"
+
+#include <fcntl.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../mgz.h"
+#include "benchtools.h"
+
+#define READ_BENCH_SIZE (16ULL << 20)     // 16 MiB
+#define READ_BENCH_BLOCK_SIZE (1 << 18)   // 256 KiB
+#define RANDOM_READ_SIZE 4096
+#define SEQUENTIAL_READ_SIZE (1 << 16)
+#define N_RANDOM_READS 1000
+#define N_SHARED_READS 8000  // Split across the threads.
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Reports percentiles of the N latencies at NS, which are sorted in
+ * place, and the throughput of the N reads over WALLNS. */
+static void report_latencies(int corpus, const char *layout,
+                             const char *api, const char *workload,
+                             uint64_t readSize, uint64_t *ns, uint64_t n,
+                             uint64_t wallNs) {
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < n; ++i) total += ns[i];
+    qsort(ns, n, sizeof(uint64_t), compare_u64);
+    json_record_begin("read");
+    json_str("corpus", corpusNames[corpus]);
+    json_str("layout", layout);
+    json_str("api", api);
+    json_str("workload", workload);
+    json_u64("read_size", readSize);
+    json_u64("reads", n);
+    json_double("mean_us", total / 1e3 / n);
+    json_double("p50_us", ns[n / 2] / 1e3);
+    json_double("p90_us", ns[n * 9 / 10] / 1e3);
+    json_double("p99_us", ns[n * 99 / 100] / 1e3);
+    json_double("max_us", ns[n - 1] / 1e3);
+    json_double("mbps", mb_per_s(readSize * n, wallNs));
+    json_record_end();
+}
+
+/* Times every read of one workload through mgz_read (READER NULL) or
+ * mgz_reader_read. Random reads land anywhere in the data; sequential
+ * reads walk it from the start. */
+static void bench_read_workload(int corpus, const char *layout, int fd,
+                                FILE *lookup, mgz_reader_t *reader,
+                                bool sequential, void *buf) {
+    uint64_t readSize = sequential ? SEQUENTIAL_READ_SIZE : RANDOM_READ_SIZE;
+    uint64_t n =
+        sequential ? READ_BENCH_SIZE / SEQUENTIAL_READ_SIZE : N_RANDOM_READS;
+    uint64_t *ns = (uint64_t *)malloc(n * sizeof(uint64_t));
+    if (!ns) return;
+    srand(corpus);
+    uint64_t wallNs = 0;
+    for (uint64_t i = 0; i < n; ++i) {
+        uint64_t offset =
+            sequential ? i * readSize
+                       : (uint64_t)rand() % (READ_BENCH_SIZE - readSize);
+        uint64_t t0 = now_ns();
+        if (reader) {
+            mgz_reader_read(reader, buf, readSize, offset);
+        } else {
+            mgz_read(buf, readSize, offset, fd, lookup);
+        }
+        ns[i] = now_ns() - t0;
+        wallNs += ns[i];
+    }
+    report_latencies(corpus, layout, reader ? "mgz_reader_read" : "mgz_read",
+                     sequential ? "sequential" : "random", readSize, ns, n,
+                     wallNs);
+    free(ns);
+}
+
+static void record_completion(void *ctx, mgz_read_req_t *req) {
+    uint64_t *t0 = (uint64_t *)ctx;
+    *(uint64_t *)req->user = now_ns() - *t0;
+}
+
+/* Issues the random workload as one batch through
+ * mgz_reader_read_batch. The latency of a read is the time from the
+ * start of the batch to its completion. */
+static void bench_read_batch(int corpus, const char *layout,
+                             mgz_reader_t *reader) {
+    uint64_t n = N_RANDOM_READS;
+    uint64_t *ns = (uint64_t *)malloc(n * sizeof(uint64_t));
+    mgz_read_req_t *reqs = (mgz_read_req_t *)malloc(n * sizeof(*reqs));
+    uint8_t *bufs = (uint8_t *)malloc(n * RANDOM_READ_SIZE);
+    if (ns && reqs && bufs) {
+        srand(corpus);
+        for (uint64_t i = 0; i < n; ++i) {
+            reqs[i].buf = bufs + i * RANDOM_READ_SIZE;
+            reqs[i].size = RANDOM_READ_SIZE;
+            reqs[i].offset =
+                (uint64_t)rand() % (READ_BENCH_SIZE - RANDOM_READ_SIZE);
+            reqs[i].user = &ns[i];
+        }
+        uint64_t t0 = now_ns();
+        mgz_reader_read_batch(reader, reqs, n, record_completion, &t0);
+        uint64_t wallNs = now_ns() - t0;
+        report_latencies(corpus, layout, "mgz_reader_read_batch", "random",
+                         RANDOM_READ_SIZE, ns, n, wallNs);
+    }
+    free(ns);
+    free(reqs);
+    free(bufs);
+}
+
+/* Splits N_SHARED_READS random reads across NTHREADS threads that share
+ * FD and LOOKUP through mgz_read (READER NULL), or share READER, and
+ * reports the aggregate throughput. Thread counts double from 1 up to
+ * the number of available threads, as in bench_deflate. */
+static void bench_read_shared(int corpus, const char *layout, int fd,
+                              FILE *lookup, mgz_reader_t *reader) {
+    int maxThreads = omp_get_max_threads();
+    for (int t = 1;; t = t * 2 < maxThreads ? t * 2 : maxThreads) {
+        uint64_t t0 = now_ns();
+#pragma omp parallel num_threads(t)
+        {
+            unsigned int seed = (unsigned int)(corpus * 64 +
+                                               omp_get_thread_num());
+            void *buf = malloc(RANDOM_READ_SIZE);
+#pragma omp for schedule(static)
+            for (int i = 0; i < N_SHARED_READS; ++i) {
+                uint64_t offset = (uint64_t)rand_r(&seed) %
+                                  (READ_BENCH_SIZE - RANDOM_READ_SIZE);
+                if (!buf) continue;
+                if (reader) {
+                    mgz_reader_read(reader, buf, RANDOM_READ_SIZE, offset);
+                } else {
+                    mgz_read(buf, RANDOM_READ_SIZE, offset, fd, lookup);
+                }
+            }
+            free(buf);
+        }
+        uint64_t wallNs = now_ns() - t0;
+        json_record_begin("read_shared");
+        json_str("corpus", corpusNames[corpus]);
+        json_str("layout", layout);
+        json_str("api", reader ? "mgz_reader_read" : "mgz_read");
+        json_u64("threads", t);
+        json_u64("read_size", RANDOM_READ_SIZE);
+        json_u64("reads", N_SHARED_READS);
+        json_double("mbps",
+                    mb_per_s((uint64_t)RANDOM_READ_SIZE * N_SHARED_READS,
+                             wallNs));
+        json_record_end();
+        if (t == maxThreads) break;
+    }
+}
+
+/* Benchmarks reads of DATA compressed with fixed blocks, or with seek
+ * points inside the blocks if SEEKABLE is set. */
+static void bench_read_layout(int corpus, const uint8_t *data,
+                              bool seekable) {
+    const char *layout = seekable ? "seekable" : "fixed";
+    FILE *outfile = fopen("bench_read.gz", "wb");
+    FILE *lookup = fopen("bench_read.lookup", "wb");
+    void *buf = malloc(SEQUENTIAL_READ_SIZE);
+    bool ok = data && outfile && lookup && buf &&
+              (seekable ? mgz_parallel_create_seekable(
+                              data, READ_BENCH_SIZE, 6, READ_BENCH_BLOCK_SIZE,
+                              0, outfile, lookup)
+                        : mgz_parallel_create(data, READ_BENCH_SIZE, 6,
+                                              READ_BENCH_BLOCK_SIZE, outfile,
+                                              lookup));
+    if (outfile) fclose(outfile);
+    if (lookup) fclose(lookup);
+
+    int fd = open("bench_read.gz", O_RDONLY);
+    lookup = fopen("bench_read.lookup", "rb");
+    mgz_reader_t *reader =
+        fd < 0 ? NULL : mgz_reader_open(fd, "bench_read.lookup");
+    if (ok && lookup && reader) {
+        for (int sequential = 0; sequential < 2; ++sequential) {
+            bench_read_workload(corpus, layout, fd, lookup, NULL,
+                                sequential, buf);
+            bench_read_workload(corpus, layout, fd, lookup, reader,
+                                sequential, buf);
+        }
+        bench_read_batch(corpus, layout, reader);
+        bench_read_shared(corpus, layout, fd, lookup, NULL);
+        bench_read_shared(corpus, layout, fd, lookup, reader);
+    } else {
+        fprintf(stderr, "bench_read: setup failed.\n");
+    }
+    mgz_reader_close(reader);
+    if (lookup) fclose(lookup);
+    if (fd >= 0) close(fd);
+    unlink("bench_read.gz");
+    unlink("bench_read.lookup");
+    free(buf);
+}
+
+void bench_read(void) {
+    for (int c = 0; c < N_CORPORA; ++c) {
+        uint8_t *data = bench_create_corpus(c, READ_BENCH_SIZE);
+        if (!data) continue;
+        bench_read_layout(c, data, false);
+        bench_read_layout(c, data, true);
+        free(data);
+    }
+}
@@ -0,0 +1,6 @@
+#ifndef BENCH_READ_H
+#define BENCH_READ_H
+
+void bench_read(void);
+
+#endif  // BENCH_READ_H
@@ -0,0 +1,130 @@
+#include "benchtools.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+double mb_per_s(uint64_t bytes, uint64_t ns) {
+    return ns ? (double)bytes / (1 << 20) / ((double)ns / 1e9) : 0;
+}
+
+/* Text-like data: random words from a small vocabulary, separated by
+ * spaces and the occasional newline. Compresses about 3:1. */
+uint8_t *bench_create_text(uint64_t size, unsigned int seed) {
+    static const char *words[] = {
+        "the",   "of",      "and",    "a",       "to",     "in",
+        "is",    "you",     "that",   "it",      "he",     "was",
+        "for",   "on",      "are",    "as",      "with",   "his",
+        "they",  "at",      "be",     "this",    "have",   "from",
+        "or",    "one",     "had",    "by",      "word",   "but",
+        "not",   "what",    "all",    "were",    "we",     "when",
+        "your",  "can",     "said",   "there",   "use",    "an",
+        "each",  "which",   "she",    "do",      "how",    "their",
+        "block", "archive", "member", "offset",  "lookup", "stream",
+        "level", "thread",  "inflate", "deflate", "buffer", "window"};
+    const int nWords = sizeof(words) / sizeof(words[0]);
+    uint8_t *data = (uint8_t *)malloc(size);
+    if (!data) return NULL;
+    srand(seed);
+    for (uint64_t i = 0; i < size;) {
+        const char *w = words[rand() % nWords];
+        for (; *w && i < size; ++w) data[i++] = (uint8_t)*w;
+        if (i < size) data[i++] = rand() % 16 ? ' ' : '\n';
+    }
+    return data;
+}
+
+/* Uniformly random bytes, which deflate cannot shrink. */
+uint8_t *bench_create_random(uint64_t size, unsigned int seed) {
+    uint8_t *data = (uint8_t *)malloc(size);
+    if (!data) return NULL;
+    srand(seed);
+    for (uint64_t i = 0; i < size; ++i) data[i] = rand() & 0xff;
+    return data;
+}
+
+/* One 4 KiB stretch of text repeated over and over with a byte changed
+ * here and there, like logs or tables with little variation. Compresses
+ * far better than 10:1. */
+uint8_t *bench_create_repetitive(uint64_t size, unsigned int seed) {
+    uint64_t periodSize = 4096;
+    uint8_t *period = bench_create_text(periodSize, seed);
+    uint8_t *data = (uint8_t *)malloc(size);
+    if (!period || !data) {
+        free(period);
+        free(data);
+        return NULL;
+    }
+    for (uint64_t i = 0; i < size; i += periodSize) {
+        uint64_t n = size - i < periodSize ? size - i : periodSize;
+        memcpy(data + i, period, n);
+        data[i + rand() % n] = 'a' + rand() % 26;
+    }
+    free(period);
+    return data;
+}
+
+const char *corpusNames[N_CORPORA] = {"random", "text", "repetitive"};
+
+uint8_t *bench_create_corpus(int corpus, uint64_t size) {
+    switch (corpus) {
+        case 0:
+            return bench_create_random(size, 0);
+        case 1:
+            return bench_create_text(size, 0);
+        default:
+            return bench_create_repetitive(size, 0);
+    }
+}
+
+static bool firstRecord = true;
+static bool firstField = true;
+
+void json_begin(void) {
+    printf("[");
+    firstRecord = true;
+}
+
+void json_record_begin(const char *bench) {
+    printf(firstRecord ? "\n  {" : ",\n  {");
+    firstRecord = false;
+    firstField = true;
+    json_str("bench", bench);
+}
+
+static void json_key(const char *key) {
+    printf(firstField ? "\"%s\": " : ", \"%s\": ", key);
+    firstField = false;
+}
+
+/* Keys and values are plain identifiers, so nothing needs escaping. */
+void json_str(const char *key, const char *value) {
+    json_key(key);
+    printf("\"%s\"", value);
+}
+
+void json_u64(const char *key, uint64_t value) {
+    json_key(key);
+    printf("%" PRIu64, value);
+}
+
+void json_double(const char *key, double value) {
+    json_key(key);
+    printf("%.3f", value);
+}
+
+void json_record_end(void) {
+    printf("}");
+    fflush(stdout);
+}
+
+void json_end(void) { printf("\n]\n"); }
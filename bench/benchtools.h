@@ -0,0 +1,25 @@
+#ifndef BENCHTOOLS_H
+#define BENCHTOOLS_H
+#include <stdint.h>
+
+uint64_t now_ns(void);
+double mb_per_s(uint64_t bytes, uint64_t ns);
+uint8_t *bench_create_text(uint64_t size, unsigned int seed);
+uint8_t *bench_create_random(uint64_t size, unsigned int seed);
+uint8_t *bench_create_repetitive(uint64_t size, unsigned int seed);
+
+/* Synthetic corpora shared by the benchmarks, selected by name. */
+#define N_CORPORA 3
+extern const char *corpusNames[N_CORPORA];
+uint8_t *bench_create_corpus(int corpus, uint64_t size);
+
+/* Results are printed to stdout as one JSON array of flat records. */
+void json_begin(void);
+void json_record_begin(const char *bench);
+void json_str(const char *key, const char *value);
+void json_u64(const char *key, uint64_t value);
+void json_double(const char *key, double value);
+void json_record_end(void);
+void json_end(void);
+
+#endif  // BENCHTOOLS_H
@@ -0,0 +1,628 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "../mgz.h"
+
+/* mgz: a pigz-style command line front end to the library.
+ *
+ * Compressed files are mgz archives with an embedded index, so they are
+ * plain gzip files for gzip and zcat and need no side files; -L writes
+ * or reads a separate lookup file instead. Compression streams the
+ * input through mgz_stream_t, so memory use is bounded by a few blocks
+ * per thread whatever the input size. Regular files are decompressed in
+ * parallel; pipes are decompressed sequentially, as they cannot be
+ * mapped or read out of order. */
+
+#define DEFAULT_LEVEL 6
+#define DEFAULT_BLOCK_KIB 1024
+#define MIN_BLOCK_KIB 16
+#define DEFAULT_SPAN_MIB 1  // Between checkpoints of --rebuild-lookup.
+#define COPY_BUFFER_SIZE (1 << 20)
+#define EXTRACT_WINDOW (8 << 20)  // Raw bytes per read while extracting.
+
+typedef enum {
+    COMPRESS,
+    DECOMPRESS,
+    LIST,
+    TEST,
+    EXTRACT,
+    REBUILD
+} cli_mode_t;
+
+typedef struct {
+    cli_mode_t mode;
+    int level;
+    uint64_t blockSize;
+    int nThreads;
+    bool toStdout;
+    bool force;
+    bool keep;
+    bool verbose;
+    bool quiet;
+    const char *lookupPath;
+    const char *suffix;
+    uint64_t offset;
+    uint64_t length;  // UINT64_MAX reads to the end.
+    uint64_t span;    // Raw bytes between checkpoints, or 0 for none.
+} options_t;
+
+static const char *progName = "mgz";
+
+static void usage(FILE *out) {
+    fprintf(out,
+            "Usage: %s [options] [files...]\n"
+            "Compress or decompress FILES in place, or standard input to "
+            "standard\noutput if there are none.\n\n"
+            "  -0 to -9            compression level (default %d)\n"
+            "  -b, --blocksize K   block size in KiB (default %d)\n"
+            "  -p, --processes N   threads to use (default: all)\n"
+            "  -c, --stdout        write to standard output, keep files\n"
+            "  -d, --decompress    decompress\n"
+            "  -f, --force         overwrite files, write to a terminal\n"
+            "  -k, --keep          keep input files\n"
+            "  -l, --list          list the layout of archives\n"
+            "  -t, --test          check the integrity of archives\n"
+            "  -L, --lookup PATH   write or use a lookup file at PATH\n"
+            "                      instead of the embedded index\n"
+            "  -S, --suffix .SUF   suffix of compressed files (default "
+            ".gz)\n"
+            "      --offset N      extract raw bytes from offset N to "
+            "standard output\n"
+            "      --length N      extract at most N raw bytes\n"
+            "      --rebuild-lookup  write FILE.lookup, or PATH with -L, "
+            "for each\n"
+            "                      archive or any other gzip file\n"
+            "      --span M        with --rebuild-lookup, checkpoint large "
+            "gzip members\n"
+            "                      every M MiB, 0 for never (default %d)\n"
+            "  -q, --quiet         print no warnings\n"
+            "  -v, --verbose       print names and ratios\n"
+            "  -h, --help          print this help\n",
+            progName, DEFAULT_LEVEL, DEFAULT_BLOCK_KIB, DEFAULT_SPAN_MIB);
+}
+
+/* Parses the unsigned decimal S into *V. Returns false if it is not
+ * one. */
+static bool parse_u64(const char *s, uint64_t *v) {
+    char *end;
+    errno = 0;
+    unsigned long long x = strtoull(s, &end, 10);
+    if (errno || end == s || *end || *s == '-') return false;
+    *v = (uint64_t)x;
+    return true;
+}
+
+static bool ends_with(const char *s, const char *suffix) {
+    size_t n = strlen(s), k = strlen(suffix);
+    return n > k && strcmp(s + n - k, suffix) == 0;
+}
+
+/* Returns the malloc'ed concatenation of A and B. */
+static char *concat(const char *a, const char *b) {
+    size_t n = strlen(a), k = strlen(b);
+    char *s = (char *)malloc(n + k + 1);
+    if (!s) return NULL;
+    memcpy(s, a, n);
+    memcpy(s + n, b, k + 1);
+    return s;
+}
+
+/* Reads up to SIZE bytes from FD into BUF, retrying short reads. Returns
+ * the number of bytes read, which is less than SIZE only at EOF, or -1
+ * on error. */
+static int64_t read_full(int fd, void *buf, uint64_t size) {
+    uint64_t done = 0;
+    while (done < size) {
+        ssize_t got = read(fd, (uint8_t *)buf + done, size - done);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) return -1;
+        if (got == 0) break;
+        done += got;
+    }
+    return (int64_t)done;
+}
+
+static bool is_regular(int fd, uint64_t *size) {
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) return false;
+    if (size) *size = (uint64_t)st.st_size;
+    return true;
+}
+
+/* Compresses everything read from INFD into OUT in batches of one block
+ * per thread, with an embedded index, or with its lookup table written
+ * to LOOKUP if it is not NULL. Empty input, for which the library writes
+ * nothing, gets a single empty gzip member, as with gzip and pigz. Sets
+ * *RAWSIZE and *OUTSIZE. */
+static bool compress_fd(const options_t *o, int infd, FILE *out,
+                        FILE *lookup, uint64_t *rawSize, uint64_t *outSize) {
+    mgz_stream_t *s =
+        lookup ? mgz_stream_init(o->level, o->blockSize, o->nThreads, out,
+                                 lookup)
+               : mgz_stream_init_indexed(o->level, o->blockSize, o->nThreads,
+                                         out);
+    uint64_t batchSize = o->blockSize * o->nThreads;
+    uint8_t *buf = (uint8_t *)malloc(batchSize);
+    if (!s || !buf) {
+        fprintf(stderr, "%s: out of memory.\n", progName);
+        free(buf);
+        if (s) (void)mgz_stream_finish(s);
+        return false;
+    }
+    bool ok = true;
+    *rawSize = 0;
+    for (;;) {
+        int64_t got = read_full(infd, buf, batchSize);
+        if (got < 0) {
+            fprintf(stderr, "%s: read failed: %s\n", progName,
+                    strerror(errno));
+            ok = false;
+            break;
+        }
+        if (got > 0 && !mgz_stream_feed(s, buf, (uint64_t)got)) {
+            ok = false;
+            break;
+        }
+        *rawSize += (uint64_t)got;
+        if ((uint64_t)got < batchSize) break;
+    }
+    free(buf);
+    *outSize = mgz_stream_finish(s);
+    if (ok && *rawSize > 0 && *outSize == 0) ok = false;
+    if (ok && *rawSize == 0) {
+        /* A final fixed-Huffman block holding only end-of-block, then a
+         * zero CRC-32 and a zero ISIZE. */
+        static const uint8_t empty[20] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0,
+                                          3,    3,    0, 0, 0, 0, 0, 0, 0,
+                                          0,    0};
+        ok = fwrite(empty, 1, sizeof(empty), out) == sizeof(empty);
+        *outSize = sizeof(empty);
+    }
+    if (ok && fflush(out) != 0) ok = false;
+    if (!ok) fprintf(stderr, "%s: compression failed.\n", progName);
+    return ok;
+}
+
+/* Decompresses the concatenated gzip members read from the pipe INFD
+ * into OUT, one after the other. */
+static bool decompress_stream(int infd, FILE *out, uint64_t *rawSize) {
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    uint8_t *in = (uint8_t *)malloc(COPY_BUFFER_SIZE);
+    uint8_t *raw = (uint8_t *)malloc(COPY_BUFFER_SIZE);
+    if (!in || !raw || inflateInit2(&strm, 15 + 16) != Z_OK) {
+        free(in);
+        free(raw);
+        return false;
+    }
+    bool ok = true, inMember = false;
+    *rawSize = 0;
+    for (;;) {
+        if (strm.avail_in == 0) {
+            int64_t got = read_full(infd, in, COPY_BUFFER_SIZE);
+            if (got < 0) {
+                ok = false;
+                break;
+            }
+            if (got == 0) {
+                ok = !inMember;
+                break;
+            }
+            strm.next_in = in;
+            strm.avail_in = (uInt)got;
+        }
+        strm.next_out = raw;
+        strm.avail_out = COPY_BUFFER_SIZE;
+        inMember = true;
+        int ret = inflate(&strm, Z_NO_FLUSH);
+        uint64_t produced = COPY_BUFFER_SIZE - strm.avail_out;
+        if (fwrite(raw, 1, produced, out) != produced) {
+            ok = false;
+            break;
+        }
+        *rawSize += produced;
+        if (ret == Z_STREAM_END) {
+            /* Another member may follow. */
+            inMember = false;
+            (void)inflateReset(&strm);
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            ok = false;
+            break;
+        }
+    }
+    (void)inflateEnd(&strm);
+    free(in);
+    free(raw);
+    if (!ok) fprintf(stderr, "%s: invalid or truncated input.\n", progName);
+    return ok && fflush(out) == 0;
+}
+
+/* Decompresses INFD into OUT, in parallel if it is a regular file. */
+static bool decompress_fd(const options_t *o, int infd, FILE *out,
+                          uint64_t *rawSize) {
+    uint64_t inSize;
+    if (!is_regular(infd, &inSize)) {
+        return decompress_stream(infd, out, rawSize);
+    }
+    if (inSize == 0) {
+        *rawSize = 0;
+        return true;
+    }
+
+    *rawSize = mgz_parallel_inflate_file(infd, o->lookupPath, out);
+    if (fflush(out) != 0) return false;
+    if (*rawSize == 0) {
+        /* The library cannot tell empty members from an error, so check
+         * the file sequentially, without output, which reports what is
+         * wrong with it. */
+        FILE *devNull = fopen("/dev/null", "wb");
+        bool ok = devNull && lseek(infd, 0, SEEK_SET) == 0 &&
+                  decompress_stream(infd, devNull, rawSize);
+        if (devNull) fclose(devNull);
+        if (ok && *rawSize == 0) return true;
+        if (ok || !devNull) {
+            fprintf(stderr, "%s: invalid or truncated input.\n", progName);
+        }
+        return false;
+    }
+    return true;
+}
+
+/* Opens PATH for writing, unless it exists and --force is not set. */
+static FILE *create_output(const options_t *o, const char *path) {
+    if (!o->force && access(path, F_OK) == 0) {
+        fprintf(stderr, "%s: %s already exists; use -f to overwrite.\n",
+                progName, path);
+        return NULL;
+    }
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "%s: cannot create %s: %s\n", progName, path,
+                strerror(errno));
+    }
+    return f;
+}
+
+static void report(const options_t *o, const char *name, uint64_t rawSize,
+                   uint64_t outSize) {
+    if (!o->verbose) return;
+    double ratio = rawSize ? 100.0 * (1.0 - (double)outSize / rawSize) : 0;
+    fprintf(stderr, "%s: %.1f%% (%" PRIu64 " -> %" PRIu64 ")\n", name,
+            ratio, rawSize, outSize);
+}
+
+/* Compresses or decompresses standard input to standard output. */
+static bool process_stdin(const options_t *o) {
+    if (o->mode == COMPRESS && isatty(STDOUT_FILENO) && !o->force) {
+        fprintf(stderr,
+                "%s: refusing to write compressed data to a terminal; use "
+                "-f to force.\n",
+                progName);
+        return false;
+    }
+    uint64_t rawSize = 0, outSize = 0;
+    if (o->mode == DECOMPRESS) {
+        return decompress_fd(o, STDIN_FILENO, stdout, &rawSize);
+    }
+    FILE *lookup = o->lookupPath ? create_output(o, o->lookupPath) : NULL;
+    if (o->lookupPath && !lookup) return false;
+    bool ok = compress_fd(o, STDIN_FILENO, stdout, lookup, &rawSize,
+                          &outSize);
+    if (lookup && fclose(lookup) != 0) ok = false;
+    report(o, "stdin", rawSize, outSize);
+    return ok;
+}
+
+/* Compresses or decompresses the file at PATH, next to it or to standard
+ * output. */
+static bool process_file(const options_t *o, const char *path) {
+    bool decompress = o->mode == DECOMPRESS;
+    if (decompress && !ends_with(path, o->suffix) && !o->toStdout) {
+        fprintf(stderr, "%s: %s does not end in %s; skipped.\n", progName,
+                path, o->suffix);
+        return false;
+    }
+    if (!decompress && ends_with(path, o->suffix) && !o->force) {
+        fprintf(stderr, "%s: %s already ends in %s; skipped.\n", progName,
+                path, o->suffix);
+        return false;
+    }
+    int infd = open(path, O_RDONLY);
+    if (infd < 0) {
+        fprintf(stderr, "%s: cannot open %s: %s\n", progName, path,
+                strerror(errno));
+        return false;
+    }
+    char *outPath = NULL;
+    FILE *out = stdout;
+    if (!o->toStdout) {
+        outPath = decompress ? strndup(path, strlen(path) - strlen(o->suffix))
+                             : concat(path, o->suffix);
+        out = outPath ? create_output(o, outPath) : NULL;
+    }
+    FILE *lookup = NULL;
+    if (out && !decompress && o->lookupPath) {
+        lookup = create_output(o, o->lookupPath);
+        if (!lookup) {
+            if (out != stdout) fclose(out);
+            out = NULL;
+            unlink(outPath);
+        }
+    }
+    bool ok = out != NULL;
+    uint64_t rawSize = 0, outSize = 0;
+    if (ok && decompress) {
+        ok = decompress_fd(o, infd, out, &rawSize);
+    } else if (ok) {
+        ok = compress_fd(o, infd, out, lookup, &rawSize, &outSize);
+    }
+    if (lookup && fclose(lookup) != 0) ok = false;
+    if (out && out != stdout && fclose(out) != 0) ok = false;
+    close(infd);
+    if (out && out != stdout && !ok) unlink(outPath);
+    if (ok && !o->toStdout && !o->keep) unlink(path);
+    if (ok && !decompress) report(o, path, rawSize, outSize);
+    free(outPath);
+    return ok;
+}
+
+static bool list_file(const options_t *o, const char *path, bool header) {
+    int fd = open(path, O_RDONLY);
+    mgz_reader_t *r = fd < 0 ? NULL : mgz_reader_open(fd, o->lookupPath);
+    mgz_info_t info;
+    bool ok = r && mgz_reader_get_info(r, &info);
+    mgz_reader_close(r);
+    if (fd >= 0) close(fd);
+    if (!ok) {
+        fprintf(stderr,
+                "%s: %s has no readable lookup table or index; see "
+                "--rebuild-lookup.\n",
+                progName, path);
+        return false;
+    }
+    if (header) {
+        printf("%14s %14s %6s %10s %10s  %-8s %-6s %s\n", "compressed",
+               "uncompressed", "ratio", "blocks", "block_size", "layout",
+               "table", "name");
+    }
+    const char *layout = info.checkpoints ? "zran"
+                         : info.nPoints     ? "seekable"
+                         : info.dictSize    ? "primed"
+                         : info.variable    ? "variable"
+                                            : "fixed";
+    double ratio = info.rawSize
+                       ? 100.0 * (1.0 - (double)info.dataSize / info.rawSize)
+                       : 0;
+    printf("%14" PRIu64 " %14" PRIu64 " %5.1f%% %10" PRIu64 " %10" PRIu64
+           "  %-8s %-6s %s\n",
+           info.dataSize, info.rawSize, ratio, info.nBlocks, info.blockSize,
+           layout, info.indexed ? "index" : "lookup", path);
+    if (o->verbose && info.hasCrc) printf("crc32 %08" PRIx32 "\n", info.crc);
+    return true;
+}
+
+static bool test_file(const options_t *o, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "%s: cannot open %s: %s\n", progName, path,
+                strerror(errno));
+        return false;
+    }
+
+    /* Without a lookup file, the archive is checked by decompressing it,
+     * which checks the trailer of every member, whether it has an index
+     * or not. */
+    bool ok;
+    if (o->lookupPath) {
+        ok = mgz_verify(fd, o->lookupPath, NULL);
+    } else {
+        FILE *devNull = fopen("/dev/null", "wb");
+        uint64_t rawSize;
+        ok = devNull && decompress_fd(o, fd, devNull, &rawSize);
+        if (devNull) fclose(devNull);
+    }
+    close(fd);
+    if (!ok) {
+        fprintf(stderr, "%s: %s is corrupt.\n", progName, path);
+    } else if (o->verbose) {
+        fprintf(stderr, "%s: OK\n", path);
+    }
+    return ok;
+}
+
+/* Writes raw bytes [OFFSET, OFFSET + LENGTH) of the archive at PATH, or
+ * of standard input if it is a regular file, to standard output. */
+static bool extract_file(const options_t *o, const char *path) {
+    int fd = path ? open(path, O_RDONLY) : STDIN_FILENO;
+    mgz_reader_t *r = fd < 0 ? NULL : mgz_reader_open(fd, o->lookupPath);
+    void *buf = malloc(EXTRACT_WINDOW);
+    bool ok = r && buf;
+    if (!r) {
+        fprintf(stderr,
+                "%s: %s has no readable lookup table or index; see "
+                "--rebuild-lookup.\n",
+                progName, path ? path : "stdin");
+    }
+    uint64_t offset = o->offset, left = o->length;
+    while (ok && left > 0) {
+        uint64_t want = left < EXTRACT_WINDOW ? left : EXTRACT_WINDOW;
+        uint64_t got = mgz_reader_read(r, buf, want, offset);
+        if (fwrite(buf, 1, got, stdout) != got) ok = false;
+        if (got < want) break;
+        offset += got;
+        left -= got;
+    }
+    if (fflush(stdout) != 0) ok = false;
+    free(buf);
+    mgz_reader_close(r);
+    if (path && fd >= 0) close(fd);
+    return ok;
+}
+
+static bool rebuild_file(const options_t *o, const char *path) {
+    char *lookupPath =
+        o->lookupPath ? strdup(o->lookupPath) : concat(path, ".lookup");
+    int fd = open(path, O_RDONLY);
+    FILE *lookup = fd >= 0 && lookupPath ? create_output(o, lookupPath)
+                                         : NULL;
+    uint64_t nBlocks = lookup ? mgz_index_gzip(fd, o->span, lookup) : 0;
+    bool ok = nBlocks > 0;
+    if (lookup && fclose(lookup) != 0) ok = false;
+    if (lookup && !ok) unlink(lookupPath);
+    if (fd < 0) {
+        fprintf(stderr, "%s: cannot open %s: %s\n", progName, path,
+                strerror(errno));
+    } else {
+        close(fd);
+    }
+    if (ok && o->verbose) {
+        fprintf(stderr, "%s: %" PRIu64 " blocks -> %s\n", path, nBlocks,
+                lookupPath);
+    }
+    free(lookupPath);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    enum { OPT_OFFSET = 256, OPT_LENGTH, OPT_REBUILD, OPT_SPAN };
+    static const struct option longOptions[] = {
+        {"blocksize", required_argument, NULL, 'b'},
+        {"processes", required_argument, NULL, 'p'},
+        {"stdout", no_argument, NULL, 'c'},
+        {"decompress", no_argument, NULL, 'd'},
+        {"force", no_argument, NULL, 'f'},
+        {"keep", no_argument, NULL, 'k'},
+        {"list", no_argument, NULL, 'l'},
+        {"test", no_argument, NULL, 't'},
+        {"lookup", required_argument, NULL, 'L'},
+        {"suffix", required_argument, NULL, 'S'},
+        {"quiet", no_argument, NULL, 'q'},
+        {"verbose", no_argument, NULL, 'v'},
+        {"help", no_argument, NULL, 'h'},
+        {"offset", required_argument, NULL, OPT_OFFSET},
+        {"length", required_argument, NULL, OPT_LENGTH},
+        {"rebuild-lookup", no_argument, NULL, OPT_REBUILD},
+        {"span", required_argument, NULL, OPT_SPAN},
+        {NULL, 0, NULL, 0}};
+    options_t o = {.mode = COMPRESS,
+                   .level = DEFAULT_LEVEL,
+                   .blockSize = (uint64_t)DEFAULT_BLOCK_KIB << 10,
+                   .suffix = ".gz",
+                   .length = UINT64_MAX,
+                   .span = (uint64_t)DEFAULT_SPAN_MIB << 20};
+    bool extract = false;
+    uint64_t v;
+    int c;
+    while ((c = getopt_long(argc, argv, "0123456789b:p:cdfkltL:S:qvh",
+                            longOptions, NULL)) != -1) {
+        switch (c) {
+            case '0': case '1': case '2': case '3': case '4':
+            case '5': case '6': case '7': case '8': case '9':
+                o.level = c - '0';
+                break;
+            case 'b':
+                if (!parse_u64(optarg, &v) || v < MIN_BLOCK_KIB ||
+                    v > (UINT64_MAX >> 10)) {
+                    fprintf(stderr, "%s: block size must be at least %d "
+                                    "KiB.\n",
+                            progName, MIN_BLOCK_KIB);
+                    return 1;
+                }
+                o.blockSize = v << 10;
+                break;
+            case 'p':
+                if (!parse_u64(optarg, &v) || v == 0 || v > 4096) {
+                    fprintf(stderr, "%s: invalid thread count %s.\n",
+                            progName, optarg);
+                    return 1;
+                }
+                o.nThreads = (int)v;
+                break;
+            case 'c': o.toStdout = true; break;
+            case 'd': o.mode = DECOMPRESS; break;
+            case 'f': o.force = true; break;
+            case 'k': o.keep = true; break;
+            case 'l': o.mode = LIST; break;
+            case 't': o.mode = TEST; break;
+            case 'L': o.lookupPath = optarg; break;
+            case 'S': o.suffix = optarg; break;
+            case 'q': o.quiet = true; o.verbose = false; break;
+            case 'v': o.verbose = true; o.quiet = false; break;
+            case 'h': usage(stdout); return 0;
+            case OPT_OFFSET:
+            case OPT_LENGTH:
+                if (!parse_u64(optarg, &v)) {
+                    fprintf(stderr, "%s: invalid %s %s.\n", progName,
+                            c == OPT_OFFSET ? "offset" : "length", optarg);
+                    return 1;
+                }
+                if (c == OPT_OFFSET) o.offset = v;
+                else o.length = v;
+                extract = true;
+                break;
+            case OPT_REBUILD: o.mode = REBUILD; break;
+            case OPT_SPAN:
+                if (!parse_u64(optarg, &v) || v > (UINT64_MAX >> 20)) {
+                    fprintf(stderr, "%s: invalid span %s.\n", progName,
+                            optarg);
+                    return 1;
+                }
+                o.span = v << 20;
+                break;
+            default: usage(stderr); return 1;
+        }
+    }
+    if (extract) o.mode = EXTRACT;
+    if (o.nThreads > 0) {
+        omp_set_num_threads(o.nThreads);
+    } else {
+        o.nThreads = omp_get_max_threads();
+    }
+    if (o.quiet) {
+        /* Library diagnostics go to stderr too. */
+        if (!freopen("/dev/null", "w", stderr)) return 1;
+    }
+
+    int nFiles = argc - optind;
+    if (o.lookupPath && nFiles > 1) {
+        fprintf(stderr, "%s: -L takes a single file.\n", progName);
+        return 1;
+    }
+    if (nFiles == 0 && (o.mode == COMPRESS || o.mode == DECOMPRESS)) {
+        return process_stdin(&o) ? 0 : 1;
+    }
+    if (nFiles == 0 && o.mode == EXTRACT) {
+        return extract_file(&o, NULL) ? 0 : 1;
+    }
+    if (nFiles == 0) {
+        usage(stderr);
+        return 1;
+    }
+    if (o.mode == EXTRACT && nFiles > 1) {
+        fprintf(stderr, "%s: --offset and --length take a single file.\n",
+                progName);
+        return 1;
+    }
+    bool ok = true;
+    for (int i = optind; i < argc; ++i) {
+        const char *path = argv[i];
+        switch (o.mode) {
+            case COMPRESS:
+            case DECOMPRESS: ok = process_file(&o, path) && ok; break;
+            case LIST: ok = list_file(&o, path, i == optind) && ok; break;
+            case TEST: ok = test_file(&o, path) && ok; break;
+            case EXTRACT: ok = extract_file(&o, path) && ok; break;
+            case REBUILD: ok = rebuild_file(&o, path) && ok; break;
+        }
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,155 @@
+#include "crc.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <zlib.h>
+
+#define SIMD_MIN_SIZE 64  // Shorter inputs are not worth the setup.
+
+typedef uint32_t crc_fn_t(uint32_t crc, const uint8_t *buf, uint64_t len);
+
+/* zlib's crc32() takes a 32-bit length, so feed it in pieces. */
+static uint32_t crc32_zlib(uint32_t crc, const uint8_t *buf, uint64_t len) {
+    while (len > 0) {
+        uInt n = len > (1U << 30) ? 1U << 30 : (uInt)len;
+        crc = (uint32_t)crc32(crc, buf, n);
+        buf += n;
+        len -= n;
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+/* Folds LEN bytes at BUF, a multiple of 16 and at least 64, into the
+ * pre-inverted CRC with PCLMULQDQ, following Intel's "Fast CRC
+ * Computation for Generic Polynomials Using PCLMULQDQ Instruction". The
+ * constants are powers of x modulo the bit-reflected gzip polynomial. */
+__attribute__((target("sse4.1,pclmul"))) static uint32_t fold_pclmul(
+    uint32_t crc, const uint8_t *buf, uint64_t len) {
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+    /* Four 128-bit lanes fold 64 bytes per iteration. */
+    __m128i x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+    __m128i x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+    __m128i x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+    __m128i x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+    buf += 64;
+    len -= 64;
+    while (len >= 64) {
+        __m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        __m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        __m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        __m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+                           _mm_loadu_si128((const __m128i *)(buf + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+                           _mm_loadu_si128((const __m128i *)(buf + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+                           _mm_loadu_si128((const __m128i *)(buf + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+                           _mm_loadu_si128((const __m128i *)(buf + 0x30)));
+        buf += 64;
+        len -= 64;
+    }
+
+    /* Fold the four lanes into one, then the remaining 16-byte chunks
+     * into it. */
+    __m128i lanes[3] = {x2, x3, x4};
+    for (int i = 0; i < 3; ++i) {
+        __m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, lanes[i]), x5);
+    }
+    while (len >= 16) {
+        __m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+                           _mm_loadu_si128((const __m128i *)buf));
+        buf += 16;
+        len -= 16;
+    }
+
+    /* Fold 128 bits to 64, then Barrett-reduce to 32. */
+    __m128i x2r = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2r);
+    x2r = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k5k0, 0x00), x2r);
+    x2r = _mm_and_si128(x1, mask32);
+    x2r = _mm_clmulepi64_si128(x2r, poly, 0x10);
+    x2r = _mm_and_si128(x2r, mask32);
+    x2r = _mm_clmulepi64_si128(x2r, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2r);
+    return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+static uint32_t crc32_pclmul(uint32_t crc, const uint8_t *buf, uint64_t len) {
+    if (len >= SIMD_MIN_SIZE) {
+        uint64_t n = len & ~(uint64_t)15;
+        crc = ~fold_pclmul(~crc, buf, n);
+        buf += n;
+        len -= n;
+    }
+    return crc32_zlib(crc, buf, len);
+}
+#endif
+
+#if defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+
+__attribute__((target("+crc"))) static uint32_t crc32_armv8(
+    uint32_t crc, const uint8_t *buf, uint64_t len) {
+    crc = ~crc;
+    for (; len > 0 && ((uintptr_t)buf & 7); --len) crc = __crc32b(crc, *buf++);
+    for (; len >= 8; len -= 8, buf += 8) {
+        crc = __crc32d(crc, *(const uint64_t *)buf);
+    }
+    for (; len > 0; --len) crc = __crc32b(crc, *buf++);
+    return ~crc;
+}
+#endif
+
+static crc_fn_t *crcFn = crc32_zlib;
+static const char *crcName = "zlib";
+static pthread_once_t crcOnce = PTHREAD_ONCE_INIT;
+
+static void crc_select(void) {
+    if (getenv("MGZ_NO_SIMD_CRC")) return;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) {
+        crcFn = crc32_pclmul;
+        crcName = "pclmul";
+    }
+#elif defined(__aarch64__)
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+        crcFn = crc32_armv8;
+        crcName = "armv8";
+    }
+#endif
+}
+
+uint32_t crc32_fast(uint32_t crc, const void *buf, uint64_t len) {
+    (void)pthread_once(&crcOnce, crc_select);
+    return crcFn(crc, (const uint8_t *)buf, len);
+}
+
+const char *crc32_impl(void) {
+    (void)pthread_once(&crcOnce, crc_select);
+    return crcName;
+}
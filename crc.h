@@ -0,0 +1,21 @@
+#ifndef CRC_H
+#define CRC_H
+#include <stdint.h>
+
+/* CRC-32 as used by gzip, with a drop-in replacement for zlib's crc32().
+ * On x86-64 CPUs with PCLMULQDQ and SSE4.1 the bulk of the input is
+ * folded with carry-less multiplies, and on ARMv8 CPUs with the CRC32
+ * extension it goes through the crc32x instructions. Everything else,
+ * including short inputs and the tails of long ones, falls back to zlib.
+ * The implementation is picked once at run time from the CPU features,
+ * and setting MGZ_NO_SIMD_CRC in the environment forces the fallback. */
+
+/* Updates the running CRC-32 CRC with the LEN bytes at BUF and returns
+ * it. Start with 0. Same result as zlib's crc32(). */
+uint32_t crc32_fast(uint32_t crc, const void *buf, uint64_t len);
+
+/* Returns the name of the implementation crc32_fast() uses: "pclmul",
+ * "armv8" or "zlib". */
+const char *crc32_impl(void);
+
+#endif  // CRC_H
@@ -1,135 +1,210 @@
 #include "mgz.h"
 
-#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <malloc.h>
+#include <math.h>
 #include <omp.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
 #include <zlib.h>
 
-#include "gz64.h"
+#include "backend.h"
+#include "crc.h"
+#include "mgz_internal.h"
+#include "topology.h"
+#include "zpool.h"
 
-#define CHUNK_SIZE 16384  // 16 KiB
-#define ILLEGAL_CHUNK_SIZE (CHUNK_SIZE + 1)
-#define DEFAULT_OUT_CAPACITY (CHUNK_SIZE << 1)
-#define MIN_BLOCK_SIZE CHUNK_SIZE
+#define MIN_BLOCK_SIZE 16384             // 16 KiB
 #define DEFAULT_BLOCK_SIZE (1ULL << 20)  // 1 MiB
-#define ILLEGAL_BLOCK_SIZE SIZE_MAX
+#define WRITEV_BATCH 1024                // IOV_MAX on Linux.
+#define SAMPLE_SIZE MIN_BLOCK_SIZE       // Granularity of adaptive blocks.
+#define STORE_ENTROPY 7.9                // Bits per byte.
+#define MIN_SYNC_SIZE 4096               // 4 KiB
+#define DEFAULT_SYNC_SIZE (1 << 16)      // 64 KiB
+#define SYNC_OVERHEAD 32  // Worst-case growth of the output per full flush.
+#define DICT_SAMPLES 32   // Slices of the input in a trained dictionary.
+#define GZIP_TRAILER_SIZE 8
+#define DEFLATE_STATE_SIZE (1 << 19)  // Per-thread deflate arena, zpool.c.
+#define OS_UNIX 3  // Same OS byte as zlib writes.
 
-static inline void *voidp_shift(const void *p, uint64_t offset) {
-    return (void *)((uint8_t *)p + offset);
+static inline void put_le32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) p[i] = (v >> (8 * i)) & 0xff;
 }
 
-static uInt load_input(uint8_t *inBuf, const void *in, uint64_t offset,
-                       uint64_t *remSize) {
-    uInt loadSize = 0;
-    if (*remSize == 0) return 0;
-    if (*remSize < CHUNK_SIZE) {
-        loadSize = *remSize;
+/* Compresses INSIZE bytes at IN with zlib as raw deflate data starting
+ * GZIP_HEADER_SIZE bytes into the DSTCAPACITY bytes at DST, primed with
+ * the DICTSIZE bytes at DICT and doing the full flushes described at
+ * deflate_into. Returns the offset in DST where the deflate data ends, or
+ * 0 if an error occurred. */
+static uint64_t zlib_deflate_into(void *dst, uint64_t dstCapacity,
+                                  const void *in, uint64_t inSize, int level,
+                                  const void *dict, uint64_t dictSize,
+                                  uint64_t syncSize, uint64_t *syncOffs) {
+    z_stream *strm = zpool_deflate(level);
+    if (!strm) return 0;
+    if (dictSize &&
+        deflateSetDictionary(strm, (const Bytef *)dict, (uInt)dictSize) !=
+            Z_OK) {
+        return 0;
+    }
+
+    /* avail_in and avail_out are 32-bit, so feed at most UINT_MAX bytes
+     * at a time. */
+    uint64_t inOffset = 0, outOffset = GZIP_HEADER_SIZE;
+    uint64_t nextSync = syncSize ? syncSize : UINT64_MAX;
+    int zRet = Z_OK;
+    strm->avail_in = strm->avail_out = 0;
+    do {
+        if (strm->avail_in == 0 && inOffset == nextSync &&
+            inOffset < inSize && strm->avail_out > 0) {
+            /* The full flush at NEXTSYNC is complete. */
+            *syncOffs++ = outOffset - strm->avail_out;
+            nextSync += syncSize;
+        }
+        if (strm->avail_in == 0) {
+            uint64_t n = inSize - inOffset;
+            if (n > UINT_MAX) n = UINT_MAX;
+            if (n > nextSync - inOffset) n = nextSync - inOffset;
+            strm->next_in = (Bytef *)voidp_shift(in, inOffset);
+            strm->avail_in = (uInt)n;
+            inOffset += n;
+        }
+        if (strm->avail_out == 0) {
+            uint64_t n = dstCapacity - outOffset;
+            if (n > UINT_MAX) n = UINT_MAX;
+            if (n == 0) break;  // Bound too small, cannot happen.
+            strm->next_out = (Bytef *)voidp_shift(dst, outOffset);
+            strm->avail_out = (uInt)n;
+            outOffset += n;
+        }
+        int flush = inOffset == inSize     ? Z_FINISH
+                    : inOffset == nextSync ? Z_FULL_FLUSH
+                                           : Z_NO_FLUSH;
+        zRet = deflate(strm, flush);
+        if (zRet == Z_STREAM_ERROR) {
+            fprintf(stderr,
+                    "mgz_deflate: (FATAL) deflate returned "
+                    "Z_STREAM_ERROR.\n");
+            exit(1);
+        }
+    } while (zRet != Z_STREAM_END);
+    return zRet == Z_STREAM_END ? outOffset - strm->avail_out : 0;
+}
+
+/* Compresses INSIZE bytes at IN as one gzip member straight into the
+ * DSTCAPACITY bytes at DST, which must hold at least
+ * gzip_deflate_bound(level, INSIZE) bytes. Deflate reads the input and
+ * writes the output in place, so nothing is staged or copied. Returns
+ * the compressed size, or 0 if an error occurred. If CRC is not NULL, it
+ * is set to the CRC-32 of the input.
+ *
+ * The header and trailer are written here around raw deflate data, byte
+ * for byte as zlib's gzip wrapper would write them, so that the CRC-32
+ * comes from crc32_fast() rather than zlib's. The deflate data comes from
+ * the alternate engine of backend.h if one is in use, and from zlib if
+ * not or if there are sync points or a dictionary.
+ *
+ * If DICTSIZE is not 0, the history is primed with the DICTSIZE bytes at
+ * DICT, at most MAX_DICT_SIZE of them, so that the start of the block can
+ * refer back into them. Such a member only inflates with the same
+ * dictionary set.
+ *
+ * If SYNCSIZE is not 0, a full flush is done after every SYNCSIZE bytes
+ * of input short of the end, which byte-aligns the output and resets the
+ * history so that raw inflate can start there, and the offset in DST of
+ * the k-th flush point is stored in SYNCOFFS[k]. Each flush may grow the
+ * output by up to SYNC_OVERHEAD bytes beyond the bound. */
+static uint64_t deflate_into(void *dst, uint64_t dstCapacity, const void *in,
+                             uint64_t inSize, int level, const void *dict,
+                             uint64_t dictSize, uint64_t syncSize,
+                             uint64_t *syncOffs, uint32_t *crc) {
+    STATS_TIMER_START(t0);
+    uint8_t *header = (uint8_t *)dst;
+    int xflLevel = level == Z_DEFAULT_COMPRESSION ? 6 : level;
+    memset(header, 0, GZIP_HEADER_SIZE);
+    header[0] = 0x1f;
+    header[1] = 0x8b;
+    header[2] = Z_DEFLATED;
+    header[8] = xflLevel == 9 ? 2 : xflLevel < 2 ? 4 : 0;  // XFL.
+    header[9] = OS_UNIX;
+
+    uint64_t dataEnd = 0;
+    if (syncSize == 0 && dictSize == 0 && backend_active()) {
+        uint64_t n = backend_deflate(
+            voidp_shift(dst, GZIP_HEADER_SIZE),
+            dstCapacity - GZIP_HEADER_SIZE - GZIP_TRAILER_SIZE, in, inSize,
+            level);
+        if (n) dataEnd = GZIP_HEADER_SIZE + n;
     } else {
-        loadSize = CHUNK_SIZE;
+        dataEnd = zlib_deflate_into(dst, dstCapacity, in, inSize, level,
+                                    dict, dictSize, syncSize, syncOffs);
     }
-    *remSize -= loadSize;
-    memcpy(inBuf, voidp_shift(in, offset), loadSize);
-    return loadSize;
+    uint64_t outSize = 0;
+    if (dataEnd != 0 && dstCapacity - dataEnd >= GZIP_TRAILER_SIZE) {
+        uint32_t sum = crc32_fast(0, in, inSize);
+        uint8_t *trailer = (uint8_t *)voidp_shift(dst, dataEnd);
+        put_le32(trailer, sum);
+        put_le32(trailer + 4, (uint32_t)inSize);
+        outSize = dataEnd + GZIP_TRAILER_SIZE;
+        if (crc) *crc = sum;
+    }
+    STATS_TIMER_ADD(deflateNs, t0);
+    STATS_ADD(blocksDeflated, 1);
+    STATS_ADD(bytesIn, inSize);
+    STATS_ADD(bytesOut, outSize);
+    return outSize;
 }
 
-static uInt copy_output(void **out, uint64_t outOffset, uint64_t *outCapacity,
-                        uint8_t *outBuf, uInt have) {
-    if (outOffset + have > *outCapacity) {
-        /* Not enough space, reallocate output array. */
-        do {
-            (*outCapacity) *= 2;
-        } while (outOffset + have > *outCapacity);
-        void *newOut = realloc(*out, *outCapacity);
-        if (!newOut) return ILLEGAL_CHUNK_SIZE;
-        *out = newOut;
+/* Returns the maximum size of a gzip member holding INSIZE bytes
+ * compressed at level LEVEL, as computed by deflateBound() or by the
+ * alternate engine if it needs more. */
+static uint64_t gzip_deflate_bound(int level, uint64_t inSize) {
+    z_stream *strm = zpool_deflate(level);
+    if (!strm) return 0;
+    uint64_t bound = deflateBound(strm, inSize);
+    if (backend_active()) {
+        uint64_t backendBound = backend_deflate_bound(level, inSize);
+        if (backendBound == 0) return 0;
+        if (backendBound > bound) bound = backendBound;
     }
-    memcpy(voidp_shift(*out, outOffset), outBuf, have);
-    return have;
+    return bound + GZIP_HEADER_SIZE + GZIP_TRAILER_SIZE;
 }
 
 uint64_t mgz_deflate(void **out, const void *in, uint64_t inSize, int level) {
-    if (inSize == 0) {
-        *out = NULL;
-        return 0;
-    }
-    int zRet = Z_OK, flush = Z_NO_FLUSH;
-    uint64_t inOffset = 0, outOffset = 0;
-    uint64_t outCapacity = DEFAULT_OUT_CAPACITY;
-    z_stream strm;
-    uint8_t *inBuf = (uint8_t *)malloc(CHUNK_SIZE);
-    uint8_t *outBuf = (uint8_t *)malloc(CHUNK_SIZE);
-    *out = malloc(outCapacity);
-    if (!inBuf || !outBuf || !(*out)) {
+    *out = NULL;
+    if (inSize == 0) return 0;
+    uint64_t bound = gzip_deflate_bound(level, inSize);
+    if (bound == 0) return 0;
+    *out = malloc(bound);
+    STATS_ADD(allocations, 1);
+    if (!(*out)) {
         fprintf(stderr, "mgz_deflate: malloc failed.\n");
-        free(*out);
-        *out = NULL;
-        goto _bailout;
+        return 0;
     }
-
-    /* Allocate deflate state. */
-    strm.zalloc = Z_NULL;
-    strm.zfree = Z_NULL;
-    strm.opaque = Z_NULL;
-    zRet = deflateInit2(&strm, level, Z_DEFLATED, 15 + 16, 8,
-                        Z_DEFAULT_STRATEGY);  // +16 for gzip header.
-    if (zRet != Z_OK) {
+    uint64_t outSize =
+        deflate_into(*out, bound, in, inSize, level, NULL, 0, 0, NULL, NULL);
+    if (outSize == 0) {
         free(*out);
         *out = NULL;
-        goto _bailout;
+        return 0;
     }
 
-    /* Compress until the end of IN. */
-    do {
-        strm.avail_in = load_input(inBuf, in, inOffset, &inSize);
-        inOffset += strm.avail_in;
-        if (strm.avail_in < CHUNK_SIZE) flush = Z_FINISH;
-        strm.next_in = inBuf;
-
-        /* Run deflate() on input until output buffer not full; finish
-         * compression if all of source has been read in. */
-        do {
-            strm.avail_out = CHUNK_SIZE;
-            strm.next_out = outBuf;
-            zRet = deflate(&strm, flush);
-            if (zRet == Z_STREAM_ERROR) {
-                fprintf(stderr,
-                        "mgz_deflate: (FATAL) deflate returned "
-                        "Z_STREAM_ERROR.\n");
-                exit(1);
-            }
-            uInt have = CHUNK_SIZE - strm.avail_out;
-            uInt copied =
-                copy_output(out, outOffset, &outCapacity, outBuf, have);
-            if (copied == ILLEGAL_CHUNK_SIZE) {
-                fprintf(stderr, "mgz_deflate: output realloc failed.\n");
-                (void)deflateEnd(&strm);
-                free(*out);
-                *out = NULL;
-                outOffset = 0;
-                goto _bailout;
-            }
-            assert(copied == have);
-            outOffset += copied;
-        } while (strm.avail_out == 0);
-    } while (flush != Z_FINISH);
-
-    /* Clean up and return. */
-    (void)deflateEnd(&strm);
-
-_bailout:
-    free(inBuf);
-    free(outBuf);
-    return outOffset;
+    /* Give back the unused part of the bound. */
+    void *shrunk = realloc(*out, outSize);
+    if (shrunk) *out = shrunk;
+    return outSize;
 }
 
 static uint64_t get_correct_block_size(uint64_t blockSize) {
     if (blockSize == 0) return DEFAULT_BLOCK_SIZE;
     if (blockSize < MIN_BLOCK_SIZE) {
         printf(
-            "mgz_parallel_deflate: resetting block size %zu to the "
-            "minimum required block size %d",
+            "mgz_parallel_deflate: resetting block size %" PRIu64
+            " to the minimum required block size %d",
             blockSize, MIN_BLOCK_SIZE);
         return MIN_BLOCK_SIZE;
     }
@@ -148,160 +223,1198 @@ static uint64_t convert_out_block_sizes_to_lookup(uint64_t *outBlockSizes,
     return t1;
 }
 
-mgz_res_t mgz_parallel_deflate(const void *in, uint64_t inSize, int level,
-                               uint64_t blockSize, bool lookup) {
+/* How deflate_blocks_into_slab lays out its blocks when they are not all
+ * BLOCKSIZE bytes at one level without sync points. */
+typedef struct {
+    /* If not NULL, block i spans [rawOffs[i], rawOffs[i + 1]) of the
+     * input and is compressed at level levels[i]. */
+    const uint64_t *rawOffs;
+    const int *levels;
+
+    /* If SYNCSIZE is not 0, blocks get a full flush every SYNCSIZE raw
+     * bytes, and the offset of the k-th flush point of block i within its
+     * member is stored in syncOffs[i * syncPerBlock + k]. */
+    uint64_t syncSize;
+    uint64_t syncPerBlock;
+    uint64_t *syncOffs;
+
+    /* If DICTSIZE is not 0, every block is primed with the DICTSIZE bytes
+     * at DICT. */
+    const uint8_t *dict;
+    uint64_t dictSize;
+} block_layout_t;
+
+/* Blocks grouped by NUMA node, so that threads pinned to a node work on
+ * the blocks of that node first and only then help the other nodes. */
+typedef struct {
+    int nNodes;
+
+    /* The blocks of node n are order[first[n]] to order[first[n + 1] - 1],
+     * and next[n] is the position in ORDER of the next one to claim. */
+    uint64_t *order;
+    uint64_t *first;
+    uint64_t *next;
+} node_plan_t;
+
+/* Groups the NBLOCKS blocks into PLAN by NODES[i], the node of block i,
+ * out of NNODES. Returns false if malloc failed. */
+static bool node_plan_init(node_plan_t *plan, const int *nodes,
+                           uint64_t nBlocks, int nNodes) {
+    plan->nNodes = nNodes;
+    plan->order = (uint64_t *)malloc(
+        (nBlocks + 2 * ((uint64_t)nNodes + 1)) * sizeof(uint64_t));
+    STATS_ADD(allocations, 1);
+    if (!plan->order) return false;
+    plan->first = plan->order + nBlocks;
+    plan->next = plan->first + nNodes + 1;
+    memset(plan->first, 0, ((uint64_t)nNodes + 1) * sizeof(uint64_t));
+    for (uint64_t i = 0; i < nBlocks; ++i) ++plan->first[nodes[i] + 1];
+    for (int n = 0; n < nNodes; ++n) plan->first[n + 1] += plan->first[n];
+    memcpy(plan->next, plan->first, ((uint64_t)nNodes + 1) * sizeof(uint64_t));
+    for (uint64_t i = 0; i < nBlocks; ++i) {
+        plan->order[plan->next[nodes[i]]++] = i;
+    }
+    memcpy(plan->next, plan->first, (uint64_t)nNodes * sizeof(uint64_t));
+    return true;
+}
+
+/* Claims the next block of PLAN for a thread of node HOME into *BLOCK,
+ * taking one of another node once HOME has none left. Returns false if
+ * every block has been claimed. Safe to call from many threads. */
+static bool node_plan_next(node_plan_t *plan, int home, uint64_t *block) {
+    for (int k = 0; k < plan->nNodes; ++k) {
+        int n = (home + k) % plan->nNodes;
+        if (__atomic_load_n(&plan->next[n], __ATOMIC_RELAXED) >=
+            plan->first[n + 1]) {
+            continue;
+        }
+        uint64_t pos = __atomic_fetch_add(&plan->next[n], 1, __ATOMIC_RELAXED);
+        if (pos < plan->first[n + 1]) {
+            *block = plan->order[pos];
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Returns the node of the input of block I out of NBLOCKS, starting at
+ * P: the node holding its first page, or a share of the blocks by
+ * position if the pages belong to no known node. */
+static int block_node(const void *p, uint64_t i, uint64_t nBlocks,
+                      int nNodes) {
+    int node = topology_node_of(p);
+    return node >= 0 ? node : (int)(i * (uint64_t)nNodes / nBlocks);
+}
+
+/* Receives blocks FIRST to END - 1 of deflate_blocks_into_slab, held in
+ * BOUND-sized slots of SLAB, once they and every block before them are
+ * compressed, while later blocks may still be compressing. Blocks are
+ * handed over in order, one call at a time, each exactly once. Returns
+ * false to be called no more. */
+typedef bool (*block_sink_t)(void *ctx, void *slab, uint64_t bound,
+                             const uint64_t *outBlockSizes, uint64_t first,
+                             uint64_t end);
+
+/* State of the ordered writer that feeds a block_sink_t. Whichever thread
+ * finishes a block hands every block that is ready in order to the sink,
+ * unless another thread is already doing so. */
+typedef struct {
+    block_sink_t sink;
+    void *ctx;
+    uint8_t *done;  // Set once block i is compressed.
+    uint64_t next;  // First block not handed to SINK yet.
+    bool busy;      // A thread is handing blocks to SINK.
+    bool stopped;   // SINK returned false.
+} block_writer_t;
+
+/* Hands the blocks of W that are ready, starting at W->NEXT, to its sink
+ * if no other thread is doing so. Blocks finished meanwhile by other
+ * threads are picked up before returning, so none is left waiting. */
+static void writer_drain(block_writer_t *w, void *slab, uint64_t bound,
+                         const uint64_t *outBlockSizes, uint64_t nBlocks) {
+    while (!__atomic_exchange_n(&w->busy, true, __ATOMIC_SEQ_CST)) {
+        uint64_t first = w->next, end = first;
+        while (end < nBlocks &&
+               __atomic_load_n(&w->done[end], __ATOMIC_SEQ_CST)) {
+            ++end;
+        }
+        if (end > first && !w->stopped &&
+            !w->sink(w->ctx, slab, bound, outBlockSizes, first, end)) {
+            w->stopped = true;
+        }
+        w->next = end;
+        __atomic_store_n(&w->busy, false, __ATOMIC_SEQ_CST);
+        if (end == nBlocks ||
+            !__atomic_load_n(&w->done[end], __ATOMIC_SEQ_CST)) {
+            return;
+        }
+    }
+}
+
+/* Compresses each block of IN in parallel into its own BOUND-sized slot
+ * of one malloc'ed slab, with block i at offset i * BOUND, and stores
+ * the compressed size of block i in OUTBLOCKSIZES[i]. If CRC is not
+ * NULL, it is set to the CRC-32 of all of IN, combined from the CRC-32s
+ * of the blocks. Returns the slab, or NULL if an error occurred.
+ *
+ * On NUMA machines, each block is compressed by a thread pinned to the
+ * node that holds its input, and its slot is first touched there. If
+ * SLOTNODES is not NULL, the node that wrote slot i is stored in
+ * SLOTNODES[i].
+ *
+ * If SINK is not NULL, finished blocks are handed to it with CTX in
+ * order while the others are still compressing. Its return value is not
+ * reported; CTX should record failures. If an error occurs, the blocks
+ * before the failed one may already have been handed over.
+ *
+ * If LAYOUT is not NULL, blocks are laid out as it describes, and
+ * BLOCKSIZE is the size of the largest block. */
+static void *deflate_blocks_into_slab(const void *in, uint64_t inSize,
+                                      int level, uint64_t blockSize,
+                                      uint64_t nBlocks,
+                                      const block_layout_t *layout,
+                                      uint64_t *bound,
+                                      uint64_t *outBlockSizes,
+                                      uint32_t *crc, int *slotNodes,
+                                      block_sink_t sink, void *ctx) {
+    static const block_layout_t fixed = {0};
+    if (!layout) layout = &fixed;
+    const uint64_t *rawOffs = layout->rawOffs;
+
+    /* Size the slots for the largest block, not a block size larger than
+     * the whole input. */
+    uint64_t largest = !rawOffs && inSize < blockSize ? inSize : blockSize;
+    *bound = gzip_deflate_bound(level, largest);
+    if (layout->levels) {
+        uint64_t storedBound = gzip_deflate_bound(0, largest);
+        if (storedBound > *bound) *bound = storedBound;
+    }
+    if (*bound == 0) return NULL;
+    *bound += layout->syncPerBlock * SYNC_OVERHEAD;
+    void *slab = malloc(*bound * nBlocks);
+    uint32_t *crcs = (uint32_t *)malloc(nBlocks * sizeof(uint32_t));
+    int *nodes = (int *)malloc(nBlocks * sizeof(int));
+    block_writer_t writer = {sink, ctx, NULL, 0, false, false};
+    if (sink) writer.done = (uint8_t *)calloc(nBlocks, 1);
+    STATS_ADD(allocations, sink ? 4 : 3);
+    node_plan_t plan = {0};
+    int nNodes = topology_nodes();
+    if (slab && crcs && nodes) {
+        for (uint64_t i = 0; i < nBlocks; ++i) {
+            nodes[i] = nNodes == 1 ? 0
+                       : block_node(voidp_shift(in, rawOffs ? rawOffs[i]
+                                                            : i * blockSize),
+                                    i, nBlocks, nNodes);
+        }
+    }
+    if (!slab || !crcs || !nodes || (sink && !writer.done) ||
+        !node_plan_init(&plan, nodes, nBlocks, nNodes)) {
+        fprintf(stderr, "mgz_parallel_deflate: malloc failed.\n");
+        free(slab);
+        free(crcs);
+        free(nodes);
+        free(writer.done);
+        return NULL;
+    }
+    free(nodes);
+    bool failed = false;
+#pragma omp parallel
+    {
+        int home = omp_get_thread_num() % nNodes;
+        topology_pin_t *pin = topology_pin(home);
+        uint64_t i;
+        while (node_plan_next(&plan, home, &i)) {
+            uint64_t start = rawOffs ? rawOffs[i] : i * blockSize;
+            uint64_t end = rawOffs ? rawOffs[i + 1]
+                           : i == nBlocks - 1 ? inSize
+                                              : start + blockSize;
+            outBlockSizes[i] = deflate_into(
+                voidp_shift(slab, i * *bound), *bound,
+                voidp_shift(in, start), end - start,
+                layout->levels ? layout->levels[i] : level, layout->dict,
+                layout->dictSize, layout->syncSize,
+                layout->syncOffs
+                    ? layout->syncOffs + i * layout->syncPerBlock
+                    : NULL,
+                &crcs[i]);
+            if (outBlockSizes[i] == 0) {
+                failed = true;
+                continue;
+            }
+            if (slotNodes) slotNodes[i] = home;
+            if (sink) {
+                __atomic_store_n(&writer.done[i], 1, __ATOMIC_SEQ_CST);
+                writer_drain(&writer, slab, *bound, outBlockSizes, nBlocks);
+            }
+        }
+        topology_unpin(pin);
+    }
+    free(plan.order);
+    free(writer.done);
+    if (failed) {
+        free(slab);
+        free(crcs);
+        return NULL;
+    }
+    if (crc) {
+        *crc = crcs[0];
+        for (uint64_t i = 1; i < nBlocks; ++i) {
+            uint64_t len = rawOffs ? rawOffs[i + 1] - rawOffs[i]
+                           : i == nBlocks - 1 ? inSize - i * blockSize
+                                              : blockSize;
+            *crc = (uint32_t)crc32_combine(*crc, crcs[i], (z_off_t)len);
+        }
+    }
+    free(crcs);
+    return slab;
+}
+
+/* Copies the NBLOCKS compressed blocks held in BOUND-sized slots of SLAB,
+ * block i at OFFSETS[i], into a new malloc'ed buffer of OUTSIZE bytes.
+ * Each block is copied by a thread pinned to SLOTNODES[i], the node that
+ * wrote its slot, so that the pages of the copy are first touched on
+ * that node too. Returns the buffer, or NULL if malloc failed. */
+static void *gather_slots(const void *slab, uint64_t bound,
+                          const uint64_t *offsets, uint64_t nBlocks,
+                          const int *slotNodes, uint64_t outSize) {
+    node_plan_t plan;
+    void *out = malloc(outSize);
+    STATS_ADD(allocations, 1);
+    if (!out || !node_plan_init(&plan, slotNodes, nBlocks, topology_nodes())) {
+        free(out);
+        return NULL;
+    }
+#pragma omp parallel
+    {
+        int home = omp_get_thread_num() % plan.nNodes;
+        topology_pin_t *pin = topology_pin(home);
+        uint64_t i;
+        while (node_plan_next(&plan, home, &i)) {
+            memcpy(voidp_shift(out, offsets[i]), voidp_shift(slab, i * bound),
+                   offsets[i + 1] - offsets[i]);
+        }
+        topology_unpin(pin);
+    }
+    free(plan.order);
+    return out;
+}
+
+/* A block_sink_t that compacts the blocks in place into the final output
+ * of mgz_parallel_deflate. CTX points to the size compacted so far. Block
+ * i moves down from i * bound to an offset no larger than that, once every
+ * block before it has moved, so it only overwrites blocks that are done
+ * and have moved. */
+static bool compact_sink(void *ctx, void *slab, uint64_t bound,
+                         const uint64_t *outBlockSizes, uint64_t first,
+                         uint64_t end) {
+    uint64_t *size = (uint64_t *)ctx;
+    for (uint64_t i = first; i < end; ++i) {
+        memmove(voidp_shift(slab, *size), voidp_shift(slab, i * bound),
+                outBlockSizes[i]);
+        *size += outBlockSizes[i];
+    }
+    return true;
+}
+
+static mgz_res_t parallel_deflate(const void *in, uint64_t inSize, int level,
+                                  uint64_t blockSize, bool lookup) {
     mgz_res_t ret = {0};
     blockSize = get_correct_block_size(blockSize);
     uint64_t nBlocks =
         (inSize + blockSize - 1) / blockSize;  // Round up division.
     if (nBlocks == 0) return ret;              // INSIZE is 0.
-    void *out = NULL;
-
-    /* Allocate space for the output of each block. */
-    void **outBlocks = (void **)calloc(nBlocks, sizeof(void *));
 
     /* Shared space for outBlockSizes and lookup. outBlockSizes
        is later converted to lookup in-place. */
     uint64_t *space = (uint64_t *)malloc((nBlocks + 1) * sizeof(uint64_t));
-    if (!outBlocks || !space) goto _bailout;
+    if (!space) return ret;
 
-    /* Compress each block. */
-    bool oom = false;
-#pragma omp parallel for
-    for (uint64_t i = 0; i < nBlocks; ++i) {
-        uint64_t thisBlockSize =
-            (i == nBlocks - 1) ? inSize - i * blockSize : blockSize;
-        space[i] = mgz_deflate(&outBlocks[i], voidp_shift(in, i * blockSize),
-                               thisBlockSize, level);
-        if (space[i] == 0) oom = true;
+    /* Compress each block into its slot of the slab. */
+    uint64_t bound;
+    int *slotNodes = NULL;
+    if (topology_nodes() > 1) {
+        slotNodes = (int *)malloc(nBlocks * sizeof(int));
+        STATS_ADD(allocations, 1);
+    }
+    uint64_t compacted = 0;
+    void *out = deflate_blocks_into_slab(
+        in, inSize, level, blockSize, nBlocks, NULL, &bound, space, &ret.crc,
+        slotNodes, slotNodes ? NULL : compact_sink, &compacted);
+    if (!out) {
+        free(slotNodes);
+        free(space);
+        return ret;
     }
-    if (oom) goto _bailout;
-
-    /* Concatenate blocks to form the final output. */
     uint64_t outSize = convert_out_block_sizes_to_lookup(space, nBlocks);
-    out = malloc(outSize);
-    if (!out) goto _bailout;
-#pragma omp parallel for
-    for (uint64_t i = 0; i < nBlocks; ++i) {
-        memcpy(voidp_shift(out, space[i]), outBlocks[i],
-               space[i + 1] - space[i]);
-        free(outBlocks[i]);
-        outBlocks[i] = NULL;
+    void *local = slotNodes ? gather_slots(out, bound, space, nBlocks,
+                                           slotNodes, outSize)
+                            : NULL;
+    if (local) {
+        free(out);
+        out = local;
+    } else {
+        /* Compact the blocks now if gathering them failed, as they were
+         * not compacted as they finished. See compact_sink. */
+        for (uint64_t i = 1; slotNodes && i < nBlocks; ++i) {
+            memmove(voidp_shift(out, space[i]), voidp_shift(out, i * bound),
+                    space[i + 1] - space[i]);
+        }
+        void *shrunk = realloc(out, outSize);
+        if (shrunk) out = shrunk;
     }
+    free(slotNodes);
 
     /* Reach here only if compression was successful.
      * Setup return value. */
     ret.out = out;
-    out = NULL;  // Prevent freeing.
     ret.size = outSize;
     if (lookup) {
         ret.lookup = space;
         space = NULL;  // Prevent freeing.
     }                  // else ret.lookup is already set to NULL.
     ret.nBlocks = nBlocks;
-
-_bailout:
-    free(out);
-    if (outBlocks)
-        for (uint64_t i = 0; i < nBlocks; ++i) free(outBlocks[i]);
-    free(outBlocks);
     free(space);
     return ret;
 }
 
-uint64_t mgz_parallel_create(const void *in, uint64_t size, int level,
-                             uint64_t blockSize, FILE *outfile, FILE *lookup) {
+mgz_res_t mgz_parallel_deflate(const void *in, uint64_t inSize, int level,
+                               uint64_t blockSize, bool lookup) {
+    STATS_TIMER_START(t0);
+    mgz_res_t ret = parallel_deflate(in, inSize, level, blockSize, lookup);
+    STATS_CALL_END("mgz_parallel_deflate", t0);
+    return ret;
+}
+
+/* Writes compressed blocks FIRST to END - 1, held in BOUND-sized slots of
+ * SLAB, to OUTFILE, skipping the unused tail of every slot. They go
+ * straight to its file descriptor with writev(), so OUTFILE must have
+ * been flushed, or through fwrite() if it has none, as with fmemopen()
+ * or open_memstream(). */
+static bool write_slab(FILE *outfile, const void *slab, uint64_t bound,
+                       const uint64_t *outBlockSizes, uint64_t first,
+                       uint64_t end) {
+    int fd = fileno(outfile);
+    if (fd < 0) {
+        for (uint64_t i = first; i < end; ++i) {
+            if (fwrite(voidp_shift(slab, i * bound), 1, outBlockSizes[i],
+                       outfile) != outBlockSizes[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    struct iovec iov[WRITEV_BATCH];
+    for (uint64_t i = first; i < end;) {
+        int n = 0;
+        for (; n < WRITEV_BATCH && i + n < end; ++n) {
+            iov[n].iov_base = voidp_shift(slab, (i + n) * bound);
+            iov[n].iov_len = outBlockSizes[i + n];
+        }
+        i += n;
+
+        /* Retry until this batch of blocks is fully written. */
+        struct iovec *v = iov;
+        while (n > 0) {
+            ssize_t written = writev(fd, v, n);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            while (n > 0 && (size_t)written >= v->iov_len) {
+                written -= v->iov_len;
+                ++v;
+                --n;
+            }
+            if (n > 0) {
+                v->iov_base = voidp_shift(v->iov_base, written);
+                v->iov_len -= written;
+            }
+        }
+    }
+    return true;
+}
+
+/* Where file_sink writes blocks. */
+typedef struct {
+    FILE *outfile;
+    FILE *lookup;     // Gets the offset of every block if not NULL.
+    uint64_t offset;  // Size of the blocks written so far.
+    bool failed;
+} file_sink_t;
+
+/* A block_sink_t that writes the blocks to the file of CTX, a
+ * file_sink_t, and their offsets to its lookup file, as they finish. */
+static bool file_sink(void *ctx, void *slab, uint64_t bound,
+                      const uint64_t *outBlockSizes, uint64_t first,
+                      uint64_t end) {
+    STATS_TIMER_START(t0);
+    file_sink_t *f = (file_sink_t *)ctx;
+    f->failed =
+        !write_slab(f->outfile, slab, bound, outBlockSizes, first, end);
+    for (uint64_t i = first; i < end && !f->failed; ++i) {
+        if (f->lookup &&
+            fwrite(&f->offset, sizeof(uint64_t), 1, f->lookup) != 1) {
+            f->failed = true;
+        }
+        f->offset += outBlockSizes[i];
+    }
+    STATS_TIMER_ADD(writeNs, t0);
+    return !f->failed;
+}
+
+/* Shared by mgz_parallel_create and mgz_parallel_create_indexed. Writes
+ * the lookup table to LOOKUP if it is not NULL and appends an embedded
+ * index to OUTFILE if INDEXED is set. Returns the size written to OUTFILE,
+ * index included. */
+static uint64_t parallel_create(const void *in, uint64_t size, int level,
+                                uint64_t blockSize, FILE *outfile,
+                                FILE *lookup, bool indexed) {
     blockSize = get_correct_block_size(blockSize);
-    mgz_res_t res = mgz_parallel_deflate(in, size, level, blockSize, lookup);
-    if (!res.out) return 0;
-    if (fwrite(res.out, 1, res.size, outfile) != res.size) {
+    uint64_t nBlocks = (size + blockSize - 1) / blockSize;
+    if (nBlocks == 0) return 0;
+    uint64_t *space = (uint64_t *)malloc((nBlocks + 1) * sizeof(uint64_t));
+    if (!space) return 0;
+
+    /* Write block size. The offsets follow as the blocks are written. */
+    if (lookup && fwrite(&blockSize, sizeof(uint64_t), 1, lookup) != 1) {
+        fprintf(stderr,
+                "mgz_parallel_create: (FATAL) failed to write to "
+                "lookup.\n");
+        exit(1);
+    }
+
+    /* Write the blocks straight from the slab, without compacting, in
+     * order as they finish. */
+    if (fflush(outfile) != 0) {
         fprintf(stderr,
                 "mgz_parallel_create: (FATAL) failed to write to "
                 "outfile.\n");
         exit(1);
     }
-    if (lookup) {
-        /* Write block size. */
-        if (fwrite(&blockSize, sizeof(uint64_t), 1, lookup) != 1) {
+    file_sink_t sink = {outfile, lookup, 0, false};
+    uint64_t bound;
+    uint32_t crc;
+    void *slab = deflate_blocks_into_slab(in, size, level, blockSize,
+                                          nBlocks, NULL, &bound, space, &crc,
+                                          NULL, file_sink, &sink);
+    if (sink.failed) {
+        fprintf(stderr,
+                "mgz_parallel_create: (FATAL) failed to write to "
+                "outfile or lookup.\n");
+        exit(1);
+    }
+    if (!slab) {
+        free(space);
+        return 0;
+    }
+    free(slab);
+    STATS_TIMER_START(t0);
+    uint64_t outSize = convert_out_block_sizes_to_lookup(space, nBlocks);
+    if (indexed) {
+        mgz_index_t idx = {blockSize, nBlocks, outSize, size, space, crc,
+                           true};
+        uint64_t indexSize = index_write(outfile, &idx);
+        if (indexSize == 0) {
             fprintf(stderr,
-                    "mgz_parallel_create: (FATAL) failed to write to "
-                    "lookup.\n");
+                    "mgz_parallel_create_indexed: (FATAL) failed to write "
+                    "to outfile.\n");
             exit(1);
         }
+        outSize += indexSize;
+    }
+    STATS_TIMER_ADD(writeNs, t0);
+    free(space);
+    return outSize;
+}
 
-        /* Write lookup table. */
-        if (fwrite(res.lookup, sizeof(uint64_t), res.nBlocks, lookup) !=
-            res.nBlocks) {
+uint64_t mgz_parallel_create(const void *in, uint64_t size, int level,
+                             uint64_t blockSize, FILE *outfile, FILE *lookup) {
+    STATS_TIMER_START(t0);
+    uint64_t ret = parallel_create(in, size, level, blockSize, outfile,
+                                   lookup, false);
+    STATS_CALL_END("mgz_parallel_create", t0);
+    return ret;
+}
+
+uint64_t mgz_parallel_create_indexed(const void *in, uint64_t size,
+                                     int level, uint64_t blockSize,
+                                     FILE *outfile) {
+    STATS_TIMER_START(t0);
+    uint64_t ret =
+        parallel_create(in, size, level, blockSize, outfile, NULL, true);
+    STATS_CALL_END("mgz_parallel_create_indexed", t0);
+    return ret;
+}
+
+/* Picks how many blocks, with BOUND-sized slots, go into each wave of a
+ * compression that must fit in BUDGET bytes, and how many threads
+ * compress them. Every thread also holds a deflate state. Returns the
+ * number of blocks per wave, or 0 if not even one block fits. */
+static uint64_t plan_waves(uint64_t budget, uint64_t bound, uint64_t nBlocks,
+                           int *nThreads) {
+    uint64_t perBlock = bound + sizeof(uint64_t) + sizeof(uint32_t);
+    uint64_t threads = (uint64_t)omp_get_max_threads();
+    if (threads > nBlocks) threads = nBlocks;
+    uint64_t wave = 0;
+    if (budget > threads * DEFLATE_STATE_SIZE) {
+        wave = (budget - threads * DEFLATE_STATE_SIZE) / perBlock;
+    }
+    if (wave < threads) {
+        /* Fewer threads, one block each. */
+        threads = budget / (perBlock + DEFLATE_STATE_SIZE);
+        wave = threads;
+    } else {
+        wave -= wave % threads;  // Keep the waves balanced.
+    }
+    if (wave > nBlocks) wave = nBlocks;
+    *nThreads = (int)threads;
+    return wave;
+}
+
+static uint64_t bounded_create(const void *in, uint64_t size, int level,
+                               uint64_t blockSize, uint64_t budget,
+                               FILE *outfile, FILE *lookup) {
+    blockSize = get_correct_block_size(blockSize);
+    uint64_t nBlocks = (size + blockSize - 1) / blockSize;
+    uint64_t bound = gzip_deflate_bound(level, size < blockSize ? size
+                                                                : blockSize);
+    if (nBlocks == 0 || bound == 0) return 0;
+    int nThreads;
+    uint64_t wave = plan_waves(budget, bound, nBlocks, &nThreads);
+    if (wave == 0) {
+        fprintf(stderr,
+                "mgz_parallel_create_bounded: a budget of %" PRIu64
+                " bytes does not fit one block.\n",
+                budget);
+        return 0;
+    }
+
+    /* One slab, reused by every wave. Blocks are compressed exactly as
+     * by mgz_parallel_create and written in order, so the output and the
+     * lookup table are the same. */
+    void *slab = malloc(bound * wave);
+    uint64_t *outSizes = (uint64_t *)malloc(wave * sizeof(uint64_t));
+    uint32_t *crcs = (uint32_t *)malloc(wave * sizeof(uint32_t));
+    STATS_ADD(allocations, 3);
+    uint64_t written = 0;
+    bool failed = !slab || !outSizes || !crcs;
+    if (failed) {
+        fprintf(stderr, "mgz_parallel_create_bounded: malloc failed.\n");
+    }
+    for (uint64_t first = 0; !failed && first < nBlocks; first += wave) {
+        uint64_t n = nBlocks - first < wave ? nBlocks - first : wave;
+#pragma omp parallel for num_threads(nThreads)
+        for (uint64_t i = 0; i < n; ++i) {
+            uint64_t start = (first + i) * blockSize;
+            uint64_t end = start + blockSize < size ? start + blockSize : size;
+            outSizes[i] = deflate_into(voidp_shift(slab, i * bound), bound,
+                                       voidp_shift(in, start), end - start,
+                                       level, NULL, 0, 0, NULL, &crcs[i]);
+            if (outSizes[i] == 0) failed = true;
+        }
+        if (failed) break;
+
+        /* Flush the wave, with its lookup entries, before the next one
+         * reuses the slab. */
+        STATS_TIMER_START(t0);
+        if (fflush(outfile) != 0 ||
+            !write_slab(outfile, slab, bound, outSizes, 0, n)) {
             fprintf(stderr,
-                    "mgz_parallel_create: (FATAL) failed to write to "
-                    "lookup.\n");
+                    "mgz_parallel_create_bounded: (FATAL) failed to write "
+                    "to outfile.\n");
             exit(1);
         }
+        for (uint64_t i = 0; i < n; ++i) {
+            if (lookup &&
+                ((first + i == 0 &&
+                  fwrite(&blockSize, sizeof(uint64_t), 1, lookup) != 1) ||
+                 fwrite(&written, sizeof(uint64_t), 1, lookup) != 1)) {
+                fprintf(stderr,
+                        "mgz_parallel_create_bounded: (FATAL) failed to "
+                        "write to lookup.\n");
+                exit(1);
+            }
+            written += outSizes[i];
+        }
+        STATS_TIMER_ADD(writeNs, t0);
     }
-    free(res.out);
-    free(res.lookup);
-    return res.size;
+    free(slab);
+    free(outSizes);
+    free(crcs);
+    return failed ? 0 : written;
 }
 
-uint64_t mgz_read(void *buf, uint64_t size, uint64_t offset, int fd,
-                  FILE *lookup) {
-    if (!buf || !size || !lookup) return 0;
+uint64_t mgz_parallel_create_bounded(const void *in, uint64_t size,
+                                     int level, uint64_t blockSize,
+                                     uint64_t budget, FILE *outfile,
+                                     FILE *lookup) {
+    STATS_TIMER_START(t0);
+    uint64_t ret = bounded_create(in, size, level, blockSize, budget,
+                                  outfile, lookup);
+    STATS_CALL_END("mgz_parallel_create_bounded", t0);
+    return ret;
+}
 
-    /* Read block size from lookup file. */
-    uint64_t blockSize;
-    if (fseek(lookup, 0, SEEK_SET) < 0) {
-        fprintf(stderr,
-                "mgz_read: failed to seek to the beginning of lookup "
-                "file.\n");
-        return 0;
+/* Returns the order-0 entropy of the SIZE bytes at P in bits per byte. */
+static double byte_entropy(const uint8_t *p, uint64_t size) {
+    uint64_t counts[256] = {0};
+    for (uint64_t i = 0; i < size; ++i) ++counts[p[i]];
+    double h = 0;
+    for (int i = 0; i < 256; ++i) {
+        if (counts[i]) h -= counts[i] * log2((double)counts[i] / size);
     }
-    if (fread(&blockSize, sizeof(uint64_t), 1, lookup) != 1) {
-        fprintf(stderr, "mgz_read: failed to read block size from lookup.\n");
+    return h / size;
+}
+
+/* Splits the INSIZE bytes at IN into blocks for adaptive compression.
+ * Every SAMPLE_SIZE-byte sample whose entropy suggests that deflate
+ * cannot shrink it is marked for storing (level 0); the rest get LEVEL.
+ * Runs of samples with the same level are merged into blocks of at most
+ * BLOCKSIZE bytes, so block boundaries fall where the data changes.
+ * Allocates and fills *RAWOFFS with the raw offset of each block plus
+ * INSIZE, and *LEVELS with the level of each block. Returns the number
+ * of blocks, or 0 if an error occurred. */
+static uint64_t plan_adaptive_blocks(const void *in, uint64_t inSize,
+                                     int level, uint64_t blockSize,
+                                     uint64_t **rawOffs, int **levels) {
+    uint64_t nSamples = (inSize + SAMPLE_SIZE - 1) / SAMPLE_SIZE;
+    int *sampleLevels = (int *)malloc(nSamples * sizeof(int));
+    *rawOffs = (uint64_t *)malloc((nSamples + 1) * sizeof(uint64_t));
+    *levels = (int *)malloc(nSamples * sizeof(int));
+    if (!sampleLevels || !*rawOffs || !*levels) {
+        fprintf(stderr, "mgz_parallel_create_adaptive: malloc failed.\n");
+        free(sampleLevels);
+        free(*rawOffs);
+        free(*levels);
         return 0;
     }
+#pragma omp parallel for
+    for (uint64_t i = 0; i < nSamples; ++i) {
+        uint64_t start = i * SAMPLE_SIZE;
+        uint64_t len = inSize - start < SAMPLE_SIZE ? inSize - start
+                                                    : SAMPLE_SIZE;
+        double h = byte_entropy((const uint8_t *)in + start, len);
+        sampleLevels[i] = h >= STORE_ENTROPY ? 0 : level;
+    }
 
-    /* Seek to the correct location. */
-    uint64_t block = offset / blockSize;
-    off_t into = offset % blockSize;
-    if (fseek(lookup, block * sizeof(uint64_t), SEEK_CUR) < 0) {
-        fprintf(stderr,
-                "mgz_read: failed to seek to the given block in lookup "
-                "file.\n");
-        return 0;
+    uint64_t nBlocks = 0;
+    for (uint64_t i = 0; i < nSamples; ++i) {
+        uint64_t start = i * SAMPLE_SIZE;
+        if (nBlocks == 0 || sampleLevels[i] != (*levels)[nBlocks - 1] ||
+            start - (*rawOffs)[nBlocks - 1] + SAMPLE_SIZE > blockSize) {
+            (*rawOffs)[nBlocks] = start;
+            (*levels)[nBlocks] = sampleLevels[i];
+            ++nBlocks;
+        }
     }
-    uint64_t gzOff;
-    if (fread(&gzOff, sizeof(uint64_t), 1, lookup) != 1) {
-        fprintf(stderr, "mgz_read: failed to read gz offset from lookup.\n");
-        return 0;
+    (*rawOffs)[nBlocks] = inSize;
+    free(sampleLevels);
+    return nBlocks;
+}
+
+bool write_variable_lookup(FILE *lookup, uint64_t nBlocks,
+                           const uint64_t *offsets, const uint64_t *rawOffs,
+                           uint64_t nPoints, const uint64_t *pointRaw,
+                           const uint64_t *pointOffs,
+                           const uint64_t *pointBits, const uint8_t *windows,
+                           const uint8_t *dict, uint64_t dictSize) {
+    bool checkpoints = nPoints && pointBits && windows;
+    uint64_t header[VARIABLE_LOOKUP_HEADER] = {
+        0,
+        checkpoints ? CHECKPOINT_LOOKUP_VERSION
+        : nPoints   ? SYNC_LOOKUP_VERSION
+        : dictSize  ? PRIMED_LOOKUP_VERSION
+                    : VARIABLE_LOOKUP_VERSION,
+        nBlocks};
+    if (fwrite(header, sizeof(uint64_t), VARIABLE_LOOKUP_HEADER, lookup) !=
+            VARIABLE_LOOKUP_HEADER ||
+        fwrite(offsets, sizeof(uint64_t), nBlocks, lookup) != nBlocks ||
+        fwrite(rawOffs, sizeof(uint64_t), nBlocks + 1, lookup) !=
+            nBlocks + 1) {
+        return false;
     }
+    if (nPoints == 0 && dictSize != 0) {
+        /* Pad the dictionary to whole words. */
+        static const uint8_t zeros[sizeof(uint64_t)] = {0};
+        uint64_t pad = (sizeof(uint64_t) - dictSize % sizeof(uint64_t)) %
+                       sizeof(uint64_t);
+        return fwrite(&dictSize, sizeof(uint64_t), 1, lookup) == 1 &&
+               fwrite(dict, 1, dictSize, lookup) == dictSize &&
+               fwrite(zeros, 1, pad, lookup) == pad;
+    }
+    if (nPoints == 0) return true;
+    bool ret =
+        fwrite(&nPoints, sizeof(uint64_t), 1, lookup) == 1 &&
+        fwrite(pointRaw, sizeof(uint64_t), nPoints, lookup) == nPoints &&
+        fwrite(pointOffs, sizeof(uint64_t), nPoints, lookup) == nPoints;
+    if (!ret || !checkpoints) return ret;
+    return fwrite(pointBits, sizeof(uint64_t), nPoints, lookup) == nPoints &&
+           fwrite(windows, WINDOW_SIZE, nPoints, lookup) == nPoints;
+}
 
-    if (lseek(fd, gzOff, SEEK_SET) != (off_t)gzOff) {
-        fprintf(stderr, "mgz_read: lseek failed.\n");
-        return 0;
+/* Shared by mgz_parallel_create_adaptive and mgz_parallel_create_seekable.
+ * Compresses the NBLOCKS blocks of IN laid out as LAYOUT describes,
+ * writes them to OUTFILE, and writes a lookup table in the variable
+ * format to LOOKUP if it is not NULL. FN names the caller in errors.
+ * Returns the size written to OUTFILE. */
+static uint64_t create_with_layout(const void *in, uint64_t size, int level,
+                                   uint64_t blockSize, uint64_t nBlocks,
+                                   const block_layout_t *layout,
+                                   FILE *outfile, FILE *lookup,
+                                   const char *fn) {
+    uint64_t *space = (uint64_t *)malloc((nBlocks + 1) * sizeof(uint64_t));
+    if (!space) return 0;
+
+    /* Write the blocks in order as they finish. The lookup table needs
+     * the sync points of every block, so it is written afterwards. */
+    if (fflush(outfile) != 0) {
+        fprintf(stderr, "%s: (FATAL) failed to write to outfile.\n", fn);
+        exit(1);
     }
-    int gzfd = dup(fd);
-    if (gzfd == -1) {
-        fprintf(stderr, "mgz_read: failed to dup() fd.\n");
+    file_sink_t sink = {outfile, NULL, 0, false};
+    uint64_t bound;
+    void *slab = deflate_blocks_into_slab(in, size, level, blockSize,
+                                          nBlocks, layout, &bound, space,
+                                          NULL, NULL, file_sink, &sink);
+    if (sink.failed) {
+        fprintf(stderr, "%s: (FATAL) failed to write to outfile.\n", fn);
+        exit(1);
+    }
+    if (!slab) {
+        free(space);
         return 0;
     }
-    gzFile archive = gzdopen(gzfd, "rb");
-    if (!archive) {
-        fprintf(stderr, "mgz_read: failed to gzdopen() the new fd.\n");
+    free(slab);
+    STATS_TIMER_START(t0);
+    uint64_t outSize = convert_out_block_sizes_to_lookup(space, nBlocks);
+
+    /* Turn the flush points of each block into absolute sync points. */
+    uint64_t *rawOffs = (uint64_t *)layout->rawOffs, nPoints = 0;
+    uint64_t *pointRaw = NULL, *pointOffs = NULL;
+    if (lookup && !rawOffs) {
+        rawOffs = (uint64_t *)malloc((nBlocks + 1) * sizeof(uint64_t));
+        for (uint64_t i = 0; rawOffs && i < nBlocks; ++i) {
+            rawOffs[i] = i * blockSize;
+        }
+        if (rawOffs) rawOffs[nBlocks] = size;
+    }
+    if (lookup && rawOffs && layout->syncSize) {
+        pointRaw = (uint64_t *)malloc(nBlocks * layout->syncPerBlock *
+                                      sizeof(uint64_t));
+        pointOffs = (uint64_t *)malloc(nBlocks * layout->syncPerBlock *
+                                       sizeof(uint64_t));
+        for (uint64_t i = 0; pointRaw && pointOffs && i < nBlocks; ++i) {
+            uint64_t n = (rawOffs[i + 1] - rawOffs[i] - 1) / layout->syncSize;
+            for (uint64_t k = 0; k < n; ++k, ++nPoints) {
+                pointRaw[nPoints] = rawOffs[i] + (k + 1) * layout->syncSize;
+                pointOffs[nPoints] =
+                    space[i] + layout->syncOffs[i * layout->syncPerBlock + k];
+            }
+        }
+    }
+    if (lookup && (!rawOffs || (layout->syncSize && (!pointRaw || !pointOffs)) ||
+                   !write_variable_lookup(lookup, nBlocks, space, rawOffs,
+                                          nPoints, pointRaw, pointOffs, NULL,
+                                          NULL, layout->dict,
+                                          layout->dictSize))) {
+        fprintf(stderr, "%s: (FATAL) failed to write to lookup.\n", fn);
+        exit(1);
+    }
+    STATS_TIMER_ADD(writeNs, t0);
+    if (rawOffs != layout->rawOffs) free(rawOffs);
+    free(pointRaw);
+    free(pointOffs);
+    free(space);
+    return outSize;
+}
+
+static uint64_t adaptive_create(const void *in, uint64_t size, int level,
+                                uint64_t blockSize, FILE *outfile,
+                                FILE *lookup) {
+    blockSize = get_correct_block_size(blockSize) / SAMPLE_SIZE * SAMPLE_SIZE;
+    if (size == 0) return 0;
+    uint64_t *rawOffs;
+    int *levels;
+    uint64_t nBlocks =
+        plan_adaptive_blocks(in, size, level, blockSize, &rawOffs, &levels);
+    if (nBlocks == 0) return 0;
+    block_layout_t layout = {.rawOffs = rawOffs, .levels = levels};
+    uint64_t outSize =
+        create_with_layout(in, size, level, blockSize, nBlocks, &layout,
+                           outfile, lookup, "mgz_parallel_create_adaptive");
+    free(rawOffs);
+    free(levels);
+    return outSize;
+}
+
+uint64_t mgz_parallel_create_adaptive(const void *in, uint64_t size,
+                                      int level, uint64_t blockSize,
+                                      FILE *outfile, FILE *lookup) {
+    STATS_TIMER_START(t0);
+    uint64_t ret =
+        adaptive_create(in, size, level, blockSize, outfile, lookup);
+    STATS_CALL_END("mgz_parallel_create_adaptive", t0);
+    return ret;
+}
+
+static uint64_t seekable_create(const void *in, uint64_t size, int level,
+                                uint64_t blockSize, uint64_t syncSize,
+                                FILE *outfile, FILE *lookup) {
+    blockSize = get_correct_block_size(blockSize);
+    if (syncSize == 0) syncSize = DEFAULT_SYNC_SIZE;
+    if (syncSize < MIN_SYNC_SIZE) syncSize = MIN_SYNC_SIZE;
+    uint64_t nBlocks = (size + blockSize - 1) / blockSize;
+    if (nBlocks == 0) return 0;
+    block_layout_t layout = {.syncSize = syncSize,
+                             .syncPerBlock = (blockSize - 1) / syncSize};
+    if (layout.syncPerBlock == 0) layout.syncSize = 0;  // Nothing to mark.
+    layout.syncOffs = (uint64_t *)malloc(
+        (nBlocks * layout.syncPerBlock + 1) * sizeof(uint64_t));
+    if (!layout.syncOffs) {
+        fprintf(stderr, "mgz_parallel_create_seekable: malloc failed.\n");
         return 0;
     }
-    if (gzseek(archive, into, SEEK_CUR) != into) {
-        fprintf(stderr,
-                "mgz_read: gzseek not returning an offset equal to "
-                "into.\n");
+    uint64_t outSize =
+        create_with_layout(in, size, level, blockSize, nBlocks, &layout,
+                           outfile, lookup, "mgz_parallel_create_seekable");
+    free(layout.syncOffs);
+    return outSize;
+}
+
+uint64_t mgz_parallel_create_seekable(const void *in, uint64_t size,
+                                      int level, uint64_t blockSize,
+                                      uint64_t syncSize, FILE *outfile,
+                                      FILE *lookup) {
+    STATS_TIMER_START(t0);
+    uint64_t ret = seekable_create(in, size, level, blockSize, syncSize,
+                                   outfile, lookup);
+    STATS_CALL_END("mgz_parallel_create_seekable", t0);
+    return ret;
+}
+
+/* Fills DICT with a dictionary of at most MAX_DICT_SIZE bytes trained on
+ * the SIZE bytes at IN: DICT_SAMPLES equal slices taken at even intervals
+ * across the input, so that every block finds strings typical of the
+ * whole data within reach. Returns the size of the dictionary. */
+static uint64_t train_dictionary(const void *in, uint64_t size,
+                                 uint8_t *dict) {
+    uint64_t sliceSize = MAX_DICT_SIZE / DICT_SAMPLES;
+    if (sliceSize > size / DICT_SAMPLES) sliceSize = size / DICT_SAMPLES;
+    if (sliceSize == 0) {
+        uint64_t n = size < MAX_DICT_SIZE ? size : MAX_DICT_SIZE;
+        memcpy(dict, in, n);
+        return n;
     }
+    for (uint64_t i = 0; i < DICT_SAMPLES; ++i) {
+        memcpy(dict + i * sliceSize, voidp_shift(in, i * (size / DICT_SAMPLES)),
+               sliceSize);
+    }
+    return sliceSize * DICT_SAMPLES;
+}
 
-    /* Read the data. */
-    if (gz64_read(archive, buf, size) <= 0) {
-        fprintf(stderr, "mgz_read: failed to gz64_read().\n");
-        gzclose(archive);
+static uint64_t primed_create(const void *in, uint64_t size, int level,
+                              uint64_t blockSize, const void *dict,
+                              uint64_t dictSize, FILE *outfile,
+                              FILE *lookup) {
+    blockSize = get_correct_block_size(blockSize);
+    uint64_t nBlocks = (size + blockSize - 1) / blockSize;
+    if (nBlocks == 0) return 0;
+    if (!lookup) {
+        fprintf(stderr,
+                "mgz_parallel_create_primed: a lookup file is required.\n");
         return 0;
     }
+    uint8_t trained[MAX_DICT_SIZE];
+    if (dict && dictSize > MAX_DICT_SIZE) {
+        /* Only the last window of history is ever referred to. */
+        dict = voidp_shift(dict, dictSize - MAX_DICT_SIZE);
+        dictSize = MAX_DICT_SIZE;
+    } else if (!dict || dictSize == 0) {
+        dictSize = train_dictionary(in, size, trained);
+        dict = trained;
+    }
+    block_layout_t layout = {.dict = (const uint8_t *)dict,
+                             .dictSize = dictSize};
+    return create_with_layout(in, size, level, blockSize, nBlocks, &layout,
+                              outfile, lookup, "mgz_parallel_create_primed");
+}
+
+uint64_t mgz_parallel_create_primed(const void *in, uint64_t size,
+                                    int level, uint64_t blockSize,
+                                    const void *dict, uint64_t dictSize,
+                                    FILE *outfile, FILE *lookup) {
+    STATS_TIMER_START(t0);
+    uint64_t ret = primed_create(in, size, level, blockSize, dict, dictSize,
+                                 outfile, lookup);
+    STATS_CALL_END("mgz_parallel_create_primed", t0);
+    return ret;
+}
+
+struct mgz_stream {
+    int level;
+    int nThreads;
+    uint64_t blockSize;
+    FILE *outfile;
+    FILE *lookup;
+
+    /* Staging area for up to NTHREADS blocks of raw input. */
+    uint8_t *in;
+    uint64_t inSize;
+
+    /* Compressed output of the batch currently in flight, one
+     * BOUND-sized slot per block, handed to the ordered writer as its
+     * blocks finish. */
+    void *slab;
+    uint64_t bound;
+    uint64_t *outSizes;
+    uint32_t *crcs;      // CRC-32 of each block of the batch.
+    uint8_t *done;       // Set once block i of the batch is compressed.
+    uint64_t batchSize;  // Raw bytes of the batch.
+
+    uint64_t written;  // Bytes written to OUTFILE so far.
+    uint64_t nBlocks;  // Blocks written to OUTFILE so far.
+    bool failed;
+
+    /* Offsets of the blocks written so far, kept only for an embedded
+     * index. */
+    bool indexed;
+    uint64_t *offsets;
+    uint64_t offsetsCapacity;
+    uint64_t rawSize;
+    uint32_t crc;  // CRC-32 of the raw data written so far.
+};
+
+mgz_stream_t *mgz_stream_init(int level, uint64_t blockSize, int nThreads,
+                              FILE *outfile, FILE *lookup) {
+    if (!outfile) return NULL;
+    if (nThreads <= 0) nThreads = omp_get_max_threads();
+    mgz_stream_t *s = (mgz_stream_t *)calloc(1, sizeof(mgz_stream_t));
+    if (!s) {
+        fprintf(stderr, "mgz_stream_init: malloc failed.\n");
+        return NULL;
+    }
+    s->level = level;
+    s->nThreads = nThreads;
+    s->blockSize = get_correct_block_size(blockSize);
+    s->outfile = outfile;
+    s->lookup = lookup;
+    s->bound = gzip_deflate_bound(level, s->blockSize);
+    s->in = (uint8_t *)malloc(s->blockSize * nThreads);
+    s->slab = malloc(s->bound * nThreads);
+    s->outSizes = (uint64_t *)calloc(nThreads, sizeof(uint64_t));
+    s->crcs = (uint32_t *)calloc(nThreads, sizeof(uint32_t));
+    s->done = (uint8_t *)calloc(nThreads, 1);
+    if (!s->bound || !s->in || !s->slab || !s->outSizes || !s->crcs ||
+        !s->done) {
+        fprintf(stderr, "mgz_stream_init: malloc failed.\n");
+        free(s->in);
+        free(s->slab);
+        free(s->outSizes);
+        free(s->crcs);
+        free(s->done);
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+/* Writes compressed block i of the current batch, which holds RAWSIZE
+ * bytes of input, and its lookup entry. The block size is written to the
+ * lookup file together with the first block so that empty input leaves
+ * both files untouched, exactly like mgz_parallel_create. */
+static void stream_write_block(mgz_stream_t *s, uint64_t i,
+                               uint64_t rawSize) {
+    STATS_TIMER_START(t0);
+    if (s->indexed) s->offsets[s->nBlocks] = s->written;
+    if (s->lookup) {
+        if ((s->nBlocks == 0 &&
+             fwrite(&s->blockSize, sizeof(uint64_t), 1, s->lookup) != 1) ||
+            fwrite(&s->written, sizeof(uint64_t), 1, s->lookup) != 1) {
+            fprintf(stderr,
+                    "mgz_stream: (FATAL) failed to write to lookup.\n");
+            exit(1);
+        }
+    }
+    if (fwrite(voidp_shift(s->slab, i * s->bound), 1, s->outSizes[i],
+               s->outfile) != s->outSizes[i]) {
+        fprintf(stderr, "mgz_stream: (FATAL) failed to write to outfile.\n");
+        exit(1);
+    }
+    s->written += s->outSizes[i];
+    s->crc = s->nBlocks == 0 ? s->crcs[i]
+                             : (uint32_t)crc32_combine(s->crc, s->crcs[i],
+                                                       (z_off_t)rawSize);
+    ++s->nBlocks;
+    STATS_TIMER_ADD(writeNs, t0);
+}
+
+/* A block_sink_t that writes blocks FIRST to END - 1 of the batch of
+ * CTX, an mgz_stream_t, as they finish. */
+static bool stream_sink(void *ctx, void *slab, uint64_t bound,
+                        const uint64_t *outBlockSizes, uint64_t first,
+                        uint64_t end) {
+    (void)slab;
+    (void)bound;
+    (void)outBlockSizes;
+    mgz_stream_t *s = (mgz_stream_t *)ctx;
+    for (uint64_t i = first; i < end; ++i) {
+        uint64_t left = s->batchSize - i * s->blockSize;
+        stream_write_block(s, i, left < s->blockSize ? left : s->blockSize);
+    }
+    return true;
+}
+
+/* Compresses INSIZE bytes at IN as one batch of at most NTHREADS blocks.
+ * Each block is written, in order, as soon as it and the blocks before it
+ * are compressed, while the rest of the batch is still compressing. */
+static bool stream_flush_batch(mgz_stream_t *s, const void *in,
+                               uint64_t inSize) {
+    int nBlocks = (int)((inSize + s->blockSize - 1) / s->blockSize);
+    if (nBlocks == 0) return true;
+    if (s->indexed && s->nBlocks + nBlocks > s->offsetsCapacity) {
+        uint64_t newCapacity = (s->nBlocks + nBlocks) * 2;
+        uint64_t *newOffsets = (uint64_t *)realloc(
+            s->offsets, newCapacity * sizeof(uint64_t));
+        if (!newOffsets) {
+            s->failed = true;
+            return false;
+        }
+        s->offsets = newOffsets;
+        s->offsetsCapacity = newCapacity;
+    }
+    s->batchSize = inSize;
+    memset(s->done, 0, nBlocks);
+    block_writer_t writer = {stream_sink, s, s->done, 0, false, false};
+    bool oom = false;
+#pragma omp parallel for num_threads(s->nThreads)
+    for (int i = 0; i < nBlocks; ++i) {
+        uint64_t thisBlockSize = (i == nBlocks - 1)
+                                     ? inSize - (uint64_t)i * s->blockSize
+                                     : s->blockSize;
+        s->outSizes[i] = deflate_into(
+            voidp_shift(s->slab, i * s->bound), s->bound,
+            voidp_shift(in, (uint64_t)i * s->blockSize), thisBlockSize,
+            s->level, NULL, 0, 0, NULL, &s->crcs[i]);
+        if (s->outSizes[i] == 0) {
+            oom = true;
+            continue;
+        }
+        __atomic_store_n(&s->done[i], 1, __ATOMIC_SEQ_CST);
+        writer_drain(&writer, s->slab, s->bound, s->outSizes,
+                     (uint64_t)nBlocks);
+    }
+    if (!oom) s->rawSize += inSize;
+    if (oom) s->failed = true;
+    return !oom;
+}
+
+bool mgz_stream_feed(mgz_stream_t *s, const void *in, uint64_t size) {
+    if (!s || s->failed) return false;
+    uint64_t batchSize = s->blockSize * s->nThreads;
+
+    /* Top up a partially filled staging area first. */
+    if (s->inSize > 0) {
+        uint64_t take = batchSize - s->inSize;
+        if (take > size) take = size;
+        memcpy(s->in + s->inSize, in, take);
+        s->inSize += take;
+        in = voidp_shift(in, take);
+        size -= take;
+        if (s->inSize < batchSize) return true;
+        s->inSize = 0;
+        if (!stream_flush_batch(s, s->in, batchSize)) return false;
+    }
+
+    /* Compress whole batches straight from the caller's buffer. */
+    while (size >= batchSize) {
+        if (!stream_flush_batch(s, in, batchSize)) return false;
+        in = voidp_shift(in, batchSize);
+        size -= batchSize;
+    }
+
+    memcpy(s->in, in, size);
+    s->inSize = size;
+    return true;
+}
+
+uint64_t mgz_stream_finish(mgz_stream_t *s) {
+    if (!s) return 0;
+    STATS_TIMER_START(t0);
+    uint64_t ret = 0;
+    if (!s->failed && stream_flush_batch(s, s->in, s->inSize)) {
+        ret = s->written;
+    }
+    if (ret && s->indexed) {
+        mgz_index_t idx = {s->blockSize, s->nBlocks, s->written, s->rawSize,
+                           s->offsets, s->crc, true};
+        STATS_TIMER_START(t1);
+        uint64_t indexSize = index_write(s->outfile, &idx);
+        STATS_TIMER_ADD(writeNs, t1);
+        if (indexSize == 0) {
+            fprintf(stderr,
+                    "mgz_stream: (FATAL) failed to write to outfile.\n");
+            exit(1);
+        }
+        ret += indexSize;
+    }
+    free(s->offsets);
+    free(s->in);
+    free(s->slab);
+    free(s->outSizes);
+    free(s->crcs);
+    free(s->done);
+    free(s);
+    STATS_CALL_END("mgz_stream_finish", t0);
+    return ret;
+}
+
+mgz_stream_t *mgz_stream_init_indexed(int level, uint64_t blockSize,
+                                      int nThreads, FILE *outfile) {
+    mgz_stream_t *s = mgz_stream_init(level, blockSize, nThreads, outfile,
+                                      NULL);
+    if (s) s->indexed = true;
+    return s;
+}
+
+uint64_t mgz_stream_create_cb(mgz_read_cb_t cb, void *ctx, int level,
+                              uint64_t blockSize, int nThreads,
+                              FILE *outfile, FILE *lookup) {
+    mgz_stream_t *s =
+        mgz_stream_init(level, blockSize, nThreads, outfile, lookup);
+    if (!s) return 0;
+    uint64_t batchSize = s->blockSize * s->nThreads;
+
+    /* Fill the staging area in place and flush it whenever it is full. */
+    for (;;) {
+        int64_t bytesRead =
+            cb(ctx, s->in + s->inSize, batchSize - s->inSize);
+        if (bytesRead < 0) {
+            fprintf(stderr, "mgz_stream_create_cb: input callback failed.\n");
+            s->failed = true;
+            break;
+        }
+        if (bytesRead == 0) break;
+        s->inSize += bytesRead;
+        if (s->inSize == batchSize) {
+            s->inSize = 0;
+            if (!stream_flush_batch(s, s->in, batchSize)) break;
+        }
+    }
+    return mgz_stream_finish(s);
+}
+
+static int64_t fd_read_cb(void *ctx, void *buf, uint64_t size) {
+    int fd = *(int *)ctx;
+    ssize_t bytesRead;
+    do {
+        bytesRead = read(fd, buf, size);
+    } while (bytesRead < 0 && errno == EINTR);
+    return (int64_t)bytesRead;
+}
 
-    gzclose(archive);
-    return size;
+uint64_t mgz_stream_create_fd(int infd, int level, uint64_t blockSize,
+                              int nThreads, FILE *outfile, FILE *lookup) {
+    return mgz_stream_create_cb(fd_read_cb, &infd, level, blockSize,
+                                nThreads, outfile, lookup);
 }
@@ -10,8 +10,86 @@ typedef struct {
     uint64_t size;
     uint64_t *lookup;
     uint64_t nBlocks;
+    uint32_t crc;  // CRC-32 of the whole input, as in the gzip trailers.
 } mgz_res_t;
 
+/* Opaque handle of a streaming compressor. See mgz_stream_init. */
+typedef struct mgz_stream mgz_stream_t;
+
+/* Opaque handle of an opened mgz archive. See mgz_reader_open. */
+typedef struct mgz_reader mgz_reader_t;
+
+/* Opaque handle of a decompressed-block cache. See mgz_cache_create. */
+typedef struct mgz_cache mgz_cache_t;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t bytes;     // Raw bytes cached or being inserted.
+    uint64_t capacity;  // Memory cap in bytes, never exceeded by BYTES
+                        // once inserts are done.
+} mgz_cache_stats_t;
+
+/* Layout of an opened archive. See mgz_reader_get_info. */
+typedef struct {
+    uint64_t blockSize;   // Raw size of the largest block.
+    uint64_t nBlocks;
+    uint64_t dataSize;    // Size of the compressed data members.
+    uint64_t rawSize;     // Total size of the raw data.
+    bool variable;        // Blocks vary in raw size.
+    uint64_t nPoints;     // Sync points inside blocks.
+    bool checkpoints;     // The sync points are checkpoints with windows.
+    uint64_t dictSize;    // Size of the shared dictionary, or 0.
+    bool indexed;         // The layout comes from an embedded index.
+    bool hasCrc;          // CRC is known without inflating anything.
+    uint32_t crc;         // CRC-32 of the raw data, if HASCRC is set.
+} mgz_info_t;
+
+/* One read of a batch. See mgz_reader_read_batch. */
+typedef struct {
+    void *buf;        // Output buffer of at least SIZE bytes.
+    uint64_t size;    // Bytes to read.
+    uint64_t offset;  // Raw offset to read from.
+    uint64_t result;  // Set on completion, as returned by mgz_reader_read.
+    void *user;       // Left untouched for the caller.
+} mgz_read_req_t;
+
+/* Completion callback of mgz_reader_read_batch, called once per request
+ * with the CTX passed to the batch. */
+typedef void (*mgz_batch_cb_t)(void *ctx, mgz_read_req_t *req);
+
+/* Process-wide counters and timers of the library's hot paths, filled
+ * only in builds with MGZ_STATS defined (make STATS=1). Timers are summed
+ * over all threads, so with N threads busy they advance up to N times as
+ * fast as the wall clock. */
+typedef struct {
+    uint64_t bytesIn;          // Raw bytes compressed.
+    uint64_t bytesOut;         // Compressed bytes produced.
+    uint64_t blocksDeflated;   // Gzip members compressed.
+    uint64_t blocksInflated;   // Gzip members (or parts) decompressed.
+    uint64_t bytesInflated;    // Raw bytes decompressed, discarded or not.
+    uint64_t bytesDiscarded;   // Raw bytes decompressed only to be skipped.
+    uint64_t bytesRead;        // Compressed bytes fetched with pread().
+    uint64_t allocations;      // Buffers malloc'ed on compress/read paths.
+    uint64_t deflateNs;        // Time in deflate().
+    uint64_t inflateNs;        // Time in inflate().
+    uint64_t readNs;           // Time in pread() of compressed data.
+    uint64_t writeNs;          // Time writing compressed data and lookups.
+    uint64_t lookupNs;         // Time loading lookup tables and indexes.
+} mgz_stats_t;
+
+/* Hook called at the end of every top-level library call, such as
+ * mgz_parallel_create or mgz_read, with the name of the call, its wall
+ * time in nanoseconds, and a snapshot of the totals after it. */
+typedef void (*mgz_stats_cb_t)(void *ctx, const char *call, uint64_t ns,
+                               const mgz_stats_t *totals);
+
+/* Input callback used by mgz_stream_create_cb. Reads at most SIZE
+ * bytes into BUF and returns the number of bytes read, 0 at end of
+ * input, or a negative value on error. */
+typedef int64_t (*mgz_read_cb_t)(void *ctx, void *buf, uint64_t size);
+
 /**
  * @brief Compresses INSIZE bytes of data from IN using compression
  * level LEVEL and stores the compressed data in a malloc'ed array at
@@ -75,8 +153,10 @@ uint64_t mgz_deflate(void **out, const void *in, uint64_t inSize,
  * size of 1 MiB is used.
  * @param lookup lookup table is returned if set to true.
  * @return A mgz_res_t containing the output buffer, the size of the
- * output buffer in bytes, the lookup table if requested, and the
- * number of blocks that raw data was split into. If an error occurred
+ * output buffer in bytes, the lookup table if requested, the number of
+ * blocks that raw data was split into, and the CRC-32 of the whole
+ * input, combined from the CRC-32s of the blocks so that checking the
+ * output takes no extra pass over the input. If an error occurred
  * during the compression, the returned structure contains all zeros.
  * Specifically, mgz_res_t.out is guaranteed to be non-NULL if
  * compression is successful, and is guaranteed to be NULL if
@@ -102,7 +182,9 @@ mgz_res_t mgz_parallel_deflate(const void *in, uint64_t inSize,
  * OUTFILE points to a valid writable stream.
  * Also writes the lookup table to LOOKUP if LOOKUP is not set to
  * NULL, in which case it is assumed to point to a valid writable
- * stream.
+ * stream. The block size is written to LOOKUP first, and each block is
+ * written to OUTFILE, with its offset to LOOKUP, as soon as it and the
+ * blocks before it are compressed.
  *
  * @param in input buffer.
  * @param size size of the input buffer in bytes.
@@ -115,16 +197,253 @@ mgz_res_t mgz_parallel_deflate(const void *in, uint64_t inSize,
  * size is used instead. If BLOCKSIZE is set to 0, a default block
  * size of 1 MiB is used.
  * @param outfile output file stream to which the compressed data
- * is written.
+ * is written. Blocks go straight to its file descriptor, or through
+ * fwrite() if it has none, as with fmemopen() or open_memstream().
  * @param lookup lookup file stream to which the lookup table is
  * written, or NULL if no lookup table is needed.
  * @return Size written to OUTFILE in bytes. 0 if SIZE is 0 or an
- * error occurred during compression.
+ * error occurred during compression, in which case LOOKUP may already
+ * hold the block size and some offsets, and OUTFILE some blocks.
  */
 uint64_t mgz_parallel_create(const void *in, uint64_t size, int level,
                              uint64_t blockSize, FILE *outfile,
                              FILE *lookup);
 
+/**
+ * @brief Same as mgz_parallel_create, but keeps the memory it allocates
+ * under BUDGET bytes however large SIZE is. Blocks are compressed in
+ * waves that fit the budget, each written to OUTFILE and LOOKUP before
+ * the next one reuses the same buffers, with as many threads as the
+ * budget allows. The output is byte-identical to mgz_parallel_create's
+ * for any budget.
+ *
+ * The budget covers one worst-case compressed slot per block of a wave
+ * and a deflate state of 512 KiB per thread. IN itself is not counted,
+ * so it may be a read-only mapping of a file larger than memory.
+ *
+ * @param budget memory cap in bytes. At least one block slot and one
+ * deflate state must fit.
+ * @return Size written to OUTFILE in bytes. 0 if SIZE is 0, BUDGET is
+ * too small, or an error occurred during compression.
+ */
+uint64_t mgz_parallel_create_bounded(const void *in, uint64_t size,
+                                     int level, uint64_t blockSize,
+                                     uint64_t budget, FILE *outfile,
+                                     FILE *lookup);
+
+/**
+ * @brief Same as mgz_parallel_create, but instead of writing a separate
+ * lookup file, appends an index to OUTFILE so that the archive describes
+ * itself. The index is carried in the extra fields of empty gzip members,
+ * so the result is still a valid gzip file that gzip and zcat decompress
+ * to the original data. Open it with a NULL lookup path.
+ *
+ * @return Size written to OUTFILE in bytes, index included. 0 if SIZE is
+ * 0 or an error occurred during compression, in which case OUTFILE may
+ * already hold some blocks.
+ */
+uint64_t mgz_parallel_create_indexed(const void *in, uint64_t size,
+                                     int level, uint64_t blockSize,
+                                     FILE *outfile);
+
+/**
+ * @brief Same as mgz_parallel_create, but adapts the blocks to the data.
+ * IN is sampled every 16 KiB, and each sample is either stored or
+ * compressed at level LEVEL, with nothing in between: samples whose byte
+ * entropy shows that deflate cannot shrink them (already-compressed or
+ * random data) are stored uncompressed, and all others are compressed
+ * at level LEVEL. Neighbouring samples with the same treatment are
+ * merged into blocks of at most BLOCKSIZE bytes, so block sizes vary and
+ * no time is spent compressing data that would not shrink.
+ *
+ * The lookup table written to LOOKUP records the raw offset of every
+ * block. It is understood by mgz_read and mgz_reader_open like any
+ * other lookup table.
+ *
+ * @param blockSize maximum size (in bytes) of each block of raw data,
+ * rounded down to a multiple of 16 KiB. Same rules as in
+ * mgz_parallel_create otherwise.
+ * @return Size written to OUTFILE in bytes. 0 if SIZE is 0 or an error
+ * occurred during compression, in which case OUTFILE may already hold
+ * some blocks.
+ */
+uint64_t mgz_parallel_create_adaptive(const void *in, uint64_t size,
+                                      int level, uint64_t blockSize,
+                                      FILE *outfile, FILE *lookup);
+
+/**
+ * @brief Same as mgz_parallel_create, but also marks a seek point every
+ * SYNCSIZE raw bytes inside each block with a deflate full flush, and
+ * records the points in the lookup table written to LOOKUP. Readers
+ * start inflating at the last point before the requested offset instead
+ * of at the start of its block, so a small random read inflates at most
+ * about SYNCSIZE bytes it does not return, while large blocks keep
+ * parallel compression cheap. Each point costs a few bytes of output and
+ * resets the compression history, so the ratio drops slightly as
+ * SYNCSIZE shrinks. The output is still a valid gzip file.
+ *
+ * @param syncSize distance (in bytes) between seek points. Minimum is
+ * 4 KiB; smaller values are raised to it. If SYNCSIZE is set to 0, a
+ * default of 64 KiB is used.
+ * @return Size written to OUTFILE in bytes. 0 if SIZE is 0 or an error
+ * occurred during compression, in which case OUTFILE may already hold
+ * some blocks.
+ */
+uint64_t mgz_parallel_create_seekable(const void *in, uint64_t size,
+                                      int level, uint64_t blockSize,
+                                      uint64_t syncSize, FILE *outfile,
+                                      FILE *lookup);
+
+/**
+ * @brief Same as mgz_parallel_create, but primes the deflate history of
+ * every block with one shared dictionary, so that even small blocks
+ * compress almost as well as a single stream while each one still
+ * inflates on its own. The dictionary is stored once in the lookup file
+ * written to LOOKUP, and readers set it before inflating any block, so
+ * random reads cost no more than with mgz_parallel_create. Blocks are
+ * still gzip members, but gzip and zcat cannot decompress them without
+ * the dictionary; use mgz_read, mgz_reader_open or
+ * mgz_parallel_inflate_file with the lookup file.
+ *
+ * @param dict dictionary to prime every block with, typically sample
+ * data of the same kind. Only its last 32 KiB are used. If DICT is NULL
+ * or DICTSIZE is 0, a 32 KiB dictionary is trained from slices taken
+ * across IN.
+ * @param dictSize size of DICT in bytes.
+ * @param lookup lookup file stream to which the lookup table and the
+ * dictionary are written. Required.
+ * @return Size written to OUTFILE in bytes. 0 if SIZE is 0, LOOKUP is
+ * NULL or an error occurred during compression, in which case OUTFILE
+ * may already hold some blocks.
+ */
+uint64_t mgz_parallel_create_primed(const void *in, uint64_t size,
+                                    int level, uint64_t blockSize,
+                                    const void *dict, uint64_t dictSize,
+                                    FILE *outfile, FILE *lookup);
+
+/**
+ * @brief Appends SIZE bytes of data from IN to the mgz gzip file with
+ * file descriptor FD and its lookup file at LOOKUPPATH, as written by
+ * mgz_parallel_create, keeping its block size. If the last block is not
+ * full, it is recompressed together with the head of the new data to
+ * fill it, and the rest of the data is compressed in parallel into
+ * blocks that follow it, so the blocks are the same as when compressing
+ * all the data at once with level LEVEL. All of them are written after
+ * the old data, so the old lookup file describes the archive until the
+ * new one replaces it atomically with a rename. The member of the old
+ * last block is then retired: it becomes an empty gzip member of the
+ * same size, which gzip and zcat skip. Before anything is written, a
+ * journal is saved at LOOKUPPATH.journal, and an append cut short by a
+ * crash is rolled back or finished by the next call.
+ *
+ * Readers opened before the call may fail to read the old last block
+ * once the call returns, and only one append may run on an archive at
+ * a time.
+ *
+ * @param fd file descriptor of the mgz gzip file, opened for reading and
+ * writing.
+ * @param lookupPath path of its lookup file, which must be in the fixed
+ * format written by mgz_parallel_create. Its directory must be writable.
+ * @return Size of the compressed data after the append in bytes, or 0
+ * if an error occurred. The lookup file then still describes the archive
+ * as it was, unless the new one was already in place, and any data
+ * written past the old end is dropped, if need be by the next call.
+ */
+uint64_t mgz_parallel_append(const void *in, uint64_t size, int level,
+                             int fd, const char *lookupPath);
+
+/**
+ * @brief Creates a streaming compressor that splits its input into
+ * blocks of size BLOCKSIZE, compresses up to NTHREADS blocks at a
+ * time in parallel using compression level LEVEL, and writes the
+ * compressed blocks in order to OUTFILE as soon as each block and the
+ * blocks before it are done, while the rest of its batch is still
+ * compressing. Also writes the lookup table to LOOKUP if LOOKUP is not set
+ * to NULL. The data and lookup streams are byte-identical to what
+ * mgz_parallel_create writes for the same input, but the input never
+ * needs to be in memory as a whole: memory use is bounded by roughly
+ * 2 * NTHREADS * BLOCKSIZE bytes.
+ *
+ * Feed data with mgz_stream_feed and call mgz_stream_finish exactly
+ * once to flush the last blocks and release the stream.
+ *
+ * @param level compression level which can be any integer from -1
+ * to 9.
+ * @param blockSize size (in bytes) of each block of raw data. Same
+ * rules as in mgz_parallel_create.
+ * @param nThreads maximum number of blocks compressed concurrently.
+ * If set to 0, omp_get_max_threads() is used.
+ * @param outfile output file stream to which the compressed data
+ * is written.
+ * @param lookup lookup file stream to which the lookup table is
+ * written, or NULL if no lookup table is needed.
+ * @return A new stream, or NULL if an error occurred.
+ *
+ * @example
+ * mgz_stream_t *s = mgz_stream_init(9, 0, 0, outfile, lookupFile);
+ * while ((n = fread(buf, 1, sizeof(buf), infile)) > 0)
+ *     mgz_stream_feed(s, buf, n);
+ * uint64_t outSize = mgz_stream_finish(s);
+ */
+mgz_stream_t *mgz_stream_init(int level, uint64_t blockSize, int nThreads,
+                              FILE *outfile, FILE *lookup);
+
+/**
+ * @brief Same as mgz_stream_init, but mgz_stream_finish appends an
+ * embedded index to OUTFILE as in mgz_parallel_create_indexed instead of
+ * writing a lookup file. The output is byte-identical to what
+ * mgz_parallel_create_indexed writes for the same input.
+ */
+mgz_stream_t *mgz_stream_init_indexed(int level, uint64_t blockSize,
+                                      int nThreads, FILE *outfile);
+
+/**
+ * @brief Appends SIZE bytes of data from IN to stream S. Full
+ * batches of blocks are compressed and written before this function
+ * returns; the remainder is buffered inside S.
+ *
+ * @param s stream returned by mgz_stream_init.
+ * @param in input buffer.
+ * @param size size of the input buffer in bytes.
+ * @return true on success, false if an error occurred, in which case
+ * S is left in a failed state and mgz_stream_finish returns 0. The
+ * blocks of the failed batch before the one that failed may already
+ * have been written.
+ */
+bool mgz_stream_feed(mgz_stream_t *s, const void *in, uint64_t size);
+
+/**
+ * @brief Compresses and writes all data still buffered in stream S
+ * and frees S. S must not be used after this call.
+ *
+ * @param s stream returned by mgz_stream_init.
+ * @return Total size written to the output file in bytes. 0 if no
+ * data was fed or an error occurred.
+ */
+uint64_t mgz_stream_finish(mgz_stream_t *s);
+
+/**
+ * @brief Compresses everything produced by the input callback CB
+ * until it signals end of input, streaming the result to OUTFILE and
+ * LOOKUP as described in mgz_stream_init. Input is read straight
+ * into the stream's block buffers without an extra copy.
+ *
+ * @param cb input callback.
+ * @param ctx opaque pointer passed to every call of CB.
+ * @return Total size written to OUTFILE in bytes. 0 if the input was
+ * empty or an error occurred.
+ */
+uint64_t mgz_stream_create_cb(mgz_read_cb_t cb, void *ctx, int level,
+                              uint64_t blockSize, int nThreads,
+                              FILE *outfile, FILE *lookup);
+
+/**
+ * @brief Same as mgz_stream_create_cb, reading input from file
+ * descriptor INFD (a regular file, pipe, or socket) until EOF.
+ */
+uint64_t mgz_stream_create_fd(int infd, int level, uint64_t blockSize,
+                              int nThreads, FILE *outfile, FILE *lookup);
+
 /**
  * @brief Reads SIZE bytes of data into BUF from a gzip file created
  * with mgz, which has file descriptor FD, starting at offset OFFSET
@@ -133,15 +452,330 @@ uint64_t mgz_parallel_create(const void *in, uint64_t size, int level,
  * a valid mgz gzip file, and LOOKUP points to a readable stream that
  * contains the lookup table for the given gzip file.
  *
+ * This is a compatibility wrapper that loads only the lookup entries
+ * covering the requested range on every call. Use mgz_reader_t for
+ * repeated reads from the same archive.
+ *
+ * Both files are read with pread() only, so neither the offset of FD
+ * nor the position of LOOKUP is used or moved, and any number of
+ * threads may call mgz_read on the same FD and LOOKUP at once. This only
+ * holds if LOOKUP has a file descriptor: a stream without one, such as
+ * one from fmemopen(), is read with fseeko() and fread(), which move its
+ * position, so calls sharing it must not overlap.
+ *
  * @param buf output buffer.
  * @param size size of data to read from FD in bytes.
  * @param offset offset into FD in bytes.
  * @param fd file descriptor of a mgz gzip file.
- * @param lookup readable stream containing the lookup table for FD.
- * @return Number of bytes read from FD. Returns 0 if size is 0 or
- * an error occurred.
+ * @param lookup readable stream containing the lookup table for FD, or
+ * NULL if FD is a self-describing archive with an embedded index.
+ * @return Number of bytes read from FD, which is less than SIZE if the
+ * data ends first. Returns 0 if size is 0 or an error occurred.
  */
 uint64_t mgz_read(void *buf, uint64_t size, uint64_t offset, int fd,
                   FILE *lookup);
 
+/**
+ * @brief Decompresses the INSIZE bytes of mgz gzip data at IN, as
+ * produced by mgz_parallel_deflate, inflating all blocks concurrently
+ * into a single malloc'ed output buffer stored at *OUT. Sets *OUT to
+ * NULL and returns 0 if INSIZE is 0 or an error occurs. It is the
+ * user's responsibility to free() the output buffer at *OUT.
+ *
+ * If LOOKUP is not NULL, it must hold at least the first NBLOCKS
+ * offsets of the lookup table of IN, which was created with block size
+ * BLOCKSIZE. The output is then sized from NBLOCKS and BLOCKSIZE and
+ * every block is inflated straight into its place in one pass.
+ *
+ * If LOOKUP is NULL, NBLOCKS and BLOCKSIZE are ignored and the member
+ * boundaries are found by scanning IN for gzip headers and probing
+ * each candidate in parallel. This works for any concatenation of gzip
+ * members, but costs an extra (parallel) inflate pass.
+ *
+ * @param out pointer to a valid (void *) which will be set to a
+ * malloc'ed array storing the decompressed result.
+ * @param in input buffer.
+ * @param inSize size of the input buffer in bytes.
+ * @param lookup lookup table of IN, or NULL.
+ * @param nBlocks number of blocks in IN.
+ * @param blockSize size (in bytes) of each block of raw data.
+ * @return The size of the output in bytes or 0 if INSIZE is 0 or an
+ * error occurs.
+ *
+ * @example
+ * mgz_res_t res =
+ *     mgz_parallel_deflate(in, inSize, level, blockSize, true);
+ * void *raw;
+ * uint64_t rawSize = mgz_parallel_inflate(&raw, res.out, res.size,
+ *                                         res.lookup, res.nBlocks,
+ *                                         blockSize);
+ */
+uint64_t mgz_parallel_inflate(void **out, const void *in, uint64_t inSize,
+                              const uint64_t *lookup, uint64_t nBlocks,
+                              uint64_t blockSize);
+
+/**
+ * @brief Decompresses the mgz gzip file with file descriptor INFD into
+ * OUTFILE, inflating a window of a few blocks per thread at a time in
+ * parallel, so memory use stays bounded regardless of the file size.
+ * Uses the lookup file at LOOKUPPATH if it is not NULL, and otherwise
+ * the index embedded in INFD if there is one; failing both, the file is
+ * mapped and its gzip members are found by scanning, as in
+ * mgz_parallel_inflate.
+ *
+ * @param infd file descriptor of a mgz gzip file.
+ * @param lookupPath path of the lookup file written for INFD, or NULL to
+ * use the index embedded in INFD or, failing that, to scan.
+ * @param outfile output file stream to which the raw data is written.
+ * @return Size written to OUTFILE in bytes. 0 if the file is empty or
+ * an error occurred, in which case OUTFILE may hold part of the data.
+ */
+uint64_t mgz_parallel_inflate_file(int infd, const char *lookupPath,
+                                   FILE *outfile);
+
+/**
+ * @brief Writes a lookup file for the gzip file with file descriptor FD
+ * to LOOKUP, for an archive whose lookup file was lost or that was
+ * never written with one. The table is copied from the embedded index
+ * if FD has one. Otherwise the file is mapped and its gzip members are
+ * found by scanning, as in mgz_parallel_inflate. The table is then in
+ * the fixed format if every member but the last holds the same number
+ * of raw bytes, and in the variable format otherwise. Empty members,
+ * such as those mgz_parallel_append leaves, are left out.
+ *
+ * Members of archives primed with a dictionary cannot be found by
+ * scanning, and sync points inside blocks are not recovered.
+ *
+ * @param fd file descriptor of a gzip file, opened for reading.
+ * @param lookup writable stream for the new lookup table.
+ * @return Number of blocks in the table, or 0 if FD is not a sequence
+ * of gzip members or an error occurred. FD holding no data, such as an
+ * empty file or only empty members, is an error too, as a lookup table
+ * cannot describe no blocks. Nothing is written to LOOKUP then.
+ */
+uint64_t mgz_rebuild_lookup(int fd, FILE *lookup);
+
+/**
+ * @brief Indexes any gzip file with file descriptor FD for random
+ * access, writing the lookup table to LOOKUP, which the readers and
+ * mgz_read then use like that of an mgz archive. Nothing is
+ * recompressed.
+ *
+ * The gzip members become blocks, as in mgz_rebuild_lookup, so files of
+ * many members such as those of bgzip, pigz --independent or mgz itself
+ * need nothing more. Inside members of more than SPAN raw bytes, such as
+ * the single member of an ordinary gzip file, a checkpoint is recorded at
+ * the first deflate block boundary past every SPAN raw bytes, in the
+ * manner of zlib's zran.c: its position to the bit and the 32 KiB of
+ * data before it, from which inflating can resume. A read then inflates
+ * at most about SPAN bytes before the data it wants, at the cost of
+ * 32 KiB of lookup file per checkpoint. A file of a single member is
+ * inflated once; larger members of a file of several are inflated twice.
+ *
+ * @param fd file descriptor of a gzip file, opened for reading.
+ * @param span raw bytes between checkpoints, or 0 for none, which is the
+ * same as mgz_rebuild_lookup.
+ * @param lookup writable stream for the new lookup table.
+ * @return Number of blocks in the table, or 0 if FD holds no data, as
+ * in mgz_rebuild_lookup, is not a sequence of gzip members, or an error
+ * occurred.
+ */
+uint64_t mgz_index_gzip(int fd, uint64_t span, FILE *lookup);
+
+/**
+ * @brief Checks the integrity of the mgz gzip file with file descriptor
+ * FD without writing any output. Every block is inflated in parallel
+ * into scratch memory and checked against its own gzip trailer: the
+ * deflate data must end exactly at the trailer, which closes the block
+ * or is followed only by empty members up to the next block, and the
+ * CRC-32 and size there must match the inflated data. The
+ * per-block CRC-32s are then combined into the CRC-32 of the whole raw
+ * data, which must also match the one stored in the embedded index if
+ * it has one.
+ *
+ * @param fd file descriptor of a mgz gzip file, opened for reading.
+ * @param lookupPath path of the lookup file written for FD, or NULL to
+ * use the index embedded in FD.
+ * @param crc if not NULL, set to the CRC-32 of the whole raw data on
+ * success.
+ * @return true if every block is intact, false if any is corrupt or an
+ * error occurred.
+ */
+bool mgz_verify(int fd, const char *lookupPath, uint32_t *crc);
+
+/**
+ * @brief Opens a reader for the mgz gzip file with file descriptor FD
+ * and the lookup file at LOOKUPPATH. The lookup table is loaded once
+ * and kept in memory until the reader is closed. FD is not closed by
+ * the reader and must stay open while the reader is in use.
+ *
+ * Reads go through pread() and a per-thread inflate state that is
+ * reset, not reallocated, for every block, so one reader can serve
+ * any number of reads cheaply. A reader is never modified by a read,
+ * and the file offset of FD is never used, so one reader, or several
+ * readers over the same FD, may be shared by any number of threads.
+ *
+ * @param fd file descriptor of a mgz gzip file.
+ * @param lookupPath path of the lookup file written for FD, or NULL to
+ * use the index embedded in FD by mgz_parallel_create_indexed.
+ * @return A new reader, or NULL if an error occurred.
+ *
+ * @example
+ * mgz_reader_t *r = mgz_reader_open(fd, "data.lookup");
+ * uint64_t n = mgz_reader_read(r, buf, size, offset);
+ * mgz_reader_close(r);
+ */
+mgz_reader_t *mgz_reader_open(int fd, const char *lookupPath);
+
+/**
+ * @brief Same as mgz_reader_open, but maps the data file of FD and the
+ * lookup file read-only instead of reading them. Inflate reads each
+ * block's compressed bytes straight from the mapping, so nothing is
+ * copied through stdio or zlib's gzFile buffers, and processes that
+ * open the same archive share its pages in the page cache. Range reads
+ * hint the kernel with madvise(MADV_WILLNEED) for the compressed span
+ * they are about to touch.
+ *
+ * The files must not be truncated while the reader is open.
+ *
+ * @param fd file descriptor of a mgz gzip file, opened for reading.
+ * @param lookupPath path of the lookup file written for FD, or NULL.
+ * @return A new reader, or NULL if an error occurred.
+ */
+mgz_reader_t *mgz_reader_open_mmap(int fd, const char *lookupPath);
+
+/**
+ * @brief Reads SIZE bytes of raw data starting at raw offset OFFSET
+ * from the archive opened by R into BUF. Assumes BUF points to a
+ * valid space of size at least SIZE bytes.
+ *
+ * @param r reader returned by mgz_reader_open.
+ * @param buf output buffer.
+ * @param size size of data to read in bytes.
+ * @param offset offset into the raw data in bytes.
+ * @return Number of bytes read, which is less than SIZE if the data
+ * ends first. Returns 0 if size is 0 or an error occurred.
+ */
+uint64_t mgz_reader_read(mgz_reader_t *r, void *buf, uint64_t size,
+                         uint64_t offset);
+
+/**
+ * @brief Fills INFO with the layout of the archive opened by R. With
+ * fixed blocks, this inflates the last block to learn its size.
+ *
+ * @return true on success, false if the last block is corrupt.
+ */
+bool mgz_reader_get_info(const mgz_reader_t *r, mgz_info_t *info);
+
+/**
+ * @brief Performs the N independent reads described by REQS on the
+ * archive opened by R, as if by mgz_reader_read, and reports each one
+ * through CB as soon as its data is in place.
+ *
+ * Requests that touch the same block share a single fetch and inflate
+ * of it. Compressed blocks of readers opened with mgz_reader_open are
+ * fetched with io_uring where the kernel allows it, keeping many reads
+ * in flight at once, and are inflated on OpenMP worker threads as they
+ * arrive. Without io_uring, or if MGZ_NO_URING is set in the
+ * environment, blocks are fetched with pread() from the worker threads
+ * instead. Mapped readers inflate straight from the mapping, and readers
+ * with a cache go through it.
+ *
+ * CB may run on any thread, and concurrently with itself, but never
+ * after this call returns. The buffers of distinct requests must not
+ * overlap.
+ *
+ * @param r reader returned by mgz_reader_open or mgz_reader_open_mmap.
+ * @param reqs requests, whose RESULT is set before CB sees them.
+ * @param n number of requests.
+ * @param cb completion callback, or NULL to only wait for the batch.
+ * @param ctx opaque pointer passed to every call of CB.
+ * @return Number of requests that completed without error. A request
+ * that failed has RESULT 0.
+ */
+uint64_t mgz_reader_read_batch(mgz_reader_t *r, mgz_read_req_t *reqs,
+                               uint64_t n, mgz_batch_cb_t cb, void *ctx);
+
+/**
+ * @brief Makes reader R look up and store whole decompressed blocks in
+ * cache C. A cache can be shared by any number of readers, including
+ * readers of different files or of the same file with different lookup
+ * tables. Blocks are keyed by the compressed bytes they were inflated
+ * from and by the file, identified by its device and inode numbers and
+ * by its size and modification time when the reader was opened, so a
+ * file that is appended to or rewritten in place never serves older
+ * blocks to readers opened after the change. Pass NULL to stop using a
+ * cache. C must outlive every reader using it.
+ *
+ * On a miss the whole block is inflated and inserted, so neighbouring
+ * reads of the same block are served by a single memcpy. A block with
+ * checkpoints is cached span by span instead, each span running from one
+ * checkpoint to the next, so a small read of a large member stays cheap.
+ */
+void mgz_reader_set_cache(mgz_reader_t *r, mgz_cache_t *c);
+
+/**
+ * @brief Creates a cache of decompressed blocks holding at most
+ * CAPACITY bytes of raw data. Blocks are evicted with the CLOCK
+ * policy. The cache is split into independently locked shards: a hit
+ * only takes a read lock on one shard, so any number of OpenMP or
+ * pthread readers can use it concurrently.
+ *
+ * @param capacity memory cap in bytes.
+ * @return A new cache, or NULL if CAPACITY is 0 or an error occurred.
+ */
+mgz_cache_t *mgz_cache_create(uint64_t capacity);
+
+/**
+ * @brief Fills STATS with the hit, miss and eviction counters and the
+ * memory use of cache C.
+ */
+void mgz_cache_get_stats(mgz_cache_t *c, mgz_cache_stats_t *stats);
+
+/**
+ * @brief Frees cache C and every block it holds. No reader may use C
+ * during or after this call.
+ */
+void mgz_cache_destroy(mgz_cache_t *c);
+
+/**
+ * @brief Copies the process-wide hot-path counters into STATS.
+ *
+ * @return true on success, false if the library was built without
+ * MGZ_STATS, in which case STATS is zeroed and nothing is counted.
+ */
+bool mgz_stats_get(mgz_stats_t *stats);
+
+/**
+ * @brief Sets every process-wide counter back to 0.
+ */
+void mgz_stats_reset(void);
+
+/**
+ * @brief Installs CB as the hook called at the end of every top-level
+ * call, or removes the hook if CB is NULL. CB may run concurrently
+ * from several threads when the library is used concurrently. Ignored
+ * in builds without MGZ_STATS.
+ *
+ * @param cb hook to call.
+ * @param ctx opaque pointer passed to every call of CB.
+ */
+void mgz_stats_set_callback(mgz_stats_cb_t cb, void *ctx);
+
+/**
+ * @brief Returns the name of the engine that compresses and inflates
+ * whole blocks: "zlib", or "libdeflate" in builds made with
+ * BACKEND=libdeflate unless MGZ_BACKEND=zlib is set in the environment.
+ * Partial reads, sync points and member probing always use zlib. Either
+ * way the archives are standard gzip members with the same lookup files,
+ * though the deflate data inside them differs between engines.
+ */
+const char *mgz_backend(void);
+
+/**
+ * @brief Frees reader R. Does not close the file descriptor it was
+ * opened with.
+ */
+void mgz_reader_close(mgz_reader_t *r);
+
 #endif  // MGZ_H
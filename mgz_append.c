@@ -0,0 +1,314 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "crc.h"
+#include "mgz_internal.h"
+
+/* An append only ever writes past the end of the valid data, so the old
+ * lookup table describes the archive correctly until the new one
+ * replaces it. A partial last block is recompressed together with the
+ * head of the new data into a member written after the old end, and the
+ * old member is retired only once the new lookup table is in place: it is
+ * overwritten with an empty gzip member of the same size, padded with
+ * its comment field, so gzip and member scans see no data there.
+ *
+ * Before any data is written, a journal is saved next to the lookup
+ * file, at LOOKUPPATH.journal. It is made of native-endian u64s like the
+ * lookup file:
+ *
+ *   magic | lookupIno | dataEnd | from | crc
+ *
+ * where DATAEND is where the valid data ended, [FROM, DATAEND) is the
+ * member to retire after the commit (empty if the last block was full),
+ * LOOKUPINO is the inode of the lookup file at the time, and CRC is the
+ * CRC-32 of everything before it, stored in a u64. The new lookup table
+ * is written to LOOKUPPATH.tmp and renamed over the old one, which
+ * commits the append, and the journal is removed once the old member is
+ * retired.
+ *
+ * A leftover journal is replayed by the next append: if the lookup file
+ * still has its old inode, the append never committed and the data file
+ * is truncated back to DATAEND; otherwise the old member is retired. A
+ * journal that fails its checks was torn before any data was written and
+ * is simply removed. */
+
+#define JOURNAL_MAGIC 0x324c4e524a5a474dULL  // "MGZJRNL2"
+#define JOURNAL_WORDS 5
+#define EMPTY_MEMBER_SIZE 20  // Header, empty deflate block, trailer.
+
+/* Returns the malloc'ed path LOOKUPPATH followed by SUFFIX. */
+static char *sibling_path(const char *lookupPath, const char *suffix) {
+    size_t n = strlen(lookupPath);
+    char *path = (char *)malloc(n + strlen(suffix) + 1);
+    if (!path) return NULL;
+    memcpy(path, lookupPath, n);
+    strcpy(path + n, suffix);
+    return path;
+}
+
+/* Flushes the directory holding PATH, so that files created, renamed or
+ * removed there survive a crash. */
+static bool sync_dir(const char *path) {
+    const char *slash = strrchr(path, '/');
+    char *dir = slash ? strndup(path, slash == path ? 1 : slash - path)
+                      : strdup(".");
+    int dirFd = dir ? open(dir, O_RDONLY | O_DIRECTORY) : -1;
+    free(dir);
+    if (dirFd < 0) return false;
+    bool ret = fsync(dirFd) == 0;
+    close(dirFd);
+    return ret;
+}
+
+static bool pread_all(int fd, void *buf, uint64_t size, uint64_t offset) {
+    for (uint64_t done = 0; done < size;) {
+        ssize_t got = pread(fd, voidp_shift(buf, done), size - done,
+                            (off_t)(offset + done));
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        done += got;
+    }
+    return true;
+}
+
+static bool pwrite_all(int fd, const void *buf, uint64_t size,
+                       uint64_t offset) {
+    for (uint64_t done = 0; done < size;) {
+        ssize_t put = pwrite(fd, voidp_shift(buf, done), size - done,
+                             (off_t)(offset + done));
+        if (put < 0 && errno == EINTR) continue;
+        if (put <= 0) return false;
+        done += put;
+    }
+    return true;
+}
+
+static bool get_ino(const char *path, uint64_t *ino) {
+    struct stat st;
+    if (stat(path, &st) < 0) return false;
+    *ino = (uint64_t)st.st_ino;
+    return true;
+}
+
+/* Overwrites bytes [FROM, TO) of FD, the gzip member of a last block
+ * that an append moved, with an empty gzip member of the same size whose
+ * comment field takes up the room, and flushes it to disk. Returns false
+ * if an error occurred. */
+static bool retire_member(int fd, uint64_t from, uint64_t to) {
+    uint64_t size = to - from;
+    if (size < EMPTY_MEMBER_SIZE) return false;
+    uint8_t *member = (uint8_t *)calloc(size, 1);
+    if (!member) return false;
+    member[0] = 0x1f;
+    member[1] = 0x8b;
+    member[2] = 8;
+    member[9] = 3;
+    if (size > EMPTY_MEMBER_SIZE) {
+        /* A comment of spaces, ended by the NUL that calloc left. */
+        member[3] = 16;  // FCOMMENT.
+        memset(member + GZIP_HEADER_SIZE, ' ', size - EMPTY_MEMBER_SIZE - 1);
+    }
+
+    /* A final fixed-Huffman block holding only end-of-block, then a zero
+     * CRC-32 and a zero ISIZE. */
+    member[size - 10] = 3;
+    bool ret = pwrite_all(fd, member, size, from) && fsync(fd) == 0;
+    free(member);
+    return ret;
+}
+
+bool append_journal_begin(const char *lookupPath, uint64_t from,
+                          uint64_t dataEnd) {
+    char *path = sibling_path(lookupPath, ".journal");
+    uint64_t words[JOURNAL_WORDS] = {JOURNAL_MAGIC, 0, dataEnd, from};
+    bool ret = false;
+    if (!path || !get_ino(lookupPath, &words[1])) goto _bailout;
+    words[JOURNAL_WORDS - 1] =
+        crc32_fast(0, words, (JOURNAL_WORDS - 1) * sizeof(uint64_t));
+
+    int jfd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (jfd < 0) goto _bailout;
+    ret = pwrite_all(jfd, words, sizeof(words), 0) && fsync(jfd) == 0;
+    ret = close(jfd) == 0 && ret && sync_dir(path);
+
+_bailout:
+    free(path);
+    return ret;
+}
+
+bool append_recover(int fd, const char *lookupPath) {
+    char *path = sibling_path(lookupPath, ".journal");
+    char *tmpPath = sibling_path(lookupPath, ".tmp");
+    bool ret = false;
+    if (!path || !tmpPath) goto _bailout;
+    int jfd = open(path, O_RDONLY);
+    if (jfd < 0) {
+        ret = errno == ENOENT;  // Nothing to recover.
+        goto _bailout;
+    }
+    struct stat st;
+    uint64_t words[JOURNAL_WORDS];
+    bool valid = fstat(jfd, &st) == 0 && st.st_size == sizeof(words) &&
+                 pread_all(jfd, words, sizeof(words), 0);
+    close(jfd);
+    valid = valid && words[0] == JOURNAL_MAGIC && words[3] <= words[2] &&
+            words[JOURNAL_WORDS - 1] ==
+                crc32_fast(0, words, (JOURNAL_WORDS - 1) * sizeof(uint64_t));
+
+    uint64_t ino;
+    if (valid && get_ino(lookupPath, &ino)) {
+        bool done;
+        if (ino == words[1]) {
+            /* The append never committed: drop what it wrote. */
+            done = ftruncate(fd, (off_t)words[2]) == 0 && fsync(fd) == 0;
+        } else {
+            /* The append committed: retire the member it moved. */
+            done = words[3] == words[2] ||
+                   retire_member(fd, words[3], words[2]);
+        }
+        if (!done) {
+            fprintf(stderr,
+                    "mgz_parallel_append: failed to recover a torn "
+                    "append.\n");
+            goto _bailout;
+        }
+    }
+    (void)unlink(tmpPath);
+    ret = unlink(path) == 0 && sync_dir(path);
+
+_bailout:
+    free(path);
+    free(tmpPath);
+    return ret;
+}
+
+/* Writes the lookup table of an appended archive, the BLOCKSIZE word
+ * followed by the NOLD first offsets of OLD and the NADDED offsets of
+ * ADDED, to a temporary file and renames it over LOOKUPPATH. */
+static bool commit_lookup(const char *lookupPath, uint64_t blockSize,
+                          const uint64_t *old, uint64_t nOld,
+                          const uint64_t *added, uint64_t nAdded) {
+    char *tmpPath = sibling_path(lookupPath, ".tmp");
+    FILE *tmp = tmpPath ? fopen(tmpPath, "wb") : NULL;
+    if (!tmp) {
+        free(tmpPath);
+        return false;
+    }
+    bool ret = fwrite(&blockSize, sizeof(uint64_t), 1, tmp) == 1 &&
+               fwrite(old, sizeof(uint64_t), nOld, tmp) == nOld &&
+               fwrite(added, sizeof(uint64_t), nAdded, tmp) == nAdded &&
+               fflush(tmp) == 0 && fsync(fileno(tmp)) == 0;
+    ret = fclose(tmp) == 0 && ret && rename(tmpPath, lookupPath) == 0 &&
+          sync_dir(lookupPath);
+    if (!ret) (void)unlink(tmpPath);
+    free(tmpPath);
+    return ret;
+}
+
+static uint64_t parallel_append(const void *in, uint64_t size, int level,
+                                int fd, const char *lookupPath) {
+    if (fd < 0 || !lookupPath) return 0;
+    if (!append_recover(fd, lookupPath)) return 0;
+    mgz_reader_t *r = mgz_reader_open(fd, lookupPath);
+    if (!r) return 0;
+    uint64_t ret = 0, blockSize = r->blockSize, nBlocks = r->nBlocks;
+    uint8_t *tail = NULL;
+    void *tailOut = NULL;
+    mgz_res_t res = {0};
+    uint64_t *offsets = NULL;
+    if (r->rawLookup) {
+        fprintf(stderr,
+                "mgz_parallel_append: only archives with fixed blocks can "
+                "be appended to.\n");
+        goto _bailout;
+    }
+
+    /* Inflate the last block to learn its raw size and where its member
+     * really ends, since the lookup file does not record the end and a
+     * failed writer may have left bytes past it. */
+    uint64_t tailStart = r->lookup[nBlocks - 1], consumed = 0;
+    tail = (uint8_t *)malloc(blockSize + 1);
+    STATS_ADD(allocations, 1);
+    int64_t tailRaw =
+        tail ? inflate_block(r, tailStart, r->dataSize, NULL, 0, tail,
+                             blockSize + 1, &consumed)
+             : -1;
+    if (tailRaw <= 0 || (uint64_t)tailRaw > blockSize) {
+        fprintf(stderr, "mgz_parallel_append: last block is corrupt.\n");
+        goto _bailout;
+    }
+    uint64_t dataEnd = tailStart + consumed;
+    if (size == 0) {
+        ret = dataEnd;
+        goto _bailout;
+    }
+
+    /* A partial last block is recompressed together with the head of the
+     * new data, and the rest of the new data is compressed in parallel
+     * into whole blocks that follow it. Both go after the old data. */
+    bool partial = (uint64_t)tailRaw < blockSize;
+    uint64_t fill = 0, tailOutSize = 0;
+    if (partial) {
+        fill = blockSize - tailRaw < size ? blockSize - tailRaw : size;
+        memcpy(tail + tailRaw, in, fill);
+        tailOutSize = mgz_deflate(&tailOut, tail, tailRaw + fill, level);
+        if (tailOutSize == 0) goto _bailout;
+    }
+    if (size > fill) {
+        res = mgz_parallel_deflate(voidp_shift(in, fill), size - fill, level,
+                                   blockSize, true);
+        if (!res.out) goto _bailout;
+    }
+    uint64_t nNew = (partial ? 1 : 0) + res.nBlocks;
+    offsets = (uint64_t *)malloc(nNew * sizeof(uint64_t));
+    if (!offsets) goto _bailout;
+    if (partial) offsets[0] = dataEnd;
+    for (uint64_t i = 0; i < res.nBlocks; ++i) {
+        offsets[nNew - res.nBlocks + i] =
+            dataEnd + tailOutSize + res.lookup[i];
+    }
+    uint64_t newEnd = dataEnd + tailOutSize + res.size;
+
+    /* Journal the append, write the data past the old end, then commit
+     * the lookup table. Until the commit, the old lookup table still
+     * describes the archive as it was. Replaying the journal then either
+     * retires the old last member or, if anything failed before the
+     * commit, drops what was written. */
+    STATS_TIMER_START(t0);
+    bool written =
+        append_journal_begin(lookupPath, partial ? tailStart : dataEnd,
+                             dataEnd) &&
+        pwrite_all(fd, tailOut, tailOutSize, dataEnd) &&
+        pwrite_all(fd, res.out, res.size, dataEnd + tailOutSize) &&
+        ftruncate(fd, (off_t)newEnd) == 0 && fsync(fd) == 0 &&
+        commit_lookup(lookupPath, blockSize, r->lookup,
+                      partial ? nBlocks - 1 : nBlocks, offsets, nNew);
+    bool recovered = append_recover(fd, lookupPath);
+    STATS_TIMER_ADD(writeNs, t0);
+    if (!written || !recovered) {
+        fprintf(stderr, "mgz_parallel_append: failed to write the archive.\n");
+        goto _bailout;
+    }
+    ret = newEnd;
+
+_bailout:
+    free(tail);
+    free(tailOut);
+    free(res.out);
+    free(res.lookup);
+    free(offsets);
+    mgz_reader_close(r);
+    return ret;
+}
+
+uint64_t mgz_parallel_append(const void *in, uint64_t size, int level,
+                             int fd, const char *lookupPath) {
+    STATS_TIMER_START(t0);
+    uint64_t ret = parallel_append(in, size, level, fd, lookupPath);
+    STATS_CALL_END("mgz_parallel_append", t0);
+    return ret;
+}
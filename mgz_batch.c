@@ -0,0 +1,305 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mgz.h"
+#include "mgz_internal.h"
+#include "uring.h"
+
+/* The part of one request that falls in one block. */
+typedef struct {
+    uint64_t block;
+    uint64_t req;
+    uint64_t from;  // Raw offset of the first byte.
+    uint64_t dst;   // Offset of the first byte in the request's buffer.
+    uint64_t size;
+} segment_t;
+
+/* All segments of one block, which are served by one fetch and one
+ * inflate of the raw range [FROM, TO) covering them. */
+typedef struct {
+    uint64_t block;
+    uint64_t first;  // Index of the first segment.
+    uint64_t n;
+    uint64_t from;
+    uint64_t to;
+    block_span_t span;
+    uint8_t *in;    // Compressed bytes of SPAN fetched with io_uring.
+    int32_t res;    // Result of the io_uring read into IN.
+} group_t;
+
+typedef struct {
+    const mgz_reader_t *r;
+    mgz_read_req_t *reqs;
+    mgz_batch_cb_t cb;
+    void *ctx;
+    segment_t *segs;
+    uint64_t *pending;  // Segments of each request not yet complete.
+    bool *failed;
+    uint64_t nDone;  // Requests completed without error.
+} batch_t;
+
+static int compare_segments(const void *a, const void *b) {
+    const segment_t *x = (const segment_t *)a, *y = (const segment_t *)b;
+    if (x->block != y->block) return x->block < y->block ? -1 : 1;
+    return (x->from > y->from) - (x->from < y->from);
+}
+
+static void finish_request(batch_t *b, uint64_t req) {
+    if (b->failed[req]) {
+        b->reqs[req].result = 0;
+    } else {
+        __atomic_add_fetch(&b->nDone, 1, __ATOMIC_RELAXED);
+    }
+    if (b->cb) b->cb(b->ctx, &b->reqs[req]);
+}
+
+/* Records that segment SEG produced GOT bytes, or failed if GOT is
+ * negative, and completes its request once all its segments are in. */
+static void complete_segment(batch_t *b, const segment_t *seg, int64_t got) {
+    if (got < 0) {
+        b->failed[seg->req] = true;
+    } else {
+        __atomic_add_fetch(&b->reqs[seg->req].result, (uint64_t)got,
+                           __ATOMIC_RELAXED);
+    }
+    if (__atomic_sub_fetch(&b->pending[seg->req], 1, __ATOMIC_ACQ_REL) ==
+        0) {
+        finish_request(b, seg->req);
+    }
+}
+
+/* Reads the part of the compressed bytes of G that its io_uring read did
+ * not deliver. Returns false on error. */
+static bool fetch_rest(const mgz_reader_t *r, group_t *g) {
+    uint64_t len = g->span.end - g->span.start;
+    uint64_t have = g->res > 0 ? (uint64_t)g->res : 0;
+    while (have < len) {
+        ssize_t got = pread(r->fd, g->in + have, len - have,
+                            (off_t)(g->span.start + have));
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        STATS_ADD(bytesRead, got);
+        have += (uint64_t)got;
+    }
+    return true;
+}
+
+/* Serves every segment of G. Compressed bytes come from G->IN if it was
+ * fetched with io_uring, and from the reader otherwise. A lone segment
+ * is inflated straight into its request's buffer; shared blocks are
+ * inflated once into scratch memory and copied out. */
+static void process_group(batch_t *b, group_t *g) {
+    const mgz_reader_t *r = b->r;
+    segment_t *segs = b->segs + g->first;
+    if (r->cache) {
+        /* The first segment to touch a block, or a span between its sync
+         * points, inflates and caches it, and the others are hits. */
+        for (uint64_t i = 0; i < g->n; ++i) {
+            mgz_read_req_t *req = &b->reqs[segs[i].req];
+            complete_segment(
+                b, &segs[i],
+                cached_read_block(r, g->block,
+                                  segs[i].from - block_raw_start(r, g->block),
+                                  voidp_shift(req->buf, segs[i].dst),
+                                  segs[i].size));
+        }
+        return;
+    }
+
+    mgz_reader_t mem = {.fd = -1,
+                        .map = g->in,
+                        .dict = r->dict,
+                        .dictSize = r->dictSize};
+    const mgz_reader_t *src = r;
+    uint64_t start = g->span.start, end = g->span.end;
+    if (g->in) {
+        src = &mem;
+        start = 0;
+        end = g->span.end - g->span.start;
+        if (!fetch_rest(r, g)) {
+            fprintf(stderr, "mgz_reader_read_batch: read failed.\n");
+            for (uint64_t i = 0; i < g->n; ++i) {
+                complete_segment(b, &segs[i], -1);
+            }
+            free(g->in);
+            return;
+        }
+    }
+    uint64_t skip = g->from - g->span.rawStart;
+    if (g->n == 1) {
+        mgz_read_req_t *req = &b->reqs[segs[0].req];
+        complete_segment(b, segs,
+                         inflate_block(src, start, end, &g->span, skip,
+                                       voidp_shift(req->buf, segs[0].dst),
+                                       segs[0].size, NULL));
+    } else {
+        uint8_t *raw = (uint8_t *)malloc(g->to - g->from);
+        STATS_ADD(allocations, 1);
+        int64_t got = raw ? inflate_block(src, start, end, &g->span, skip,
+                                          raw, g->to - g->from, NULL)
+                          : -1;
+        for (uint64_t i = 0; i < g->n; ++i) {
+            uint64_t at = segs[i].from - g->from, n = 0;
+            if (got >= 0 && (uint64_t)got > at) {
+                n = (uint64_t)got - at < segs[i].size ? (uint64_t)got - at
+                                                      : segs[i].size;
+                memcpy(voidp_shift(b->reqs[segs[i].req].buf, segs[i].dst),
+                       raw + at, n);
+            }
+            complete_segment(b, &segs[i], got < 0 ? -1 : (int64_t)n);
+        }
+        free(raw);
+    }
+    free(g->in);
+}
+
+/* Fetches the groups with io_uring from the calling thread, keeping up to
+ * URING_DEPTH reads in flight, and inflates each one in an OpenMP task as
+ * soon as its read completes. */
+static void run_uring(batch_t *b, uring_t *u, group_t *groups,
+                      uint64_t nGroups) {
+#pragma omp parallel
+#pragma omp master
+    {
+        uint64_t next = 0;
+        unsigned inFlight = 0;
+        while (next < nGroups || inFlight > 0) {
+            for (; next < nGroups && inFlight < URING_DEPTH; ++next) {
+                group_t *g = &groups[next];
+                uint64_t len = g->span.end - g->span.start;
+                g->in = len <= UINT32_MAX ? (uint8_t *)malloc(len) : NULL;
+                STATS_ADD(allocations, 1);
+                if (g->in && uring_read(u, b->r->fd, g->in, (uint32_t)len,
+                                        g->span.start, next)) {
+                    ++inFlight;
+                    continue;
+                }
+                /* Too large for one read: inflate it from the file. */
+                free(g->in);
+                g->in = NULL;
+#pragma omp task firstprivate(g)
+                process_group(b, g);
+            }
+            uint64_t tag;
+            int32_t res;
+            if (inFlight == 0) continue;
+            if (!uring_wait(u, &tag, &res)) {
+                fprintf(stderr,
+                        "mgz_reader_read_batch: (FATAL) io_uring_enter "
+                        "failed.\n");
+                exit(1);
+            }
+            --inFlight;
+            group_t *g = &groups[tag];
+            g->res = res;
+            STATS_ADD(bytesRead, res > 0 ? res : 0);
+#pragma omp task firstprivate(g)
+            process_group(b, g);
+        }
+    }
+}
+
+static uint64_t read_batch(mgz_reader_t *r, mgz_read_req_t *reqs,
+                           uint64_t n, mgz_batch_cb_t cb, void *ctx) {
+    batch_t b = {.r = r, .reqs = reqs, .cb = cb, .ctx = ctx};
+    b.pending = (uint64_t *)calloc(n ? n : 1, sizeof(uint64_t));
+    b.failed = (bool *)calloc(n ? n : 1, sizeof(bool));
+    if (!b.pending || !b.failed) {
+        fprintf(stderr, "mgz_reader_read_batch: malloc failed.\n");
+        free(b.pending);
+        free(b.failed);
+        return 0;
+    }
+
+    /* Split the requests into segments, one per block touched. Requests
+     * that touch no data complete at once. */
+    uint64_t nSegs = 0;
+    for (uint64_t i = 0; i < n; ++i) {
+        reqs[i].result = 0;
+        if (reqs[i].size && !reqs[i].buf) b.failed[i] = true;
+        uint64_t first = reqs[i].size && reqs[i].buf
+                             ? find_block(r, reqs[i].offset)
+                             : r->nBlocks;
+        if (first >= r->nBlocks) continue;
+        uint64_t last = find_block(r, reqs[i].offset + reqs[i].size - 1);
+        if (last >= r->nBlocks) last = r->nBlocks - 1;
+        b.pending[i] = last - first + 1;
+        nSegs += b.pending[i];
+    }
+    b.segs = (segment_t *)malloc((nSegs ? nSegs : 1) * sizeof(segment_t));
+    group_t *groups = (group_t *)calloc(nSegs ? nSegs : 1, sizeof(group_t));
+    STATS_ADD(allocations, 2);
+    if (!b.segs || !groups) {
+        fprintf(stderr, "mgz_reader_read_batch: malloc failed.\n");
+        free(b.segs);
+        free(groups);
+        free(b.pending);
+        free(b.failed);
+        return 0;
+    }
+    for (uint64_t i = 0, k = 0; i < n; ++i) {
+        if (b.pending[i] == 0) {
+            finish_request(&b, i);
+            continue;
+        }
+        uint64_t block = find_block(r, reqs[i].offset);
+        for (uint64_t dst = 0; dst < reqs[i].size && block < r->nBlocks;
+             ++block, ++k) {
+            uint64_t from = reqs[i].offset + dst;
+            uint64_t blockEnd = block + 1 < r->nBlocks
+                                    ? block_raw_start(r, block + 1)
+                                    : UINT64_MAX;
+            uint64_t size = reqs[i].size - dst;
+            if (size > blockEnd - from) size = blockEnd - from;
+            b.segs[k] = (segment_t){block, i, from, dst, size};
+            dst += size;
+        }
+    }
+
+    /* Coalesce the segments of each block into one group. */
+    qsort(b.segs, nSegs, sizeof(segment_t), compare_segments);
+    uint64_t nGroups = 0;
+    for (uint64_t i = 0; i < nSegs; ++i) {
+        group_t *g = &groups[nGroups];
+        if (i == 0 || b.segs[i].block != g[-1].block) {
+            g->block = b.segs[i].block;
+            g->first = i;
+            g->from = b.segs[i].from;
+            ++nGroups;
+        } else {
+            --g;
+        }
+        ++g->n;
+        if (b.segs[i].from + b.segs[i].size > g->to) {
+            g->to = b.segs[i].from + b.segs[i].size;
+        }
+    }
+    for (uint64_t i = 0; i < nGroups; ++i) {
+        block_span(r, groups[i].block, groups[i].from, groups[i].to,
+                   &groups[i].span);
+    }
+
+    uring_t *u = r->map || r->cache ? NULL : uring_get();
+    if (u) {
+        run_uring(&b, u, groups, nGroups);
+    } else {
+#pragma omp parallel for schedule(dynamic)
+        for (uint64_t i = 0; i < nGroups; ++i) process_group(&b, &groups[i]);
+    }
+    free(groups);
+    free(b.segs);
+    free(b.pending);
+    free(b.failed);
+    return b.nDone;
+}
+
+uint64_t mgz_reader_read_batch(mgz_reader_t *r, mgz_read_req_t *reqs,
+                               uint64_t n, mgz_batch_cb_t cb, void *ctx) {
+    if (!r || (!reqs && n)) return 0;
+    STATS_TIMER_START(t0);
+    uint64_t ret = read_batch(r, reqs, n, cb, ctx);
+    STATS_CALL_END("mgz_reader_read_batch", t0);
+    return ret;
+}
@@ -0,0 +1,248 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mgz.h"
+#include "mgz_internal.h"
+
+#define N_SHARDS 64
+#define MIN_BUCKETS 64
+
+/* A decompressed block. DATA holds the whole raw block. */
+typedef struct cache_entry {
+    cache_key_t key;
+    void *data;
+    uint64_t size;
+    int ref;  // CLOCK reference bit, set on every hit.
+    uint64_t slot;  // Position in the shard's CLOCK ring.
+    struct cache_entry *next;  // Next entry in the same hash bucket.
+} cache_entry_t;
+
+/* Hits only take the shard's read lock. Inserts and evictions take the
+ * write lock of the shard they modify, never a global one. */
+typedef struct {
+    pthread_rwlock_t lock;
+    cache_entry_t **buckets;
+    uint64_t nBuckets;
+    cache_entry_t **ring;  // CLOCK ring of all entries in the shard.
+    uint64_t nEntries;
+    uint64_t ringCapacity;
+    uint64_t hand;
+} cache_shard_t;
+
+struct mgz_cache {
+    uint64_t capacity;
+    uint64_t used;  // Bytes held by all shards, updated atomically.
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    cache_shard_t shards[N_SHARDS];
+};
+
+static inline uint64_t hash_key(const cache_key_t *k) {
+    const uint64_t words[] = {k->dev,   k->ino,   k->fileSize,
+                              k->mtime, k->start, k->end};
+    uint64_t h = 0x632BE59BD9B4E019ULL;
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); ++i) {
+        h ^= words[i] + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+    }
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline bool key_equal(const cache_key_t *a, const cache_key_t *b) {
+    return a->dev == b->dev && a->ino == b->ino &&
+           a->fileSize == b->fileSize && a->mtime == b->mtime &&
+           a->start == b->start && a->end == b->end;
+}
+
+static inline cache_shard_t *get_shard(mgz_cache_t *c, uint64_t h) {
+    return &c->shards[h % N_SHARDS];
+}
+
+static cache_entry_t **find_entry(cache_shard_t *s, uint64_t h,
+                                  const cache_key_t *key) {
+    cache_entry_t **e = &s->buckets[(h / N_SHARDS) % s->nBuckets];
+    while (*e && !key_equal(&(*e)->key, key)) e = &(*e)->next;
+    return e;
+}
+
+mgz_cache_t *mgz_cache_create(uint64_t capacity) {
+    if (capacity == 0) return NULL;
+    mgz_cache_t *c = (mgz_cache_t *)calloc(1, sizeof(mgz_cache_t));
+    if (!c) {
+        fprintf(stderr, "mgz_cache_create: malloc failed.\n");
+        return NULL;
+    }
+    c->capacity = capacity;
+    for (int i = 0; i < N_SHARDS; ++i) {
+        cache_shard_t *s = &c->shards[i];
+        pthread_rwlock_init(&s->lock, NULL);
+        s->nBuckets = MIN_BUCKETS;
+        s->buckets =
+            (cache_entry_t **)calloc(s->nBuckets, sizeof(cache_entry_t *));
+        if (!s->buckets) {
+            fprintf(stderr, "mgz_cache_create: malloc failed.\n");
+            mgz_cache_destroy(c);
+            return NULL;
+        }
+    }
+    return c;
+}
+
+void mgz_cache_destroy(mgz_cache_t *c) {
+    if (!c) return;
+    for (int i = 0; i < N_SHARDS; ++i) {
+        cache_shard_t *s = &c->shards[i];
+        for (uint64_t j = 0; j < s->nEntries; ++j) {
+            free(s->ring[j]->data);
+            free(s->ring[j]);
+        }
+        free(s->ring);
+        free(s->buckets);
+        pthread_rwlock_destroy(&s->lock);
+    }
+    free(c);
+}
+
+void mgz_cache_get_stats(mgz_cache_t *c, mgz_cache_stats_t *stats) {
+    if (!c || !stats) return;
+    stats->hits = __atomic_load_n(&c->hits, __ATOMIC_RELAXED);
+    stats->misses = __atomic_load_n(&c->misses, __ATOMIC_RELAXED);
+    stats->evictions = __atomic_load_n(&c->evictions, __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&c->used, __ATOMIC_RELAXED);
+    stats->capacity = c->capacity;
+}
+
+int64_t cache_read(mgz_cache_t *c, const cache_key_t *key, uint64_t skip,
+                   void *dst, uint64_t size) {
+    uint64_t h = hash_key(key);
+    cache_shard_t *s = get_shard(c, h);
+    int64_t ret = -1;
+    pthread_rwlock_rdlock(&s->lock);
+    cache_entry_t *e = *find_entry(s, h, key);
+    if (e) {
+        __atomic_store_n(&e->ref, 1, __ATOMIC_RELAXED);
+        if (skip > e->size) skip = e->size;
+        if (size > e->size - skip) size = e->size - skip;
+        memcpy(dst, voidp_shift(e->data, skip), size);
+        ret = (int64_t)size;
+    }
+    pthread_rwlock_unlock(&s->lock);
+    __atomic_fetch_add(ret < 0 ? &c->misses : &c->hits, 1, __ATOMIC_RELAXED);
+    return ret;
+}
+
+/* Evicts one entry from shard S using the CLOCK policy. Assumes the
+ * write lock of S is held. Returns false if S is empty. */
+static bool shard_evict_one(mgz_cache_t *c, cache_shard_t *s) {
+    if (s->nEntries == 0) return false;
+    for (;;) {
+        if (s->hand >= s->nEntries) s->hand = 0;
+        cache_entry_t *e = s->ring[s->hand];
+        if (__atomic_exchange_n(&e->ref, 0, __ATOMIC_RELAXED)) {
+            ++s->hand;
+            continue;
+        }
+
+        /* Unlink from its bucket and fill its ring slot with the last
+         * entry of the ring. */
+        cache_entry_t **link = find_entry(s, hash_key(&e->key), &e->key);
+        *link = e->next;
+        cache_entry_t *last = s->ring[--s->nEntries];
+        s->ring[e->slot] = last;
+        last->slot = e->slot;
+        __atomic_fetch_sub(&c->used, e->size, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&c->evictions, 1, __ATOMIC_RELAXED);
+        free(e->data);
+        free(e);
+        return true;
+    }
+}
+
+static bool shard_grow(cache_shard_t *s) {
+    if (s->nEntries == s->ringCapacity) {
+        uint64_t newCapacity = s->ringCapacity ? s->ringCapacity * 2 : 16;
+        cache_entry_t **newRing = (cache_entry_t **)realloc(
+            s->ring, newCapacity * sizeof(cache_entry_t *));
+        if (!newRing) return false;
+        s->ring = newRing;
+        s->ringCapacity = newCapacity;
+    }
+    if (s->nEntries >= s->nBuckets * 2) {
+        /* Rehash into twice as many buckets. */
+        uint64_t newNBuckets = s->nBuckets * 2;
+        cache_entry_t **newBuckets =
+            (cache_entry_t **)calloc(newNBuckets, sizeof(cache_entry_t *));
+        if (!newBuckets) return false;
+        for (uint64_t i = 0; i < s->nEntries; ++i) {
+            cache_entry_t *e = s->ring[i];
+            uint64_t b = (hash_key(&e->key) / N_SHARDS) % newNBuckets;
+            e->next = newBuckets[b];
+            newBuckets[b] = e;
+        }
+        free(s->buckets);
+        s->buckets = newBuckets;
+        s->nBuckets = newNBuckets;
+    }
+    return true;
+}
+
+void cache_insert(mgz_cache_t *c, const cache_key_t *key, void *data,
+                  uint64_t size) {
+    if (size > c->capacity) {
+        free(data);
+        return;
+    }
+    uint64_t h = hash_key(key);
+    cache_shard_t *s = get_shard(c, h);
+    cache_entry_t *e = (cache_entry_t *)malloc(sizeof(cache_entry_t));
+    if (!e) {
+        free(data);
+        return;
+    }
+
+    /* Reserve the space first, so that concurrent inserts count each
+     * other's blocks, then make room, starting with the shard the new
+     * entry goes to. Only one shard lock is held at a time. If the other
+     * reservations leave no room even once every shard is empty, the
+     * block is not cached. */
+    __atomic_fetch_add(&c->used, size, __ATOMIC_RELAXED);
+    uint64_t start = (uint64_t)(s - c->shards);
+    for (uint64_t i = 0;
+         __atomic_load_n(&c->used, __ATOMIC_RELAXED) > c->capacity;) {
+        if (i == N_SHARDS) {
+            __atomic_fetch_sub(&c->used, size, __ATOMIC_RELAXED);
+            free(data);
+            free(e);
+            return;
+        }
+        cache_shard_t *victim = &c->shards[(start + i) % N_SHARDS];
+        pthread_rwlock_wrlock(&victim->lock);
+        bool evicted = shard_evict_one(c, victim);
+        pthread_rwlock_unlock(&victim->lock);
+        if (!evicted) ++i;
+    }
+
+    pthread_rwlock_wrlock(&s->lock);
+    cache_entry_t **link = find_entry(s, h, key);
+    if (*link || !shard_grow(s)) {
+        /* Another reader inserted the same block first, or OOM. */
+        pthread_rwlock_unlock(&s->lock);
+        __atomic_fetch_sub(&c->used, size, __ATOMIC_RELAXED);
+        free(data);
+        free(e);
+        return;
+    }
+    e->key = *key;
+    e->data = data;
+    e->size = size;
+    e->ref = 0;
+    e->slot = s->nEntries;
+    e->next = s->buckets[(h / N_SHARDS) % s->nBuckets];
+    s->buckets[(h / N_SHARDS) % s->nBuckets] = e;
+    s->ring[s->nEntries++] = e;
+    pthread_rwlock_unlock(&s->lock);
+}
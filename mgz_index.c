@@ -0,0 +1,259 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "mgz_internal.h"
+
+/* An embedded index is stored after the data members as a run of empty
+ * gzip members whose FEXTRA fields carry the index, followed by one
+ * fixed-size empty member whose FEXTRA field locates the index:
+ *
+ *   data members | 'MI' member ... 'MI' member | 'ML' member
+ *
+ * Empty members inflate to nothing, so the archive stays a valid gzip
+ * stream with the same content for gzip, zcat and friends. All integers
+ * are little-endian.
+ *
+ * The 'ML' (locator) subfield holds the magic "MGZL", a u32 version, the
+ * u64 offset of the first 'MI' member (which is also the size of the
+ * data members) and the u64 total size of the 'MI' members.
+ *
+ * The 'MI' subfields, concatenated, hold the index: the magic "MGZI", a
+ * u32 version, the u64 block size, the u64 number of blocks, the u64
+ * total raw size, then from version 2 on the u32 CRC-32 of the raw data
+ * and a zero u32, then the u64 compressed offset of every block, and
+ * finally the u32 CRC-32 of everything before it. */
+
+#define LOCATOR_VERSION 1
+#define INDEX_VERSION 2
+#define EMPTY_MEMBER_SIZE 22  // Header, XLEN, empty deflate block, trailer.
+#define SUBFIELD_HEADER_SIZE 4
+#define MAX_SUBFIELD_PAYLOAD (65535 - SUBFIELD_HEADER_SIZE)
+#define LOCATOR_PAYLOAD_SIZE 24
+#define LOCATOR_SIZE \
+    (EMPTY_MEMBER_SIZE + SUBFIELD_HEADER_SIZE + LOCATOR_PAYLOAD_SIZE)
+#define INDEX_V1_HEADER_SIZE 32
+#define INDEX_HEADER_SIZE 40
+#define TAIL_READ_SIZE (1 << 16)  // Covers the index of most archives.
+
+static inline void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static inline void put_u32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) p[i] = (v >> (8 * i)) & 0xff;
+}
+
+static inline void put_u64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; ++i) p[i] = (v >> (8 * i)) & 0xff;
+}
+
+static inline uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static inline uint32_t get_u32(const uint8_t *p) {
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; --i) v = v << 8 | p[i];
+    return v;
+}
+
+static inline uint64_t get_u64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) v = v << 8 | p[i];
+    return v;
+}
+
+/* Writes one empty gzip member whose FEXTRA field holds the subfield
+ * (SI1, SI2) with LEN bytes of PAYLOAD. Returns the bytes written, or 0
+ * if writing failed. */
+static uint64_t write_empty_member(FILE *out, char si1, char si2,
+                                   const uint8_t *payload, uint16_t len) {
+    uint8_t header[16] = {0x1f, 0x8b, 8, 4 /* FEXTRA */, 0, 0, 0, 0, 0, 3};
+    put_u16(header + 10, len + SUBFIELD_HEADER_SIZE);
+    header[12] = si1;
+    header[13] = si2;
+    put_u16(header + 14, len);
+
+    /* A final fixed-Huffman block holding only end-of-block, then a zero
+     * CRC-32 and a zero ISIZE. */
+    static const uint8_t trailer[10] = {3, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    if (fwrite(header, 1, sizeof(header), out) != sizeof(header) ||
+        fwrite(payload, 1, len, out) != len ||
+        fwrite(trailer, 1, sizeof(trailer), out) != sizeof(trailer)) {
+        return 0;
+    }
+    return sizeof(header) + len + sizeof(trailer);
+}
+
+uint64_t index_write(FILE *out, const mgz_index_t *idx) {
+    uint64_t size = INDEX_HEADER_SIZE + idx->nBlocks * 8 + 4;
+    uint8_t *buf = (uint8_t *)malloc(size);
+    if (!buf) return 0;
+    memcpy(buf, "MGZI", 4);
+    put_u32(buf + 4, INDEX_VERSION);
+    put_u64(buf + 8, idx->blockSize);
+    put_u64(buf + 16, idx->nBlocks);
+    put_u64(buf + 24, idx->rawSize);
+    put_u32(buf + 32, idx->crc);
+    put_u32(buf + 36, 0);
+    for (uint64_t i = 0; i < idx->nBlocks; ++i) {
+        put_u64(buf + INDEX_HEADER_SIZE + i * 8, idx->offsets[i]);
+    }
+    put_u32(buf + size - 4, (uint32_t)crc32(0L, buf, size - 4));
+
+    /* Split the index over as many members as FEXTRA's 16-bit length
+     * requires. */
+    uint64_t written = 0;
+    for (uint64_t off = 0; off < size; off += MAX_SUBFIELD_PAYLOAD) {
+        uint64_t len = size - off;
+        if (len > MAX_SUBFIELD_PAYLOAD) len = MAX_SUBFIELD_PAYLOAD;
+        uint64_t n = write_empty_member(out, 'M', 'I', buf + off, len);
+        if (n == 0) {
+            free(buf);
+            return 0;
+        }
+        written += n;
+    }
+    free(buf);
+
+    uint8_t locator[LOCATOR_PAYLOAD_SIZE];
+    memcpy(locator, "MGZL", 4);
+    put_u32(locator + 4, LOCATOR_VERSION);
+    put_u64(locator + 8, idx->dataSize);
+    put_u64(locator + 16, written);
+    uint64_t n = write_empty_member(out, 'M', 'L', locator, sizeof(locator));
+    return n ? written + n : 0;
+}
+
+static bool pread_all(int fd, void *buf, uint64_t size, uint64_t offset) {
+    while (size > 0) {
+        ssize_t got = pread(fd, buf, size, (off_t)offset);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        buf = voidp_shift(buf, got);
+        size -= got;
+        offset += got;
+    }
+    return true;
+}
+
+/* Parses the empty member at P of at most AVAIL bytes. On success, sets
+ * *PAYLOAD and *LEN to the payload of its (SI1, SI2) subfield and returns
+ * the size of the member; returns 0 otherwise. */
+static uint64_t parse_empty_member(const uint8_t *p, uint64_t avail,
+                                   char si1, char si2,
+                                   const uint8_t **payload, uint16_t *len) {
+    static const uint8_t empty[10] = {3, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    if (avail < 12 || p[0] != 0x1f || p[1] != 0x8b || p[2] != 8 ||
+        p[3] != 4) {
+        return 0;
+    }
+    uint16_t xlen = get_u16(p + 10);
+    if (avail < (uint64_t)EMPTY_MEMBER_SIZE + xlen ||
+        memcmp(p + 12 + xlen, empty, sizeof(empty)) != 0) {
+        return 0;
+    }
+    *payload = NULL;
+    for (uint16_t off = 0; off + SUBFIELD_HEADER_SIZE <= xlen;) {
+        const uint8_t *sub = p + 12 + off;
+        uint16_t subLen = get_u16(sub + 2);
+        if (off + SUBFIELD_HEADER_SIZE + subLen > xlen) return 0;
+        if (sub[0] == si1 && sub[1] == si2) {
+            *payload = sub + SUBFIELD_HEADER_SIZE;
+            *len = subLen;
+        }
+        off += SUBFIELD_HEADER_SIZE + subLen;
+    }
+    return *payload ? EMPTY_MEMBER_SIZE + xlen : 0;
+}
+
+bool index_read(int fd, mgz_index_t *idx) {
+    memset(idx, 0, sizeof(*idx));
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (uint64_t)st.st_size < LOCATOR_SIZE) {
+        return false;
+    }
+    uint64_t fileSize = (uint64_t)st.st_size;
+
+    /* One read from the end usually covers the locator and the index. */
+    uint64_t tailSize = fileSize < TAIL_READ_SIZE ? fileSize : TAIL_READ_SIZE;
+    uint8_t *tail = (uint8_t *)malloc(tailSize);
+    uint8_t *raw = NULL, *members = NULL;
+    bool ownMembers = false, ret = false;
+    if (!tail || !pread_all(fd, tail, tailSize, fileSize - tailSize)) {
+        goto _bailout;
+    }
+    const uint8_t *payload;
+    uint16_t len;
+    if (parse_empty_member(tail + tailSize - LOCATOR_SIZE, LOCATOR_SIZE, 'M',
+                           'L', &payload, &len) != LOCATOR_SIZE ||
+        len != LOCATOR_PAYLOAD_SIZE || memcmp(payload, "MGZL", 4) != 0 ||
+        get_u32(payload + 4) != LOCATOR_VERSION) {
+        goto _bailout;
+    }
+    uint64_t dataSize = get_u64(payload + 8);
+    uint64_t membersSize = get_u64(payload + 16);
+    if (dataSize > fileSize - LOCATOR_SIZE ||
+        membersSize != fileSize - LOCATOR_SIZE - dataSize) {
+        goto _bailout;
+    }
+    if (membersSize + LOCATOR_SIZE <= tailSize) {
+        members = tail + tailSize - LOCATOR_SIZE - membersSize;
+    } else {
+        members = (uint8_t *)malloc(membersSize);
+        ownMembers = true;
+        if (!members || !pread_all(fd, members, membersSize, dataSize)) {
+            goto _bailout;
+        }
+    }
+
+    /* Reassemble the index from the payloads of the 'MI' members. */
+    raw = (uint8_t *)malloc(membersSize);
+    uint64_t rawSize = 0;
+    for (uint64_t off = 0; raw && off < membersSize;) {
+        uint64_t n = parse_empty_member(members + off, membersSize - off, 'M',
+                                        'I', &payload, &len);
+        if (n == 0) goto _bailout;
+        memcpy(raw + rawSize, payload, len);
+        rawSize += len;
+        off += n;
+    }
+    /* Version 1 indexes predate the CRC-32 of the raw data. */
+    uint32_t version = raw && rawSize >= INDEX_V1_HEADER_SIZE + 4
+                           ? get_u32(raw + 4)
+                           : 0;
+    uint64_t headerSize = version == 1 ? INDEX_V1_HEADER_SIZE
+                                       : INDEX_HEADER_SIZE;
+    if (!raw || rawSize < headerSize + 4 || memcmp(raw, "MGZI", 4) != 0 ||
+        (version != 1 && version != INDEX_VERSION) ||
+        get_u32(raw + rawSize - 4) != (uint32_t)crc32(0L, raw, rawSize - 4)) {
+        goto _bailout;
+    }
+    idx->blockSize = get_u64(raw + 8);
+    idx->nBlocks = get_u64(raw + 16);
+    idx->rawSize = get_u64(raw + 24);
+    idx->dataSize = dataSize;
+    idx->hasCrc = version >= 2;
+    idx->crc = idx->hasCrc ? get_u32(raw + 32) : 0;
+    if (idx->blockSize == 0 || idx->nBlocks == 0 ||
+        rawSize != headerSize + idx->nBlocks * 8 + 4) {
+        goto _bailout;
+    }
+    idx->offsets = (uint64_t *)malloc(idx->nBlocks * sizeof(uint64_t));
+    if (!idx->offsets) goto _bailout;
+    for (uint64_t i = 0; i < idx->nBlocks; ++i) {
+        idx->offsets[i] = get_u64(raw + headerSize + i * 8);
+    }
+    ret = true;
+
+_bailout:
+    if (ownMembers) free(members);
+    free(raw);
+    free(tail);
+    return ret;
+}
@@ -0,0 +1,272 @@
+#ifndef MGZ_INTERNAL_H
+#define MGZ_INTERNAL_H
+#include <stdint.h>
+
+#include "mgz.h"
+
+/* Helpers shared by the mgz translation units. Not part of the public
+ * API. */
+
+static inline void *voidp_shift(const void *p, uint64_t offset) {
+    return (void *)((uint8_t *)p + offset);
+}
+
+/* Hot-path instrumentation. Every macro compiles to nothing unless
+ * MGZ_STATS is defined. Counters are updated atomically, so they may be
+ * bumped from inside OpenMP loops. Defined in mgz_stats.c. */
+#ifdef MGZ_STATS
+#include <time.h>
+
+extern mgz_stats_t mgzStats;
+
+static inline uint64_t stats_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Calls the user hook, if any, at the end of top-level call CALL. */
+void stats_call_end(const char *call, uint64_t ns);
+
+#define STATS_ADD(field, n) \
+    __atomic_fetch_add(&mgzStats.field, (n), __ATOMIC_RELAXED)
+#define STATS_TIMER_START(t) uint64_t t = stats_now_ns()
+#define STATS_TIMER_ADD(field, t) STATS_ADD(field, stats_now_ns() - (t))
+#define STATS_CALL_END(call, t) stats_call_end(call, stats_now_ns() - (t))
+#else
+#define STATS_ADD(field, n) ((void)0)
+#define STATS_TIMER_START(t) ((void)0)
+#define STATS_TIMER_ADD(field, t) ((void)0)
+#define STATS_CALL_END(call, t) ((void)0)
+#endif
+
+/* A lookup file normally holds the block size followed by the compressed
+ * offset of every block. A lookup file whose block size is 0 describes
+ * blocks of varying raw size instead, as written by
+ * mgz_parallel_create_adaptive. All words are native-endian u64s:
+ *
+ *   0 | version | nBlocks | offsets[nBlocks] | rawOffsets[nBlocks + 1]
+ *
+ * where rawOffsets[i] is the raw offset of block i and
+ * rawOffsets[nBlocks] is the total raw size. Version 2, written by
+ * mgz_parallel_create_seekable, appends the sync points inside blocks:
+ *
+ *   ... | nPoints | pointRaw[nPoints] | pointOffsets[nPoints]
+ *
+ * where a raw-deflate inflater started at compressed offset
+ * pointOffsets[i] produces the data from raw offset pointRaw[i] on. Both
+ * arrays are ascending. Version 3, written by mgz_parallel_create_primed,
+ * appends the dictionary that every block was primed with instead:
+ *
+ *   ... | dictSize | dict[dictSize], zero-padded to a whole word
+ *
+ * where 0 < dictSize <= MAX_DICT_SIZE. Version 4, written by
+ * mgz_index_gzip for gzip files that mgz did not write, appends
+ * checkpoints in the middle of deflate streams instead:
+ *
+ *   ... | nPoints | pointRaw[nPoints] | pointOffs[nPoints] |
+ *       pointBits[nPoints] | windows[nPoints * WINDOW_SIZE]
+ *
+ * where a raw-deflate inflater resumes producing the data from raw offset
+ * pointRaw[i] on at compressed offset pointOffs[i], once it is primed
+ * with the top pointBits[i] < 8 bits of the byte before and given the
+ * WINDOW_SIZE raw bytes before the point, windows[i], as its
+ * dictionary. */
+#define VARIABLE_LOOKUP_VERSION 1
+#define SYNC_LOOKUP_VERSION 2
+#define PRIMED_LOOKUP_VERSION 3
+#define CHECKPOINT_LOOKUP_VERSION 4
+#define VARIABLE_LOOKUP_HEADER 3  // Words before the offsets.
+#define MAX_DICT_SIZE 32768       // The deflate window.
+#define WINDOW_SIZE MAX_DICT_SIZE  // Saved with every checkpoint.
+
+/* mgz writes every member with a bare header of this size, without a
+ * name or any other optional field. */
+#define GZIP_HEADER_SIZE 10
+
+/* Writes a lookup table in the variable format above to LOOKUP: the
+ * compressed and raw offsets of NBLOCKS blocks, followed by NPOINTS sync
+ * points if there are any, which are checkpoints if POINTBITS and WINDOWS
+ * are not NULL, or else by the DICTSIZE-byte dictionary at DICT if
+ * DICTSIZE is not 0. Returns false if writing failed. Defined in mgz.c. */
+bool write_variable_lookup(FILE *lookup, uint64_t nBlocks,
+                           const uint64_t *offsets, const uint64_t *rawOffs,
+                           uint64_t nPoints, const uint64_t *pointRaw,
+                           const uint64_t *pointOffs,
+                           const uint64_t *pointBits, const uint8_t *windows,
+                           const uint8_t *dict, uint64_t dictSize);
+
+/* In-memory form of the index embedded at the end of a self-describing
+ * archive. See mgz_index.c for the on-disk format. */
+typedef struct {
+    uint64_t blockSize;
+    uint64_t nBlocks;
+    uint64_t dataSize;  // Size of the data members, where the index starts.
+    uint64_t rawSize;   // Total size of the raw data.
+    uint64_t *offsets;  // Compressed offset of each block.
+    uint32_t crc;       // CRC-32 of the raw data, if HASCRC is set.
+    bool hasCrc;        // Not set for indexes written before version 2.
+} mgz_index_t;
+
+/* Appends the embedded index IDX to OUT. Returns the number of bytes
+ * written, or 0 if an error occurred. Defined in mgz_index.c. */
+uint64_t index_write(FILE *out, const mgz_index_t *idx);
+
+/* Loads the embedded index of the archive FD into IDX, whose offsets are
+ * malloc'ed. Returns false if FD has no valid embedded index. Defined in
+ * mgz_index.c. */
+bool index_read(int fd, mgz_index_t *idx);
+
+/* Starts the journal of an append to the archive whose lookup file is
+ * at LOOKUPPATH and whose valid data ends at DATAEND, recording that the
+ * member at [FROM, DATAEND) is to be retired once the append commits,
+ * and flushes it to disk. Returns false if an error occurred. Defined in
+ * mgz_append.c. */
+bool append_journal_begin(const char *lookupPath, uint64_t from,
+                          uint64_t dataEnd);
+
+/* Replays the journal of an append to FD and LOOKUPPATH, if there is
+ * one: an append that never committed is rolled back, and one that did
+ * is finished. The journal is then removed. Returns false if an error
+ * occurred. Defined in mgz_append.c. */
+bool append_recover(int fd, const char *lookupPath);
+
+/* An opened archive. Shared by mgz_reader.c and mgz_batch.c. */
+struct mgz_reader {
+    int fd;
+    const uint8_t *map;  // Compressed data in memory, or NULL to use FD.
+    uint64_t dev;  // Identity of the data file for the block cache.
+    uint64_t ino;
+    uint64_t fileSize;  // Size and modification time of the data file,
+    uint64_t mtime;     // so that cached blocks of older contents miss.
+    mgz_cache_t *cache;
+    uint64_t blockSize;  // Raw size of the largest block.
+    uint64_t nBlocks;
+    uint64_t dataSize;  // Size of the compressed data.
+
+    /* Compressed offset of each block. Block i spans [lookup[i],
+     * lookup[i + 1]), and the last block ends at DATASIZE. */
+    const uint64_t *lookup;
+
+    /* Raw offset of each block followed by the total raw size, or NULL
+     * if every block but the last holds BLOCKSIZE bytes. Part of the
+     * same allocation or mapping as LOOKUP. */
+    const uint64_t *rawLookup;
+
+    /* Sync points inside blocks, as written by
+     * mgz_parallel_create_seekable: raw deflate data starting at
+     * compressed offset pointOffs[i] inflates to the data from raw offset
+     * pointRaw[i] on. Part of the same allocation or mapping as LOOKUP. */
+    uint64_t nPoints;
+    const uint64_t *pointRaw;
+    const uint64_t *pointOffs;
+
+    /* Primed bits and saved window of every sync point if they are
+     * checkpoints, as written by mgz_index_gzip, or NULL. Part of the
+     * same allocation or mapping as LOOKUP. */
+    const uint64_t *pointBits;
+    const uint8_t *windows;
+
+    /* Dictionary that every block was primed with, as written by
+     * mgz_parallel_create_primed, or NULL. Part of the same allocation or
+     * mapping as LOOKUP. */
+    const uint8_t *dict;
+    uint64_t dictSize;
+
+    /* CRC-32 of the raw data, from an embedded index of version 2 or
+     * later. */
+    uint32_t crc;
+    bool hasCrc;
+    bool indexed;  // Opened from the embedded index rather than a file.
+
+    /* Non-zero if MAP is a mapping owned by the reader rather than
+     * borrowed memory. */
+    uint64_t mapSize;
+
+    /* Memory holding LOOKUP and RAWLOOKUP, owned by the reader: a mapping
+     * of the lookup file if LOOKUPMAPSIZE is non-zero, and malloc'ed
+     * otherwise. */
+    void *lookupMap;
+    uint64_t lookupMapSize;
+};
+
+static inline uint64_t block_end(const mgz_reader_t *r, uint64_t block) {
+    return block + 1 < r->nBlocks ? r->lookup[block + 1] : r->dataSize;
+}
+
+static inline uint64_t block_raw_start(const mgz_reader_t *r,
+                                       uint64_t block) {
+    return r->rawLookup ? r->rawLookup[block] : block * r->blockSize;
+}
+
+/* Returns the block of R holding raw offset OFFSET, or NBLOCKS if OFFSET
+ * is past the end of the data. Defined in mgz_reader.c. */
+uint64_t find_block(const mgz_reader_t *r, uint64_t offset);
+
+/* Where inflating must start and may stop to produce raw bytes
+ * [FROM, TO) of one block. See block_span. */
+typedef struct {
+    uint64_t start;     // Compressed offset to inflate from.
+    uint64_t end;       // Compressed offset past the last byte needed.
+    uint64_t rawStart;  // Raw offset produced at START.
+    uint64_t rawEnd;    // Raw offset of END, or past the end of the block.
+    bool raw;           // START is a sync point, so inflate raw deflate.
+
+    /* If START is a checkpoint, the dictionary to resume with, and the
+     * number of bits at the top of the byte at START to prime the
+     * inflater with; the deflate data then goes on at START + 1 if BITS
+     * is not 0. */
+    const uint8_t *window;
+    uint64_t bits;
+} block_span_t;
+
+/* Fills SPAN with the part of block BLOCK of R that must be inflated to
+ * produce raw bytes [FROM, TO) of it. Without sync points, this is the
+ * whole gzip member. Defined in mgz_reader.c. */
+void block_span(const mgz_reader_t *r, uint64_t block, uint64_t from,
+                uint64_t to, block_span_t *span);
+
+/* Inflates the gzip member at [START, END) of the data of R, or the raw
+ * deflate data there if SPAN is not NULL and has RAW set, discards the
+ * first SKIP bytes of output and writes at most SIZE of the following
+ * bytes into BUF. See mgz_reader.c for the details. Returns the number of
+ * bytes written, or -1 on error. */
+int64_t inflate_block(const mgz_reader_t *r, uint64_t start, uint64_t end,
+                      const block_span_t *span, uint64_t skip, void *buf,
+                      uint64_t size, uint64_t *consumed);
+
+/* Copies SIZE bytes starting at SKIP of block BLOCK of R into BUF
+ * through the cache of R, which holds whole blocks, or the spans between
+ * the sync points of blocks that have any. Every span read is inflated
+ * and inserted on a miss. Returns the number of bytes copied, or -1 on
+ * error. Defined in mgz_reader.c. */
+int64_t cached_read_block(const mgz_reader_t *r, uint64_t block,
+                          uint64_t skip, void *buf, uint64_t size);
+
+/* Identifies a cached raw block by the version of the data file it
+ * comes from, so that a file rewritten in place misses, and by the
+ * compressed bytes [START, END) it was inflated from, so that readers
+ * with other lookup tables, or of an archive that was appended to, never
+ * get blocks that differ from theirs. */
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t fileSize;
+    uint64_t mtime;
+    uint64_t start;
+    uint64_t end;
+} cache_key_t;
+
+/* Copies SIZE bytes starting at SKIP of the cached raw block KEY into
+ * DST. Returns the number of bytes copied, or -1 if the block is not
+ * cached. Defined in mgz_cache.c. */
+int64_t cache_read(mgz_cache_t *c, const cache_key_t *key, uint64_t skip,
+                   void *dst, uint64_t size);
+
+/* Adds the raw block KEY with SIZE bytes at DATA to cache C, evicting
+ * other blocks as needed. Takes ownership of the malloc'ed DATA. Defined
+ * in mgz_cache.c. */
+void cache_insert(mgz_cache_t *c, const cache_key_t *key, void *data,
+                  uint64_t size);
+
+#endif  // MGZ_INTERNAL_H
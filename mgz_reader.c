@@ -0,0 +1,1633 @@
+#include <errno.h>
+#include <limits.h>
+#include <omp.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "mgz.h"
+#include "backend.h"
+#include "crc.h"
+#include "mgz_internal.h"
+#include "zpool.h"
+
+#define READ_CHUNK_SIZE (1 << 17)  // 128 KiB of compressed input per pread.
+#define DISCARD_SIZE (1 << 16)     // 64 KiB scratch for skipped output.
+
+uint64_t find_block(const mgz_reader_t *r, uint64_t offset) {
+    if (!r->rawLookup) {
+        uint64_t block = offset / r->blockSize;
+        return block < r->nBlocks ? block : r->nBlocks;
+    }
+    if (offset >= r->rawLookup[r->nBlocks]) return r->nBlocks;
+    uint64_t lo = 0, hi = r->nBlocks - 1;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo + 1) / 2;
+        if (r->rawLookup[mid] <= offset) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+/* Returns the number of sync points of R at or before raw OFFSET. */
+static uint64_t count_points(const mgz_reader_t *r, uint64_t offset) {
+    uint64_t lo = 0, hi = r->nPoints;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (r->pointRaw[mid] <= offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+void block_span(const mgz_reader_t *r, uint64_t block, uint64_t from,
+                uint64_t to, block_span_t *span) {
+    uint64_t rawStart = block_raw_start(r, block);
+    span->start = r->lookup[block];
+    span->end = block_end(r, block);
+    span->rawStart = rawStart;
+    span->rawEnd = block_raw_start(r, block + 1);
+    span->raw = false;
+    span->window = NULL;
+    span->bits = 0;
+    if (r->nPoints == 0) return;
+
+    /* Start at the last sync point at or before FROM, and stop at the
+     * first one at or after TO, both inside the block. */
+    uint64_t n = count_points(r, from);
+    if (n > 0 && r->pointRaw[n - 1] > rawStart) {
+        span->start = r->pointOffs[n - 1];
+        span->rawStart = r->pointRaw[n - 1];
+        span->raw = true;
+        if (r->windows) {
+            span->window = r->windows + (n - 1) * WINDOW_SIZE;
+            span->bits = r->pointBits[n - 1];
+            if (span->bits) --span->start;
+        }
+    }
+    n = count_points(r, to - 1);
+    if (n < r->nPoints && r->pointRaw[n] < span->rawEnd) {
+        span->end = r->pointOffs[n];
+        span->rawEnd = r->pointRaw[n];
+    }
+}
+
+/* Per-thread I/O buffers of the read path. The inflate state itself comes
+ * from the per-thread stream pool. */
+typedef struct {
+    uint8_t in[READ_CHUNK_SIZE];
+    uint8_t discard[DISCARD_SIZE];
+} inflate_ctx_t;
+
+static pthread_key_t ctxKey;
+static pthread_once_t ctxKeyOnce = PTHREAD_ONCE_INIT;
+
+static void ctx_key_create(void) {
+    (void)pthread_key_create(&ctxKey, free);
+}
+
+static inflate_ctx_t *get_inflate_ctx(void) {
+    (void)pthread_once(&ctxKeyOnce, ctx_key_create);
+    inflate_ctx_t *ctx = (inflate_ctx_t *)pthread_getspecific(ctxKey);
+    if (ctx) return ctx;
+
+    ctx = (inflate_ctx_t *)malloc(sizeof(inflate_ctx_t));
+    if (!ctx) return NULL;
+    if (pthread_setspecific(ctxKey, ctx) != 0) {
+        free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+/* Reads the SIZE bytes at OFFSET of the data file of R into BUF. Returns
+ * false if they could not all be read. */
+static bool pread_all(const mgz_reader_t *r, void *buf, uint64_t size,
+                      uint64_t offset) {
+    STATS_TIMER_START(t0);
+    for (uint64_t done = 0; done < size;) {
+        ssize_t got = pread(r->fd, voidp_shift(buf, done), size - done,
+                            (off_t)(offset + done));
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        done += got;
+        STATS_ADD(bytesRead, got);
+    }
+    STATS_TIMER_ADD(readNs, t0);
+    return true;
+}
+
+/* Reads the ISIZE field of the gzip member ending at END of IN. */
+static inline uint32_t member_isize(const uint8_t *in, uint64_t end) {
+    const uint8_t *p = in + end - 4;
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+           (uint32_t)p[3] << 24;
+}
+
+/* Inflates the whole gzip member at [START, END) of the data of R into
+ * BUF in one call to the alternate engine of backend.h. This only applies
+ * if the member ends exactly at END and its raw data fits in SIZE, which
+ * is checked against its trailer first; returns -2 if it does not, so
+ * that the caller streams it with zlib instead, which also reports any
+ * corruption the engine rejected. A file-backed member is fetched whole
+ * into a temporary buffer first. */
+static int64_t backend_inflate_block(const mgz_reader_t *r, uint64_t start,
+                                     uint64_t end, void *buf, uint64_t size,
+                                     uint64_t *consumed) {
+    if (end - start < 18) return -2;
+    uint8_t trailer[4];
+    const uint8_t *in = r->map ? r->map + start : NULL;
+    uint32_t isize;
+    if (r->map) {
+        isize = member_isize(r->map, end);
+    } else if (pread_all(r, trailer, 4, end - 4)) {
+        isize = member_isize(trailer, 4);
+    } else {
+        return -2;
+    }
+    if (isize > size) return -2;  // Partial read.
+
+    uint8_t *copy = NULL;
+    if (!r->map) {
+        copy = (uint8_t *)malloc(end - start);
+        STATS_ADD(allocations, 1);
+        if (!copy || !pread_all(r, copy, end - start, start)) {
+            free(copy);
+            return -2;
+        }
+        in = copy;
+    }
+    uint64_t used = 0;
+    STATS_TIMER_START(t0);
+    int64_t got = backend_inflate(buf, size, in, end - start, &used);
+    STATS_TIMER_ADD(inflateNs, t0);
+    free(copy);
+    if (got < 0) return -2;
+    STATS_ADD(blocksInflated, 1);
+    STATS_ADD(bytesInflated, got);
+    if (consumed) *consumed = used;
+    return got;
+}
+
+/* Inflates the gzip member stored at [START, END) of the data file of
+ * R, or the raw deflate data there if SPAN has RAW set, discards the
+ * first SKIP bytes of raw output, and writes at most SIZE of the
+ * following bytes into BUF. If BUF is NULL, all output is
+ * discarded and only counted. Compressed bytes come straight from the
+ * mapping of R if it has one, and otherwise are fetched with pread() so
+ * the file offset of the descriptor is never touched. If CONSUMED is not
+ * NULL, it is set to the number of compressed bytes used. Returns the
+ * number of bytes written to (or counted for) BUF, which is less than
+ * SIZE only if the member ends first, or -1 on error.
+ *
+ * If R has a dictionary, the member's bare header is skipped and its
+ * deflate data is inflated raw with the dictionary set, which gzip mode
+ * does not allow. The trailer is then not checked. Raw data at a
+ * checkpoint of SPAN is resumed the same way with its saved window, after
+ * priming the inflater with the bits of the byte at START that belong to
+ * it. */
+int64_t inflate_block(const mgz_reader_t *r, uint64_t start, uint64_t end,
+                      const block_span_t *span, uint64_t skip, void *buf,
+                      uint64_t size, uint64_t *consumed) {
+    bool raw = span && span->raw;
+    const uint8_t *dict = r->dict;
+    uint64_t dictSize = r->dictSize, header = 0, bits = 0;
+    uint8_t first = 0;
+    if (dictSize && !raw) {
+        header = GZIP_HEADER_SIZE;
+        start += header;
+        raw = true;
+    } else if (raw && span->window) {
+        dict = span->window;
+        dictSize = WINDOW_SIZE;
+        bits = span->bits;
+        if (bits) {
+            bool ok = start < end;
+            if (ok && r->map) {
+                first = r->map[start];
+            } else if (ok) {
+                ok = pread_all(r, &first, 1, start);
+            }
+            if (!ok) {
+                fprintf(stderr, "mgz_reader: failed to read checkpoint.\n");
+                return -1;
+            }
+            header = 1;
+            start += header;
+        }
+    }
+    if (!raw && skip == 0 && buf && backend_active()) {
+        int64_t got =
+            backend_inflate_block(r, start, end, buf, size, consumed);
+        if (got != -2) return got;
+    }
+    inflate_ctx_t *ctx = get_inflate_ctx();
+    z_stream *strm = zpool_inflate(raw ? -15 : 15 + 16);  // +16 for gzip.
+    if (!ctx || !strm ||
+        (bits && inflatePrime(strm, (int)bits, first >> (8 - bits)) != Z_OK) ||
+        (dictSize &&
+         inflateSetDictionary(strm, dict, (uInt)dictSize) != Z_OK)) {
+        fprintf(stderr, "mgz_reader: failed to set up inflate state.\n");
+        return -1;
+    }
+    strm->avail_in = 0;
+    if (!buf) size = UINT64_MAX;
+    STATS_ADD(blocksInflated, 1);
+
+    uint64_t pos = start, produced = 0;
+    while (produced < size) {
+        if (strm->avail_in == 0) {
+            if (pos >= end) {
+                if (!buf) return -1;  // Probing, failure is expected.
+                fprintf(stderr, "mgz_reader: truncated gzip member.\n");
+                return -1;
+            }
+            uint64_t want = end - pos;
+            if (r->map) {
+                if (want > UINT_MAX) want = UINT_MAX;
+                strm->next_in = (Bytef *)r->map + pos;
+            } else {
+                if (want > READ_CHUNK_SIZE) want = READ_CHUNK_SIZE;
+                ssize_t got;
+                STATS_TIMER_START(t0);
+                do {
+                    got = pread(r->fd, ctx->in, want, (off_t)pos);
+                } while (got < 0 && errno == EINTR);
+                STATS_TIMER_ADD(readNs, t0);
+                STATS_ADD(bytesRead, got > 0 ? got : 0);
+                if (got <= 0) {
+                    fprintf(stderr, "mgz_reader: pread failed.\n");
+                    return -1;
+                }
+                want = got;
+                strm->next_in = ctx->in;
+            }
+            pos += want;
+            strm->avail_in = (uInt)want;
+        }
+
+        uint64_t room;
+        if (skip || !buf) {
+            room = skip && skip < DISCARD_SIZE ? skip : DISCARD_SIZE;
+            strm->next_out = ctx->discard;
+        } else {
+            room = size - produced;
+            if (room > UINT_MAX) room = UINT_MAX;
+            strm->next_out = (Bytef *)voidp_shift(buf, produced);
+        }
+        strm->avail_out = (uInt)room;
+        STATS_TIMER_START(t0);
+        int zRet = inflate(strm, Z_NO_FLUSH);
+        STATS_TIMER_ADD(inflateNs, t0);
+        uint64_t have = room - strm->avail_out;
+        STATS_ADD(bytesInflated, have);
+        STATS_ADD(bytesDiscarded, skip ? have : 0);
+        if (skip) {
+            skip -= have;
+        } else {
+            produced += have;
+        }
+        if (zRet == Z_STREAM_END) break;
+        if (zRet != Z_OK && zRet != Z_BUF_ERROR) {
+            if (!buf) return -1;  // Probing, failure is expected.
+            fprintf(stderr, "mgz_reader: inflate failed (%d).\n", zRet);
+            return -1;
+        }
+    }
+    if (consumed) *consumed = header + pos - start - strm->avail_in;
+    return (int64_t)produced;
+}
+
+/* Copies SIZE bytes starting at SKIP of SPAN, which starts at a sync
+ * point or at the start of a block, into BUF through the cache of R,
+ * inflating and inserting the whole span on a miss. Returns the number
+ * of bytes copied, which is less than SIZE only at the end of the span,
+ * or -1 on error. */
+static int64_t cached_read_span(const mgz_reader_t *r,
+                                const block_span_t *span, uint64_t skip,
+                                void *buf, uint64_t size) {
+    cache_key_t key = {r->dev,   r->ino,      r->fileSize,
+                       r->mtime, span->start, span->end};
+    int64_t got = cache_read(r->cache, &key, skip, buf, size);
+    if (got >= 0) return got;
+
+    uint64_t capacity = span->rawEnd - span->rawStart;
+    void *raw = malloc(capacity ? capacity : 1);
+    STATS_ADD(allocations, 1);
+    if (!raw) {
+        fprintf(stderr, "mgz_reader: malloc failed.\n");
+        return -1;
+    }
+    int64_t rawSize = inflate_block(r, span->start, span->end, span, 0, raw,
+                                    capacity, NULL);
+    if (rawSize < 0) {
+        free(raw);
+        return -1;
+    }
+    if ((uint64_t)rawSize < capacity) {
+        /* Last block. Give the unused tail back before caching it. */
+        void *shrunk = realloc(raw, rawSize ? rawSize : 1);
+        if (shrunk) raw = shrunk;
+    }
+    if (skip > (uint64_t)rawSize) skip = rawSize;
+    got = (uint64_t)rawSize - skip < size ? rawSize - (int64_t)skip
+                                           : (int64_t)size;
+    memcpy(buf, voidp_shift(raw, skip), got);
+    cache_insert(r->cache, &key, raw, rawSize);
+    return got;
+}
+
+/* Copies SIZE bytes starting at SKIP of block BLOCK into BUF through the
+ * cache of R. A block with sync points is cached span by span, so that a
+ * small read of a large member only inflates the span around it. Returns
+ * the number of bytes copied or -1 on error. */
+int64_t cached_read_block(const mgz_reader_t *r, uint64_t block,
+                          uint64_t skip, void *buf, uint64_t size) {
+    uint64_t pos = block_raw_start(r, block) + skip, done = 0;
+    while (done < size) {
+        block_span_t span;
+        block_span(r, block, pos, pos + 1, &span);
+        int64_t got = cached_read_span(r, &span, pos - span.rawStart,
+                                       voidp_shift(buf, done), size - done);
+        if (got < 0) return -1;
+        if (got == 0) break;  // End of the data.
+        done += (uint64_t)got;
+        pos += (uint64_t)got;
+    }
+    return (int64_t)done;
+}
+
+/* Tells the kernel that the mapped compressed bytes [START, END) of R
+ * are about to be read, so that page faults on them are served from
+ * readahead. */
+static void advise_range(const mgz_reader_t *r, uint64_t start,
+                         uint64_t end) {
+    uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+    uint64_t from = start / page * page;
+    if (end <= from) return;
+    (void)madvise((void *)(r->map + from), end - from, MADV_WILLNEED);
+}
+
+/* Reads SIZE bytes at raw OFFSET through the lookup table of R. When the
+ * range covers more than one block, the blocks are inflated in parallel,
+ * each straight into its own slice of BUF. Uncached reads inflate only
+ * the part of each block between the sync points around the range if
+ * the lookup table has any. */
+static uint64_t reader_read(const mgz_reader_t *r, void *buf, uint64_t size,
+                            uint64_t offset) {
+    uint64_t first = find_block(r, offset);
+    if (first >= r->nBlocks) return 0;
+    uint64_t last = find_block(r, offset + size - 1);
+    if (last >= r->nBlocks) last = r->nBlocks - 1;
+
+    if (r->mapSize) advise_range(r, r->lookup[first], block_end(r, last));
+
+    /* Only the last block of the data can end short of the next block's
+     * raw offset, so the bytes read add up to a contiguous prefix of
+     * BUF. */
+    uint64_t total = 0;
+    bool failed = false;
+#pragma omp parallel for schedule(dynamic) reduction(+ : total) \
+    if (last > first)
+    for (uint64_t block = first; block <= last; ++block) {
+        uint64_t start = block_raw_start(r, block);
+        uint64_t skip = block == first ? offset - start : 0;
+        uint64_t dst = block == first ? 0 : start - offset;
+        uint64_t want = block_raw_start(r, block + 1) - start - skip;
+        if (want > size - dst) want = size - dst;
+        block_span_t span;
+        block_span(r, block, start + skip, start + skip + want, &span);
+        int64_t got =
+            r->cache ? cached_read_block(r, block, skip,
+                                         voidp_shift(buf, dst), want)
+                     : inflate_block(r, span.start, span.end, &span,
+                                     start + skip - span.rawStart,
+                                     voidp_shift(buf, dst), want, NULL);
+        if (got < 0) {
+            failed = true;
+        } else {
+            total += got;
+        }
+    }
+    return failed ? 0 : total;
+}
+
+static bool get_file_size(int fd, uint64_t *size) {
+    struct stat st;
+    if (fstat(fd, &st) < 0) return false;
+    *size = (uint64_t)st.st_size;
+    return true;
+}
+
+/* Sets the identity of the data file FD, under which R caches blocks. */
+static bool get_file_id(int fd, mgz_reader_t *r) {
+    struct stat st;
+    if (fstat(fd, &st) < 0) return false;
+    r->dev = (uint64_t)st.st_dev;
+    r->ino = (uint64_t)st.st_ino;
+    r->fileSize = (uint64_t)st.st_size;
+    r->mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000 +
+               (uint64_t)st.st_mtim.tv_nsec;
+    return true;
+}
+
+/* Reads up to SIZE bytes at OFFSET of the lookup file LOOKUP into BUF
+ * with pread(), so that the offset of its descriptor, and the position of
+ * LOOKUP, are left alone and threads may share it. A stream without a
+ * descriptor, such as one from fmemopen(), is read with fseeko() and
+ * fread() instead, which moves its position. Returns the number of bytes
+ * read, which is less than SIZE only at the end of the file, or -1 on
+ * error. */
+static int64_t lookup_pread(FILE *lookup, void *buf, uint64_t size,
+                            uint64_t offset) {
+    int fd = fileno(lookup);
+    if (fd < 0) {
+        if (fseeko(lookup, (off_t)offset, SEEK_SET) < 0) return -1;
+        uint64_t got = fread(buf, 1, size, lookup);
+        return got < size && ferror(lookup) ? -1 : (int64_t)got;
+    }
+    uint64_t done = 0;
+    while (done < size) {
+        ssize_t got = pread(fd, voidp_shift(buf, done), size - done,
+                            (off_t)(offset + done));
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) return -1;
+        if (got == 0) break;
+        done += got;
+    }
+    return (int64_t)done;
+}
+
+/* Opens a reader for the self-describing archive FD whose embedded index
+ * IDX was already loaded. Takes ownership of the offsets of IDX. The data
+ * is mapped read-only if MAPPED is set. */
+static mgz_reader_t *reader_from_index(int fd, const mgz_index_t *idx,
+                                       bool mapped) {
+    mgz_reader_t *r = (mgz_reader_t *)calloc(1, sizeof(mgz_reader_t));
+    if (!r) {
+        fprintf(stderr, "mgz_reader_open: malloc failed.\n");
+        free(idx->offsets);
+        return NULL;
+    }
+    r->fd = fd;
+    r->blockSize = idx->blockSize;
+    r->nBlocks = idx->nBlocks;
+    r->dataSize = idx->dataSize;
+    r->lookup = idx->offsets;
+    r->lookupMap = idx->offsets;
+    r->crc = idx->crc;
+    r->hasCrc = idx->hasCrc;
+    r->indexed = true;
+    if (!get_file_id(fd, r)) {
+        fprintf(stderr, "mgz_reader_open: invalid data file.\n");
+        mgz_reader_close(r);
+        return NULL;
+    }
+    if (mapped) {
+        /* Only the data members are mapped; the index is already in
+         * memory. */
+        void *map = mmap(NULL, r->dataSize, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+            fprintf(stderr, "mgz_reader_open: mmap failed.\n");
+            mgz_reader_close(r);
+            return NULL;
+        }
+        r->map = (const uint8_t *)map;
+        r->mapSize = r->dataSize;
+    }
+    return r;
+}
+
+static mgz_reader_t *reader_open_indexed(int fd, bool mapped) {
+    mgz_index_t idx;
+    STATS_TIMER_START(t0);
+    bool found = index_read(fd, &idx);
+    STATS_TIMER_ADD(lookupNs, t0);
+    if (!found) {
+        fprintf(stderr, "mgz_reader_open: no valid embedded index.\n");
+        return NULL;
+    }
+    return reader_from_index(fd, &idx, mapped);
+}
+
+/* Points the block tables of R into the NWORDS words of a lookup file
+ * at WORDS. Returns false if they do not form a valid lookup table. */
+static bool parse_lookup(mgz_reader_t *r, const uint64_t *words,
+                         uint64_t nWords) {
+    if (nWords < 2) return false;
+    if (words[0] != 0) {
+        r->blockSize = words[0];
+        r->nBlocks = nWords - 1;
+        r->lookup = words + 1;
+        return true;
+    }
+
+    /* Blocks of varying raw size, possibly followed by sync points,
+     * checkpoints or a dictionary. */
+    if (nWords < VARIABLE_LOOKUP_HEADER ||
+        (words[1] != VARIABLE_LOOKUP_VERSION &&
+         words[1] != SYNC_LOOKUP_VERSION &&
+         words[1] != PRIMED_LOOKUP_VERSION &&
+         words[1] != CHECKPOINT_LOOKUP_VERSION) ||
+        words[2] == 0 || words[2] > nWords) {
+        return false;
+    }
+    bool checkpoints = words[1] == CHECKPOINT_LOOKUP_VERSION;
+    bool sync = words[1] == SYNC_LOOKUP_VERSION || checkpoints;
+    bool primed = words[1] == PRIMED_LOOKUP_VERSION;
+    uint64_t tableWords = VARIABLE_LOOKUP_HEADER + 2 * words[2] + 1;
+    uint64_t nPoints = sync && nWords > tableWords ? words[tableWords] : 0;
+    uint64_t dictSize = primed && nWords > tableWords ? words[tableWords] : 0;
+    uint64_t dictWords =
+        (dictSize + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    uint64_t pointWords =
+        checkpoints ? 3 + WINDOW_SIZE / sizeof(uint64_t) : 2;
+    if (nPoints > nWords || (primed && dictSize == 0) ||
+        dictSize > MAX_DICT_SIZE ||
+        nWords != tableWords + (sync     ? 1 + pointWords * nPoints
+                                : primed ? 1 + dictWords
+                                         : 0)) {
+        return false;
+    }
+    r->nBlocks = words[2];
+    r->lookup = words + VARIABLE_LOOKUP_HEADER;
+    r->rawLookup = r->lookup + r->nBlocks;
+    r->blockSize = 0;
+    for (uint64_t i = 0; i < r->nBlocks; ++i) {
+        if (r->rawLookup[i + 1] <= r->rawLookup[i]) return false;
+        if (r->rawLookup[i + 1] - r->rawLookup[i] > r->blockSize) {
+            r->blockSize = r->rawLookup[i + 1] - r->rawLookup[i];
+        }
+    }
+    if (sync) {
+        r->nPoints = nPoints;
+        r->pointRaw = words + tableWords + 1;
+        r->pointOffs = r->pointRaw + r->nPoints;
+        for (uint64_t i = 1; i < r->nPoints; ++i) {
+            if (r->pointRaw[i] <= r->pointRaw[i - 1]) return false;
+        }
+    }
+    if (checkpoints) {
+        r->pointBits = r->pointOffs + r->nPoints;
+        r->windows = (const uint8_t *)(r->pointBits + r->nPoints);
+        for (uint64_t i = 0; i < r->nPoints; ++i) {
+            if (r->pointBits[i] > 7 || r->pointOffs[i] == 0) return false;
+        }
+    }
+    if (primed) {
+        r->dictSize = dictSize;
+        r->dict = (const uint8_t *)(words + tableWords + 1);
+    }
+    return true;
+}
+
+/* Sets *SIZE to the size of the lookup file LOOKUP, seeking to its end
+ * if it has no descriptor. Returns false if an error occurred. */
+static bool get_lookup_size(FILE *lookup, uint64_t *size) {
+    if (fileno(lookup) >= 0) return get_file_size(fileno(lookup), size);
+    off_t end;
+    if (fseeko(lookup, 0, SEEK_END) < 0 || (end = ftello(lookup)) < 0) {
+        return false;
+    }
+    *size = (uint64_t)end;
+    return true;
+}
+
+/* Loads the whole lookup file LOOKUP into R, mapping it read-only if
+ * MAPPED is set and LOOKUP has a descriptor. Returns false if an error
+ * occurred. */
+static bool load_lookup(mgz_reader_t *r, FILE *lookup, bool mapped) {
+    uint64_t lookupSize;
+    if (!get_lookup_size(lookup, &lookupSize) ||
+        lookupSize < 2 * sizeof(uint64_t)) {
+        return false;
+    }
+    void *words;
+    if (mapped && fileno(lookup) >= 0) {
+        /* Mappings are page aligned, so the tables are aligned. */
+        words =
+            mmap(NULL, lookupSize, PROT_READ, MAP_SHARED, fileno(lookup), 0);
+        if (words == MAP_FAILED) return false;
+        r->lookupMapSize = lookupSize;
+    } else {
+        words = malloc(lookupSize);
+        if (!words) return false;
+        if (lookup_pread(lookup, words, lookupSize, 0) !=
+            (int64_t)lookupSize) {
+            free(words);
+            return false;
+        }
+    }
+    r->lookupMap = words;
+    return parse_lookup(r, (const uint64_t *)words,
+                        lookupSize / sizeof(uint64_t));
+}
+
+/* Opens a reader for FD and the lookup file at LOOKUPPATH, or the index
+ * embedded in FD if LOOKUPPATH is NULL. The data and the lookup table are
+ * mapped read-only if MAPPED is set, and read with pread() and loaded into
+ * memory otherwise. */
+static mgz_reader_t *reader_open(int fd, const char *lookupPath,
+                                 bool mapped) {
+    if (fd < 0) return NULL;
+    if (!lookupPath) return reader_open_indexed(fd, mapped);
+    FILE *lookup = fopen(lookupPath, "rb");
+    if (!lookup) {
+        fprintf(stderr, "mgz_reader_open: failed to open lookup file.\n");
+        return NULL;
+    }
+    mgz_reader_t *r = (mgz_reader_t *)calloc(1, sizeof(mgz_reader_t));
+    if (!r) {
+        fprintf(stderr, "mgz_reader_open: malloc failed.\n");
+        goto _bailout;
+    }
+    r->fd = fd;
+    if (!get_file_size(fd, &r->dataSize) ||
+        !get_file_id(fd, r)) {
+        fprintf(stderr, "mgz_reader_open: invalid data file.\n");
+        goto _bailout;
+    }
+    STATS_TIMER_START(t0);
+    bool loaded = load_lookup(r, lookup, mapped);
+    STATS_TIMER_ADD(lookupNs, t0);
+    if (!loaded || r->blockSize == 0) {
+        fprintf(stderr, "mgz_reader_open: invalid lookup file.\n");
+        goto _bailout;
+    }
+    if (mapped) {
+        void *map = mmap(NULL, r->dataSize, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+            fprintf(stderr, "mgz_reader_open: mmap failed.\n");
+            goto _bailout;
+        }
+        r->map = (const uint8_t *)map;
+        r->mapSize = r->dataSize;
+    }
+    fclose(lookup);
+    return r;
+
+_bailout:
+    fclose(lookup);
+    mgz_reader_close(r);
+    return NULL;
+}
+
+mgz_reader_t *mgz_reader_open(int fd, const char *lookupPath) {
+    STATS_TIMER_START(t0);
+    mgz_reader_t *r = reader_open(fd, lookupPath, false);
+    STATS_CALL_END("mgz_reader_open", t0);
+    return r;
+}
+
+mgz_reader_t *mgz_reader_open_mmap(int fd, const char *lookupPath) {
+    STATS_TIMER_START(t0);
+    mgz_reader_t *r = reader_open(fd, lookupPath, true);
+    STATS_CALL_END("mgz_reader_open_mmap", t0);
+    return r;
+}
+
+uint64_t mgz_reader_read(mgz_reader_t *r, void *buf, uint64_t size,
+                         uint64_t offset) {
+    if (!r || !buf || !size) return 0;
+    STATS_TIMER_START(t0);
+    uint64_t ret = reader_read(r, buf, size, offset);
+    STATS_CALL_END("mgz_reader_read", t0);
+    return ret;
+}
+
+/* Sets *SIZE to the total raw size of the data of R. Returns false if
+ * its last block is corrupt. */
+static bool reader_raw_size(const mgz_reader_t *r, uint64_t *size) {
+    if (r->rawLookup) {
+        *size = r->rawLookup[r->nBlocks];
+        return true;
+    }
+
+    /* The last block is inflated with the output discarded rather than
+     * trusting the trailer at the end of the data, which belongs to the
+     * embedded index if a lookup file is used on an indexed archive. */
+    uint64_t consumed = 0, last = r->nBlocks - 1;
+    int64_t lastSize = inflate_block(r, r->lookup[last], block_end(r, last),
+                                     NULL, 0, NULL, 0, &consumed);
+    if (lastSize < 0) return false;
+    *size = last * r->blockSize + (uint64_t)lastSize;
+    return true;
+}
+
+bool mgz_reader_get_info(const mgz_reader_t *r, mgz_info_t *info) {
+    if (!r || !info) return false;
+    memset(info, 0, sizeof(*info));
+    info->blockSize = r->blockSize;
+    info->nBlocks = r->nBlocks;
+    info->dataSize = r->dataSize;
+    info->variable = r->rawLookup != NULL;
+    info->nPoints = r->nPoints;
+    info->checkpoints = r->windows != NULL;
+    info->dictSize = r->dictSize;
+    info->indexed = r->indexed;
+    info->hasCrc = r->hasCrc;
+    info->crc = r->crc;
+    return reader_raw_size(r, &info->rawSize);
+}
+
+void mgz_reader_set_cache(mgz_reader_t *r, mgz_cache_t *c) {
+    if (r) r->cache = c;
+}
+
+void mgz_reader_close(mgz_reader_t *r) {
+    if (!r) return;
+    if (r->lookupMapSize) {
+        munmap(r->lookupMap, r->lookupMapSize);
+    } else {
+        free(r->lookupMap);
+    }
+    if (r->mapSize) munmap((void *)r->map, r->mapSize);
+    free(r);
+}
+
+static uint64_t lookup_read(void *buf, uint64_t size, uint64_t offset,
+                            int fd, FILE *lookup) {
+    if (!lookup) {
+        mgz_reader_t *r = reader_open_indexed(fd, false);
+        if (!r) return 0;
+        uint64_t ret = reader_read(r, buf, size, offset);
+        mgz_reader_close(r);
+        return ret;
+    }
+
+    /* Read block size from lookup file. */
+    STATS_TIMER_START(t0);
+    uint64_t blockSize;
+    if (lookup_pread(lookup, &blockSize, sizeof(uint64_t), 0) !=
+        sizeof(uint64_t)) {
+        fprintf(stderr, "mgz_read: failed to read block size from lookup.\n");
+        return 0;
+    }
+    if (blockSize == 0) {
+        /* Blocks of varying size: load the whole table to find the
+         * range. */
+        mgz_reader_t r = {.fd = fd};
+        uint64_t ret = 0;
+        bool loaded =
+            get_file_size(fd, &r.dataSize) && load_lookup(&r, lookup, false);
+        STATS_TIMER_ADD(lookupNs, t0);
+        if (!loaded) {
+            fprintf(stderr, "mgz_read: failed to read lookup table.\n");
+        } else {
+            ret = reader_read(&r, buf, size, offset);
+        }
+        free(r.lookupMap);
+        return ret;
+    }
+
+    /* Load only the lookup entries covering the requested range plus
+     * the start of the block that follows it. */
+    uint64_t first = offset / blockSize;
+    uint64_t count = (offset + size - 1) / blockSize - first + 1;
+    uint64_t *entries = (uint64_t *)malloc((count + 1) * sizeof(uint64_t));
+    STATS_ADD(allocations, 1);
+    if (!entries) {
+        fprintf(stderr, "mgz_read: malloc failed.\n");
+        return 0;
+    }
+    int64_t got = lookup_pread(lookup, entries,
+                               (count + 1) * sizeof(uint64_t),
+                               (first + 1) * sizeof(uint64_t));
+    if (got < 0) {
+        fprintf(stderr, "mgz_read: failed to read lookup table.\n");
+        free(entries);
+        return 0;
+    }
+    uint64_t n = (uint64_t)got / sizeof(uint64_t);
+    if (n == 0) {
+        free(entries);
+        return 0;  // OFFSET is past the end of the data.
+    }
+    if (n <= count) {
+        /* The range reaches the last block, which ends at EOF. */
+        if (!get_file_size(fd, &entries[n])) {
+            fprintf(stderr, "mgz_read: fstat failed.\n");
+            free(entries);
+            return 0;
+        }
+        count = n;
+    }
+    STATS_TIMER_ADD(lookupNs, t0);
+
+    mgz_reader_t r = {.fd = fd,
+                      .blockSize = blockSize,
+                      .nBlocks = count,
+                      .dataSize = entries[count],
+                      .lookup = entries};
+    uint64_t ret = reader_read(&r, buf, size, offset - first * blockSize);
+    free(entries);
+    return ret;
+}
+
+uint64_t mgz_read(void *buf, uint64_t size, uint64_t offset, int fd,
+                  FILE *lookup) {
+    if (!buf || !size) return 0;
+    STATS_TIMER_START(t0);
+    uint64_t ret = lookup_read(buf, size, offset, fd, lookup);
+    STATS_CALL_END("mgz_read", t0);
+    return ret;
+}
+
+/* Returns true if the bytes at P look like the start of a gzip member
+ * header with the deflate method and no reserved flags set. */
+static inline bool is_member_candidate(const uint8_t *p, uint64_t avail) {
+    return avail >= 18 && p[0] == 0x1f && p[1] == 0x8b && p[2] == 8 &&
+           (p[3] & 0xe0) == 0;
+}
+
+/* Finds the gzip members of the INSIZE bytes at IN without a lookup
+ * table. Every position that looks like a member header is probed by
+ * inflating from it in parallel with the output discarded; the real
+ * members are then the chain of probes that starts at offset 0 and ends
+ * exactly at INSIZE. On success, sets *OFFS and *RAWOFFS to malloc'ed
+ * arrays of (count + 1) compressed and raw offsets, the last entries
+ * holding the total sizes, and returns the number of members. Returns
+ * -1 if IN is not a sequence of gzip members or an error occurred. */
+static int64_t scan_members(const uint8_t *in, uint64_t inSize,
+                            uint64_t **offs, uint64_t **rawOffs) {
+    *offs = *rawOffs = NULL;
+    if (!is_member_candidate(in, inSize)) return -1;
+
+    /* Collect candidates chunk by chunk in parallel. */
+    int nChunks = omp_get_max_threads() * 4;
+    uint64_t chunkSize = (inSize + nChunks - 1) / nChunks;
+    uint64_t *nFound = (uint64_t *)calloc(nChunks, sizeof(uint64_t));
+    uint64_t **found = (uint64_t **)calloc(nChunks, sizeof(uint64_t *));
+    uint64_t nCand = 0;
+    uint64_t *cand = NULL, *candEnd = NULL, *candRaw = NULL;
+    int64_t ret = -1;
+    if (!nFound || !found) goto _bailout;
+    bool oom = false;
+#pragma omp parallel for schedule(dynamic)
+    for (int c = 0; c < nChunks; ++c) {
+        uint64_t from = c * chunkSize, to = from + chunkSize, capacity = 0;
+        if (to > inSize) to = inSize;
+        for (uint64_t i = from; i < to; ++i) {
+            const uint8_t *p = (const uint8_t *)memchr(in + i, 0x1f, to - i);
+            if (!p) break;
+            i = p - in;
+            if (!is_member_candidate(p, inSize - i)) continue;
+            if (nFound[c] == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                uint64_t *grown = (uint64_t *)realloc(
+                    found[c], capacity * sizeof(uint64_t));
+                if (!grown) {
+                    oom = true;
+                    break;
+                }
+                found[c] = grown;
+            }
+            found[c][nFound[c]++] = i;
+        }
+    }
+    if (oom) goto _bailout;
+    for (int c = 0; c < nChunks; ++c) nCand += nFound[c];
+    cand = (uint64_t *)malloc(nCand * sizeof(uint64_t));
+    candEnd = (uint64_t *)malloc(nCand * sizeof(uint64_t));
+    candRaw = (uint64_t *)malloc(nCand * sizeof(uint64_t));
+    *offs = (uint64_t *)malloc((nCand + 1) * sizeof(uint64_t));
+    *rawOffs = (uint64_t *)malloc((nCand + 1) * sizeof(uint64_t));
+    if (!cand || !candEnd || !candRaw || !*offs || !*rawOffs) goto _bailout;
+    for (uint64_t c = 0, k = 0; c < (uint64_t)nChunks; k += nFound[c++]) {
+        if (nFound[c]) memcpy(cand + k, found[c], nFound[c] * sizeof(uint64_t));
+    }
+
+    /* Probe every candidate. A failed probe ends at offset 0, which no
+     * member can end at. */
+    mgz_reader_t src = {.fd = -1, .map = in};
+#pragma omp parallel for schedule(dynamic)
+    for (uint64_t i = 0; i < nCand; ++i) {
+        uint64_t consumed = 0;
+        int64_t raw =
+            inflate_block(&src, cand[i], inSize, NULL, 0, NULL, 0,
+                          &consumed);
+        candEnd[i] = raw < 0 ? 0 : cand[i] + consumed;
+        candRaw[i] = raw < 0 ? 0 : (uint64_t)raw;
+    }
+
+    /* Follow the chain of members from offset 0. */
+    uint64_t n = 0, raw = 0;
+    for (uint64_t i = 0; candEnd[i] != 0;) {
+        (*offs)[n] = cand[i];
+        (*rawOffs)[n] = raw;
+        raw += candRaw[i];
+        ++n;
+        uint64_t end = candEnd[i];
+        if (end == inSize) {
+            (*offs)[n] = inSize;
+            (*rawOffs)[n] = raw;
+            ret = (int64_t)n;
+            break;
+        }
+        while (i < nCand && cand[i] < end) ++i;
+        if (i == nCand || cand[i] != end) break;  // Broken chain.
+    }
+
+_bailout:
+    if (found)
+        for (int c = 0; c < nChunks; ++c) free(found[c]);
+    free(found);
+    free(nFound);
+    free(cand);
+    free(candEnd);
+    free(candRaw);
+    if (ret < 0) {
+        free(*offs);
+        free(*rawOffs);
+        *offs = *rawOffs = NULL;
+    }
+    return ret;
+}
+
+/* Inflates members [FIRST, LAST) of IN, described by the compressed and
+ * raw offsets OFFS and RAWOFFS, in parallel into OUT, which receives
+ * member i at RAWOFFS[i] - RAWOFFS[FIRST]. Returns false if any member
+ * does not inflate to exactly its expected size. */
+static bool inflate_members(const mgz_reader_t *src, const uint64_t *offs,
+                            const uint64_t *rawOffs, uint64_t first,
+                            uint64_t last, void *out) {
+    bool ok = true;
+#pragma omp parallel for schedule(dynamic)
+    for (uint64_t i = first; i < last; ++i) {
+        uint64_t rawSize = rawOffs[i + 1] - rawOffs[i];
+        int64_t got = inflate_block(
+            src, offs[i], offs[i + 1], NULL, 0,
+            voidp_shift(out, rawOffs[i] - rawOffs[first]), rawSize, NULL);
+        if (got != (int64_t)rawSize) ok = false;
+    }
+    return ok;
+}
+
+static uint64_t parallel_inflate(void **out, const void *in,
+                                 uint64_t inSize, const uint64_t *lookup,
+                                 uint64_t nBlocks, uint64_t blockSize) {
+    *out = NULL;
+    if (!in || inSize == 0) return 0;
+    mgz_reader_t src = {.fd = -1, .map = (const uint8_t *)in};
+    uint64_t *offs = NULL, *rawOffs = NULL, outSize = 0;
+
+    if (lookup) {
+        if (nBlocks == 0 || blockSize == 0) return 0;
+
+        /* Size the output from the block count and block size; the last
+         * block's size comes from its gzip trailer when it fits. The
+         * trailer only holds the size modulo 2^32, so with larger blocks
+         * room is made for a whole last block, and the output is cut
+         * down to what it really holds. */
+        src.blockSize = blockSize;
+        src.nBlocks = nBlocks;
+        src.dataSize = inSize;
+        src.lookup = lookup;
+        uint64_t lastSize = blockSize;
+        bool exact = blockSize <= UINT32_MAX;
+        if (exact && inSize >= lookup[nBlocks - 1] + 18) {
+            lastSize = member_isize(src.map, inSize);
+        }
+        outSize = (nBlocks - 1) * blockSize + lastSize;
+        *out = malloc(outSize ? outSize : 1);
+        STATS_ADD(allocations, 1);
+        uint64_t got = *out ? reader_read(&src, *out, outSize, 0) : 0;
+        if (got != outSize &&
+            (exact || got <= (nBlocks - 1) * blockSize)) {
+            fprintf(stderr, "mgz_parallel_inflate: inflate failed.\n");
+            goto _bailout;
+        }
+        if (got != outSize) {
+            outSize = got;
+            void *shrunk = realloc(*out, outSize);
+            if (shrunk) *out = shrunk;
+        }
+    } else {
+        int64_t n = scan_members(src.map, inSize, &offs, &rawOffs);
+        if (n < 0) {
+            fprintf(stderr,
+                    "mgz_parallel_inflate: input is not a sequence of gzip "
+                    "members.\n");
+            return 0;
+        }
+        outSize = rawOffs[n];
+        *out = malloc(outSize ? outSize : 1);
+        STATS_ADD(allocations, 1);
+        if (!*out || !inflate_members(&src, offs, rawOffs, 0, n, *out)) {
+            fprintf(stderr, "mgz_parallel_inflate: inflate failed.\n");
+            goto _bailout;
+        }
+    }
+    free(offs);
+    free(rawOffs);
+    return outSize;
+
+_bailout:
+    free(*out);
+    *out = NULL;
+    free(offs);
+    free(rawOffs);
+    return 0;
+}
+
+uint64_t mgz_parallel_inflate(void **out, const void *in, uint64_t inSize,
+                              const uint64_t *lookup, uint64_t nBlocks,
+                              uint64_t blockSize) {
+    STATS_TIMER_START(t0);
+    uint64_t ret =
+        parallel_inflate(out, in, inSize, lookup, nBlocks, blockSize);
+    STATS_CALL_END("mgz_parallel_inflate", t0);
+    return ret;
+}
+
+static void write_or_die(const void *buf, uint64_t size, FILE *outfile) {
+    if (fwrite(buf, 1, size, outfile) != size) {
+        fprintf(stderr,
+                "mgz_parallel_inflate_file: (FATAL) failed to write to "
+                "outfile.\n");
+        exit(1);
+    }
+}
+
+static uint64_t parallel_inflate_file(int infd, const char *lookupPath,
+                                      FILE *outfile) {
+    uint64_t total = 0;
+    int nThreads = omp_get_max_threads();
+
+    /* Without a lookup file, prefer an embedded index to scanning. */
+    mgz_index_t idx;
+    mgz_reader_t *r = NULL;
+    STATS_TIMER_START(t0);
+    bool indexed = !lookupPath && index_read(infd, &idx);
+    STATS_TIMER_ADD(lookupNs, t0);
+    if (lookupPath) {
+        r = reader_open(infd, lookupPath, false);
+        if (!r) return 0;
+    } else if (indexed) {
+        r = reader_from_index(infd, &idx, false);
+        if (!r) return 0;
+    }
+
+    if (r) {
+        /* Read consecutive windows of a few blocks per thread, up to the
+         * raw size, so that a corrupt block does not pass for the end. */
+        uint64_t window = r->blockSize * nThreads * 2, rawSize;
+        void *buf = malloc(window);
+        if (!buf || !reader_raw_size(r, &rawSize)) {
+            fprintf(stderr,
+                    buf ? "mgz_parallel_inflate_file: invalid archive.\n"
+                        : "mgz_parallel_inflate_file: malloc failed.\n");
+            free(buf);
+            mgz_reader_close(r);
+            return 0;
+        }
+        while (total < rawSize) {
+            uint64_t want =
+                rawSize - total < window ? rawSize - total : window;
+            uint64_t got = reader_read(r, buf, want, total);
+            write_or_die(buf, got, outfile);
+            total += got;
+            if (got < want) break;
+        }
+        free(buf);
+        mgz_reader_close(r);
+        if (total != rawSize) {
+            fprintf(stderr, "mgz_parallel_inflate_file: inflate failed.\n");
+            return 0;
+        }
+        return total;
+    }
+
+    /* No lookup table or index: map the file and find the members first. */
+    uint64_t inSize;
+    if (!get_file_size(infd, &inSize) || inSize == 0) return 0;
+    void *map = mmap(NULL, inSize, PROT_READ, MAP_PRIVATE, infd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "mgz_parallel_inflate_file: mmap failed.\n");
+        return 0;
+    }
+    (void)madvise(map, inSize, MADV_SEQUENTIAL);
+    mgz_reader_t src = {.fd = infd, .map = (const uint8_t *)map};
+    uint64_t *offs, *rawOffs;
+    int64_t n = scan_members(src.map, inSize, &offs, &rawOffs);
+    if (n < 0) {
+        fprintf(stderr,
+                "mgz_parallel_inflate_file: input is not a sequence of "
+                "gzip members.\n");
+        munmap(map, inSize);
+        return 0;
+    }
+
+    /* Inflate windows of about two members per thread at a time. */
+    uint64_t maxRaw = 0;
+    for (int64_t i = 0; i < n; ++i) {
+        if (rawOffs[i + 1] - rawOffs[i] > maxRaw) {
+            maxRaw = rawOffs[i + 1] - rawOffs[i];
+        }
+    }
+    uint64_t window = maxRaw * nThreads * 2;
+    void *buf = malloc(window ? window : 1);
+    if (!buf) {
+        fprintf(stderr, "mgz_parallel_inflate_file: malloc failed.\n");
+        n = 0;
+    }
+    for (int64_t first = 0; first < n;) {
+        int64_t last = first + 1;
+        while (last < n && rawOffs[last + 1] - rawOffs[first] <= window) {
+            ++last;
+        }
+        if (!inflate_members(&src, offs, rawOffs, first, last, buf)) {
+            fprintf(stderr, "mgz_parallel_inflate_file: inflate failed.\n");
+            total = 0;
+            break;
+        }
+        write_or_die(buf, rawOffs[last] - rawOffs[first], outfile);
+        total = rawOffs[last];
+        first = last;
+    }
+    free(buf);
+    free(offs);
+    free(rawOffs);
+    munmap(map, inSize);
+    return total;
+}
+
+uint64_t mgz_parallel_inflate_file(int infd, const char *lookupPath,
+                                   FILE *outfile) {
+    STATS_TIMER_START(t0);
+    uint64_t ret = parallel_inflate_file(infd, lookupPath, outfile);
+    STATS_CALL_END("mgz_parallel_inflate_file", t0);
+    return ret;
+}
+
+/* Checkpoints inside gzip members, kept as the arrays of a lookup table
+ * of version 4. */
+typedef struct {
+    uint64_t n;
+    uint64_t capacity;
+    uint64_t *raw;
+    uint64_t *offs;
+    uint64_t *bits;
+    uint8_t *windows;
+} points_t;
+
+static void points_free(points_t *p) {
+    free(p->raw);
+    free(p->offs);
+    free(p->bits);
+    free(p->windows);
+}
+
+/* Adds to P a checkpoint at raw offset RAW and compressed offset OFF with
+ * BITS bits to prime. WINDOW is the circular output buffer of the
+ * inflater with LEFT bytes still free, so the oldest data comes first
+ * from WINDOW + WINDOW_SIZE - LEFT. Returns false if out of memory. */
+static bool points_add(points_t *p, uint64_t raw, uint64_t off,
+                       uint64_t bits, const uint8_t *window, uint64_t left) {
+    if (p->n == p->capacity) {
+        uint64_t capacity = p->capacity ? 2 * p->capacity : 16;
+        uint64_t *grownRaw =
+            (uint64_t *)realloc(p->raw, capacity * sizeof(uint64_t));
+        if (grownRaw) p->raw = grownRaw;
+        uint64_t *grownOffs =
+            (uint64_t *)realloc(p->offs, capacity * sizeof(uint64_t));
+        if (grownOffs) p->offs = grownOffs;
+        uint64_t *grownBits =
+            (uint64_t *)realloc(p->bits, capacity * sizeof(uint64_t));
+        if (grownBits) p->bits = grownBits;
+        uint8_t *grownWindows =
+            (uint8_t *)realloc(p->windows, capacity * WINDOW_SIZE);
+        if (grownWindows) p->windows = grownWindows;
+        if (!grownRaw || !grownOffs || !grownBits || !grownWindows) {
+            return false;
+        }
+        p->capacity = capacity;
+    }
+    uint8_t *dst = p->windows + p->n * WINDOW_SIZE;
+    memcpy(dst, window + WINDOW_SIZE - left, left);
+    memcpy(dst + left, window, WINDOW_SIZE - left);
+    p->raw[p->n] = raw;
+    p->offs[p->n] = off;
+    p->bits[p->n] = bits;
+    ++p->n;
+    return true;
+}
+
+/* Inflates the gzip member at offset START of the INSIZE bytes at IN,
+ * whose raw data starts at raw offset RAWSTART, with the output
+ * discarded, and adds to PTS a checkpoint at the first deflate block
+ * boundary past every SPAN raw bytes, as zran.c does. Sets *END to the
+ * offset where the member ends and *RAWSIZE to its raw size. Returns
+ * false if there is no valid member at START or an error occurred. */
+static bool checkpoint_member(const uint8_t *in, uint64_t inSize,
+                              uint64_t start, uint64_t rawStart,
+                              uint64_t span, points_t *pts, uint64_t *end,
+                              uint64_t *rawSize) {
+    uint8_t *window = (uint8_t *)calloc(1, WINDOW_SIZE);
+    z_stream *strm = zpool_inflate(15 + 16);  // +16 for gzip.
+    STATS_ADD(allocations, 1);
+    if (!window || !strm) {
+        free(window);
+        return false;
+    }
+    STATS_ADD(blocksInflated, 1);
+    uint64_t pos = start, consumed = 0, produced = 0, last = 0;
+    int zRet = Z_OK;
+    bool ok = true;
+    strm->avail_in = strm->avail_out = 0;
+    while (ok && zRet != Z_STREAM_END) {
+        if (strm->avail_in == 0) {
+            uint64_t want = inSize - pos;
+            if (want == 0) {
+                ok = false;  // Truncated.
+                break;
+            }
+            if (want > UINT_MAX) want = UINT_MAX;
+            strm->next_in = (Bytef *)in + pos;
+            strm->avail_in = (uInt)want;
+            pos += want;
+        }
+        if (strm->avail_out == 0) {
+            strm->next_out = window;
+            strm->avail_out = WINDOW_SIZE;
+        }
+        uInt availIn = strm->avail_in, availOut = strm->avail_out;
+        STATS_TIMER_START(t0);
+        zRet = inflate(strm, Z_BLOCK);
+        STATS_TIMER_ADD(inflateNs, t0);
+        consumed += availIn - strm->avail_in;
+        produced += availOut - strm->avail_out;
+        STATS_ADD(bytesInflated, availOut - strm->avail_out);
+        STATS_ADD(bytesDiscarded, availOut - strm->avail_out);
+        if (zRet != Z_OK && zRet != Z_STREAM_END && zRet != Z_BUF_ERROR) {
+            ok = false;
+            break;
+        }
+
+        /* Stopped between two deflate blocks, and not before the last. */
+        if ((strm->data_type & 128) && !(strm->data_type & 64) &&
+            produced - last > span) {
+            ok = points_add(pts, rawStart + produced, start + consumed,
+                            strm->data_type & 7, window, strm->avail_out);
+            last = produced;
+        }
+    }
+    free(window);
+    *end = start + consumed;
+    *rawSize = produced;
+    return ok;
+}
+
+/* Finds the gzip members of the INSIZE bytes at IN like scan_members,
+ * and adds to PTS checkpoints every SPAN raw bytes or so inside the
+ * members larger than that. The first member is inflated on its own
+ * first, so that a file of a single member, as most large gzip files
+ * are, is read once. The other members are found by scan_members, and
+ * those larger than SPAN are then inflated again in parallel. */
+static int64_t scan_checkpoints(const uint8_t *in, uint64_t inSize,
+                                uint64_t span, uint64_t **offs,
+                                uint64_t **rawOffs, points_t *pts) {
+    *offs = *rawOffs = NULL;
+    uint64_t firstEnd, firstRaw;
+    if (!is_member_candidate(in, inSize) ||
+        !checkpoint_member(in, inSize, 0, 0, span, pts, &firstEnd,
+                           &firstRaw)) {
+        return -1;
+    }
+    uint64_t *restOffs = NULL, *restRaw = NULL;
+    int64_t nRest = 0;
+    if (firstEnd < inSize) {
+        nRest = scan_members(in + firstEnd, inSize - firstEnd, &restOffs,
+                             &restRaw);
+        if (nRest < 0) return -1;
+    }
+    int64_t n = nRest + 1, ret = -1;
+    *offs = (uint64_t *)malloc((n + 1) * sizeof(uint64_t));
+    *rawOffs = (uint64_t *)malloc((n + 1) * sizeof(uint64_t));
+    points_t *memberPts = (points_t *)calloc(n, sizeof(points_t));
+    if (!*offs || !*rawOffs || !memberPts) goto _bailout;
+    (*offs)[0] = (*rawOffs)[0] = 0;
+    (*offs)[1] = firstEnd;
+    (*rawOffs)[1] = firstRaw;
+    for (int64_t i = 1; i <= nRest; ++i) {
+        (*offs)[i + 1] = firstEnd + restOffs[i];
+        (*rawOffs)[i + 1] = firstRaw + restRaw[i];
+    }
+
+    const uint64_t *o = *offs, *ro = *rawOffs;
+    bool ok = true;
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t i = 1; i < n; ++i) {
+        if (ro[i + 1] - ro[i] <= span) continue;
+        uint64_t end, rawSize;
+        if (!checkpoint_member(in, inSize, o[i], ro[i], span, &memberPts[i],
+                               &end, &rawSize) ||
+            end != o[i + 1] || rawSize != ro[i + 1] - ro[i]) {
+            ok = false;
+        }
+    }
+    for (int64_t i = 1; ok && i < n; ++i) {
+        for (uint64_t k = 0; ok && k < memberPts[i].n; ++k) {
+            ok = points_add(pts, memberPts[i].raw[k], memberPts[i].offs[k],
+                            memberPts[i].bits[k],
+                            memberPts[i].windows + k * WINDOW_SIZE,
+                            WINDOW_SIZE);
+        }
+    }
+    if (ok) ret = n;
+
+_bailout:
+    for (int64_t i = 0; memberPts && i < n; ++i) points_free(&memberPts[i]);
+    free(memberPts);
+    free(restOffs);
+    free(restRaw);
+    if (ret < 0) {
+        free(*offs);
+        free(*rawOffs);
+        *offs = *rawOffs = NULL;
+    }
+    return ret;
+}
+
+/* Writes the fixed-format lookup table of NBLOCKS blocks of BLOCKSIZE
+ * raw bytes at compressed offsets OFFSETS to LOOKUP. */
+static bool write_fixed_lookup(FILE *lookup, uint64_t blockSize,
+                               const uint64_t *offsets, uint64_t nBlocks) {
+    return fwrite(&blockSize, sizeof(uint64_t), 1, lookup) == 1 &&
+           fwrite(offsets, sizeof(uint64_t), nBlocks, lookup) == nBlocks;
+}
+
+/* Shared by mgz_rebuild_lookup and mgz_index_gzip, which FN names in
+ * errors. Checkpoints are only recorded if SPAN is not 0. */
+static uint64_t index_gzip(int fd, uint64_t span, FILE *lookup,
+                           const char *fn) {
+    if (fd < 0 || !lookup) return 0;
+    mgz_index_t idx;
+    if (index_read(fd, &idx)) {
+        if (span == 0 || idx.blockSize <= span) {
+            bool ok = write_fixed_lookup(lookup, idx.blockSize, idx.offsets,
+                                         idx.nBlocks);
+            free(idx.offsets);
+            if (!ok) {
+                fprintf(stderr, "%s: failed to write to lookup.\n", fn);
+                return 0;
+            }
+            return idx.nBlocks;
+        }
+        free(idx.offsets);  // Blocks too large to go without checkpoints.
+    }
+
+    uint64_t inSize;
+    if (!get_file_size(fd, &inSize)) {
+        fprintf(stderr, "%s: fstat failed.\n", fn);
+        return 0;
+    }
+    if (inSize == 0) {
+        fprintf(stderr, "%s: no data to index.\n", fn);
+        return 0;
+    }
+    void *map = mmap(NULL, inSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "%s: mmap failed.\n", fn);
+        return 0;
+    }
+    (void)madvise(map, inSize, MADV_SEQUENTIAL);
+    uint64_t *offs, *rawOffs;
+    points_t pts = {0};
+    int64_t n =
+        span ? scan_checkpoints((const uint8_t *)map, inSize, span, &offs,
+                                &rawOffs, &pts)
+             : scan_members((const uint8_t *)map, inSize, &offs, &rawOffs);
+    munmap(map, inSize);
+    if (n < 0) {
+        fprintf(stderr, "%s: input is not a sequence of gzip members.\n",
+                fn);
+        points_free(&pts);
+        return 0;
+    }
+
+    /* Leave out empty members, such as an embedded index that failed its
+     * checks or a block that mgz_parallel_append moved: each is folded
+     * into the block before it, or dropped at the start. */
+    uint64_t nBlocks = 0;
+    for (int64_t i = 0; i < n; ++i) {
+        if (rawOffs[i + 1] == rawOffs[i]) continue;
+        offs[nBlocks] = offs[i];
+        rawOffs[nBlocks++] = rawOffs[i];
+    }
+    rawOffs[nBlocks] = rawOffs[n];
+    if (nBlocks == 0) {
+        /* Only empty members, as for empty input: a lookup table cannot
+         * describe no blocks. */
+        fprintf(stderr, "%s: no data to index.\n", fn);
+        free(offs);
+        free(rawOffs);
+        points_free(&pts);
+        return 0;
+    }
+    bool fixed = rawOffs[1] > 0 && pts.n == 0;
+    for (uint64_t i = 1; fixed && i < nBlocks; ++i) {
+        fixed = rawOffs[i] - rawOffs[i - 1] == rawOffs[1] &&
+                (i + 1 < nBlocks || rawOffs[i + 1] - rawOffs[i] <= rawOffs[1]);
+    }
+    bool ok = fixed ? write_fixed_lookup(lookup, rawOffs[1], offs, nBlocks)
+                    : write_variable_lookup(lookup, nBlocks, offs, rawOffs,
+                                            pts.n, pts.raw, pts.offs,
+                                            pts.bits, pts.windows, NULL, 0);
+    free(offs);
+    free(rawOffs);
+    points_free(&pts);
+    if (!ok) {
+        fprintf(stderr, "%s: failed to write to lookup.\n", fn);
+        return 0;
+    }
+    return nBlocks;
+}
+
+uint64_t mgz_rebuild_lookup(int fd, FILE *lookup) {
+    STATS_TIMER_START(t0);
+    uint64_t ret = index_gzip(fd, 0, lookup, "mgz_rebuild_lookup");
+    STATS_CALL_END("mgz_rebuild_lookup", t0);
+    return ret;
+}
+
+uint64_t mgz_index_gzip(int fd, uint64_t span, FILE *lookup) {
+    STATS_TIMER_START(t0);
+    uint64_t ret = index_gzip(fd, span, lookup, "mgz_index_gzip");
+    STATS_CALL_END("mgz_index_gzip", t0);
+    return ret;
+}
+
+/* Returns the size of the gzip member header at P of at most AVAIL
+ * bytes, with any optional fields, or 0 if it is not a valid header. */
+static uint64_t gzip_header_size(const uint8_t *p, uint64_t avail) {
+    if (avail < 10 || p[0] != 0x1f || p[1] != 0x8b || p[2] != 8 ||
+        (p[3] & 0xe0)) {
+        return 0;
+    }
+    uint64_t size = 10;
+    if (p[3] & 4) {  // FEXTRA.
+        if (avail < size + 2) return 0;
+        size += 2 + (uint64_t)(p[size] | p[size + 1] << 8);
+    }
+    for (int flag = 8; flag <= 16; flag <<= 1) {  // FNAME, FCOMMENT.
+        if (!(p[3] & flag)) continue;
+        const uint8_t *nul =
+            size < avail ? (const uint8_t *)memchr(p + size, 0, avail - size)
+                         : NULL;
+        if (!nul) return 0;
+        size = nul - p + 1;
+    }
+    if (p[3] & 2) size += 2;  // FHCRC.
+    return size <= avail ? size : 0;
+}
+
+/* Returns true if the AVAIL bytes at P hold nothing but empty gzip
+ * members, such as the one mgz_parallel_append leaves where it moved a
+ * last block. */
+static bool only_empty_members(const uint8_t *p, uint64_t avail) {
+    static const uint8_t empty[10] = {3, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    while (avail > 0) {
+        uint64_t header = gzip_header_size(p, avail);
+        if (header == 0 || avail - header < sizeof(empty) ||
+            memcmp(p + header, empty, sizeof(empty)) != 0) {
+            return false;
+        }
+        p += header + sizeof(empty);
+        avail -= header + sizeof(empty);
+    }
+    return true;
+}
+
+/* Checks block BLOCK of the mapped reader R: its header must be valid,
+ * its deflate data must be followed by the 8-byte trailer that closes the
+ * block, or by that trailer and empty members, and the trailer must
+ * match the CRC-32 and size of the inflated data, which is discarded. On
+ * success, sets *CRC and *RAWSIZE for the block and returns true. */
+static bool verify_block(const mgz_reader_t *r, uint64_t block,
+                         uint32_t *crc, uint64_t *rawSize) {
+    uint64_t start = r->lookup[block], end = block_end(r, block);
+    const uint8_t *p = r->map + start;
+    uint64_t header = end > start ? gzip_header_size(p, end - start) : 0;
+    inflate_ctx_t *ctx = get_inflate_ctx();
+    z_stream *strm = zpool_inflate(-15);
+    if (header == 0 || end - start < header + 8 || !ctx || !strm ||
+        (r->dictSize &&
+         inflateSetDictionary(strm, r->dict, (uInt)r->dictSize) != Z_OK)) {
+        return false;
+    }
+    STATS_ADD(blocksInflated, 1);
+
+    uint64_t pos = start + header, dataEnd = end - 8, produced = 0;
+    uint32_t sum = 0;
+    int zRet = Z_OK;
+    strm->avail_in = 0;
+    while (zRet != Z_STREAM_END) {
+        if (strm->avail_in == 0) {
+            uint64_t want = dataEnd - pos;
+            if (want == 0) return false;  // Truncated.
+            if (want > UINT_MAX) want = UINT_MAX;
+            strm->next_in = (Bytef *)r->map + pos;
+            strm->avail_in = (uInt)want;
+            pos += want;
+        }
+        strm->next_out = ctx->discard;
+        strm->avail_out = DISCARD_SIZE;
+        STATS_TIMER_START(t0);
+        zRet = inflate(strm, Z_NO_FLUSH);
+        STATS_TIMER_ADD(inflateNs, t0);
+        if (zRet != Z_OK && zRet != Z_STREAM_END && zRet != Z_BUF_ERROR) {
+            return false;
+        }
+        uint64_t have = DISCARD_SIZE - strm->avail_out;
+        sum = crc32_fast(sum, ctx->discard, have);
+        produced += have;
+        STATS_ADD(bytesInflated, have);
+        STATS_ADD(bytesDiscarded, have);
+    }
+    uint64_t memberEnd = pos - strm->avail_in + 8;
+    const uint8_t *t = r->map + memberEnd - 8;
+    uint32_t wantCrc = (uint32_t)t[0] | (uint32_t)t[1] << 8 |
+                       (uint32_t)t[2] << 16 | (uint32_t)t[3] << 24;
+    if (wantCrc != sum ||
+        member_isize(r->map, memberEnd) != (uint32_t)produced ||
+        !only_empty_members(r->map + memberEnd, end - memberEnd)) {
+        return false;
+    }
+
+    /* Every block but the last of a fixed layout holds BLOCKSIZE bytes. */
+    if (r->rawLookup) {
+        if (produced != r->rawLookup[block + 1] - r->rawLookup[block]) {
+            return false;
+        }
+    } else if (produced > r->blockSize ||
+               (block + 1 < r->nBlocks && produced != r->blockSize)) {
+        return false;
+    }
+    *crc = sum;
+    *rawSize = produced;
+    return true;
+}
+
+static bool verify(int fd, const char *lookupPath, uint32_t *crc) {
+    mgz_reader_t *r = reader_open(fd, lookupPath, true);
+    if (!r) return false;
+    uint32_t *crcs = (uint32_t *)malloc(r->nBlocks * sizeof(uint32_t));
+    uint64_t *sizes = (uint64_t *)malloc(r->nBlocks * sizeof(uint64_t));
+    STATS_ADD(allocations, 2);
+    if (!crcs || !sizes) {
+        fprintf(stderr, "mgz_verify: malloc failed.\n");
+        free(crcs);
+        free(sizes);
+        mgz_reader_close(r);
+        return false;
+    }
+    (void)madvise((void *)r->map, r->mapSize, MADV_SEQUENTIAL);
+
+    /* Check every block in parallel, then chain their CRC-32s. */
+    uint64_t bad = r->nBlocks;
+#pragma omp parallel for schedule(dynamic)
+    for (uint64_t i = 0; i < r->nBlocks; ++i) {
+        if (!verify_block(r, i, &crcs[i], &sizes[i])) {
+#pragma omp critical
+            if (i < bad) bad = i;
+        }
+    }
+    bool ret = bad == r->nBlocks;
+    if (!ret) {
+        fprintf(stderr, "mgz_verify: block %lu is corrupt.\n",
+                (unsigned long)bad);
+    }
+    uint32_t sum = 0;
+    for (uint64_t i = 0; ret && i < r->nBlocks; ++i) {
+        sum = i == 0 ? crcs[0]
+                     : (uint32_t)crc32_combine(sum, crcs[i],
+                                               (z_off_t)sizes[i]);
+    }
+    if (ret && r->hasCrc && sum != r->crc) {
+        fprintf(stderr, "mgz_verify: CRC-32 does not match the index.\n");
+        ret = false;
+    }
+    if (ret && crc) *crc = sum;
+    free(crcs);
+    free(sizes);
+    mgz_reader_close(r);
+    return ret;
+}
+
+bool mgz_verify(int fd, const char *lookupPath, uint32_t *crc) {
+    STATS_TIMER_START(t0);
+    bool ret = verify(fd, lookupPath, crc);
+    STATS_CALL_END("mgz_verify", t0);
+    return ret;
+}
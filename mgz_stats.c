@@ -0,0 +1,59 @@
+#include <string.h>
+
+#include "mgz.h"
+#include "mgz_internal.h"
+
+#ifdef MGZ_STATS
+mgz_stats_t mgzStats;
+
+static mgz_stats_cb_t statsCb;
+static void *statsCtx;
+
+/* Reads every counter atomically. The snapshot as a whole is not
+ * atomic, which is fine for monitoring. */
+static void stats_snapshot(mgz_stats_t *stats) {
+    const uint64_t *src = (const uint64_t *)&mgzStats;
+    uint64_t *dst = (uint64_t *)stats;
+    for (size_t i = 0; i < sizeof(mgz_stats_t) / sizeof(uint64_t); ++i) {
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+}
+
+void stats_call_end(const char *call, uint64_t ns) {
+    mgz_stats_cb_t cb = __atomic_load_n(&statsCb, __ATOMIC_ACQUIRE);
+    if (!cb) return;
+    mgz_stats_t totals;
+    stats_snapshot(&totals);
+    cb(__atomic_load_n(&statsCtx, __ATOMIC_RELAXED), call, ns, &totals);
+}
+
+bool mgz_stats_get(mgz_stats_t *stats) {
+    if (!stats) return false;
+    stats_snapshot(stats);
+    return true;
+}
+
+void mgz_stats_reset(void) {
+    uint64_t *counters = (uint64_t *)&mgzStats;
+    for (size_t i = 0; i < sizeof(mgz_stats_t) / sizeof(uint64_t); ++i) {
+        __atomic_store_n(&counters[i], 0, __ATOMIC_RELAXED);
+    }
+}
+
+void mgz_stats_set_callback(mgz_stats_cb_t cb, void *ctx) {
+    __atomic_store_n(&statsCtx, ctx, __ATOMIC_RELAXED);
+    __atomic_store_n(&statsCb, cb, __ATOMIC_RELEASE);
+}
+#else
+bool mgz_stats_get(mgz_stats_t *stats) {
+    if (stats) memset(stats, 0, sizeof(*stats));
+    return false;
+}
+
+void mgz_stats_reset(void) {}
+
+void mgz_stats_set_callback(mgz_stats_cb_t cb, void *ctx) {
+    (void)cb;
+    (void)ctx;
+}
+#endif
@@ -0,0 +1,150 @@
+#include "test_adaptive.h"
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../mgz.h"
+#include "testtools.h"
+
+#define N_READS 100
+
+/* Fills SIZE bytes at DATA with runs of random bytes, standing in for
+ * already-compressed payloads, and of text made of a few words, at
+ * boundaries that do not line up with blocks. */
+static void mixed_fill(uint8_t *data, size_t size, unsigned int seed) {
+    static const char *words[8] = {"lorem ", "ipsum ", "dolor ", "sit ",
+                                   "amet, ", "consectetur ", "adipiscing ",
+                                   "elit.\n"};
+    srand(seed);
+    for (size_t off = 0; off < size;) {
+        size_t len = 1000 + (size_t)rand() % 300000;
+        if (len > size - off) len = size - off;
+        if (rand() % 2) {
+            random_fill(data + off, len, (unsigned int)rand());
+        } else {
+            for (size_t i = 0; i < len;) {
+                const char *w = words[rand() % 8];
+                while (*w && i < len) data[off + i++] = (uint8_t)*w++;
+            }
+        }
+        off += len;
+    }
+}
+
+/* Compress a mixed corpus adaptively and check that it is no larger
+ * than with fixed blocks, that the lookup table has blocks of varying
+ * size, and that every way of reading it back gives the original. */
+static bool test_adaptive_helper(size_t size, unsigned int seed) {
+    uint8_t *data = (uint8_t *)malloc(size);
+    uint8_t *buf = (uint8_t *)malloc(size + 1);
+    FILE *outfile = fopen("test_adaptive.gz", "wb");
+    FILE *lookup = fopen("test_adaptive.lookup", "wb");
+    if (!data || !buf || !outfile || !lookup) {
+        printf("test_adaptive_helper: setup failed.\n");
+        if (outfile) fclose(outfile);
+        if (lookup) fclose(lookup);
+        free(data);
+        free(buf);
+        return false;
+    }
+    mixed_fill(data, size, seed);
+    uint64_t outSize =
+        mgz_parallel_create_adaptive(data, size, 9, 0, outfile, lookup);
+    fclose(outfile);
+    fclose(lookup);
+    mgz_res_t fixed = mgz_parallel_deflate(data, size, 9, 0, false);
+
+    /* Engines other than zlib already pick stored deflate blocks inside a
+     * member, so splitting members there only has to come close. */
+    uint64_t limit = strcmp(mgz_backend(), "zlib") == 0
+                         ? fixed.size
+                         : fixed.size + fixed.size / 100;
+    bool ret = outSize > 0 && outSize <= limit;
+    if (!ret) {
+        printf("test_adaptive_helper: %lu bytes, %lu with fixed blocks.\n",
+               (unsigned long)outSize, (unsigned long)fixed.size);
+    }
+    free(fixed.out);
+
+    uint64_t lookupSize;
+    uint64_t *words = (uint64_t *)read_file("test_adaptive.lookup",
+                                            &lookupSize);
+    if (ret && (!words || lookupSize < 3 * sizeof(uint64_t) ||
+                words[0] != 0 ||
+                (size > (1 << 20) && words[2] <= (size >> 20) + 1))) {
+        printf("test_adaptive_helper: lookup has fixed blocks.\n");
+        ret = false;
+    }
+    FILE *memLookup = words ? fmemopen(words, lookupSize, "rb") : NULL;
+
+    int fd = open("test_adaptive.gz", O_RDONLY);
+    lookup = fopen("test_adaptive.lookup", "rb");
+    mgz_reader_t *r =
+        fd < 0 ? NULL : mgz_reader_open(fd, "test_adaptive.lookup");
+    mgz_reader_t *mapped =
+        fd < 0 ? NULL : mgz_reader_open_mmap(fd, "test_adaptive.lookup");
+    if (ret && (!lookup || !memLookup || !r || !mapped)) {
+        printf("test_adaptive_helper: failed to open readers.\n");
+        ret = false;
+    }
+    const char *names[4] = {"mgz_reader_read", "mgz_read", "mmap",
+                            "fmemopen"};
+    for (int i = 0; ret && i < N_READS; ++i) {
+        uint64_t offset = (uint64_t)rand() % size;
+        uint64_t len = 1 + (uint64_t)rand() % (i % 2 ? 64 : 3000000);
+        uint64_t expected = offset + len > size ? size - offset : len;
+        for (int mode = 0; ret && mode < 4; ++mode) {
+            uint64_t got =
+                mode == 0   ? mgz_reader_read(r, buf, len, offset)
+                : mode == 1 ? mgz_read(buf, len, offset, fd, lookup)
+                : mode == 2 ? mgz_reader_read(mapped, buf, len, offset)
+                            : mgz_read(buf, len, offset, fd, memLookup);
+            if (got != expected ||
+                compare(buf, data + offset, got) != expected) {
+                printf(
+                    "test_adaptive_helper: %s read of %lu bytes at %lu "
+                    "returned %lu.\n",
+                    names[mode], (unsigned long)len, (unsigned long)offset,
+                    (unsigned long)got);
+                ret = false;
+            }
+        }
+    }
+    if (ret && (mgz_reader_read(r, buf, size + 1, 0) != size ||
+                compare(buf, data, size) != size ||
+                mgz_reader_read(mapped, buf, 1, size) != 0)) {
+        printf("test_adaptive_helper: whole-range read failed.\n");
+        ret = false;
+    }
+    mgz_reader_close(r);
+    mgz_reader_close(mapped);
+    if (lookup) fclose(lookup);
+    if (memLookup) fclose(memLookup);
+    if (fd >= 0) close(fd);
+    free(words);
+    free(buf);
+    free(data);
+    return ret;
+}
+
+bool test_adaptive() {
+    size_t testSizes[4] = {1, 16385, 999999, 9000000};
+    for (int i = 0; i < 4; ++i) {
+        for (unsigned int seed = 0; seed < 2; ++seed) {
+            if (!test_adaptive_helper(testSizes[i], seed)) {
+                printf(
+                    "test_adaptive: failed at %d of size %zd with seed "
+                    "%u.\n",
+                    i, testSizes[i], seed);
+                return false;
+            }
+        }
+        printf("test_adaptive: %d done.\n", i);
+    }
+    return true;
+}
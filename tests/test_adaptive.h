@@ -0,0 +1,7 @@
+#ifndef TEST_ADAPTIVE_H
+#define TEST_ADAPTIVE_H
+#include <stdbool.h>
+
+bool test_adaptive(void);
+
+#endif  // TEST_ADAPTIVE_H
@@ -3,7 +3,25 @@
 
 int main() {
     if (!test_sequential_byte()) return 1;
+    if (!test_concurrent()) return 1;
     if (!test_gzread()) return 1;
+    if (!test_stream()) return 1;
+    if (!test_writer()) return 1;
+    if (!test_reader()) return 1;
+    if (!test_inflate()) return 1;
+    if (!test_index()) return 1;
+    if (!test_adaptive()) return 1;
+    if (!test_seek()) return 1;
+    if (!test_batch()) return 1;
+    if (!test_crc()) return 1;
+    if (!test_dict()) return 1;
+    if (!test_append()) return 1;
+    if (!test_bounded()) return 1;
+    if (!test_rebuild()) return 1;
+    if (!test_gzindex()) return 1;
+    if (!test_numa()) return 1;
+    if (!test_huge()) return 1;
+    if (!test_stats()) return 1;
     printf("passed\n");
     return 0;
 }
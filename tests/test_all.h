@@ -1,6 +1,24 @@
 #ifndef TEST_ALL_H
 #define TEST_ALL_H
+#include "test_adaptive.h"
+#include "test_append.h"
+#include "test_batch.h"
+#include "test_bounded.h"
+#include "test_concurrent.h"
+#include "test_crc.h"
+#include "test_dict.h"
+#include "test_gzindex.h"
 #include "test_gzread.h"
+#include "test_huge.h"
+#include "test_index.h"
+#include "test_inflate.h"
+#include "test_numa.h"
+#include "test_reader.h"
+#include "test_rebuild.h"
+#include "test_seek.h"
 #include "test_sequential_byte.h"
+#include "test_stats.h"
+#include "test_stream.h"
+#include "test_writer.h"
 
 #endif  // TEST_ALL_H
@@ -0,0 +1,289 @@
+#include "test_append.h"
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../mgz.h"
+#include "../mgz_internal.h"
+#include "testtools.h"
+
+#define BLOCK_SIZE 65536
+
+/* Compresses the SIZE bytes at DATA in one go into PATH and LOOKUPPATH.
+ * Returns false if that failed. */
+static bool create(const char *path, const char *lookupPath, uint8_t *data,
+                   size_t size) {
+    FILE *outfile = fopen(path, "wb");
+    FILE *lookup = fopen(lookupPath, "wb");
+    uint64_t outSize =
+        outfile && lookup
+            ? mgz_parallel_create(data, size, 6, BLOCK_SIZE, outfile, lookup)
+            : 0;
+    if (outfile) fclose(outfile);
+    if (lookup) fclose(lookup);
+    return outSize > 0;
+}
+
+/* Check that test_append.gz holds the SIZE bytes at DATA for mgz_reader,
+ * mgz_verify and gzread, and that its lookup file has the offsets that
+ * mgz_rebuild_lookup finds, which are only in the fixed format if every
+ * block but the last is full, as after a single create. The block size
+ * is not compared, since a rebuild takes it from the first block. */
+static bool check_archive(uint8_t *data, size_t size) {
+    int fd = open("test_append.gz", O_RDONLY);
+    mgz_reader_t *r = fd >= 0 ? mgz_reader_open(fd, "test_append.lookup")
+                              : NULL;
+    uint8_t *buf = (uint8_t *)malloc(size + 1);
+    bool ret = r && buf && mgz_reader_read(r, buf, size + 1, 0) == size &&
+               compare(buf, data, size) == size &&
+               mgz_verify(fd, "test_append.lookup", NULL);
+    mgz_reader_close(r);
+    free(buf);
+    if (!ret) printf("test_append: archive does not read back.\n");
+    FILE *lookup = fopen("test_append_ref.lookup", "wb");
+    bool rebuilt = fd >= 0 && lookup && mgz_rebuild_lookup(fd, lookup) > 0;
+    if (lookup) fclose(lookup);
+    if (fd >= 0) close(fd);
+    uint64_t size1 = 0, size2 = 0;
+    uint8_t *words1 = read_file("test_append.lookup", &size1);
+    uint8_t *words2 = rebuilt ? read_file("test_append_ref.lookup", &size2)
+                              : NULL;
+    if (ret && (!words1 || !words2 || size1 != size2 || size1 < 8 ||
+                compare(words1 + 8, words2 + 8, size1 - 8) != size1 - 8)) {
+        printf("test_append: lookup differs from a rebuilt one.\n");
+        ret = false;
+    }
+    free(words1);
+    free(words2);
+    if (ret && !check_gzread("test_append.gz", data, size)) {
+        printf("test_append: gzread sees other data.\n");
+        ret = false;
+    }
+    return ret;
+}
+
+/* Create an archive from the first of PARTS bytes of DATA, append each
+ * of the following parts in turn, and check the archive after every
+ * step. */
+static bool test_append_helper(uint8_t *data, const size_t *parts,
+                               int nParts) {
+    if (!create("test_append.gz", "test_append.lookup", data, parts[0])) {
+        printf("test_append_helper: create failed.\n");
+        return false;
+    }
+    int fd = open("test_append.gz", O_RDWR);
+    bool ret = fd >= 0;
+    size_t size = parts[0];
+    for (int i = 1; ret && i < nParts; ++i) {
+        uint64_t outSize = mgz_parallel_append(data + size, parts[i], 6, fd,
+                                               "test_append.lookup");
+        size += parts[i];
+        if (outSize == 0) {
+            printf("test_append_helper: append %d failed.\n", i);
+            ret = false;
+        }
+        if (ret) ret = check_archive(data, size);
+    }
+    if (fd >= 0) close(fd);
+    return ret;
+}
+
+/* Simulate a crash in the middle of an append: its journal is written
+ * and junk lands past the end of the data. The whole archive, last block
+ * included, must still read under the old lookup file, and the next
+ * append must drop the junk first. */
+static bool test_torn_append(uint8_t *data) {
+    size_t first = 3 * BLOCK_SIZE + 1000, second = 100000;
+    if (!create("test_append.gz", "test_append.lookup", data, first)) {
+        printf("test_torn_append: create failed.\n");
+        return false;
+    }
+    int fd = open("test_append.gz", O_RDWR);
+    if (fd < 0) return false;
+    uint64_t lookupSize, dataSize;
+    uint64_t *words = (uint64_t *)read_file("test_append.lookup",
+                                            &lookupSize);
+    uint8_t *archive = read_file("test_append.gz", &dataSize);
+    bool ret = words && archive &&
+               append_journal_begin("test_append.lookup",
+                                    words[lookupSize / 8 - 1], dataSize);
+    uint8_t junk[5000];
+    random_fill(junk, sizeof(junk), 7);
+    ret = ret && pwrite(fd, junk, sizeof(junk), dataSize) ==
+                     (ssize_t)sizeof(junk);
+    if (!ret) printf("test_torn_append: setup failed.\n");
+
+    uint8_t *buf = (uint8_t *)malloc(first);
+    mgz_reader_t *r = ret ? mgz_reader_open(fd, "test_append.lookup") : NULL;
+    if (ret && (!buf || !r || mgz_reader_read(r, buf, first, 0) != first ||
+                compare(buf, data, first) != first)) {
+        printf("test_torn_append: archive unreadable after the crash.\n");
+        ret = false;
+    }
+    mgz_reader_close(r);
+    free(buf);
+
+    if (ret && mgz_parallel_append(data + first, second, 6, fd,
+                                   "test_append.lookup") == 0) {
+        printf("test_torn_append: append after the crash failed.\n");
+        ret = false;
+    }
+    if (ret) ret = check_archive(data, first + second);
+    if (ret && access("test_append.lookup.journal", F_OK) == 0) {
+        printf("test_torn_append: journal left behind.\n");
+        ret = false;
+    }
+    free(words);
+    free(archive);
+    close(fd);
+    return ret;
+}
+
+/* Simulate a crash right after an append committed: the member of the
+ * old last block is back in place, so gzip reads its data twice, and the
+ * journal is the one written before the commit gave the lookup file a
+ * new inode. The next append must retire the old member. */
+static bool test_committed_append(uint8_t *data) {
+    size_t first = 2 * BLOCK_SIZE + 5000, second = BLOCK_SIZE;
+    if (!create("test_append.gz", "test_append.lookup", data, first)) {
+        printf("test_committed_append: create failed.\n");
+        return false;
+    }
+    int fd = open("test_append.gz", O_RDWR);
+    if (fd < 0) return false;
+    uint64_t lookupSize, dataSize;
+    uint64_t *words = (uint64_t *)read_file("test_append.lookup",
+                                            &lookupSize);
+    uint8_t *archive = read_file("test_append.gz", &dataSize);
+    uint64_t tailStart = words ? words[lookupSize / 8 - 1] : 0;
+    bool ret = words && archive &&
+               append_journal_begin("test_append.lookup", tailStart,
+                                    dataSize) &&
+               rename("test_append.lookup.journal", "test_append.saved") ==
+                   0 &&
+               mgz_parallel_append(data + first, second, 6, fd,
+                                   "test_append.lookup") > 0 &&
+               pwrite(fd, archive + tailStart, dataSize - tailStart,
+                      tailStart) == (ssize_t)(dataSize - tailStart) &&
+               rename("test_append.saved", "test_append.lookup.journal") ==
+                   0 &&
+               !check_gzread("test_append.gz", data, first + second);
+    if (!ret) printf("test_committed_append: setup failed.\n");
+
+    if (ret && mgz_parallel_append(data, 0, 6, fd, "test_append.lookup") ==
+                   0) {
+        printf("test_committed_append: recovery failed.\n");
+        ret = false;
+    }
+    if (ret) ret = check_archive(data, first + second);
+    if (ret && access("test_append.lookup.journal", F_OK) == 0) {
+        printf("test_committed_append: journal left behind.\n");
+        ret = false;
+    }
+    free(words);
+    free(archive);
+    close(fd);
+    return ret;
+}
+
+/* Read an archive through a cache, append to it, and read it again
+ * through the same cache with a new reader: the last block moved and
+ * grew, so its old cached bytes must not be served. */
+static bool test_cached_append(uint8_t *data) {
+    size_t first = 2 * BLOCK_SIZE + 3000, second = 20000;
+    if (!create("test_append.gz", "test_append.lookup", data, first)) {
+        printf("test_cached_append: create failed.\n");
+        return false;
+    }
+    int fd = open("test_append.gz", O_RDWR);
+    mgz_cache_t *cache = mgz_cache_create(16 * BLOCK_SIZE);
+    uint8_t *buf = (uint8_t *)malloc(first + second);
+    bool ret = fd >= 0 && cache && buf;
+    for (int pass = 0; ret && pass < 2; ++pass) {
+        size_t size = pass == 0 ? first : first + second;
+        mgz_reader_t *r = mgz_reader_open(fd, "test_append.lookup");
+        mgz_reader_set_cache(r, cache);
+        ret = r && mgz_reader_read(r, buf, size, 0) == size &&
+              compare(buf, data, size) == size;
+        mgz_reader_close(r);
+        if (!ret) {
+            printf("test_cached_append: read %d differs.\n", pass);
+        } else if (pass == 0) {
+            ret = mgz_parallel_append(data + first, second, 6, fd,
+                                      "test_append.lookup") > 0;
+            if (!ret) printf("test_cached_append: append failed.\n");
+        }
+    }
+    free(buf);
+    mgz_cache_destroy(cache);
+    if (fd >= 0) close(fd);
+    return ret;
+}
+
+/* An empty append changes nothing, and archives with variable blocks are
+ * refused. */
+static bool test_edge_cases(uint8_t *data) {
+    size_t size = 2 * BLOCK_SIZE + 17;
+    if (!create("test_append.gz", "test_append.lookup", data, size)) {
+        return false;
+    }
+    int fd = open("test_append.gz", O_RDWR);
+    if (fd < 0) return false;
+    struct stat st;
+    bool ret = fstat(fd, &st) == 0 &&
+               mgz_parallel_append(data, 0, 6, fd, "test_append.lookup") ==
+                   (uint64_t)st.st_size &&
+               check_archive(data, size);
+    if (!ret) printf("test_edge_cases: empty append failed.\n");
+    close(fd);
+
+    FILE *outfile = fopen("test_append.gz", "wb");
+    FILE *lookup = fopen("test_append.lookup", "wb");
+    ret = ret && outfile && lookup &&
+          mgz_parallel_create_adaptive(data, size, 6, BLOCK_SIZE, outfile,
+                                       lookup) > 0;
+    if (outfile) fclose(outfile);
+    if (lookup) fclose(lookup);
+    fd = ret ? open("test_append.gz", O_RDWR) : -1;
+    if (ret && (fd < 0 || mgz_parallel_append(data, 100, 6, fd,
+                                              "test_append.lookup") != 0)) {
+        printf("test_edge_cases: appended to variable blocks.\n");
+        ret = false;
+    }
+    if (fd >= 0) close(fd);
+    return ret;
+}
+
+bool test_append() {
+    size_t total = 40 * BLOCK_SIZE;
+    uint8_t *data = test_create(total, 3);
+    if (!data) return false;
+    for (size_t i = 0; i < total; ++i) data[i] &= 0x1f;
+
+    /* Partial and full last blocks, appends that do not fill a block,
+     * and appends of many blocks. */
+    size_t cases[4][4] = {
+        {1, 1, 100, BLOCK_SIZE},
+        {BLOCK_SIZE, BLOCK_SIZE, 1, 10 * BLOCK_SIZE + 5},
+        {BLOCK_SIZE - 1, 2, 3 * BLOCK_SIZE, 7},
+        {999999, 12345, 6 * BLOCK_SIZE, 54321},
+    };
+    for (int i = 0; i < 4; ++i) {
+        if (!test_append_helper(data, cases[i], 4)) {
+            printf("test_append: failed at %d.\n", i);
+            free(data);
+            return false;
+        }
+        printf("test_append: %d done.\n", i);
+    }
+    bool ret = test_torn_append(data) && test_committed_append(data) &&
+               test_cached_append(data) && test_edge_cases(data);
+    if (ret) printf("test_append: torn append done.\n");
+    free(data);
+    return ret;
+}
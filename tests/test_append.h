@@ -0,0 +1,7 @@
+#ifndef TEST_APPEND_H
+#define TEST_APPEND_H
+#include <stdbool.h>
+
+bool test_append(void);
+
+#endif  // TEST_APPEND_H
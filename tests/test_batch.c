@@ -0,0 +1,142 @@
+#include "test_batch.h"
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../mgz.h"
+#include "testtools.h"
+
+#define N_REQS 2000
+#define BLOCK_SIZE 65536
+
+static void count_completion(void *ctx, mgz_read_req_t *req) {
+    (void)ctx;
+#pragma omp atomic
+    ++*(int *)req->user;
+}
+
+/* Issue one batch of N_REQS reads on R: mostly small reads, many of them
+ * in the same few blocks, plus reads that span blocks, are empty or start
+ * past the end. Check every result and that each request completed
+ * exactly once. */
+static bool run_batch(mgz_reader_t *r, const char *name, uint8_t *data,
+                      size_t size, unsigned int seed) {
+    mgz_read_req_t *reqs =
+        (mgz_read_req_t *)calloc(N_REQS, sizeof(mgz_read_req_t));
+    int *calls = (int *)calloc(N_REQS, sizeof(int));
+    bool ret = reqs && calls;
+    srand(seed);
+    for (int i = 0; ret && i < N_REQS; ++i) {
+        uint64_t offset = (uint64_t)rand() % size;
+        if (i % 4 == 0) offset = (uint64_t)rand() % (3 * BLOCK_SIZE) % size;
+        uint64_t len = i % 10 == 0 ? (uint64_t)rand() % (4 * BLOCK_SIZE)
+                                   : 1 + (uint64_t)rand() % 4096;
+        if (i % 97 == 0) len = 0;
+        if (i % 89 == 0) offset = size + (uint64_t)rand() % 100;
+        reqs[i].offset = offset;
+        reqs[i].size = len;
+        reqs[i].buf = malloc(len ? len : 1);
+        reqs[i].user = &calls[i];
+        if (!reqs[i].buf) ret = false;
+    }
+    uint64_t done =
+        ret ? mgz_reader_read_batch(r, reqs, N_REQS, count_completion, NULL)
+            : 0;
+    if (ret && done != N_REQS) {
+        printf("test_batch: %s completed %lu of %d requests.\n", name,
+               (unsigned long)done, N_REQS);
+        ret = false;
+    }
+    for (int i = 0; ret && i < N_REQS; ++i) {
+        uint64_t offset = reqs[i].offset;
+        uint64_t expected = offset >= size ? 0
+                            : offset + reqs[i].size > size
+                                ? size - offset
+                                : reqs[i].size;
+        if (calls[i] != 1 || reqs[i].result != expected ||
+            compare(reqs[i].buf, data + offset, expected) != expected) {
+            printf(
+                "test_batch: %s read of %lu bytes at %lu returned %lu in %d "
+                "calls.\n",
+                name, (unsigned long)reqs[i].size, (unsigned long)offset,
+                (unsigned long)reqs[i].result, calls[i]);
+            ret = false;
+        }
+    }
+    for (int i = 0; reqs && i < N_REQS; ++i) free(reqs[i].buf);
+    free(reqs);
+    free(calls);
+    return ret;
+}
+
+/* Compress SIZE bytes with fixed blocks, or with sync points if SEEKABLE
+ * is set, and run a batch through io_uring, the pread fallback, a mapped
+ * reader and a cached reader. */
+static bool test_batch_helper(size_t size, bool seekable, unsigned int seed) {
+    uint8_t *data = (uint8_t *)malloc(size);
+    FILE *outfile = fopen("test_batch.gz", "wb");
+    FILE *lookup = fopen("test_batch.lookup", "wb");
+    if (!data || !outfile || !lookup) {
+        printf("test_batch_helper: setup failed.\n");
+        if (outfile) fclose(outfile);
+        if (lookup) fclose(lookup);
+        free(data);
+        return false;
+    }
+    random_fill(data, size, seed);
+    for (size_t i = 0; i < size; ++i) data[i] &= 0x3f;
+    if (seekable) {
+        mgz_parallel_create_seekable(data, size, 6, 4 * BLOCK_SIZE, 4096,
+                                     outfile, lookup);
+    } else {
+        mgz_parallel_create(data, size, 6, BLOCK_SIZE, outfile, lookup);
+    }
+    fclose(outfile);
+    fclose(lookup);
+
+    int fd = open("test_batch.gz", O_RDONLY);
+    mgz_reader_t *r =
+        fd < 0 ? NULL : mgz_reader_open(fd, "test_batch.lookup");
+    mgz_reader_t *mapped =
+        fd < 0 ? NULL : mgz_reader_open_mmap(fd, "test_batch.lookup");
+    mgz_cache_t *cache = mgz_cache_create(1 << 20);
+    bool ret = r && mapped && cache;
+    if (!ret) printf("test_batch_helper: failed to open readers.\n");
+    ret = ret && run_batch(r, "io_uring", data, size, seed);
+    setenv("MGZ_NO_URING", "1", 1);
+    ret = ret && run_batch(r, "pread", data, size, seed + 1);
+    unsetenv("MGZ_NO_URING");
+    ret = ret && run_batch(mapped, "mmap", data, size, seed + 2);
+    mgz_reader_set_cache(r, cache);
+    ret = ret && run_batch(r, "cached", data, size, seed + 3);
+    mgz_reader_close(r);
+    mgz_reader_close(mapped);
+    mgz_cache_destroy(cache);
+    if (fd >= 0) close(fd);
+    free(data);
+    return ret;
+}
+
+bool test_batch() {
+    size_t testSizes[3] = {1, 65537, 4258475};
+    for (int i = 0; i < 3; ++i) {
+        for (int seekable = 0; seekable < 2; ++seekable) {
+            if (!test_batch_helper(testSizes[i], seekable, i)) {
+                printf("test_batch: failed at %d of size %zd%s.\n", i,
+                       testSizes[i], seekable ? " with sync points" : "");
+                return false;
+            }
+        }
+        printf("test_batch: %d done.\n", i);
+    }
+    mgz_read_req_t none;
+    if (mgz_reader_read_batch(NULL, &none, 1, NULL, NULL) != 0) {
+        printf("test_batch: batch without a reader succeeded.\n");
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,7 @@
+#ifndef TEST_BATCH_H
+#define TEST_BATCH_H
+#include <stdbool.h>
+
+bool test_batch(void);
+
+#endif  // TEST_BATCH_H
@@ -0,0 +1,73 @@
+#include "test_bounded.h"
+
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../mgz.h"
+#include "testtools.h"
+
+#define BLOCK_SIZE 16384
+#define DEFLATE_STATE_SIZE (1 << 19)
+#define N_BUDGETS 4
+
+/* Compress SIZE bytes with mgz_parallel_create_bounded under BUDGET and
+ * check that the archive and the lookup file are the same as
+ * mgz_parallel_create's, or that nothing is written if BUDGET cannot fit
+ * one block. */
+static bool test_bounded_helper(uint8_t *data, size_t size, uint64_t budget,
+                                bool fits) {
+    FILE *outfile = fopen("test_bounded.gz", "wb");
+    FILE *lookup = fopen("test_bounded.lookup", "wb");
+    if (!outfile || !lookup) {
+        printf("test_bounded_helper: failed to create outfile(s).\n");
+        if (outfile) fclose(outfile);
+        if (lookup) fclose(lookup);
+        return false;
+    }
+    uint64_t outSize = mgz_parallel_create_bounded(data, size, 9, BLOCK_SIZE,
+                                                   budget, outfile, lookup);
+    long lookupSize = ftell(lookup);
+    fclose(outfile);
+    fclose(lookup);
+    if (!fits) {
+        if (outSize != 0 || lookupSize != 0) {
+            printf("test_bounded_helper: budget %lu should not fit.\n",
+                   (unsigned long)budget);
+            return false;
+        }
+        return true;
+    }
+    if (outSize == 0 || !compare_files("test_bounded.gz", "test.gz") ||
+        !compare_files("test_bounded.lookup", "test.lookup")) {
+        printf("test_bounded_helper: budget %lu differs from unbounded.\n",
+               (unsigned long)budget);
+        return false;
+    }
+    return check_gzread("test_bounded.gz", data, size);
+}
+
+bool test_bounded() {
+    size_t testSizes[4] = {1, 16385, 999999, 4258475};
+    uint64_t budgets[N_BUDGETS] = {
+        1000,                                // Too small.
+        DEFLATE_STATE_SIZE + 2 * BLOCK_SIZE,  // One block at a time.
+        4ULL << 20, 1ULL << 40};
+    for (int i = 0; i < 4; ++i) {
+        /* test_create leaves the unbounded archive in test.gz. */
+        uint8_t *data = test_create(testSizes[i], i);
+        if (!data) return false;
+        for (int b = 0; b < N_BUDGETS; ++b) {
+            if (!test_bounded_helper(data, testSizes[i], budgets[b], b > 0)) {
+                printf("test_bounded: failed at %d of size %zd.\n", i,
+                       testSizes[i]);
+                free(data);
+                return false;
+            }
+        }
+        free(data);
+        printf("test_bounded: %d done.\n", i);
+    }
+    return true;
+}
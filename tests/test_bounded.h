@@ -0,0 +1,7 @@
+#ifndef TEST_BOUNDED_H
+#define TEST_BOUNDED_H
+#include <stdbool.h>
+
+bool test_bounded(void);
+
+#endif  // TEST_BOUNDED_H
@@ -0,0 +1,132 @@
+#include "test_concurrent.h"
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <omp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../mgz.h"
+#include "testtools.h"
+
+#define BLOCK_SIZE 16384
+#define N_THREADS 16
+#define N_READS 500  // Per thread.
+#define FD_OFFSET 12345
+#define LOOKUP_OFFSET 24
+
+enum { FIXED, SEEKABLE, ADAPTIVE, N_LAYOUTS };
+static const char *layoutNames[N_LAYOUTS] = {"fixed", "seekable",
+                                             "adaptive"};
+
+/* Compresses SIZE bytes at DATA into test_concurrent.gz with LAYOUT.
+ * Returns false if that failed. */
+static bool create(uint8_t *data, size_t size, int layout) {
+    FILE *outfile = fopen("test_concurrent.gz", "wb");
+    FILE *lookup = fopen("test_concurrent.lookup", "wb");
+    uint64_t outSize = 0;
+    if (outfile && lookup) {
+        outSize = layout == FIXED ? mgz_parallel_create(data, size, 6,
+                                                        BLOCK_SIZE, outfile,
+                                                        lookup)
+                  : layout == SEEKABLE
+                      ? mgz_parallel_create_seekable(data, size, 6,
+                                                     BLOCK_SIZE, 4096,
+                                                     outfile, lookup)
+                      : mgz_parallel_create_adaptive(data, size, 6,
+                                                     BLOCK_SIZE, outfile,
+                                                     lookup);
+    }
+    if (outfile) fclose(outfile);
+    if (lookup) fclose(lookup);
+    return outSize > 0;
+}
+
+/* Hammer one archive from N_THREADS threads that share one descriptor,
+ * one lookup stream, and one reader of each kind, with small and large
+ * reads through every read path at once. The shared descriptor and
+ * stream are left at odd positions, which must come out untouched. */
+static bool test_concurrent_helper(uint8_t *data, size_t size, int layout) {
+    if (!create(data, size, layout)) {
+        printf("test_concurrent_helper: create failed.\n");
+        return false;
+    }
+    int fd = open("test_concurrent.gz", O_RDONLY);
+    FILE *lookup = fopen("test_concurrent.lookup", "rb");
+    mgz_reader_t *readers[3] = {NULL, NULL, NULL};
+    mgz_cache_t *cache = mgz_cache_create(4 * BLOCK_SIZE);
+    if (fd >= 0) {
+        readers[0] = mgz_reader_open(fd, "test_concurrent.lookup");
+        readers[1] = mgz_reader_open_mmap(fd, "test_concurrent.lookup");
+        readers[2] = mgz_reader_open(fd, "test_concurrent.lookup");
+    }
+    mgz_reader_set_cache(readers[2], cache);
+    bool ret = fd >= 0 && lookup && readers[0] && readers[1] &&
+               readers[2] && cache &&
+               lseek(fd, FD_OFFSET, SEEK_SET) == FD_OFFSET &&
+               fseek(lookup, LOOKUP_OFFSET, SEEK_SET) == 0;
+    if (!ret) printf("test_concurrent_helper: setup failed.\n");
+
+    const char *names[4] = {"mgz_reader_read", "mmap", "cache", "mgz_read"};
+#pragma omp parallel num_threads(N_THREADS)
+    {
+        unsigned int seed = (unsigned int)omp_get_thread_num() + 1;
+        uint8_t *buf = (uint8_t *)malloc(4 * BLOCK_SIZE);
+        if (!buf) ret = false;
+        for (int i = 0; ret && i < N_READS; ++i) {
+            uint64_t offset = (uint64_t)rand_r(&seed) % size;
+            uint64_t len = 1 + (uint64_t)rand_r(&seed) %
+                                   (i % 8 ? 64 : 4 * BLOCK_SIZE);
+            uint64_t expected = offset + len > size ? size - offset : len;
+            int mode = rand_r(&seed) % 4;
+            uint64_t got = mode < 3
+                               ? mgz_reader_read(readers[mode], buf, len,
+                                                 offset)
+                               : mgz_read(buf, len, offset, fd, lookup);
+            if (got != expected ||
+                compare(buf, data + offset, got) != expected) {
+                printf(
+                    "test_concurrent_helper: %s read of %lu bytes at %lu "
+                    "returned %lu.\n",
+                    names[mode], (unsigned long)len, (unsigned long)offset,
+                    (unsigned long)got);
+                ret = false;
+            }
+        }
+        free(buf);
+    }
+
+    if (ret && (lseek(fd, 0, SEEK_CUR) != FD_OFFSET ||
+                ftell(lookup) != LOOKUP_OFFSET)) {
+        printf("test_concurrent_helper: a shared offset was moved.\n");
+        ret = false;
+    }
+    for (int i = 0; i < 3; ++i) mgz_reader_close(readers[i]);
+    mgz_cache_destroy(cache);
+    if (lookup) fclose(lookup);
+    if (fd >= 0) close(fd);
+    return ret;
+}
+
+bool test_concurrent() {
+    size_t testSizes[3] = {1, 100000, 4258475};
+    for (int i = 0; i < 3; ++i) {
+        uint8_t *data = (uint8_t *)malloc(testSizes[i]);
+        if (!data) return false;
+        random_fill(data, testSizes[i], i);
+        for (size_t j = 0; j < testSizes[i]; ++j) data[j] &= 0x0f;
+        for (int layout = 0; layout < N_LAYOUTS; ++layout) {
+            if (!test_concurrent_helper(data, testSizes[i], layout)) {
+                printf("test_concurrent: failed at %d of size %zd, %s.\n", i,
+                       testSizes[i], layoutNames[layout]);
+                free(data);
+                return false;
+            }
+        }
+        free(data);
+        printf("test_concurrent: %d done.\n", i);
+    }
+    return true;
+}
@@ -0,0 +1,7 @@
+#ifndef TEST_CONCURRENT_H
+#define TEST_CONCURRENT_H
+#include <stdbool.h>
+
+bool test_concurrent(void);
+
+#endif  // TEST_CONCURRENT_H
@@ -0,0 +1,161 @@
+#include "test_crc.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "../crc.h"
+#include "../mgz.h"
+#include "testtools.h"
+
+/* Check crc32_fast against zlib's crc32 over every length up to 300 at
+ * every alignment up to 16, and over a few long inputs, both in one call
+ * and split in two. */
+static bool test_crc_fast(void) {
+    size_t size = 1 << 20;
+    uint8_t *data = test_create(size, 15);
+    if (!data) {
+        printf("test_crc_fast: setup failed.\n");
+        return false;
+    }
+    bool ret = true;
+    for (size_t off = 0; ret && off < 16; ++off) {
+        for (size_t len = 0; ret && len <= 300; ++len) {
+            uint32_t want = (uint32_t)crc32(0L, data + off, len);
+            uint32_t got = crc32_fast(0, data + off, len);
+            if (got != want) {
+                printf("test_crc_fast: %zu bytes at %zu: %08x, not %08x.\n",
+                       len, off, got, want);
+                ret = false;
+            }
+        }
+    }
+    size_t lens[4] = {4097, 65536, 1000003, size - 3};
+    for (int i = 0; ret && i < 4; ++i) {
+        uint32_t want = (uint32_t)crc32(0L, data + 3, lens[i]);
+        uint32_t split = crc32_fast(crc32_fast(0, data + 3, lens[i] / 3),
+                                    data + 3 + lens[i] / 3,
+                                    lens[i] - lens[i] / 3);
+        if (crc32_fast(0, data + 3, lens[i]) != want || split != want) {
+            printf("test_crc_fast: %zu bytes differ.\n", lens[i]);
+            ret = false;
+        }
+    }
+    free(data);
+    return ret;
+}
+
+/* Flip one byte in the middle of the file at PATH. */
+static bool corrupt(const char *path) {
+    int fd = open(path, O_RDWR);
+    if (fd < 0) return false;
+    off_t size = lseek(fd, 0, SEEK_END);
+    uint8_t c;
+    bool ret = size > 0 && pread(fd, &c, 1, size / 2) == 1;
+    c ^= 0x55;
+    ret = ret && pwrite(fd, &c, 1, size / 2) == 1;
+    close(fd);
+    return ret;
+}
+
+/* Run mgz_verify on the archive at PATH, with the lookup file at LOOKUP
+ * or its embedded index, and check that it accepts it with the CRC-32
+ * WANT, then that it rejects it once a byte is flipped. */
+static bool check_verify(const char *path, const char *lookup,
+                         uint32_t want) {
+    int fd = open(path, O_RDONLY);
+    uint32_t got = ~want;
+    bool ok = fd >= 0 && mgz_verify(fd, lookup, &got);
+    if (fd >= 0) close(fd);
+    if (!ok || got != want) {
+        printf("check_verify: %s failed with %08x, not %08x.\n", path, got,
+               want);
+        return false;
+    }
+    if (!corrupt(path)) {
+        printf("check_verify: failed to corrupt %s.\n", path);
+        return false;
+    }
+    fd = open(path, O_RDONLY);
+    ok = fd >= 0 && mgz_verify(fd, lookup, NULL);
+    if (fd >= 0) close(fd);
+    if (ok) {
+        printf("check_verify: corrupt %s passed.\n", path);
+        return false;
+    }
+    return true;
+}
+
+/* Compress SIZE bytes at LEVEL in memory and to files with a lookup
+ * file, an embedded index and sync points. Check that the whole-input
+ * CRC-32 matches zlib's and that mgz_verify accepts each archive and
+ * rejects it when corrupted. */
+static bool test_crc_helper(size_t size, int level, unsigned int seed) {
+    uint8_t *data = test_create(size, seed);
+    if (!data) {
+        printf("test_crc_helper: setup failed.\n");
+        return false;
+    }
+    uint32_t want = (uint32_t)crc32(0L, data, size);
+    mgz_res_t res = mgz_parallel_deflate(data, size, level, 16384, false);
+    bool ret = res.out && res.crc == want;
+    if (!ret) printf("test_crc_helper: mgz_res_t.crc differs.\n");
+    free(res.out);
+
+    FILE *outfile = fopen("test_crc.gz", "wb");
+    FILE *lookup = fopen("test_crc.lookup", "wb");
+    if (ret && outfile && lookup) {
+        mgz_parallel_create(data, size, level, 16384, outfile, lookup);
+    }
+    if (outfile) fclose(outfile);
+    if (lookup) fclose(lookup);
+    ret = ret && outfile && lookup &&
+          check_verify("test_crc.gz", "test_crc.lookup", want);
+
+    outfile = fopen("test_crc.gz", "wb");
+    if (ret && outfile) {
+        mgz_parallel_create_indexed(data, size, level, 16384, outfile);
+    }
+    if (outfile) fclose(outfile);
+    ret = ret && outfile && check_verify("test_crc.gz", NULL, want);
+
+    outfile = fopen("test_crc.gz", "wb");
+    mgz_stream_t *s =
+        ret && outfile ? mgz_stream_init_indexed(level, 16384, 3, outfile)
+                       : NULL;
+    ret = ret && s && mgz_stream_feed(s, data, size);
+    if (s) mgz_stream_finish(s);
+    if (outfile) fclose(outfile);
+    ret = ret && check_verify("test_crc.gz", NULL, want);
+
+    outfile = fopen("test_crc.gz", "wb");
+    lookup = fopen("test_crc.lookup", "wb");
+    if (ret && outfile && lookup) {
+        mgz_parallel_create_seekable(data, size, level, 65536, 4096, outfile,
+                                     lookup);
+    }
+    if (outfile) fclose(outfile);
+    if (lookup) fclose(lookup);
+    ret = ret && outfile && lookup &&
+          check_verify("test_crc.gz", "test_crc.lookup", want);
+    free(data);
+    return ret;
+}
+
+bool test_crc() {
+    printf("test_crc: crc32_fast uses %s.\n", crc32_impl());
+    if (!test_crc_fast()) return false;
+    size_t testSizes[3] = {1, 65537, 4258475};
+    int levels[3] = {6, 0, 9};
+    for (int i = 0; i < 3; ++i) {
+        if (!test_crc_helper(testSizes[i], levels[i], i)) {
+            printf("test_crc: failed at %d of size %zd.\n", i, testSizes[i]);
+            return false;
+        }
+        printf("test_crc: %d done.\n", i);
+    }
+    return true;
+}
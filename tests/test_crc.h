@@ -0,0 +1,7 @@
+#ifndef TEST_CRC_H
+#define TEST_CRC_H
+#include <stdbool.h>
+
+bool test_crc(void);
+
+#endif  // TEST_CRC_H
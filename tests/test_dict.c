@@ -0,0 +1,165 @@
+#include "test_dict.h"
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../mgz.h"
+#include "testtools.h"
+
+#define N_READS 100
+#define BLOCK_SIZE 16384
+#define N_REQS 200
+
+/* Fills SIZE bytes at DATA with records drawn from a small vocabulary,
+ * the kind of data whose blocks share most of their strings. */
+static void record_fill(uint8_t *data, size_t size, unsigned int seed) {
+    static const char *fields[8] = {
+        "{\"user\": ",     "\"status\": \"ok\", ", "\"latency_ms\": ",
+        "\"region\": ",    "\"eu-west-1\", ",      "\"us-east-2\", ",
+        "\"path\": \"/v2/", "\"}\n"};
+    srand(seed);
+    for (size_t i = 0; i < size;) {
+        const char *f = fields[rand() % 8];
+        while (*f && i < size) data[i++] = (uint8_t)*f++;
+        if (i < size && rand() % 3 == 0) data[i++] = '0' + rand() % 10;
+    }
+}
+
+/* Compress SIZE bytes primed with DICT, or a trained dictionary if DICT
+ * is NULL, in 16 KiB blocks. Check that the result is smaller than
+ * without priming, and that every read path and mgz_verify see the
+ * original data. */
+static bool test_dict_helper(size_t size, const char *dict,
+                             unsigned int seed) {
+    uint8_t *data = (uint8_t *)malloc(size);
+    uint8_t *buf = (uint8_t *)malloc(size + 1);
+    FILE *outfile = fopen("test_dict.gz", "wb");
+    FILE *lookup = fopen("test_dict.lookup", "wb");
+    if (!data || !buf || !outfile || !lookup) {
+        printf("test_dict_helper: setup failed.\n");
+        if (outfile) fclose(outfile);
+        if (lookup) fclose(lookup);
+        free(data);
+        free(buf);
+        return false;
+    }
+    record_fill(data, size, seed);
+    uint64_t outSize = mgz_parallel_create_primed(
+        data, size, 6, BLOCK_SIZE, dict, dict ? strlen(dict) : 0, outfile,
+        lookup);
+    fclose(outfile);
+    fclose(lookup);
+    mgz_res_t plain = mgz_parallel_deflate(data, size, 6, BLOCK_SIZE, false);
+    bool ret = outSize > 0 && (size < 4 * BLOCK_SIZE || outSize < plain.size);
+    if (!ret) {
+        printf("test_dict_helper: %lu bytes, %lu without priming.\n",
+               (unsigned long)outSize, (unsigned long)plain.size);
+    }
+    free(plain.out);
+
+    int fd = open("test_dict.gz", O_RDONLY);
+    lookup = fopen("test_dict.lookup", "rb");
+    mgz_reader_t *r = fd < 0 ? NULL : mgz_reader_open(fd, "test_dict.lookup");
+    mgz_reader_t *mapped =
+        fd < 0 ? NULL : mgz_reader_open_mmap(fd, "test_dict.lookup");
+    mgz_reader_t *cached =
+        fd < 0 ? NULL : mgz_reader_open(fd, "test_dict.lookup");
+    mgz_cache_t *cache = mgz_cache_create(1 << 20);
+    mgz_reader_set_cache(cached, cache);
+    if (ret && (!lookup || !r || !mapped || !cached || !cache)) {
+        printf("test_dict_helper: failed to open readers.\n");
+        ret = false;
+    }
+    const char *names[4] = {"mgz_reader_read", "mgz_read", "mmap", "cache"};
+    for (int i = 0; ret && i < N_READS; ++i) {
+        uint64_t offset = (uint64_t)rand() % size;
+        uint64_t len = 1 + (uint64_t)rand() % (i % 2 ? 64 : 100000);
+        uint64_t expected = offset + len > size ? size - offset : len;
+        for (int mode = 0; ret && mode < 4; ++mode) {
+            uint64_t got =
+                mode == 0   ? mgz_reader_read(r, buf, len, offset)
+                : mode == 1 ? mgz_read(buf, len, offset, fd, lookup)
+                : mode == 2 ? mgz_reader_read(mapped, buf, len, offset)
+                            : mgz_reader_read(cached, buf, len, offset);
+            if (got != expected ||
+                compare(buf, data + offset, got) != expected) {
+                printf(
+                    "test_dict_helper: %s read of %lu bytes at %lu "
+                    "returned %lu.\n",
+                    names[mode], (unsigned long)len, (unsigned long)offset,
+                    (unsigned long)got);
+                ret = false;
+            }
+        }
+    }
+
+    /* A batch of small reads goes through its own fetch path. */
+    mgz_read_req_t reqs[N_REQS];
+    uint8_t *bufs = (uint8_t *)malloc(N_REQS * 256);
+    for (int i = 0; ret && bufs && i < N_REQS; ++i) {
+        reqs[i].buf = bufs + i * 256;
+        reqs[i].size = 256;
+        reqs[i].offset = (uint64_t)rand() % size;
+    }
+    if (ret && (!bufs || mgz_reader_read_batch(r, reqs, N_REQS, NULL,
+                                               NULL) != N_REQS)) {
+        printf("test_dict_helper: batch failed.\n");
+        ret = false;
+    }
+    for (int i = 0; ret && i < N_REQS; ++i) {
+        uint64_t expected = reqs[i].offset + 256 > size
+                                ? size - reqs[i].offset
+                                : 256;
+        if (reqs[i].result != expected ||
+            compare(reqs[i].buf, data + reqs[i].offset, expected) !=
+                expected) {
+            printf("test_dict_helper: batch read at %lu differs.\n",
+                   (unsigned long)reqs[i].offset);
+            ret = false;
+        }
+    }
+    free(bufs);
+
+    if (ret && (mgz_reader_read(r, buf, size + 1, 0) != size ||
+                compare(buf, data, size) != size)) {
+        printf("test_dict_helper: whole-range read failed.\n");
+        ret = false;
+    }
+    if (ret && !mgz_verify(fd, "test_dict.lookup", NULL)) {
+        printf("test_dict_helper: mgz_verify failed.\n");
+        ret = false;
+    }
+    mgz_reader_close(r);
+    mgz_reader_close(mapped);
+    mgz_reader_close(cached);
+    mgz_cache_destroy(cache);
+    if (lookup) fclose(lookup);
+    if (fd >= 0) close(fd);
+    free(buf);
+    free(data);
+    return ret;
+}
+
+bool test_dict() {
+    size_t testSizes[4] = {1, 16385, 999999, 4258475};
+    const char *dicts[2] = {NULL,
+                            "\"status\": \"ok\", \"region\": \"eu-west-1\", "
+                            "\"path\": \"/v2/\"}\n{\"user\": "};
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 2; ++j) {
+            if (!test_dict_helper(testSizes[i], dicts[j], i)) {
+                printf("test_dict: failed at %d of size %zd with %s.\n", i,
+                       testSizes[i],
+                       dicts[j] ? "a given dictionary"
+                                : "a trained dictionary");
+                return false;
+            }
+        }
+        printf("test_dict: %d done.\n", i);
+    }
+    return true;
+}
@@ -0,0 +1,7 @@
+#ifndef TEST_DICT_H
+#define TEST_DICT_H
+#include <stdbool.h>
+
+bool test_dict(void);
+
+#endif  // TEST_DICT_H
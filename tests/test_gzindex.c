@@ -0,0 +1,198 @@
+#include "test_gzindex.h"
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "../mgz.h"
+#include "testtools.h"
+
+#define SPAN (1 << 18)
+#define N_READS 100
+#define N_REQS 100
+
+/* Writes the SIZE bytes at DATA to PATH as gzip and zlib would, one
+ * member per entry of PARTS, which add up to SIZE, at level LEVEL. */
+static bool write_members(const char *path, const uint8_t *data,
+                          const size_t *parts, int nParts, int level) {
+    char mode[4] = {'w', 'b', (char)('0' + level), 0};
+    bool ret = true;
+    for (int i = 0, off = 0; ret && i < nParts; off += parts[i++]) {
+        mode[0] = i == 0 ? 'w' : 'a';
+        gzFile gz = gzopen(path, mode);
+        ret = gz && gzwrite(gz, data + off, (unsigned)parts[i]) ==
+                        (int)parts[i];
+        if (gz && gzclose(gz) != Z_OK) ret = false;
+    }
+    return ret;
+}
+
+/* Index test_gzindex.gz, made of the SIZE bytes at DATA, with checkpoints
+ * every SPAN bytes. Check that it has NBLOCKS blocks and at least
+ * MINPOINTS checkpoints, and that every read path and mgz_verify see the
+ * original data through the new lookup table. */
+static bool check_index(uint8_t *data, size_t size, uint64_t nBlocks,
+                        uint64_t minPoints) {
+    int fd = open("test_gzindex.gz", O_RDONLY);
+    FILE *lookup = fopen("test_gzindex.lookup", "wb");
+    uint64_t got = fd >= 0 && lookup ? mgz_index_gzip(fd, SPAN, lookup) : 0;
+    if (lookup) fclose(lookup);
+    lookup = fopen("test_gzindex.lookup", "rb");
+    mgz_reader_t *r =
+        got ? mgz_reader_open(fd, "test_gzindex.lookup") : NULL;
+    mgz_reader_t *mapped =
+        got ? mgz_reader_open_mmap(fd, "test_gzindex.lookup") : NULL;
+    mgz_reader_t *cached =
+        got ? mgz_reader_open(fd, "test_gzindex.lookup") : NULL;
+    mgz_cache_t *cache = mgz_cache_create(4 * SPAN);
+    mgz_reader_set_cache(cached, cache);
+    mgz_info_t info;
+    bool ret = r && mapped && cached && cache && lookup &&
+               mgz_reader_get_info(r, &info);
+    if (!ret || got != nBlocks || info.nBlocks != nBlocks ||
+        info.rawSize != size || info.nPoints < minPoints ||
+        info.checkpoints != (minPoints > 0)) {
+        printf("check_index: %lu blocks and %lu checkpoints, %lu and %lu "
+               "expected.\n",
+               (unsigned long)got, ret ? (unsigned long)info.nPoints : 0,
+               (unsigned long)nBlocks, (unsigned long)minPoints);
+        ret = false;
+    }
+
+    /* A small read through the cache only inflates and caches the span
+     * around it, not its whole member. */
+    uint8_t *buf = (uint8_t *)malloc(size + 1);
+    mgz_cache_stats_t stats = {0};
+    if (ret && buf &&
+        (mgz_reader_read(cached, buf, 100, size / 2) != 100 ||
+         compare(buf, data + size / 2, 100) != 100)) {
+        printf("check_index: cached read failed.\n");
+        ret = false;
+    }
+    mgz_cache_get_stats(cache, &stats);
+    if (ret && minPoints > 0 && (stats.bytes == 0 || stats.bytes > 2 * SPAN)) {
+        printf("check_index: cached %lu bytes for a checkpointed read.\n",
+               (unsigned long)stats.bytes);
+        ret = false;
+    }
+
+    const char *names[4] = {"mgz_reader_read", "mmap", "mgz_read", "cached"};
+    for (int i = 0; ret && buf && i < N_READS; ++i) {
+        uint64_t offset = (uint64_t)rand() % size;
+        uint64_t len = 1 + (uint64_t)rand() % (i % 2 ? 100 : 3 * SPAN);
+        uint64_t expected = offset + len > size ? size - offset : len;
+        for (int mode = 0; ret && mode < 4; ++mode) {
+            uint64_t n = mode == 0   ? mgz_reader_read(r, buf, len, offset)
+                         : mode == 1 ? mgz_reader_read(mapped, buf, len,
+                                                       offset)
+                         : mode == 2 ? mgz_read(buf, len, offset, fd, lookup)
+                                     : mgz_reader_read(cached, buf, len,
+                                                       offset);
+            if (n != expected || compare(buf, data + offset, n) != expected) {
+                printf("check_index: %s read of %lu bytes at %lu returned "
+                       "%lu.\n",
+                       names[mode], (unsigned long)len,
+                       (unsigned long)offset, (unsigned long)n);
+                ret = false;
+            }
+        }
+    }
+
+    /* Batches fetch each span themselves, prime byte included, with and
+     * without the cache. */
+    mgz_read_req_t reqs[N_REQS];
+    uint8_t *bufs = (uint8_t *)malloc(N_REQS * 256);
+    for (int pass = 0; ret && pass < 2; ++pass) {
+        for (int i = 0; bufs && i < N_REQS; ++i) {
+            reqs[i].buf = bufs + i * 256;
+            reqs[i].size = 256;
+            reqs[i].offset = (uint64_t)rand() % size;
+        }
+        if (!bufs || mgz_reader_read_batch(pass ? cached : r, reqs, N_REQS,
+                                           NULL, NULL) != N_REQS) {
+            printf("check_index: batch failed.\n");
+            ret = false;
+        }
+        for (int i = 0; ret && i < N_REQS; ++i) {
+            uint64_t expected =
+                reqs[i].offset + 256 > size ? size - reqs[i].offset : 256;
+            if (reqs[i].result != expected ||
+                compare(reqs[i].buf, data + reqs[i].offset, expected) !=
+                    expected) {
+                printf("check_index: batch read at %lu differs.\n",
+                       (unsigned long)reqs[i].offset);
+                ret = false;
+            }
+        }
+    }
+    free(bufs);
+    mgz_cache_get_stats(cache, &stats);
+    if (ret && stats.bytes > stats.capacity) {
+        printf("check_index: cache holds %lu bytes.\n",
+               (unsigned long)stats.bytes);
+        ret = false;
+    }
+
+    if (ret && (mgz_reader_read(mapped, buf, size + 1, 0) != size ||
+                compare(buf, data, size) != size)) {
+        printf("check_index: whole-range read failed.\n");
+        ret = false;
+    }
+    if (ret && !mgz_verify(fd, "test_gzindex.lookup", NULL)) {
+        printf("check_index: mgz_verify failed.\n");
+        ret = false;
+    }
+    free(buf);
+    mgz_reader_close(r);
+    mgz_reader_close(mapped);
+    mgz_reader_close(cached);
+    mgz_cache_destroy(cache);
+    if (lookup) fclose(lookup);
+    if (fd >= 0) close(fd);
+    return ret;
+}
+
+/* A single member at every level, and several members of which only the
+ * large ones get checkpoints. Without a span the table is the one
+ * mgz_rebuild_lookup writes. */
+bool test_gzindex() {
+    size_t size = 3000000;
+    uint8_t *data = (uint8_t *)malloc(size);
+    if (!data) return false;
+    random_fill(data, size, 11);
+    for (size_t i = 0; i < size; ++i) data[i] &= 0x0f;
+
+    bool ret = true;
+    int levels[3] = {1, 6, 9};
+    for (int i = 0; ret && i < 3; ++i) {
+        ret = write_members("test_gzindex.gz", data, &size, 1, levels[i]) &&
+              check_index(data, size, 1, size / SPAN - 1);
+        if (!ret) printf("test_gzindex: failed at level %d.\n", levels[i]);
+    }
+    if (ret) printf("test_gzindex: single member done.\n");
+
+    size_t parts[5] = {SPAN / 2, 1500000, 1, 100000, 1399999 - SPAN / 2};
+    ret = ret && write_members("test_gzindex.gz", data, parts, 5, 6) &&
+          check_index(data, size, 5, parts[1] / SPAN + parts[4] / SPAN - 2);
+    if (ret) printf("test_gzindex: members done.\n");
+
+    int fd = ret ? open("test_gzindex.gz", O_RDONLY) : -1;
+    FILE *indexed = fopen("test_gzindex.lookup", "wb");
+    FILE *rebuilt = fopen("test_gzindex_ref.lookup", "wb");
+    ret = ret && fd >= 0 && indexed && rebuilt &&
+          mgz_index_gzip(fd, 0, indexed) == 5 &&
+          mgz_rebuild_lookup(fd, rebuilt) == 5;
+    if (indexed) fclose(indexed);
+    if (rebuilt) fclose(rebuilt);
+    if (fd >= 0) close(fd);
+    if (ret && !compare_files("test_gzindex.lookup", "test_gzindex_ref.lookup")) {
+        printf("test_gzindex: a span of 0 differs from a rebuild.\n");
+        ret = false;
+    }
+    free(data);
+    return ret;
+}
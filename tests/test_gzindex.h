@@ -0,0 +1,7 @@
+#ifndef TEST_GZINDEX_H
+#define TEST_GZINDEX_H
+#include <stdbool.h>
+
+bool test_gzindex(void);
+
+#endif  // TEST_GZINDEX_H
@@ -0,0 +1,148 @@
+#include "test_huge.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../crc.h"
+#include "../mgz.h"
+#include "testtools.h"
+
+#define HUGE_SIZE ((4ULL << 30) + (3ULL << 20) + 7)    // Past 2^32.
+#define HUGE_BLOCK_SIZE ((2ULL << 30) + (1ULL << 20))  // Past 2^31.
+#define HUGE_BUDGET (HUGE_BLOCK_SIZE + (64ULL << 20))  // One block a wave.
+#define MARKER_SIZE 64
+#define N_MARKERS 6
+#define SMALL_SIZE 999999
+#define SMALL_BLOCK_SIZE (5ULL << 30)  // Past 2^32 and past the data.
+
+/* Random bytes around the offsets where 32-bit arithmetic would go
+ * wrong: 2^31, 2^32, the block boundaries and the end of the data. The
+ * rest of the input is zero pages that are never touched, so it costs
+ * no memory. */
+static const uint64_t markers[N_MARKERS] = {
+    0,
+    (1ULL << 31) - MARKER_SIZE / 2,
+    HUGE_BLOCK_SIZE - MARKER_SIZE / 2,
+    (1ULL << 32) - MARKER_SIZE / 2,
+    2 * HUGE_BLOCK_SIZE - MARKER_SIZE / 2,
+    HUGE_SIZE - MARKER_SIZE,
+};
+
+/* Reads the 3 * MARKER_SIZE bytes around marker M through R, or through
+ * mgz_read if R is NULL, and checks them against DATA. */
+static bool check_marker(mgz_reader_t *r, int fd, FILE *lookup,
+                         const uint8_t *data, int m) {
+    uint8_t buf[3 * MARKER_SIZE];
+    uint64_t from = markers[m] < MARKER_SIZE ? 0 : markers[m] - MARKER_SIZE;
+    uint64_t want = HUGE_SIZE - from < sizeof(buf) ? HUGE_SIZE - from
+                                                   : sizeof(buf);
+    uint64_t got = r ? mgz_reader_read(r, buf, sizeof(buf), from)
+                     : mgz_read(buf, sizeof(buf), from, fd, lookup);
+    if (got != want || compare(buf, (void *)(data + from), want) != want) {
+        printf("check_marker: %s differs at %lu.\n",
+               r ? "mgz_reader_read" : "mgz_read", (unsigned long)from);
+        return false;
+    }
+    return true;
+}
+
+/* Compresses HUGE_SIZE bytes in blocks of HUGE_BLOCK_SIZE, then checks
+ * the whole archive with mgz_verify and reads around every marker. */
+static bool test_huge_archive(void) {
+    uint8_t *data = (uint8_t *)mmap(NULL, HUGE_SIZE, PROT_READ | PROT_WRITE,
+                                    MAP_PRIVATE | MAP_ANONYMOUS |
+                                        MAP_NORESERVE,
+                                    -1, 0);
+    if (data == MAP_FAILED) {
+        printf("test_huge_archive: mmap failed.\n");
+        return false;
+    }
+    for (int m = 0; m < N_MARKERS; ++m) {
+        random_fill(data + markers[m], MARKER_SIZE, m);
+    }
+    bool ret = false;
+    mgz_reader_t *r = NULL;
+    int fd = -1;
+    FILE *outfile = fopen("test_huge.gz", "wb");
+    FILE *lookup = fopen("test_huge.lookup", "wb");
+    if (!outfile || !lookup) {
+        printf("test_huge_archive: failed to create outfile(s).\n");
+        goto _bailout;
+    }
+    uint64_t outSize = mgz_parallel_create_bounded(
+        data, HUGE_SIZE, 1, HUGE_BLOCK_SIZE, HUGE_BUDGET, outfile, lookup);
+    fclose(outfile);
+    fclose(lookup);
+    outfile = NULL;
+    lookup = fopen("test_huge.lookup", "rb");
+    fd = open("test_huge.gz", O_RDONLY);
+    if (outSize == 0 || !lookup || fd < 0) {
+        printf("test_huge_archive: create failed.\n");
+        goto _bailout;
+    }
+
+    uint32_t crc = 0;
+    if (!mgz_verify(fd, "test_huge.lookup", &crc) ||
+        crc != crc32_fast(0, data, HUGE_SIZE)) {
+        printf("test_huge_archive: verify failed.\n");
+        goto _bailout;
+    }
+    r = mgz_reader_open(fd, "test_huge.lookup");
+    mgz_info_t info;
+    if (!r || !mgz_reader_get_info(r, &info) || info.rawSize != HUGE_SIZE ||
+        info.nBlocks != 3) {
+        printf("test_huge_archive: wrong layout.\n");
+        goto _bailout;
+    }
+    for (int m = 0; m < N_MARKERS; ++m) {
+        if (!check_marker(r, fd, lookup, data, m)) goto _bailout;
+    }
+    if (!check_marker(NULL, fd, lookup, data, 3) ||
+        !check_marker(NULL, fd, lookup, data, N_MARKERS - 1)) {
+        goto _bailout;
+    }
+    ret = true;
+
+_bailout:
+    if (r) mgz_reader_close(r);
+    if (fd >= 0) close(fd);
+    if (outfile) fclose(outfile);
+    if (lookup) fclose(lookup);
+    munmap(data, HUGE_SIZE);
+    return ret;
+}
+
+/* Round-trips a small input through a single block whose nominal size
+ * does not fit 32 bits, so its gzip trailer cannot tell its size. */
+static bool test_huge_block_size(void) {
+    uint8_t *data = (uint8_t *)malloc(SMALL_SIZE);
+    if (!data) return false;
+    random_fill(data, SMALL_SIZE, 7);
+    mgz_res_t res =
+        mgz_parallel_deflate(data, SMALL_SIZE, 6, SMALL_BLOCK_SIZE, true);
+    void *out = NULL;
+    uint64_t outSize =
+        res.out ? mgz_parallel_inflate(&out, res.out, res.size, res.lookup,
+                                       res.nBlocks, SMALL_BLOCK_SIZE)
+                : 0;
+    bool ret = res.nBlocks == 1 && outSize == SMALL_SIZE &&
+               compare(out, data, SMALL_SIZE) == SMALL_SIZE;
+    if (!ret) printf("test_huge_block_size: round trip failed.\n");
+    free(out);
+    free(res.out);
+    free(res.lookup);
+    free(data);
+    return ret;
+}
+
+bool test_huge() {
+    if (!test_huge_block_size()) return false;
+    printf("test_huge: 0 done.\n");
+    if (!test_huge_archive()) return false;
+    printf("test_huge: 1 done.\n");
+    return true;
+}
@@ -0,0 +1,7 @@
+#ifndef TEST_HUGE_H
+#define TEST_HUGE_H
+#include <stdbool.h>
+
+bool test_huge(void);
+
+#endif  // TEST_HUGE_H
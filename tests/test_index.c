@@ -0,0 +1,195 @@
+#include "test_index.h"
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../mgz.h"
+#include "../mgz_internal.h"
+#include "testtools.h"
+
+#define N_READS 100
+
+/* Compress SIZE random bytes into a self-describing archive, both in one
+ * call and through the streaming API, and check that the two are
+ * byte-identical, that gzread still sees the original data, and that
+ * random ranges read back correctly without a lookup file. */
+static bool test_index_helper(size_t size, unsigned int seed) {
+    uint8_t *data = test_create(size, seed);
+    uint8_t *buf = (uint8_t *)malloc(size + 1);
+    FILE *outfile = fopen("test_index.gz", "wb");
+    FILE *streamOut = fopen("test_index_stream.gz", "wb");
+    if (!data || !buf || !outfile || !streamOut) {
+        printf("test_index_helper: setup failed.\n");
+        if (outfile) fclose(outfile);
+        if (streamOut) fclose(streamOut);
+        free(data);
+        free(buf);
+        return false;
+    }
+    mgz_parallel_create_indexed(data, size, 9, 16384, outfile);
+    fclose(outfile);
+    mgz_stream_t *s = mgz_stream_init_indexed(9, 16384, 3, streamOut);
+    bool ret = s && mgz_stream_feed(s, data, size);
+    if (s) mgz_stream_finish(s);
+    fclose(streamOut);
+    if (!ret || !compare_files("test_index.gz", "test_index_stream.gz")) {
+        printf("test_index_helper: stream output differs.\n");
+        ret = false;
+    }
+    if (ret && !check_gzread("test_index.gz", data, size)) {
+        printf("test_index_helper: gzread output differs.\n");
+        ret = false;
+    }
+
+    int fd = open("test_index.gz", O_RDONLY);
+    mgz_reader_t *r = fd < 0 ? NULL : mgz_reader_open(fd, NULL);
+    mgz_reader_t *mapped = fd < 0 ? NULL : mgz_reader_open_mmap(fd, NULL);
+    if (ret && (!r || !mapped)) {
+        printf("test_index_helper: failed to open readers.\n");
+        ret = false;
+    }
+    const char *names[3] = {"mgz_reader_read", "mgz_read", "mmap"};
+    srand(seed);
+    for (int i = 0; ret && i < N_READS; ++i) {
+        uint64_t offset = (uint64_t)rand() % size;
+        uint64_t len = 1 + (uint64_t)rand() % (i % 2 ? 64 : 100000);
+        uint64_t expected = offset + len > size ? size - offset : len;
+        for (int mode = 0; ret && mode < 3; ++mode) {
+            uint64_t got =
+                mode == 0   ? mgz_reader_read(r, buf, len, offset)
+                : mode == 1 ? mgz_read(buf, len, offset, fd, NULL)
+                            : mgz_reader_read(mapped, buf, len, offset);
+            if (got != expected ||
+                compare(buf, data + offset, got) != expected) {
+                printf(
+                    "test_index_helper: %s read of %lu bytes at %lu "
+                    "returned %lu.\n",
+                    names[mode], (unsigned long)len, (unsigned long)offset,
+                    (unsigned long)got);
+                ret = false;
+            }
+        }
+    }
+
+    /* The index members inflate to nothing, so nothing follows the
+     * data. */
+    if (ret && (mgz_reader_read(mapped, buf, size + 1, 0) != size ||
+                compare(buf, data, size) != size ||
+                mgz_reader_read(r, buf, 1, size) != 0)) {
+        printf("test_index_helper: whole-range read failed.\n");
+        ret = false;
+    }
+    mgz_reader_close(r);
+    mgz_reader_close(mapped);
+
+    if (ret && fd >= 0) {
+        FILE *raw = fopen("test_index.raw", "wb");
+        uint64_t outSize = raw ? mgz_parallel_inflate_file(fd, NULL, raw) : 0;
+        if (raw) fclose(raw);
+        uint8_t *out = read_file("test_index.raw", &outSize);
+        if (!out || outSize != size || compare(out, data, size) != size) {
+            printf("test_index_helper: mgz_parallel_inflate_file failed.\n");
+            ret = false;
+        }
+        free(out);
+    }
+    if (fd >= 0) close(fd);
+    free(buf);
+    free(data);
+    return ret;
+}
+
+/* Write an index too large for a single extra field after some filler
+ * and check that it is split over several members and read back. */
+static bool test_index_large(void) {
+    uint64_t nBlocks = 20000;  // 160 KB of offsets, 3 members.
+    uint64_t *offsets = (uint64_t *)malloc(nBlocks * sizeof(uint64_t));
+    FILE *out = fopen("test_index.gz", "wb");
+    if (!offsets || !out) {
+        if (out) fclose(out);
+        free(offsets);
+        return false;
+    }
+    for (uint64_t i = 0; i < nBlocks; ++i) offsets[i] = i * 1000;
+    uint8_t filler[1000] = {0};
+    fwrite(filler, 1, sizeof(filler), out);
+    mgz_index_t idx = {16384, nBlocks, sizeof(filler), nBlocks * 16384,
+                       offsets, 0x8badf00d, true};
+    uint64_t written = index_write(out, &idx);
+    fclose(out);
+
+    int fd = open("test_index.gz", O_RDONLY);
+    mgz_index_t got;
+    bool ret = written > 2 * 65535 && fd >= 0 && index_read(fd, &got);
+    if (ret) {
+        ret = got.blockSize == 16384 && got.nBlocks == nBlocks &&
+              got.dataSize == sizeof(filler) &&
+              got.rawSize == nBlocks * 16384 && got.hasCrc &&
+              got.crc == 0x8badf00d &&
+              compare(got.offsets, offsets, nBlocks * sizeof(uint64_t)) ==
+                  nBlocks * sizeof(uint64_t);
+        free(got.offsets);
+    }
+    if (fd >= 0) close(fd);
+    free(offsets);
+    return ret;
+}
+
+/* Archives without a valid index must be rejected rather than misread:
+ * a plain archive, and an indexed one with a byte of its index flipped
+ * or its locator cut off. */
+static bool test_index_invalid(void) {
+    uint64_t size;
+    uint8_t *archive = read_file("test_index_stream.gz", &size);
+    if (!archive) return false;
+    const char *paths[3] = {"test.gz", "test_index.gz", "test_index.gz"};
+    bool ret = true;
+    for (int i = 0; ret && i < 3; ++i) {
+        if (i > 0) {
+            FILE *out = fopen("test_index.gz", "wb");
+            uint64_t len = i == 1 ? size : size - 1;
+            if (i == 1) archive[size - 64] ^= 1;  // In the CRC of the index.
+            if (!out || fwrite(archive, 1, len, out) != len) ret = false;
+            if (out) fclose(out);
+        }
+        int fd = open(paths[i], O_RDONLY);
+        mgz_reader_t *r = fd < 0 ? NULL : mgz_reader_open(fd, NULL);
+        if (fd < 0 || r) {
+            printf("test_index_invalid: case %d not rejected.\n", i);
+            ret = false;
+        }
+        mgz_reader_close(r);
+        if (fd >= 0) close(fd);
+    }
+    free(archive);
+    return ret;
+}
+
+bool test_index() {
+    size_t testSizes[6] = {1, 16383, 16384, 16385, 999999, 4258475};
+    for (int i = 0; i < 6; ++i) {
+        for (unsigned int seed = 0; seed < 2; ++seed) {
+            if (!test_index_helper(testSizes[i], seed)) {
+                printf(
+                    "test_index: failed at %d of size %zd with seed %u.\n",
+                    i, testSizes[i], seed);
+                return false;
+            }
+        }
+        printf("test_index: %d done.\n", i);
+    }
+    if (!test_index_invalid()) {
+        printf("test_index: invalid archive accepted.\n");
+        return false;
+    }
+    if (!test_index_large()) {
+        printf("test_index: large index failed.\n");
+        return false;
+    }
+    printf("test_index: invalid and large indexes done.\n");
+    return true;
+}
@@ -0,0 +1,7 @@
+#ifndef TEST_INDEX_H
+#define TEST_INDEX_H
+#include <stdbool.h>
+
+bool test_index(void);
+
+#endif  // TEST_INDEX_H
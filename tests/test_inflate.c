@@ -0,0 +1,169 @@
+#include "test_inflate.h"
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../mgz.h"
+#include "testtools.h"
+
+static bool check_output(const char *what, void *out, uint64_t outSize,
+                         uint8_t *data, size_t size) {
+    if (outSize != size || !out || compare(out, data, size) != size) {
+        printf("check_output: %s returned %lu bytes, expected %zd.\n", what,
+               (unsigned long)outSize, size);
+        return false;
+    }
+    return true;
+}
+
+/* Decompress a mgz archive of SIZE random bytes in memory and from
+ * disk, with and without its lookup table. */
+static bool test_inflate_helper(size_t size, unsigned int seed) {
+    uint8_t *data = test_create(size, seed);
+    if (!data) return false;
+    mgz_res_t res = mgz_parallel_deflate(data, size, 9, 16384, true);
+    void *out = NULL;
+    uint64_t outSize = mgz_parallel_inflate(&out, res.out, res.size,
+                                            res.lookup, res.nBlocks, 16384);
+    bool ret = check_output("lookup", out, outSize, data, size);
+    free(out);
+    outSize = mgz_parallel_inflate(&out, res.out, res.size, NULL, 0, 0);
+    ret = ret && check_output("scan", out, outSize, data, size);
+    free(out);
+    free(res.out);
+    free(res.lookup);
+
+    for (int useLookup = 0; ret && useLookup < 2; ++useLookup) {
+        int infd = open("test.gz", O_RDONLY);
+        FILE *outfile = fopen("test_inflate.raw", "wb");
+        if (infd < 0 || !outfile) {
+            printf("test_inflate_helper: failed to open files.\n");
+            ret = false;
+            break;
+        }
+        outSize = mgz_parallel_inflate_file(
+            infd, useLookup ? "test.lookup" : NULL, outfile);
+        close(infd);
+        fclose(outfile);
+        out = read_file("test_inflate.raw", &outSize);
+        ret = check_output(useLookup ? "file lookup" : "file scan", out,
+                           outSize, data, size);
+        free(out);
+    }
+    free(data);
+    return ret;
+}
+
+/* Concatenate gzip members of varying sizes, as other tools write
+ * them, and decompress the result without a lookup table. */
+static bool test_inflate_members(unsigned int seed) {
+    size_t size = 3000000;
+    uint8_t *data = (uint8_t *)malloc(size);
+    uint8_t *in = (uint8_t *)malloc(size * 2);
+    if (!data || !in) {
+        free(data);
+        free(in);
+        return false;
+    }
+    random_fill(data, size, seed);
+    for (size_t i = 0; i < size; i += 7) data[i] = 0;  // Compressible.
+    uint64_t inSize = 0;
+    srand(seed);
+    for (size_t off = 0; off < size;) {
+        size_t len = 1 + rand() % 200000;
+        if (len > size - off) len = size - off;
+        void *member;
+        uint64_t memberSize = mgz_deflate(&member, data + off, len, 6);
+        memcpy(in + inSize, member, memberSize);
+        free(member);
+        inSize += memberSize;
+        off += len;
+    }
+    void *out = NULL;
+    uint64_t outSize = mgz_parallel_inflate(&out, in, inSize, NULL, 0, 0);
+    bool ret = check_output("members", out, outSize, data, size);
+
+    /* A trailing partial member is an error, not silent truncation. */
+    free(out);
+    outSize = mgz_parallel_inflate(&out, in, inSize - 1, NULL, 0, 0);
+    if (outSize != 0 || out) {
+        printf("test_inflate_members: truncated input accepted.\n");
+        ret = false;
+    }
+    free(out);
+    free(in);
+    free(data);
+    return ret;
+}
+
+/* Corrupt a block in the middle of an archive and check that
+ * mgz_parallel_inflate_file reports an error rather than returning the
+ * data before the block as if it were all of it. */
+static bool test_inflate_corrupt(void) {
+    uint8_t *data = test_create(999999, 3);
+    uint64_t inSize, lookupSize;
+    uint8_t *in = read_file("test.gz", &inSize);
+    uint64_t *lookup = (uint64_t *)read_file("test.lookup", &lookupSize);
+    bool ret = data && in && lookup;
+    if (ret) {
+        /* lookup[0] is the block size, and lookup[1 + i] the offset of
+         * block i. */
+        uint64_t middle = lookup[1 + (lookupSize / sizeof(uint64_t) - 1) / 2];
+        memset(in + middle + 100, 0xff, 64);
+        FILE *f = fopen("test_inflate_corrupt.gz", "wb");
+        ret = f && fwrite(in, 1, inSize, f) == inSize;
+        if (f) fclose(f);
+    }
+    for (int useLookup = 0; ret && useLookup < 2; ++useLookup) {
+        int infd = open("test_inflate_corrupt.gz", O_RDONLY);
+        FILE *outfile = fopen("test_inflate.raw", "wb");
+        if (infd < 0 || !outfile) {
+            printf("test_inflate_corrupt: failed to open files.\n");
+            ret = false;
+        } else if (mgz_parallel_inflate_file(
+                       infd, useLookup ? "test.lookup" : NULL, outfile) !=
+                   0) {
+            printf("test_inflate_corrupt: %s accepted a corrupt block.\n",
+                   useLookup ? "lookup" : "scan");
+            ret = false;
+        }
+        if (infd >= 0) close(infd);
+        if (outfile) fclose(outfile);
+    }
+    free(lookup);
+    free(in);
+    free(data);
+    return ret;
+}
+
+bool test_inflate() {
+    size_t testSizes[8] = {1,     16383,  16384,   16385,
+                           65537, 999999, 4258475, 0};
+    for (int i = 0; i < 8; ++i) {
+        if (testSizes[i] == 0) break;
+        for (unsigned int seed = 0; seed < 3; ++seed) {
+            if (!test_inflate_helper(testSizes[i], seed)) {
+                printf(
+                    "test_inflate: failed at %d of size %zd with seed "
+                    "%u.\n",
+                    i, testSizes[i], seed);
+                return false;
+            }
+        }
+        printf("test_inflate: %d done.\n", i);
+    }
+    for (unsigned int seed = 0; seed < 3; ++seed) {
+        if (!test_inflate_members(seed)) {
+            printf("test_inflate: members failed with seed %u.\n", seed);
+            return false;
+        }
+    }
+    printf("test_inflate: members done.\n");
+    if (!test_inflate_corrupt()) return false;
+    printf("test_inflate: corrupt done.\n");
+    return true;
+}
@@ -0,0 +1,7 @@
+#ifndef TEST_INFLATE_H
+#define TEST_INFLATE_H
+#include <stdbool.h>
+
+bool test_inflate(void);
+
+#endif  // TEST_INFLATE_H
@@ -0,0 +1,84 @@
+#define _GNU_SOURCE
+#include "test_numa.h"
+
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../mgz.h"
+#include "../topology.h"
+#include "testtools.h"
+
+#define BLOCK_SIZE 16384
+#define N_NODE_COUNTS 3
+
+/* With the machine pretending to have NNODES nodes, compress SIZE bytes
+ * and check that the output of mgz_parallel_deflate matches REF, that
+ * mgz_parallel_create writes the same files as test_create did, and that
+ * the calling thread may still run on every CPU it could before. */
+static bool test_numa_helper(uint8_t *data, size_t size, const mgz_res_t *ref,
+                             int nNodes) {
+    cpu_set_t before, after;
+    if (sched_getaffinity(0, sizeof(before), &before) != 0) {
+        printf("test_numa_helper: sched_getaffinity failed.\n");
+        return false;
+    }
+    topology_pretend(nNodes);
+    mgz_res_t res = mgz_parallel_deflate(data, size, 9, BLOCK_SIZE, true);
+    FILE *outfile = fopen("test_numa.gz", "wb");
+    FILE *lookup = fopen("test_numa.lookup", "wb");
+    bool ok = outfile && lookup;
+    if (ok) mgz_parallel_create(data, size, 9, BLOCK_SIZE, outfile, lookup);
+    if (outfile) fclose(outfile);
+    if (lookup) fclose(lookup);
+    topology_pretend(0);
+    if (!ok) {
+        printf("test_numa_helper: failed to create outfile(s).\n");
+    } else if (res.size != ref->size || res.nBlocks != ref->nBlocks ||
+               res.crc != ref->crc ||
+               compare(res.out, ref->out, res.size) != res.size ||
+               compare(res.lookup, ref->lookup,
+                       (res.nBlocks + 1) * sizeof(uint64_t)) !=
+                   (res.nBlocks + 1) * sizeof(uint64_t)) {
+        printf("test_numa_helper: deflate with %d nodes differs.\n", nNodes);
+        ok = false;
+    } else if (!compare_files("test_numa.gz", "test.gz") ||
+               !compare_files("test_numa.lookup", "test.lookup")) {
+        printf("test_numa_helper: create with %d nodes differs.\n", nNodes);
+        ok = false;
+    } else if (sched_getaffinity(0, sizeof(after), &after) != 0 ||
+               !CPU_EQUAL(&before, &after)) {
+        printf("test_numa_helper: %d nodes left the thread pinned.\n",
+               nNodes);
+        ok = false;
+    }
+    free(res.out);
+    free(res.lookup);
+    return ok;
+}
+
+bool test_numa() {
+    size_t testSizes[4] = {1, 16385, 999999, 4258475};
+    int nodeCounts[N_NODE_COUNTS] = {1, 2, 3};
+    for (int i = 0; i < 4; ++i) {
+        /* test_create leaves the archive in test.gz. */
+        uint8_t *data = test_create(testSizes[i], i);
+        if (!data) return false;
+        mgz_res_t ref =
+            mgz_parallel_deflate(data, testSizes[i], 9, BLOCK_SIZE, true);
+        bool ok = ref.out != NULL;
+        for (int n = 0; ok && n < N_NODE_COUNTS; ++n) {
+            ok = test_numa_helper(data, testSizes[i], &ref, nodeCounts[n]);
+        }
+        free(ref.out);
+        free(ref.lookup);
+        free(data);
+        if (!ok) {
+            printf("test_numa: failed at %d of size %zd.\n", i, testSizes[i]);
+            return false;
+        }
+        printf("test_numa: %d done.\n", i);
+    }
+    return true;
+}
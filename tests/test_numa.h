@@ -0,0 +1,7 @@
+#ifndef TEST_NUMA_H
+#define TEST_NUMA_H
+#include <stdbool.h>
+
+bool test_numa(void);
+
+#endif  // TEST_NUMA_H
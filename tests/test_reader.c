@@ -0,0 +1,154 @@
+#include "test_reader.h"
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../mgz.h"
+#include "testtools.h"
+
+#define N_READS 200
+
+/* gzip a random array of size bytes, save it to disk, and then read
+ * random ranges through a single mgz_reader_t as well as through the
+ * mgz_read compatibility wrapper, with the lookup table in a file and in
+ * memory, including ranges that cross block boundaries and ranges that
+ * run past the end of the data. */
+static bool test_reader_helper(size_t size, unsigned int seed) {
+    uint8_t *data = test_create(size, seed);
+    uint8_t *buf = (uint8_t *)malloc(size + 1);
+    int fd = open("test.gz", O_RDONLY);
+    FILE *lookup = fopen("test.lookup", "rb");
+    mgz_reader_t *r = fd < 0 ? NULL : mgz_reader_open(fd, "test.lookup");
+    mgz_reader_t *mapped =
+        fd < 0 ? NULL : mgz_reader_open_mmap(fd, "test.lookup");
+    uint64_t lookupSize = 0;
+    uint8_t *words = read_file("test.lookup", &lookupSize);
+    FILE *memLookup = words ? fmemopen(words, lookupSize, "rb") : NULL;
+    bool ret = data && buf && lookup && r && mapped && memLookup;
+    if (!ret) printf("test_reader_helper: setup failed.\n");
+    const char *names[4] = {"mgz_reader_read", "mgz_read", "mmap",
+                            "fmemopen"};
+
+    srand(seed);
+    for (int i = 0; ret && i < N_READS; ++i) {
+        uint64_t offset = (uint64_t)rand() % size;
+        uint64_t len = 1 + (uint64_t)rand() % (i % 2 ? 64 : 100000);
+        uint64_t expected = offset + len > size ? size - offset : len;
+        for (int mode = 0; ret && mode < 4; ++mode) {
+            uint64_t got =
+                mode == 0   ? mgz_reader_read(r, buf, len, offset)
+                : mode == 1 ? mgz_read(buf, len, offset, fd, lookup)
+                : mode == 2 ? mgz_reader_read(mapped, buf, len, offset)
+                            : mgz_read(buf, len, offset, fd, memLookup);
+            if (got != expected ||
+                compare(buf, data + offset, got) != expected) {
+                printf(
+                    "test_reader_helper: %s read of %lu bytes at %lu "
+                    "returned %lu.\n",
+                    names[mode],
+                    (unsigned long)len, (unsigned long)offset,
+                    (unsigned long)got);
+                ret = false;
+            }
+        }
+    }
+
+    /* The whole data in one call, which inflates every block in
+     * parallel. */
+    if (ret && (mgz_reader_read(r, buf, size + 1, 0) != size ||
+                compare(buf, data, size) != size ||
+                mgz_reader_read(mapped, buf, size + 1, 0) != size ||
+                compare(buf, data, size) != size)) {
+        printf("test_reader_helper: whole-range read failed.\n");
+        ret = false;
+    }
+
+    /* Nothing to read past the end. */
+    if (ret && mgz_reader_read(r, buf, 1, size) != 0) {
+        printf("test_reader_helper: read past the end succeeded.\n");
+        ret = false;
+    }
+
+    mgz_reader_close(r);
+    mgz_reader_close(mapped);
+    if (lookup) fclose(lookup);
+    if (memLookup) fclose(memLookup);
+    if (fd >= 0) close(fd);
+    free(words);
+    free(buf);
+    free(data);
+    return ret;
+}
+
+/* Scan the data byte by byte from several threads sharing one reader
+ * and one cache that is too small to hold the whole file, then check
+ * the counters. */
+static bool test_reader_cache_helper(size_t size, unsigned int seed) {
+    uint8_t *data = test_create(size, seed);
+    int fd = open("test.gz", O_RDONLY);
+    mgz_reader_t *r = fd < 0 ? NULL : mgz_reader_open(fd, "test.lookup");
+    mgz_cache_t *cache = mgz_cache_create(4 * 16384);
+    bool ret = data && r && cache;
+    if (!ret) printf("test_reader_cache_helper: setup failed.\n");
+    mgz_reader_set_cache(r, cache);
+
+#pragma omp parallel for schedule(static, 4096)
+    for (size_t i = 0; i < (ret ? size : 0); ++i) {
+        uint8_t b = 0;
+        if (mgz_reader_read(r, &b, 1, i) != 1 || b != data[i]) {
+            printf(
+                "test_reader_cache_helper: test failed at index i = "
+                "%zd.\n",
+                i);
+            ret = false;
+        }
+    }
+
+    mgz_cache_stats_t stats = {0};
+    mgz_cache_get_stats(cache, &stats);
+    uint64_t nBlocks = (size + 16383) / 16384;
+    if (ret && (stats.hits + stats.misses != size ||
+                stats.misses < nBlocks || stats.bytes > stats.capacity ||
+                (nBlocks > 4 && stats.evictions == 0))) {
+        printf(
+            "test_reader_cache_helper: bad stats: %lu hits, %lu misses, "
+            "%lu evictions, %lu bytes.\n",
+            (unsigned long)stats.hits, (unsigned long)stats.misses,
+            (unsigned long)stats.evictions, (unsigned long)stats.bytes);
+        ret = false;
+    }
+
+    mgz_reader_close(r);
+    mgz_cache_destroy(cache);
+    if (fd >= 0) close(fd);
+    free(data);
+    return ret;
+}
+
+bool test_reader() {
+    size_t testSizes[10] = {1,     1023,  16383,   16384,   16385,
+                            65537, 99999, 1048577, 4258475, 0};
+    for (int i = 0; i < 10; ++i) {
+        if (testSizes[i] == 0) break;
+        for (unsigned int seed = 0; seed < 3; ++seed) {
+            if (!test_reader_helper(testSizes[i], seed)) {
+                printf(
+                    "test_reader: failed at %d of size %zd with seed "
+                    "%u.\n",
+                    i, testSizes[i], seed);
+                return false;
+            }
+        }
+        if (!test_reader_cache_helper(testSizes[i], i)) {
+            printf("test_reader: cache failed at %d of size %zd.\n", i,
+                   testSizes[i]);
+            return false;
+        }
+        printf("test_reader: %d done.\n", i);
+    }
+    return true;
+}
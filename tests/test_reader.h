@@ -0,0 +1,7 @@
+#ifndef TEST_READER_H
+#define TEST_READER_H
+#include <stdbool.h>
+
+bool test_reader(void);
+
+#endif  // TEST_READER_H
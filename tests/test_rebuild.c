@@ -0,0 +1,158 @@
+#include "test_rebuild.h"
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "../mgz.h"
+#include "testtools.h"
+
+#define BLOCK_SIZE 16384
+#define N_READS 50
+
+/* Rebuild the lookup file of the archive at PATH into
+ * test_rebuild.lookup and check that it has NBLOCKS blocks, that the
+ * layout it gives matches SIZE, and that random reads through it return
+ * the SIZE bytes at DATA. */
+static bool check_rebuild(const char *path, uint8_t *data, size_t size,
+                          uint64_t nBlocks) {
+    int fd = open(path, O_RDONLY);
+    FILE *lookup = fopen("test_rebuild.lookup", "wb");
+    uint64_t got = fd >= 0 && lookup ? mgz_rebuild_lookup(fd, lookup) : 0;
+    if (lookup) fclose(lookup);
+    mgz_reader_t *r =
+        got ? mgz_reader_open(fd, "test_rebuild.lookup") : NULL;
+    mgz_info_t info;
+    bool ret = r && mgz_reader_get_info(r, &info);
+    if (!ret || got != nBlocks || info.nBlocks != nBlocks ||
+        info.rawSize != size) {
+        printf("test_rebuild: %s rebuilt with %lu blocks, %lu expected.\n",
+               path, (unsigned long)got, (unsigned long)nBlocks);
+        ret = false;
+    }
+    uint8_t buf[4096];
+    for (int i = 0; ret && i < N_READS; ++i) {
+        uint64_t offset = (uint64_t)rand() % size;
+        uint64_t len = 1 + (uint64_t)rand() % sizeof(buf);
+        uint64_t expected = offset + len > size ? size - offset : len;
+        if (mgz_reader_read(r, buf, len, offset) != expected ||
+            compare(buf, data + offset, expected) != expected) {
+            printf("test_rebuild: %s read at %lu differs.\n", path,
+                   (unsigned long)offset);
+            ret = false;
+        }
+    }
+    mgz_reader_close(r);
+    if (fd >= 0) close(fd);
+    return ret;
+}
+
+/* An archive with a lookup file and an indexed one: the rebuilt table
+ * is the original one, and the reader reports the layout. */
+static bool test_rebuild_mgz(size_t size, unsigned int seed) {
+    uint8_t *data = test_create(size, seed);  // test.gz and test.lookup.
+    uint64_t nBlocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    bool ret = data && check_rebuild("test.gz", data, size, nBlocks);
+    if (ret && size > BLOCK_SIZE &&
+        !compare_files("test_rebuild.lookup", "test.lookup")) {
+        printf("test_rebuild_mgz: rebuilt lookup differs.\n");
+        ret = false;
+    }
+
+    FILE *outfile = fopen("test_rebuild.gz", "wb");
+    ret = ret && outfile &&
+          mgz_parallel_create_indexed(data, size, 9, BLOCK_SIZE, outfile) >
+              0;
+    if (outfile) fclose(outfile);
+    ret = ret && check_rebuild("test_rebuild.gz", data, size, nBlocks) &&
+          compare_files("test_rebuild.lookup", "test.lookup");
+    int fd = ret ? open("test_rebuild.gz", O_RDONLY) : -1;
+    mgz_reader_t *r = fd >= 0 ? mgz_reader_open(fd, NULL) : NULL;
+    mgz_info_t info;
+    if (ret && (!r || !mgz_reader_get_info(r, &info) || !info.indexed ||
+                !info.hasCrc || info.crc != crc32(0, data, size) ||
+                info.blockSize != BLOCK_SIZE || info.variable)) {
+        printf("test_rebuild_mgz: wrong layout of an indexed archive.\n");
+        ret = false;
+    }
+    mgz_reader_close(r);
+    if (fd >= 0) close(fd);
+    free(data);
+    return ret;
+}
+
+/* Plain gzip members of different sizes, as gzip and zlib write them,
+ * get a table in the variable format. A file that is not gzip, or that
+ * holds only empty members, gets none. */
+static bool test_rebuild_gzip() {
+    size_t sizes[3] = {100000, 1, 250000}, total = 350001;
+    uint8_t *data = (uint8_t *)malloc(total);
+    if (!data) return false;
+    random_fill(data, total, 7);
+    bool ret = true;
+    for (size_t i = 0, off = 0; ret && i < 3; off += sizes[i++]) {
+        gzFile gz = gzopen("test_rebuild.gz", i == 0 ? "wb" : "ab");
+        ret = gz && gzwrite(gz, data + off, (unsigned)sizes[i]) ==
+                        (int)sizes[i];
+        if (gz) gzclose(gz);
+    }
+    ret = ret && check_rebuild("test_rebuild.gz", data, total, 3);
+    int fd = ret ? open("test_rebuild.gz", O_RDONLY) : -1;
+    mgz_reader_t *r =
+        fd >= 0 ? mgz_reader_open(fd, "test_rebuild.lookup") : NULL;
+    mgz_info_t info;
+    if (ret && (!r || !mgz_reader_get_info(r, &info) || !info.variable ||
+                info.indexed || info.blockSize != 250000)) {
+        printf("test_rebuild_gzip: wrong layout of gzip members.\n");
+        ret = false;
+    }
+    mgz_reader_close(r);
+    if (fd >= 0) close(fd);
+
+    FILE *junk = fopen("test_rebuild.gz", "wb");
+    ret = ret && junk && fwrite(data, 1, 1000, junk) == 1000;
+    if (junk) fclose(junk);
+    fd = ret ? open("test_rebuild.gz", O_RDONLY) : -1;
+    FILE *lookup = fopen("test_rebuild.lookup", "wb");
+    if (ret && (fd < 0 || !lookup || mgz_rebuild_lookup(fd, lookup) != 0)) {
+        printf("test_rebuild_gzip: rebuilt a table for junk.\n");
+        ret = false;
+    }
+    if (lookup) fclose(lookup);
+    if (fd >= 0) close(fd);
+
+    for (int i = 0; ret && i < 2; ++i) {
+        gzFile gz = gzopen("test_rebuild.gz", i == 0 ? "wb" : "ab");
+        ret = gz && gzclose(gz) == Z_OK;
+    }
+    fd = ret ? open("test_rebuild.gz", O_RDONLY) : -1;
+    lookup = fopen("test_rebuild.lookup", "wb");
+    if (ret && (fd < 0 || !lookup || mgz_rebuild_lookup(fd, lookup) != 0 ||
+                ftell(lookup) != 0)) {
+        printf("test_rebuild_gzip: rebuilt a table for empty members.\n");
+        ret = false;
+    }
+    if (lookup) fclose(lookup);
+    if (fd >= 0) close(fd);
+    free(data);
+    return ret;
+}
+
+bool test_rebuild() {
+    size_t testSizes[4] = {1, 16385, 999999, 4258475};
+    for (int i = 0; i < 4; ++i) {
+        if (!test_rebuild_mgz(testSizes[i], i)) {
+            printf("test_rebuild: failed at %d of size %zd.\n", i,
+                   testSizes[i]);
+            return false;
+        }
+        printf("test_rebuild: %d done.\n", i);
+    }
+    if (!test_rebuild_gzip()) return false;
+    printf("test_rebuild: gzip done.\n");
+    return true;
+}
@@ -0,0 +1,7 @@
+#ifndef TEST_REBUILD_H
+#define TEST_REBUILD_H
+#include <stdbool.h>
+
+bool test_rebuild(void);
+
+#endif  // TEST_REBUILD_H
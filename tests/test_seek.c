@@ -0,0 +1,129 @@
+#include "test_seek.h"
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../mgz.h"
+#include "testtools.h"
+
+#define N_READS 100
+#define BLOCK_SIZE (1 << 20)
+
+/* Small reads starting inside a block inflate at most SYNCSIZE bytes
+ * they do not return. Only checked when stats are compiled in. */
+static bool check_discarded(mgz_reader_t *r, uint8_t *buf, size_t size,
+                            uint64_t syncSize) {
+    mgz_stats_t stats;
+    if (!mgz_stats_get(&stats) || size < BLOCK_SIZE) return true;
+    for (uint64_t offset = 1; offset < BLOCK_SIZE; offset = offset * 3 + 1) {
+        mgz_stats_reset();
+        mgz_reader_read(r, buf, 64, offset);
+        mgz_stats_get(&stats);
+        if (stats.bytesDiscarded >= syncSize) {
+            printf("test_seek: read at %lu discarded %lu bytes.\n",
+                   (unsigned long)offset,
+                   (unsigned long)stats.bytesDiscarded);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Compress SIZE bytes of compressible data with seek points every
+ * SYNCSIZE bytes and check that gzread still sees the original data and
+ * that random ranges read back correctly through every read path. */
+static bool test_seek_helper(size_t size, uint64_t syncSize,
+                             unsigned int seed) {
+    uint8_t *data = (uint8_t *)malloc(size);
+    uint8_t *buf = (uint8_t *)malloc(size + 1);
+    FILE *outfile = fopen("test_seek.gz", "wb");
+    FILE *lookup = fopen("test_seek.lookup", "wb");
+    if (!data || !buf || !outfile || !lookup) {
+        printf("test_seek_helper: setup failed.\n");
+        if (outfile) fclose(outfile);
+        if (lookup) fclose(lookup);
+        free(data);
+        free(buf);
+        return false;
+    }
+    random_fill(data, size, seed);
+    for (size_t i = 0; i < size; ++i) data[i] &= 0x0f;
+    uint64_t outSize = mgz_parallel_create_seekable(
+        data, size, 6, BLOCK_SIZE, syncSize, outfile, lookup);
+    fclose(outfile);
+    fclose(lookup);
+    bool ret = outSize > 0 && check_gzread("test_seek.gz", data, size);
+    if (!ret) printf("test_seek_helper: gzread output differs.\n");
+
+    int fd = open("test_seek.gz", O_RDONLY);
+    lookup = fopen("test_seek.lookup", "rb");
+    mgz_reader_t *r =
+        fd < 0 ? NULL : mgz_reader_open(fd, "test_seek.lookup");
+    mgz_reader_t *mapped =
+        fd < 0 ? NULL : mgz_reader_open_mmap(fd, "test_seek.lookup");
+    if (ret && (!lookup || !r || !mapped)) {
+        printf("test_seek_helper: failed to open readers.\n");
+        ret = false;
+    }
+    const char *names[3] = {"mgz_reader_read", "mgz_read", "mmap"};
+    srand(seed);
+    for (int i = 0; ret && i < N_READS; ++i) {
+        uint64_t offset = (uint64_t)rand() % size;
+        uint64_t len = 1 + (uint64_t)rand() % (i % 2 ? 64 : 3000000);
+        uint64_t expected = offset + len > size ? size - offset : len;
+        for (int mode = 0; ret && mode < 3; ++mode) {
+            uint64_t got =
+                mode == 0   ? mgz_reader_read(r, buf, len, offset)
+                : mode == 1 ? mgz_read(buf, len, offset, fd, lookup)
+                            : mgz_reader_read(mapped, buf, len, offset);
+            if (got != expected ||
+                compare(buf, data + offset, got) != expected) {
+                printf(
+                    "test_seek_helper: %s read of %lu bytes at %lu "
+                    "returned %lu.\n",
+                    names[mode], (unsigned long)len, (unsigned long)offset,
+                    (unsigned long)got);
+                ret = false;
+            }
+        }
+    }
+    if (ret && (mgz_reader_read(r, buf, size + 1, 0) != size ||
+                compare(buf, data, size) != size ||
+                mgz_reader_read(mapped, buf, 1, size) != 0)) {
+        printf("test_seek_helper: whole-range read failed.\n");
+        ret = false;
+    }
+    uint64_t effective = syncSize == 0      ? 65536
+                         : syncSize < 4096 ? 4096
+                                           : syncSize;
+    if (ret) ret = check_discarded(r, buf, size, effective);
+    mgz_reader_close(r);
+    mgz_reader_close(mapped);
+    if (lookup) fclose(lookup);
+    if (fd >= 0) close(fd);
+    free(buf);
+    free(data);
+    return ret;
+}
+
+bool test_seek() {
+    size_t testSizes[4] = {1, 4097, 999999, 4258475};
+    uint64_t syncSizes[3] = {0, 1, 100000};
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            if (!test_seek_helper(testSizes[i], syncSizes[j], i)) {
+                printf(
+                    "test_seek: failed at %d of size %zd with sync size "
+                    "%lu.\n",
+                    i, testSizes[i], (unsigned long)syncSizes[j]);
+                return false;
+            }
+        }
+        printf("test_seek: %d done.\n", i);
+    }
+    return true;
+}
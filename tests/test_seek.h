@@ -0,0 +1,7 @@
+#ifndef TEST_SEEK_H
+#define TEST_SEEK_H
+#include <stdbool.h>
+
+bool test_seek(void);
+
+#endif  // TEST_SEEK_H
@@ -16,19 +16,22 @@ static bool test_sequential_byte_helper(size_t size, unsigned int seed) {
     bool ret = data;
     if (!ret) return false;
 
+    /* One descriptor and one lookup stream shared by every thread. */
+    int outfd = open("test.gz", O_RDONLY);
+    FILE *lookup = fopen("test.lookup", "rb");
+    if (outfd < 0 || !lookup) {
+        printf("test_sequential_byte_helper: failed to open files.\n");
+        if (outfd >= 0) close(outfd);
+        if (lookup) fclose(lookup);
+        free(data);
+        return false;
+    }
+
 #pragma omp parallel for
     for (size_t i = 0; i < size; ++i) {
         /* Validate data using random access. */
-        int outfd = open("test.gz", O_RDONLY);
-        if (outfd < 0) {
-            printf(
-                "test_sequential_byte_helper: failed to open().\n");
-            ret = false;
-        }
-        FILE *lookup2 = fopen("test.lookup", "rb");
         uint8_t b;
-        mgz_read(&b, 1, i, outfd, lookup2);
-        if (b != data[i]) {
+        if (mgz_read(&b, 1, i, outfd, lookup) != 1 || b != data[i]) {
             printf(
                 "test_sequential_byte_helper: test failed at "
                 "index i = %zd; "
@@ -36,11 +39,10 @@ static bool test_sequential_byte_helper(size_t size, unsigned int seed) {
                 i, b, data[i]);
             ret = false;
         }
-        fclose(lookup2);
-        if (close(outfd) < 0) {
-            printf(
-                "test_sequential_byte_helper: failed to close().\n");
-        }
+    }
+    fclose(lookup);
+    if (close(outfd) < 0) {
+        printf("test_sequential_byte_helper: failed to close().\n");
     }
     free(data);
     return ret;
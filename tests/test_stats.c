@@ -0,0 +1,109 @@
+#include "test_stats.h"
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../mgz.h"
+#include "testtools.h"
+
+typedef struct {
+    int calls;
+    char last[64];
+} hook_ctx_t;
+
+static void stats_hook(void *ctx, const char *call, uint64_t ns,
+                       const mgz_stats_t *totals) {
+    (void)ns;
+    (void)totals;
+    hook_ctx_t *h = (hook_ctx_t *)ctx;
+#pragma omp atomic
+    ++h->calls;
+    strncpy(h->last, call, sizeof(h->last) - 1);
+}
+
+/* Compress SIZE random bytes and read part of them back, then check that
+ * the counters add up exactly even though blocks were compressed and
+ * inflated from several threads, and that the hook saw every call. */
+static bool test_stats_helper(size_t size, unsigned int seed) {
+    uint8_t *data = test_create(size, seed);
+    uint8_t *buf = (uint8_t *)malloc(size);
+    FILE *outfile = fopen("test_stats.gz", "wb");
+    FILE *lookup = fopen("test_stats.lookup", "wb");
+    if (!data || !buf || !outfile || !lookup) {
+        printf("test_stats_helper: setup failed.\n");
+        if (outfile) fclose(outfile);
+        if (lookup) fclose(lookup);
+        free(data);
+        free(buf);
+        return false;
+    }
+    hook_ctx_t hook = {0};
+    mgz_stats_reset();
+    mgz_stats_set_callback(stats_hook, &hook);
+    uint64_t outSize =
+        mgz_parallel_create(data, size, 6, 16384, outfile, lookup);
+    fclose(outfile);
+    fclose(lookup);
+
+    mgz_stats_t stats;
+    mgz_stats_get(&stats);
+    uint64_t nBlocks = (size + 16383) / 16384;
+    bool ret = stats.bytesIn == size && stats.bytesOut == outSize &&
+               stats.blocksDeflated == nBlocks && hook.calls == 1 &&
+               strcmp(hook.last, "mgz_parallel_create") == 0;
+    if (!ret) printf("test_stats_helper: deflate counters are off.\n");
+
+    /* Start every read 1000 bytes into a block, so that many bytes are
+     * inflated and discarded per block. */
+    int fd = open("test_stats.gz", O_RDONLY);
+    lookup = fopen("test_stats.lookup", "rb");
+    mgz_stats_reset();
+    uint64_t got = 0;
+    if (ret && fd >= 0 && lookup) {
+        got = mgz_read(buf, size - 1000, 1000, fd, lookup);
+    }
+    mgz_stats_get(&stats);
+    if (ret && (got != size - 1000 ||
+                compare(buf, data + 1000, got) != got ||
+                stats.blocksInflated != nBlocks ||
+                stats.bytesDiscarded != 1000 ||
+                stats.bytesInflated != size || stats.bytesRead != outSize ||
+                hook.calls != 2 || strcmp(hook.last, "mgz_read") != 0)) {
+        printf("test_stats_helper: inflate counters are off.\n");
+        ret = false;
+    }
+    mgz_stats_set_callback(NULL, NULL);
+    if (lookup) fclose(lookup);
+    if (fd >= 0) close(fd);
+    free(buf);
+    free(data);
+    return ret;
+}
+
+bool test_stats() {
+    mgz_stats_t stats;
+    if (!mgz_stats_get(&stats)) {
+        /* Built without MGZ_STATS: nothing is counted. */
+        mgz_stats_t zero = {0};
+        if (memcmp(&stats, &zero, sizeof(stats)) != 0) {
+            printf("test_stats: counters are not zero.\n");
+            return false;
+        }
+        printf("test_stats: disabled, skipped.\n");
+        return true;
+    }
+    size_t testSizes[3] = {16385, 999999, 4258475};
+    for (int i = 0; i < 3; ++i) {
+        if (!test_stats_helper(testSizes[i], i)) {
+            printf("test_stats: failed at %d of size %zd.\n", i,
+                   testSizes[i]);
+            return false;
+        }
+        printf("test_stats: %d done.\n", i);
+    }
+    return true;
+}
@@ -0,0 +1,7 @@
+#ifndef TEST_STATS_H
+#define TEST_STATS_H
+#include <stdbool.h>
+
+bool test_stats(void);
+
+#endif  // TEST_STATS_H
@@ -0,0 +1,92 @@
+#include "test_stream.h"
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "../mgz.h"
+#include "testtools.h"
+
+/* Compress SIZE random bytes with mgz_parallel_create and with the
+ * streaming API, feeding it FEEDSIZE bytes at a time, and check that
+ * both the data and lookup files are byte-identical. Then do the
+ * same through mgz_stream_create_fd. */
+static bool test_stream_helper(size_t size, unsigned int seed,
+                               size_t feedSize) {
+    uint8_t *data = test_create(size, seed);
+    if (!data) return false;
+
+    FILE *outfile = fopen("test_stream.gz", "wb");
+    FILE *lookup = fopen("test_stream.lookup", "wb");
+    if (!outfile || !lookup) {
+        printf("test_stream_helper: failed to create outfile(s).\n");
+        free(data);
+        return false;
+    }
+    mgz_stream_t *s = mgz_stream_init(9, 16384, 3, outfile, lookup);
+    bool ret = s;
+    for (size_t off = 0; ret && off < size; off += feedSize) {
+        size_t n = size - off < feedSize ? size - off : feedSize;
+        ret = mgz_stream_feed(s, data + off, n);
+    }
+    if (s) mgz_stream_finish(s);
+    fclose(outfile);
+    fclose(lookup);
+    if (!ret || !compare_files("test.gz", "test_stream.gz") ||
+        !compare_files("test.lookup", "test_stream.lookup")) {
+        printf("test_stream_helper: feed output differs.\n");
+        free(data);
+        return false;
+    }
+
+    /* Same again, reading the raw data from a file descriptor. */
+    FILE *raw = fopen("test_stream.raw", "wb");
+    if (!raw || fwrite(data, 1, size, raw) != size) {
+        printf("test_stream_helper: failed to write raw file.\n");
+        if (raw) fclose(raw);
+        free(data);
+        return false;
+    }
+    fclose(raw);
+    int infd = open("test_stream.raw", O_RDONLY);
+    outfile = fopen("test_stream.gz", "wb");
+    lookup = fopen("test_stream.lookup", "wb");
+    if (infd < 0 || !outfile || !lookup) {
+        printf("test_stream_helper: failed to open files.\n");
+        free(data);
+        return false;
+    }
+    mgz_stream_create_fd(infd, 9, 16384, 2, outfile, lookup);
+    close(infd);
+    fclose(outfile);
+    fclose(lookup);
+    if (!compare_files("test.gz", "test_stream.gz") ||
+        !compare_files("test.lookup", "test_stream.lookup")) {
+        printf("test_stream_helper: fd output differs.\n");
+        ret = false;
+    }
+    free(data);
+    return ret;
+}
+
+bool test_stream() {
+    size_t testSizes[10] = {1,     16383,  16384,   16385,   49152,
+                            49153, 100000, 1048575, 1048577, 0};
+    size_t feedSizes[3] = {1000, 16384, 1 << 20};
+    for (int i = 0; i < 10; ++i) {
+        if (testSizes[i] == 0) break;
+        for (int j = 0; j < 3; ++j) {
+            if (!test_stream_helper(testSizes[i], i, feedSizes[j])) {
+                printf(
+                    "test_stream: failed at %d of size %zd with feed "
+                    "size %zd.\n",
+                    i, testSizes[i], feedSizes[j]);
+                return false;
+            }
+        }
+        printf("test_stream: %d done.\n", i);
+    }
+    return true;
+}
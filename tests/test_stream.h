@@ -0,0 +1,7 @@
+#ifndef TEST_STREAM_H
+#define TEST_STREAM_H
+#include <stdbool.h>
+
+bool test_stream(void);
+
+#endif  // TEST_STREAM_H
@@ -0,0 +1,252 @@
+#include "test_writer.h"
+
+#include <omp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../mgz.h"
+#include "testtools.h"
+
+#define BLOCK_SIZE 16384
+#define N_BLOCKS 200
+#define TAIL_SIZE 1234  // Raw bytes of the partial last block.
+#define LEVEL 6
+#define BUDGET ((8 << 19) + 64 * BLOCK_SIZE)  // Waves of about 60 blocks.
+
+static const int threadCounts[] = {1, 2, 4, 8};
+
+/* Fills SIZE bytes at DATA with blocks that alternate between random
+ * bytes, which deflate works hard on for nothing, and repetitive text,
+ * which it gets through quickly, so that blocks finish out of order. */
+static void fill_skewed(uint8_t *data, size_t size) {
+    static const char text[] = "the block writer hands finished blocks on ";
+    random_fill(data, size, 11);
+    for (size_t i = 0; i < size; ++i) {
+        if ((i / BLOCK_SIZE) % 2 == 1 && data[i] % 64 != 0) {
+            data[i] = (uint8_t)text[i % (sizeof(text) - 1)];
+        }
+    }
+}
+
+/* Compresses every block of the SIZE bytes at DATA on its own, one after
+ * the other, into *OUT, and sets *OFFSETS to the offset of every block.
+ * Returns the number of blocks, or 0 if an error occurred. */
+static uint64_t serial_reference(const uint8_t *data, size_t size,
+                                 uint8_t **out, uint64_t *outSize,
+                                 uint64_t **offsets) {
+    uint64_t nBlocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    *out = (uint8_t *)malloc(2 * size + nBlocks * 64);
+    *offsets = (uint64_t *)malloc(nBlocks * sizeof(uint64_t));
+    *outSize = 0;
+    if (!*out || !*offsets) return 0;
+    for (uint64_t i = 0; i < nBlocks; ++i) {
+        uint64_t len =
+            i + 1 < nBlocks ? BLOCK_SIZE : size - i * BLOCK_SIZE;
+        void *block;
+        uint64_t n = mgz_deflate(&block, data + i * BLOCK_SIZE, len, LEVEL);
+        if (n == 0) return 0;
+        (*offsets)[i] = *outSize;
+        memcpy(*out + *outSize, block, n);
+        *outSize += n;
+        free(block);
+    }
+    return nBlocks;
+}
+
+/* Writes the reference archive and its lookup file, as mgz_parallel_create
+ * must write them, to test_writer_ref.gz and test_writer_ref.lookup. */
+static bool write_reference(const uint8_t *out, uint64_t outSize,
+                            const uint64_t *offsets, uint64_t nBlocks) {
+    uint64_t blockSize = BLOCK_SIZE;
+    FILE *outfile = fopen("test_writer_ref.gz", "wb");
+    FILE *lookup = fopen("test_writer_ref.lookup", "wb");
+    bool ret = outfile && lookup &&
+               fwrite(out, 1, outSize, outfile) == outSize &&
+               fwrite(&blockSize, sizeof(uint64_t), 1, lookup) == 1 &&
+               fwrite(offsets, sizeof(uint64_t), nBlocks, lookup) == nBlocks;
+    if (outfile) ret = fclose(outfile) == 0 && ret;
+    if (lookup) ret = fclose(lookup) == 0 && ret;
+    return ret;
+}
+
+/* Compresses the SIZE bytes at DATA with mgz_parallel_create, or
+ * mgz_parallel_create_adaptive if ADAPTIVE is set, into PATH and
+ * LOOKUPPATH. Returns false if that failed. */
+static bool create(const uint8_t *data, size_t size, bool adaptive,
+                   const char *path, const char *lookupPath) {
+    FILE *outfile = fopen(path, "wb");
+    FILE *lookup = fopen(lookupPath, "wb");
+    uint64_t outSize = 0;
+    if (outfile && lookup) {
+        outSize = adaptive ? mgz_parallel_create_adaptive(
+                                 data, size, LEVEL, BLOCK_SIZE, outfile,
+                                 lookup)
+                           : mgz_parallel_create(data, size, LEVEL,
+                                                 BLOCK_SIZE, outfile, lookup);
+    }
+    if (outfile) fclose(outfile);
+    if (lookup) fclose(lookup);
+    return outSize > 0;
+}
+
+/* Compresses the SIZE bytes at DATA with an mgz_stream_t of NTHREADS
+ * threads, fed in uneven pieces, into test_writer.gz and
+ * test_writer.lookup. Returns false if that failed. */
+static bool stream_create(const uint8_t *data, size_t size, int nThreads) {
+    FILE *outfile = fopen("test_writer.gz", "wb");
+    FILE *lookup = fopen("test_writer.lookup", "wb");
+    mgz_stream_t *s = outfile && lookup ? mgz_stream_init(LEVEL, BLOCK_SIZE,
+                                                          nThreads, outfile,
+                                                          lookup)
+                                        : NULL;
+    bool ret = s != NULL;
+    for (size_t off = 0, piece = 1000; ret && off < size; off += piece) {
+        piece = piece * 3 % (5 * BLOCK_SIZE) + 1;
+        if (piece > size - off) piece = size - off;
+        ret = mgz_stream_feed(s, data + off, piece);
+    }
+    if (s) ret = mgz_stream_finish(s) > 0 && ret;
+    if (outfile) fclose(outfile);
+    if (lookup) fclose(lookup);
+    return ret;
+}
+
+/* Check the output of every thread count against the reference written
+ * one block at a time: the archive and lookup file of
+ * mgz_parallel_create and of mgz_stream_t, the buffer and offsets of
+ * mgz_parallel_deflate, and the archive and lookup file of mgz_parallel_create_adaptive, which
+ * must match its own single-threaded output. */
+static bool check_thread_count(const uint8_t *data, size_t size,
+                               const uint8_t *refOut, uint64_t refSize,
+                               const uint64_t *refOffsets, uint64_t nBlocks,
+                               int nThreads) {
+    omp_set_num_threads(nThreads);
+    bool ret = create(data, size, false, "test_writer.gz",
+                      "test_writer.lookup") &&
+               compare_files("test_writer.gz", "test_writer_ref.gz") &&
+               compare_files("test_writer.lookup", "test_writer_ref.lookup");
+    if (!ret) {
+        printf("test_writer: mgz_parallel_create differs with %d threads.\n",
+               nThreads);
+        return false;
+    }
+
+    ret = stream_create(data, size, nThreads) &&
+          compare_files("test_writer.gz", "test_writer_ref.gz") &&
+          compare_files("test_writer.lookup", "test_writer_ref.lookup");
+    if (!ret) {
+        printf("test_writer: mgz_stream_t differs with %d threads.\n",
+               nThreads);
+        return false;
+    }
+
+    mgz_res_t res = mgz_parallel_deflate(data, size, LEVEL, BLOCK_SIZE, true);
+    ret = res.out && res.size == refSize && res.nBlocks == nBlocks &&
+          compare(res.out, (void *)refOut, refSize) == refSize &&
+          compare(res.lookup, (void *)refOffsets,
+                  nBlocks * sizeof(uint64_t)) == nBlocks * sizeof(uint64_t);
+    free(res.out);
+    free(res.lookup);
+    if (!ret) {
+        printf("test_writer: mgz_parallel_deflate differs with %d threads.\n",
+               nThreads);
+        return false;
+    }
+
+    ret = create(data, size, true, "test_writer.gz", "test_writer.lookup") &&
+          compare_files("test_writer.gz", "test_writer_adaptive.gz") &&
+          compare_files("test_writer.lookup", "test_writer_adaptive.lookup");
+    if (!ret) {
+        printf(
+            "test_writer: mgz_parallel_create_adaptive differs with %d "
+            "threads.\n",
+            nThreads);
+    }
+    return ret;
+}
+
+/* Streams without a file descriptor, such as open_memstream(), get the
+ * same archive and lookup table from mgz_parallel_create,
+ * mgz_parallel_create_bounded and mgz_parallel_create_adaptive as files
+ * do. */
+static bool check_memstream(const uint8_t *data, size_t size) {
+    const char *names[3] = {"mgz_parallel_create",
+                            "mgz_parallel_create_bounded",
+                            "mgz_parallel_create_adaptive"};
+    const char *paths[3][2] = {
+        {"test_writer_ref.gz", "test_writer_ref.lookup"},
+        {"test_writer_ref.gz", "test_writer_ref.lookup"},
+        {"test_writer_adaptive.gz", "test_writer_adaptive.lookup"}};
+    bool ret = true;
+    for (int i = 0; ret && i < 3; ++i) {
+        char *out = NULL, *lookupOut = NULL;
+        size_t outLen = 0, lookupLen = 0;
+        FILE *outfile = open_memstream(&out, &outLen);
+        FILE *lookup = open_memstream(&lookupOut, &lookupLen);
+        uint64_t outSize = 0;
+        if (outfile && lookup) {
+            outSize = i == 0   ? mgz_parallel_create(data, size, LEVEL,
+                                                     BLOCK_SIZE, outfile,
+                                                     lookup)
+                      : i == 1 ? mgz_parallel_create_bounded(
+                                     data, size, LEVEL, BLOCK_SIZE,
+                                     BUDGET, outfile, lookup)
+                               : mgz_parallel_create_adaptive(
+                                     data, size, LEVEL, BLOCK_SIZE, outfile,
+                                     lookup);
+        }
+        if (outfile) fclose(outfile);
+        if (lookup) fclose(lookup);
+
+        uint64_t refSize = 0, refLookupSize = 0;
+        uint8_t *ref = read_file(paths[i][0], &refSize);
+        uint8_t *refLookup = read_file(paths[i][1], &refLookupSize);
+        ret = outSize > 0 && ref && refLookup && outLen == refSize &&
+              lookupLen == refLookupSize &&
+              compare(out, ref, refSize) == refSize &&
+              compare(lookupOut, refLookup, refLookupSize) == refLookupSize;
+        if (!ret) {
+            printf("test_writer: %s differs through open_memstream.\n",
+                   names[i]);
+        }
+        free(out);
+        free(lookupOut);
+        free(ref);
+        free(refLookup);
+    }
+    return ret;
+}
+
+bool test_writer() {
+    size_t size = (size_t)N_BLOCKS * BLOCK_SIZE + TAIL_SIZE;
+    uint8_t *data = (uint8_t *)malloc(size);
+    uint8_t *refOut = NULL;
+    uint64_t *refOffsets = NULL, refSize = 0;
+    if (!data) return false;
+    fill_skewed(data, size);
+    int maxThreads = omp_get_max_threads();
+    uint64_t nBlocks =
+        serial_reference(data, size, &refOut, &refSize, &refOffsets);
+    omp_set_num_threads(1);
+    bool ret = nBlocks > 0 &&
+               write_reference(refOut, refSize, refOffsets, nBlocks) &&
+               create(data, size, true, "test_writer_adaptive.gz",
+                      "test_writer_adaptive.lookup");
+    if (!ret) printf("test_writer: failed to write the references.\n");
+    for (size_t i = 0;
+         ret && i < sizeof(threadCounts) / sizeof(threadCounts[0]); ++i) {
+        ret = check_thread_count(data, size, refOut, refSize, refOffsets,
+                                 nBlocks, threadCounts[i]);
+        if (ret) printf("test_writer: %d threads done.\n", threadCounts[i]);
+    }
+    if (ret && (ret = check_memstream(data, size))) {
+        printf("test_writer: open_memstream done.\n");
+    }
+    omp_set_num_threads(maxThreads);
+    free(data);
+    free(refOut);
+    free(refOffsets);
+    return ret;
+}
@@ -0,0 +1,7 @@
+#ifndef TEST_WRITER_H
+#define TEST_WRITER_H
+#include <stdbool.h>
+
+bool test_writer(void);
+
+#endif  // TEST_WRITER_H
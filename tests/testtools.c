@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <zlib.h>
 
 #include "../mgz.h"
 
@@ -40,3 +41,42 @@ uint64_t compare(void *buf1, void *buf2, uint64_t size) {
     }
     return size;
 }
+
+uint8_t *read_file(const char *path, uint64_t *size) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = (uint8_t *)malloc(*size + 1);  // +1 so empty files work.
+    if (data && fread(data, 1, *size, f) != *size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+bool compare_files(const char *path1, const char *path2) {
+    uint64_t size1, size2;
+    uint8_t *data1 = read_file(path1, &size1);
+    uint8_t *data2 = read_file(path2, &size2);
+    bool ret = data1 && data2 && size1 == size2 &&
+               compare(data1, data2, size1) == size1;
+    free(data1);
+    free(data2);
+    return ret;
+}
+
+bool check_gzread(const char *path, uint8_t *data, size_t size) {
+    gzFile gz = gzopen(path, "rb");
+    uint8_t *buf = (uint8_t *)malloc(size + 1);
+    bool ret = gz && buf;
+    if (ret) {
+        int n = gzread(gz, buf, (unsigned)size + 1);
+        ret = n >= 0 && (size_t)n == size && compare(buf, data, size) == size;
+    }
+    if (gz) gzclose(gz);
+    free(buf);
+    return ret;
+}
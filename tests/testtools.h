@@ -1,10 +1,17 @@
 #ifndef TESTTOOLS_H
 #define TESTTOOLS_H
+#include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
 
 void random_fill(void *space, size_t size, unsigned int seed);
 uint8_t *test_create(size_t size, unsigned int seed);
 uint64_t compare(void *buf1, void *buf2, uint64_t size);
+uint8_t *read_file(const char *path, uint64_t *size);
+bool compare_files(const char *path1, const char *path2);
+
+/* Decompresses the whole file at PATH with zlib's gzread, the way gzip
+ * and zcat see it, and checks that it matches DATA. */
+bool check_gzread(const char *path, uint8_t *data, size_t size);
 
 #endif  // TESTTOOLS_H
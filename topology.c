@@ -0,0 +1,189 @@
+#include "topology.h"
+
+#include <stdlib.h>
+
+#if defined(__linux__) && __has_include(<linux/mempolicy.h>)
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define MAX_CPUS 4096  // Also bounds node ids, which sysfs lists alike.
+#define MAX_NODES 64
+#define WORD_BITS (8 * sizeof(unsigned long))
+#define MASK_WORDS (MAX_CPUS / WORD_BITS)
+
+typedef struct {
+    unsigned long bits[MASK_WORDS];
+} cpu_mask_t;
+
+struct topology_pin {
+    cpu_mask_t saved;
+};
+
+typedef struct {
+    int nNodes;
+    int ids[MAX_NODES];  // Kernel id of each node, or -1 if pretended.
+    cpu_mask_t cpus[MAX_NODES];
+} topo_t;
+
+static topo_t machine, pretended;
+static topo_t *topo = &machine;
+static pthread_once_t topoOnce = PTHREAD_ONCE_INIT;
+
+static void mask_set(cpu_mask_t *m, unsigned i) {
+    if (i < MAX_CPUS) m->bits[i / WORD_BITS] |= 1UL << (i % WORD_BITS);
+}
+
+static bool mask_test(const cpu_mask_t *m, unsigned i) {
+    return i < MAX_CPUS && (m->bits[i / WORD_BITS] >> (i % WORD_BITS) & 1);
+}
+
+static bool mask_empty(const cpu_mask_t *m) {
+    for (unsigned w = 0; w < MASK_WORDS; ++w) {
+        if (m->bits[w]) return false;
+    }
+    return true;
+}
+
+static bool get_affinity(cpu_mask_t *m) {
+    memset(m, 0, sizeof(*m));
+    return syscall(SYS_sched_getaffinity, 0, sizeof(m->bits), m->bits) > 0;
+}
+
+static bool set_affinity(const cpu_mask_t *m) {
+    return syscall(SYS_sched_setaffinity, 0, sizeof(m->bits), m->bits) == 0;
+}
+
+/* Reads a list in the sysfs format, such as "0-3,8-11", from the file at
+ * PATH into M. Returns false if the file cannot be read or parsed. */
+static bool read_list(const char *path, cpu_mask_t *m) {
+    memset(m, 0, sizeof(*m));
+    FILE *f = fopen(path, "r");
+    if (!f) return false;
+    bool ok = true;
+    unsigned lo, hi;
+    while (fscanf(f, "%u", &lo) == 1) {
+        hi = lo;
+        int c = fgetc(f);
+        if (c == '-') {
+            if (fscanf(f, "%u", &hi) != 1) {
+                ok = false;
+                break;
+            }
+            c = fgetc(f);
+        }
+        for (unsigned i = lo; i <= hi && i < MAX_CPUS; ++i) mask_set(m, i);
+        if (c != ',') break;
+    }
+    fclose(f);
+    return ok;
+}
+
+static void topology_init(void) {
+    machine.nNodes = 1;
+    machine.ids[0] = -1;
+    if (getenv("MGZ_NO_NUMA")) return;
+    cpu_mask_t online;
+    if (!read_list("/sys/devices/system/node/online", &online)) return;
+    int n = 0;
+    for (unsigned id = 0; id < MAX_CPUS && n < MAX_NODES; ++id) {
+        if (!mask_test(&online, id)) continue;
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist",
+                 id);
+        if (read_list(path, &machine.cpus[n]) &&
+            !mask_empty(&machine.cpus[n])) {
+            machine.ids[n++] = (int)id;
+        }
+    }
+    if (n > 1) machine.nNodes = n;
+}
+
+int topology_nodes(void) {
+    (void)pthread_once(&topoOnce, topology_init);
+    return topo->nNodes;
+}
+
+void topology_pretend(int nNodes) {
+    (void)pthread_once(&topoOnce, topology_init);
+    cpu_mask_t all;
+    if (nNodes < 1 || !get_affinity(&all)) {
+        topo = &machine;
+        return;
+    }
+    if (nNodes > MAX_NODES) nNodes = MAX_NODES;
+    unsigned nCpus = 0;
+    for (unsigned i = 0; i < MAX_CPUS; ++i) nCpus += mask_test(&all, i);
+    memset(&pretended, 0, sizeof(pretended));
+    for (unsigned i = 0, k = 0; i < MAX_CPUS; ++i) {
+        if (mask_test(&all, i)) {
+            mask_set(&pretended.cpus[k++ * nNodes / nCpus], i);
+        }
+    }
+    for (int i = 0; i < nNodes; ++i) pretended.ids[i] = -1;
+    pretended.nNodes = nNodes;
+    topo = &pretended;
+}
+
+int topology_node_of(const void *p) {
+    if (topology_nodes() == 1) return 0;
+    int id = -1;
+    if (syscall(SYS_get_mempolicy, &id, NULL, 0, p,
+                MPOL_F_NODE | MPOL_F_ADDR) != 0) {
+        return -1;
+    }
+    for (int i = 0; i < topo->nNodes; ++i) {
+        if (topo->ids[i] == id) return i;
+    }
+    return -1;
+}
+
+topology_pin_t *topology_pin(int node) {
+    if (topology_nodes() == 1 || node < 0 || node >= topo->nNodes) {
+        return NULL;
+    }
+    topology_pin_t *pin = (topology_pin_t *)malloc(sizeof(topology_pin_t));
+    if (!pin || !get_affinity(&pin->saved)) {
+        free(pin);
+        return NULL;
+    }
+    cpu_mask_t mask;
+    for (unsigned w = 0; w < MASK_WORDS; ++w) {
+        mask.bits[w] = pin->saved.bits[w] & topo->cpus[node].bits[w];
+    }
+    if (mask_empty(&mask) || !set_affinity(&mask)) {
+        free(pin);
+        return NULL;
+    }
+    return pin;
+}
+
+void topology_unpin(topology_pin_t *pin) {
+    if (!pin) return;
+    (void)set_affinity(&pin->saved);
+    free(pin);
+}
+
+#else  // No NUMA support on this system.
+
+int topology_nodes(void) { return 1; }
+
+int topology_node_of(const void *p) {
+    (void)p;
+    return 0;
+}
+
+topology_pin_t *topology_pin(int node) {
+    (void)node;
+    return NULL;
+}
+
+void topology_pretend(int nNodes) { (void)nNodes; }
+
+void topology_unpin(topology_pin_t *pin) { (void)pin; }
+
+#endif
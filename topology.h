@@ -0,0 +1,37 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+#include <stdbool.h>
+
+/* NUMA placement for parallel compression, read from sysfs and applied
+ * with the raw system calls so that libnuma is not needed. Nodes are
+ * numbered from 0 to topology_nodes() - 1 here, skipping nodes that have
+ * memory but no CPUs. On machines with a single node, on non-Linux
+ * systems, and when MGZ_NO_NUMA is set in the environment, there is one
+ * node and nothing is pinned. */
+
+/* Saved CPU affinity of a pinned thread. See topology_pin. */
+typedef struct topology_pin topology_pin_t;
+
+/* Returns the number of nodes to spread work over, at least 1. */
+int topology_nodes(void);
+
+/* Returns the node whose memory holds the page at P, faulting it in if
+ * needed, or -1 if that is unknown. */
+int topology_node_of(const void *p);
+
+/* Pretends from now on that the machine has NNODES nodes, with the CPUs
+ * the calling thread may run on split evenly among them and no memory,
+ * or goes back to the real topology if NNODES is 0. Lets tests exercise
+ * placement on machines with a single node. Not thread safe. */
+void topology_pretend(int nNodes);
+
+/* Restricts the calling thread to the CPUs of NODE that it may already
+ * run on. Returns the affinity to restore with topology_unpin, or NULL,
+ * with nothing changed, if there is a single node or the thread cannot
+ * run on NODE. */
+topology_pin_t *topology_pin(int node);
+
+/* Restores the affinity saved in PIN, if not NULL, and frees it. */
+void topology_unpin(topology_pin_t *pin);
+
+#endif  // TOPOLOGY_H
@@ -0,0 +1,181 @@
+#include "uring.h"
+
+#include <stdlib.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+struct uring {
+    int fd;
+    unsigned inFlight;  // Queued or submitted reads not yet reaped.
+    unsigned toSubmit;  // Queued reads not yet passed to the kernel.
+
+    /* Submission queue, shared with the kernel. */
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned sqMask;
+    unsigned *sqArray;
+    struct io_uring_sqe *sqes;
+
+    /* Completion queue, shared with the kernel. */
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe *cqes;
+
+    void *sqMap;
+    size_t sqMapSize;
+    void *cqMap;  // Same as SQMAP if the kernel maps both rings at once.
+    size_t cqMapSize;
+    size_t sqesSize;
+};
+
+static pthread_key_t ringKey;
+static pthread_once_t ringKeyOnce = PTHREAD_ONCE_INIT;
+static int unavailable;  // Set once the kernel refuses to set up a ring.
+
+static void ring_destroy(void *p) {
+    uring_t *u = (uring_t *)p;
+    if (u->sqes) munmap(u->sqes, u->sqesSize);
+    if (u->cqMap && u->cqMap != u->sqMap) munmap(u->cqMap, u->cqMapSize);
+    if (u->sqMap) munmap(u->sqMap, u->sqMapSize);
+    if (u->fd >= 0) close(u->fd);
+    free(u);
+}
+
+static void ring_key_create(void) {
+    (void)pthread_key_create(&ringKey, ring_destroy);
+}
+
+static void *map_ring(int fd, size_t size, off_t offset) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, offset);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+static uring_t *ring_create(void) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = (int)syscall(__NR_io_uring_setup, URING_DEPTH, &p);
+    if (fd < 0) {
+        __atomic_store_n(&unavailable, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    uring_t *u = (uring_t *)calloc(1, sizeof(uring_t));
+    if (!u) {
+        close(fd);
+        return NULL;
+    }
+    u->fd = fd;
+    u->sqMapSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cqMapSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cqMapSize > u->sqMapSize) u->sqMapSize = u->cqMapSize;
+        u->cqMapSize = u->sqMapSize;
+    }
+    u->sqMap = map_ring(fd, u->sqMapSize, IORING_OFF_SQ_RING);
+    u->cqMap = p.features & IORING_FEAT_SINGLE_MMAP
+                   ? u->sqMap
+                   : map_ring(fd, u->cqMapSize, IORING_OFF_CQ_RING);
+    u->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = (struct io_uring_sqe *)map_ring(fd, u->sqesSize,
+                                              IORING_OFF_SQES);
+    if (!u->sqMap || !u->cqMap || !u->sqes) {
+        ring_destroy(u);
+        return NULL;
+    }
+    uint8_t *sq = (uint8_t *)u->sqMap, *cq = (uint8_t *)u->cqMap;
+    u->sqHead = (unsigned *)(sq + p.sq_off.head);
+    u->sqTail = (unsigned *)(sq + p.sq_off.tail);
+    u->sqMask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    u->sqArray = (unsigned *)(sq + p.sq_off.array);
+    u->cqHead = (unsigned *)(cq + p.cq_off.head);
+    u->cqTail = (unsigned *)(cq + p.cq_off.tail);
+    u->cqMask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return u;
+}
+
+uring_t *uring_get(void) {
+    if (getenv("MGZ_NO_URING") ||
+        __atomic_load_n(&unavailable, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+    (void)pthread_once(&ringKeyOnce, ring_key_create);
+    uring_t *u = (uring_t *)pthread_getspecific(ringKey);
+    if (u) return u;
+    u = ring_create();
+    if (!u) return NULL;
+    if (pthread_setspecific(ringKey, u) != 0) {
+        ring_destroy(u);
+        return NULL;
+    }
+    return u;
+}
+
+bool uring_read(uring_t *u, int fd, void *buf, uint32_t size,
+                uint64_t offset, uint64_t tag) {
+    if (u->inFlight >= URING_DEPTH) return false;
+    unsigned tail = *u->sqTail;
+    unsigned idx = tail & u->sqMask;
+    struct io_uring_sqe *sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->user_data = tag;
+    u->sqArray[idx] = idx;
+    __atomic_store_n(u->sqTail, tail + 1, __ATOMIC_RELEASE);
+    ++u->inFlight;
+    ++u->toSubmit;
+    return true;
+}
+
+bool uring_wait(uring_t *u, uint64_t *tag, int32_t *res) {
+    if (u->inFlight == 0) return false;
+    for (;;) {
+        unsigned head = *u->cqHead;
+        if (head != __atomic_load_n(u->cqTail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &u->cqes[head & u->cqMask];
+            *tag = cqe->user_data;
+            *res = cqe->res;
+            __atomic_store_n(u->cqHead, head + 1, __ATOMIC_RELEASE);
+            --u->inFlight;
+            return true;
+        }
+        int ret = (int)syscall(__NR_io_uring_enter, u->fd, u->toSubmit, 1,
+                               IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                continue;
+            }
+            return false;
+        }
+        u->toSubmit -= (unsigned)ret;
+    }
+}
+
+#else  // No io_uring on this system.
+
+uring_t *uring_get(void) { return NULL; }
+
+bool uring_read(uring_t *u, int fd, void *buf, uint32_t size,
+                uint64_t offset, uint64_t tag) {
+    (void)u, (void)fd, (void)buf, (void)size, (void)offset, (void)tag;
+    return false;
+}
+
+bool uring_wait(uring_t *u, uint64_t *tag, int32_t *res) {
+    (void)u, (void)tag, (void)res;
+    return false;
+}
+
+#endif
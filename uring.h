@@ -0,0 +1,33 @@
+#ifndef URING_H
+#define URING_H
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Minimal io_uring wrapper for batched reads, built on the raw system
+ * calls so that liburing is not needed. Each thread owns one ring, which
+ * is set up on first use and torn down when the thread exits. On kernels
+ * without io_uring, under seccomp filters that block it, on non-Linux
+ * systems, and when MGZ_NO_URING is set in the environment, uring_get()
+ * returns NULL and callers fall back to pread(). */
+
+#define URING_DEPTH 64  // Reads in flight per ring.
+
+typedef struct uring uring_t;
+
+/* Returns the calling thread's ring, or NULL if io_uring cannot be
+ * used. */
+uring_t *uring_get(void);
+
+/* Queues a read of SIZE bytes at OFFSET of FD into BUF, reported by
+ * uring_wait() with TAG. Returns false if URING_DEPTH reads are already
+ * in flight. */
+bool uring_read(uring_t *u, int fd, void *buf, uint32_t size,
+                uint64_t offset, uint64_t tag);
+
+/* Submits the queued reads and waits for one to complete. Sets TAG to
+ * the tag it was queued with and RES to the number of bytes read or a
+ * negated errno. Returns false if no read is in flight or the kernel
+ * refused the submission. */
+bool uring_wait(uring_t *u, uint64_t *tag, int32_t *res);
+
+#endif  // URING_H
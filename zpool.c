@@ -0,0 +1,152 @@
+#include "zpool.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#define ARENA_CHUNK_SIZE (1 << 19)  // 512 KiB, enough for level 9 deflate.
+#define ARENA_ALIGN 16
+
+typedef struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;
+    size_t used;
+    _Alignas(ARENA_ALIGN) unsigned char data[];
+} arena_chunk_t;
+
+/* Bump allocator. Frees are no-ops; memory is reclaimed as a whole by
+ * arena_reset() and arena_destroy(). */
+typedef struct {
+    arena_chunk_t *head;
+} arena_t;
+
+static void *arena_alloc(voidpf opaque, uInt items, uInt size) {
+    arena_t *arena = (arena_t *)opaque;
+    size_t n = ((size_t)items * size + ARENA_ALIGN - 1) &
+               ~(size_t)(ARENA_ALIGN - 1);
+    arena_chunk_t *c = arena->head;
+    if (!c || c->size - c->used < n) {
+        size_t chunkSize = n > ARENA_CHUNK_SIZE ? n : ARENA_CHUNK_SIZE;
+        c = (arena_chunk_t *)malloc(sizeof(arena_chunk_t) + chunkSize);
+        if (!c) return Z_NULL;
+        c->size = chunkSize;
+        c->used = 0;
+        c->next = arena->head;
+        arena->head = c;
+    }
+    void *p = c->data + c->used;
+    c->used += n;
+    return p;
+}
+
+static void arena_free(voidpf opaque, voidpf p) {
+    (void)opaque;
+    (void)p;
+}
+
+/* Keeps only the largest chunk, emptied. */
+static void arena_reset(arena_t *arena) {
+    arena_chunk_t *keep = arena->head;
+    for (arena_chunk_t *c = arena->head; c; c = c->next) {
+        if (c->size > keep->size) keep = c;
+    }
+    for (arena_chunk_t *c = arena->head, *next; c; c = next) {
+        next = c->next;
+        if (c != keep) free(c);
+    }
+    if (keep) {
+        keep->used = 0;
+        keep->next = NULL;
+    }
+    arena->head = keep;
+}
+
+static void arena_destroy(arena_t *arena) {
+    for (arena_chunk_t *c = arena->head, *next; c; c = next) {
+        next = c->next;
+        free(c);
+    }
+    arena->head = NULL;
+}
+
+typedef struct {
+    arena_t deflateArena;
+    arena_t inflateArena;
+    z_stream deflateStrm;
+    z_stream inflateStrm;
+    bool deflateReady;
+    bool inflateReady;
+    int level;
+} zpool_t;
+
+static pthread_key_t poolKey;
+static pthread_once_t poolKeyOnce = PTHREAD_ONCE_INIT;
+
+static void pool_destroy(void *p) {
+    zpool_t *pool = (zpool_t *)p;
+    if (pool->deflateReady) (void)deflateEnd(&pool->deflateStrm);
+    if (pool->inflateReady) (void)inflateEnd(&pool->inflateStrm);
+    arena_destroy(&pool->deflateArena);
+    arena_destroy(&pool->inflateArena);
+    free(pool);
+}
+
+static void pool_key_create(void) {
+    (void)pthread_key_create(&poolKey, pool_destroy);
+}
+
+static zpool_t *get_pool(void) {
+    (void)pthread_once(&poolKeyOnce, pool_key_create);
+    zpool_t *pool = (zpool_t *)pthread_getspecific(poolKey);
+    if (pool) return pool;
+    pool = (zpool_t *)calloc(1, sizeof(zpool_t));
+    if (!pool) return NULL;
+    if (pthread_setspecific(poolKey, pool) != 0) {
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+z_stream *zpool_deflate(int level) {
+    zpool_t *pool = get_pool();
+    if (!pool) return NULL;
+    z_stream *strm = &pool->deflateStrm;
+    if (pool->deflateReady && pool->level == level) {
+        return deflateReset(strm) == Z_OK ? strm : NULL;
+    }
+
+    /* First use on this thread, or a different level: set the stream up
+     * again from a recycled arena. */
+    if (pool->deflateReady) (void)deflateEnd(strm);
+    pool->deflateReady = false;
+    arena_reset(&pool->deflateArena);
+    strm->zalloc = arena_alloc;
+    strm->zfree = arena_free;
+    strm->opaque = &pool->deflateArena;
+    if (deflateInit2(strm, level, Z_DEFLATED, -15, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {  // Raw deflate.
+        return NULL;
+    }
+    pool->deflateReady = true;
+    pool->level = level;
+    return strm;
+}
+
+z_stream *zpool_inflate(int windowBits) {
+    zpool_t *pool = get_pool();
+    if (!pool) return NULL;
+    z_stream *strm = &pool->inflateStrm;
+    if (pool->inflateReady) {
+        return inflateReset2(strm, windowBits) == Z_OK ? strm : NULL;
+    }
+    strm->zalloc = arena_alloc;
+    strm->zfree = arena_free;
+    strm->opaque = &pool->inflateArena;
+    strm->avail_in = 0;
+    strm->next_in = Z_NULL;
+    if (inflateInit2(strm, windowBits) != Z_OK) return NULL;
+    pool->inflateReady = true;
+    return strm;
+}
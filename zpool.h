@@ -0,0 +1,23 @@
+#ifndef ZPOOL_H
+#define ZPOOL_H
+#include <zlib.h>
+
+/* Per-thread pools of zlib streams. Each thread owns one deflate stream,
+ * producing raw deflate data that the caller wraps as a gzip member, and
+ * one inflate stream, which are set up on first use and afterwards only
+ * reset with deflateReset()/inflateReset2(). Their memory comes from
+ * per-thread arenas, so zlib's allocations are bump pointer increments
+ * and are released together when the stream is set up again or the
+ * thread exits. */
+
+/* Returns the calling thread's deflate stream, reset and ready to
+ * compress a new raw deflate stream at level LEVEL, or NULL if an error
+ * occurred. */
+z_stream *zpool_deflate(int level);
+
+/* Returns the calling thread's inflate stream, reset with WINDOWBITS and
+ * ready to decompress a new stream, or NULL if an error occurred. Pass
+ * 15 + 16 for a gzip member and -15 for raw deflate data. */
+z_stream *zpool_inflate(int windowBits);
+
+#endif  // ZPOOL_H